@@ -199,7 +199,7 @@
 / System Configurations
 /---------------------------------------------------------------------------*/
 
-#define _FS_NORTC	0
+#define _FS_NORTC	1
 #define _NORTC_MON	11
 #define _NORTC_MDAY	9
 #define _NORTC_YEAR	2014
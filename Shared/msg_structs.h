@@ -25,6 +25,11 @@ enum msg_id {
     MSG_ID_NOP                  = 0x0000,
 
     MSG_ID_IMU_DATA             = 0x0010,
+    MSG_ID_SENSOR_STATS         = 0x0011,
+    MSG_ID_ATTITUDE             = 0x0012,
+
+    MSG_ID_SETPOINT             = 0x0020,
+    MSG_ID_SETPOINT_ACK         = 0x0021,
 
     MSG_ID_BOOT_ENTER           = 0xB000,
     MSG_ID_BOOT_READ_DATA       = 0xB001,
@@ -91,6 +96,78 @@ struct msg_imu_data
 };
 
 
+/**
+ * Sensor health statistics, one message per driver
+ */
+struct msg_sensor_stats
+{
+    struct msg_header h;
+    uint8_t     index;
+    char        name[11];
+    float       rate;           // [Hz]
+    float       latency;        // [us]
+    uint32_t    latency_max;    // [us]
+    uint32_t    samples;
+    uint32_t    conv_errors;
+    uint32_t    bus_errors;
+    uint32_t    clip_events;
+    uint16_t    hist[8];        // interval jitter histogram
+};
+
+
+/**
+ * Attitude estimate. The standard deviations are
+ * only available from the EKF, and zero otherwise.
+ */
+struct msg_attitude
+{
+    struct msg_header h;
+    uint32_t    time;           // IMU sample time [us]
+    uint8_t     estimator;      // ATTITUDE_*
+    float       q[4];           // body to earth rotation (w, x, y, z)
+    float       bias[3];        // gyro bias [rad/s]
+    float       sigma_att[3];   // attitude std. deviation [rad]
+    float       sigma_bias[3];  // gyro bias std. deviation [rad/s]
+};
+
+
+/**
+ * Stick commands PC -> Vehicle, see rc_pc.c
+ *
+ * Messages to the vehicle are framed by a zero byte on both
+ * sides, so the receiver can tell them from shell input.
+ */
+#define SETPOINT_ARM        0x01
+
+struct msg_setpoint
+{
+    struct msg_header h;
+    uint16_t    seq;            // incremented for each message
+    uint8_t     flags;          // SETPOINT_*
+    uint32_t    time;           // PC time [us]
+    float       roll;           // -1 .. 1
+    float       pitch;          // -1 .. 1
+    float       yaw;            // -1 .. 1
+    float       thrust;         //  0 .. 1
+};
+
+
+/**
+ * Setpoint link state Vehicle -> PC. The round trip time
+ * is (PC time now) - time - hold.
+ */
+struct msg_setpoint_ack
+{
+    struct msg_header h;
+    uint16_t    seq;            // last accepted setpoint
+    uint32_t    time;           // its PC time [us]
+    uint32_t    hold;           // time since its reception [us]
+    uint32_t    received;
+    uint32_t    lost;
+    uint32_t    stale;
+    uint32_t    errors;
+};
+
 
 /**
  * Enter bootloader
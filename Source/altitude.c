@@ -0,0 +1,154 @@
+#include "altitude.h"
+#include "sensors.h"
+#include "ustime.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <math.h>
+#include <string.h>
+
+// Plausible pressure readings [hPa]
+//
+#define PRESSURE_MIN    300
+#define PRESSURE_MAX    1100
+
+/**
+ * Barometric altitude estimator
+ *
+ * A third order complementary filter integrates the earth
+ * frame vertical acceleration at the IMU rate, and is pulled
+ * towards the barometric altitude whenever a new pressure
+ * reading arrives. The accelerometer bias is estimated by
+ * the third state.
+ *
+ * With all poles at -1/tau, the correction gains are
+ *
+ *   k1 = 3 / tau,   k2 = 3 / tau^2,   k3 = 1 / tau^3
+ *
+ * Below 1/tau the estimate follows the barometer, above it
+ * follows the accelerometer.
+ *
+ */
+struct altitude_config altitude_config = {
+    .qnh = STANDARD_PRESSURE,
+    .qfe = 0,
+    .tau = 2
+};
+
+static struct altitude  state;
+static struct altitude  published;
+static float            last_pressure;
+static uint32_t         last_baro_time;
+
+
+/**
+ * International standard atmosphere, valid in the troposphere.
+ *
+ */
+float pressure_to_altitude(float pressure, float reference)
+{
+    return 44330.8 * (1 - powf(pressure / reference, 0.190263));
+}
+
+
+void altitude_update(float acc_up, float dt)
+{
+    if (state.valid) {
+        float a = acc_up - state.acc_bias;
+
+        state.altitude   += state.climb_rate * dt + 0.5 * a * dt * dt;
+        state.climb_rate += a * dt;
+
+        state.height = state.altitude -
+            pressure_to_altitude(altitude_config.qfe, altitude_config.qnh);
+    }
+
+    taskENTER_CRITICAL();
+    published = state;
+    taskEXIT_CRITICAL();
+}
+
+
+void altitude_baro(float pressure)
+{
+    // Also keeps a broken reading from becoming the QFE
+    //
+    if (!(pressure >= PRESSURE_MIN && pressure <= PRESSURE_MAX))
+        return;
+
+    uint32_t t = get_us_time32();
+    float dt = (t - last_baro_time) * 1e-6;
+
+    last_pressure  = pressure;
+    last_baro_time = t;
+
+    if (altitude_config.qfe <= 0)
+        altitude_config.qfe = pressure;
+
+    float h = pressure_to_altitude(pressure, altitude_config.qnh);
+    state.baro_altitude = h;
+
+    if (!state.valid || dt > altitude_config.tau) {
+        // Start over after a reset or a long dropout
+        //
+        state.altitude   = h;
+        state.climb_rate = 0;
+        state.valid      = 1;
+    }
+    else {
+        float tau = altitude_config.tau;
+        float e = h - state.altitude;
+
+        state.altitude   += 3 / tau * e * dt;
+        state.climb_rate += 3 / (tau * tau) * e * dt;
+        state.acc_bias   -= 1 / (tau * tau * tau) * e * dt;
+    }
+}
+
+
+void altitude_zero(void)
+{
+    if (last_pressure > 0)
+        altitude_config.qfe = last_pressure;
+}
+
+
+void altitude_read(struct altitude *a)
+{
+    taskENTER_CRITICAL();
+    memcpy(a, &published, sizeof(*a));
+    taskEXIT_CRITICAL();
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+#include <stdio.h>
+
+static void cmd_altitude_show(void)
+{
+    while (!stdin_chars_avail()) {
+        struct altitude a;
+        altitude_read(&a);
+
+        printf(
+            "alt %8.2f m  height %7.2f m  climb %6.2f m/s  baro %8.2f m  bias %6.3f m/s^2\r",
+            a.altitude, a.height, a.climb_rate, a.baro_altitude, a.acc_bias
+        );
+
+        vTaskDelay(100);
+    }
+    printf("\n");
+}
+
+
+static void cmd_alt_zero(void)
+{
+    altitude_zero();
+    printf("QFE set to %.2f hPa\n", altitude_config.qfe);
+}
+
+
+SHELL_CMD(altitude_show, (cmdfunc_t)cmd_altitude_show, "Show altitude estimate")
+SHELL_CMD(alt_zero, (cmdfunc_t)cmd_alt_zero, "Set QFE to the current pressure")
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Altimeter settings
+ *
+ * qnh: pressure reduced to mean sea level. The altitude
+ *      is the height above MSL with this setting.
+ *
+ * qfe: pressure at the field elevation. The height is
+ *      zero on the field with this setting. It is taken
+ *      from the first barometer reading after reset, or
+ *      set with alt_zero.
+ *
+ */
+struct altitude_config {
+    float   qnh;            // [hPa]
+    float   qfe;            // [hPa]
+    float   tau;            // [s] complementary filter time constant
+};
+
+struct altitude {
+    int     valid;
+    float   altitude;       // [m] above QNH reference
+    float   height;         // [m] above QFE reference
+    float   climb_rate;     // [m/s]
+    float   acc_bias;       // [m/s^2]
+    float   baro_altitude;  // [m] unfiltered, above QNH reference
+};
+
+extern struct altitude_config altitude_config;
+
+float pressure_to_altitude(float pressure, float reference);
+
+// Called by the sensor task
+//
+void altitude_update(float acc_up, float dt);
+void altitude_baro(float pressure);
+
+void altitude_zero(void);
+void altitude_read(struct altitude *a);
@@ -1,38 +1,89 @@
 #include "attitude.h"
+#include "attitude_ekf.h"
 #include "util.h"
+#include "seqlock.h"
+#include "ustime.h"
+#include "FreeRTOS.h"
+#include "task.h"
 #include <stdio.h>
+#include <errno.h>
+
+// Budget for one estimator update: 10% of a 1 kHz cycle
+//
+#define ATTITUDE_CYCLE_BUDGET   (configCPU_CLOCK_HZ / 1000 / 10)
+
+struct attitude_config attitude_config = {
+    .estimator = ATTITUDE_MAHONY,
+    .decim     = 1,
+    .coning    = 1
+};
 
 struct dcm dcm = {
     .matrix    = MAT3_IDENTITY,
     .down_ref  = { 0,  0, -1 },
     .north_ref = { 1,  0,  0 },
-/*
     .acc_kp = 1, .acc_ki = 0.001,
     .mag_kp = 0, .mag_ki = 0
-*/
 };
 
+struct mahony mahony = {
+    .q         = QUAT_IDENTITY,
+    .down_ref  = { 0,  0, -1 },
+    .north_ref = { 1,  0,  0 },
+    .acc_kp = 1, .acc_ki = 0.001,
+    .mag_kp = 0, .mag_ki = 0
+};
+
+struct attitude_stats attitude_stats;
+
+static struct attitude  published;
+static struct seqlock   published_lock;
+
+
+/**
+ * Heading error of a magnetometer reading, for the
+ * rotation matrix R from the body to the earth frame.
+ *
+ * Only the horizontal component of the field is used,
+ * so magnetic disturbances can't tilt the attitude.
+ * The error is a rotation about the earth z axis.
+ *
+ */
+float attitude_heading_error(mat3f R, vec3f mag, vec3f north_ref)
+{
+    vec3f north = vec3f_matmul(R, mag);
+    north.z = 0;
+
+    if (vec3f_lensq(north) == 0)
+        return 0;
+
+    return vec3f_cross(vec3f_norm(north), north_ref).z;
+}
+
 
 /**
- * Apply an infinitesimal rotation w*dt to a direction cosine matrix A.
- * An orthonormalization step is added to prevent rounding errors.
+ * Apply a rotation phi (axis * angle, in the body frame) to a
+ * direction cosine matrix A. An orthonormalization step is
+ * added to prevent rounding errors.
  *
  * Without the normalization, this would be a simple matrix multiplication:
  *
- * return mat3_matmul( A, (mat3f) {
- *        1,   -w.z,  w.y,
- *      w.z,    1, -w.x,
- *     -w.y,  w.x,    1
- * };
+ * return mat3f_mul(A, mat3f_from_rotvec(phi));
+ *
+ * For small angles, mat3f_from_rotvec(phi) is about
+ *
+ *        1,   -phi.z,  phi.y,
+ *    phi.z,      1,   -phi.x,
+ *   -phi.y,  phi.x,      1
  */
-static mat3f dcm_integrate(mat3f A, vec3f w, float dt)
+static mat3f dcm_integrate(mat3f A, vec3f phi)
 {
-    w = vec3f_scale(w, dt);
+    mat3f E = mat3f_from_rotvec(phi);
 
     // Calculate the new x and y axes. z is calculated later.
     //
-    vec3f x = vec3f_matmul(A, (vec3f){    1, w.z, -w.y } );
-    vec3f y = vec3f_matmul(A, (vec3f){ -w.z,   1,  w.x } );
+    vec3f x = vec3f_matmul(A, mat3f_col(E, 0));
+    vec3f y = vec3f_matmul(A, mat3f_col(E, 1));
 
     // Orthonormalization
     //
@@ -51,8 +102,8 @@ static mat3f dcm_integrate(mat3f A, vec3f w, float dt)
 
     // Scale them to unit length and take a cross product for the Z axis
     //
-    xo = vec3f_norm(xo);
-    yo = vec3f_norm(yo);
+    xo = vec3f_renorm(xo);
+    yo = vec3f_renorm(yo);
     zo = vec3f_cross(xo, yo);
 
     return (mat3f) {
@@ -63,52 +114,367 @@ static mat3f dcm_integrate(mat3f A, vec3f w, float dt)
 }
 
 
-extern void dcm_update(vec3f gyro, vec3f acc, float dt)
+/**
+ * Update the DCM with the gyro rotation rot [rad] over dt
+ * seconds, see attitude_update().
+ *
+ */
+extern void dcm_update(vec3f rot, vec3f acc, vec3f mag, float dt)
 {
     dcm.offset_p = vec3f_zero;
 
-    // Apply accelerometer correction
+    // Apply accelerometer correction. The offsets are added
+    // to the body rates, so the error is computed in the body
+    // frame, against the reference rotated by R^T.
     //
-    vec3f down  = vec3f_matmul(dcm.matrix, vec3f_norm(acc));
-    vec3f error = vec3f_cross(down, dcm.down_ref);
+    vec3f down  = vec3f_matmul(mat3f_trans(dcm.matrix), dcm.down_ref);
+    vec3f error = vec3f_cross(vec3f_norm_fast(acc), down);
 
     dcm.debug = error;
 
     dcm.offset_p = vec3f_add(dcm.offset_p, vec3f_scale(error, dcm.acc_kp));
     dcm.offset_i = vec3f_add(dcm.offset_i, vec3f_scale(error, dcm.acc_ki));
 
-    // todo: magnetometer correction, once we have one
+    // Apply magnetometer correction. The heading error
+    // is rotated into the body frame.
+    //
+    if (vec3f_lensq(mag) > 0 && (dcm.mag_kp > 0 || dcm.mag_ki > 0)) {
+        float yaw = attitude_heading_error(dcm.matrix, mag, dcm.north_ref);
+        error = vec3f_scale(mat3f_row(dcm.matrix, 2), yaw);
+
+        dcm.offset_p = vec3f_add(dcm.offset_p, vec3f_scale(error, dcm.mag_kp));
+        dcm.offset_i = vec3f_add(dcm.offset_i, vec3f_scale(error, dcm.mag_ki));
+    }
 
     // Calculate drift-corrected roll, pitch and yaw angles
     //
-    dcm.omega = gyro;
-    dcm.omega = vec3f_add(dcm.omega, dcm.offset_p);
-    dcm.omega = vec3f_add(dcm.omega, dcm.offset_i);
+    vec3f offset = vec3f_add(dcm.offset_p, dcm.offset_i);
+
+    dcm.omega = vec3f_add(vec3f_scale(rot, 1 / dt), offset);
 
     // Apply rotation to the direction cosine matrix
     //
-    dcm.matrix = dcm_integrate(dcm.matrix, dcm.omega, dt);
-    dcm.euler = mat3f_to_euler(dcm.matrix);
+    dcm.matrix = dcm_integrate(dcm.matrix, vec3f_add(rot, vec3f_scale(offset, dt)));
 }
 
 
 void  dcm_reset(void)
 {
     dcm.matrix   = mat3f_identity;
-    dcm.euler    = vec3f_zero;
     dcm.omega    = vec3f_zero;
     dcm.offset_p = vec3f_zero;
     dcm.offset_i = vec3f_zero;
 }
 
-// -----
+
+/**
+ * Mahony's filter in quaternion form
+ *
+ * The accelerometer correction is computed in the body frame,
+ * against the reference rotated by the current estimate. The
+ * integration is one quaternion product and needs no square
+ * root, compared to two matrix products and a Gram-Schmidt
+ * step of the DCM.
+ *
+ */
+void mahony_update(vec3f rot, vec3f acc, vec3f mag, float dt)
+{
+    quatf q = mahony.q;
+
+    // Apply accelerometer correction
+    //
+    vec3f down  = quatf_rotate(quatf_conj(q), mahony.down_ref);
+    vec3f error = vec3f_cross(vec3f_norm_fast(acc), down);
+
+    vec3f offset_p = vec3f_scale(error, mahony.acc_kp);
+    vec3f offset_i = vec3f_add(mahony.offset_i, vec3f_scale(error, mahony.acc_ki));
+
+    // Apply magnetometer correction
+    //
+    if (vec3f_lensq(mag) > 0 && (mahony.mag_kp > 0 || mahony.mag_ki > 0)) {
+        float yaw = attitude_heading_error(quatf_to_mat3f(q), mag, mahony.north_ref);
+        error = quatf_rotate(quatf_conj(q), (vec3f) { 0, 0, yaw });
+
+        offset_p = vec3f_add(offset_p, vec3f_scale(error, mahony.mag_kp));
+        offset_i = vec3f_add(offset_i, vec3f_scale(error, mahony.mag_ki));
+    }
+
+    vec3f offset = vec3f_add(offset_p, offset_i);
+    vec3f phi    = vec3f_add(rot, vec3f_scale(offset, dt));
+
+    mahony.q        = quatf_renorm(quatf_mul(q, quatf_from_rotvec(phi)));
+    mahony.omega    = vec3f_add(vec3f_scale(rot, 1 / dt), offset);
+    mahony.offset_i = offset_i;
+}
+
+
+void mahony_reset(void)
+{
+    mahony.q        = quatf_identity;
+    mahony.omega    = vec3f_zero;
+    mahony.offset_i = vec3f_zero;
+}
+
+
+int attitude_active = ATTITUDE_MAHONY;
+
+struct attitude_accum attitude_accum;
+
+
+/**
+ * The estimator can be changed at run time. The new one
+ * continues from the attitude and gyro bias of the old one.
+ * The DCM and Mahony filter have offset_i = -bias.
+ *
+ */
+static void attitude_switch(int from, int to)
+{
+    quatf q;
+    vec3f offset_i;
+
+    switch (from) {
+    case ATTITUDE_MAHONY:
+        q = mahony.q;
+        offset_i = mahony.offset_i;
+        break;
+
+    case ATTITUDE_EKF:
+        q = ekf.q;
+        offset_i = vec3f_scale(ekf.bias, -1);
+        break;
+
+    default:
+    case ATTITUDE_DCM:
+        q = mat3f_to_quatf(dcm.matrix);
+        offset_i = dcm.offset_i;
+        break;
+    }
+
+    switch (to) {
+    case ATTITUDE_MAHONY:
+        mahony.q = q;
+        mahony.offset_i = offset_i;
+        break;
+
+    case ATTITUDE_EKF:
+        ekf_reset();
+        ekf.q = q;
+        ekf.bias = vec3f_scale(offset_i, -1);
+        break;
+
+    default:
+    case ATTITUDE_DCM:
+        dcm.matrix = quatf_to_mat3f(q);
+        dcm.offset_i = offset_i;
+        break;
+    }
+}
+
+
+/**
+ * Gyro integration with coning compensation
+ *
+ * The rotation vector of several gyro samples is not their
+ * sum if the rotation axis moves, e.g. under vibration. The
+ * classic two-sample algorithm (Savage, sample plus previous
+ * form) adds the coning term for each sample:
+ *
+ *   beta  += 1/2 (alpha + dtheta_prev / 6) x dtheta
+ *   alpha += dtheta
+ *
+ * The rotation over the update interval is alpha + beta.
+ * The estimator runs every attitude.decim samples, which
+ * saves CPU without losing the high-rate gyro information.
+ *
+ * \returns 1 if the estimator was updated
+ */
+int attitude_update(vec3f gyro, vec3f acc, vec3f mag, float dt)
+{
+    uint32_t t0 = get_cycle_count();
+    struct attitude_accum *a = &attitude_accum;
+
+    vec3f dtheta = vec3f_scale(gyro, dt);
+
+    if (attitude_config.coning) {
+        vec3f c = vec3f_add(a->alpha, vec3f_scale(a->dtheta_prev, 1.0 / 6));
+        a->beta = vec3f_add(a->beta, vec3f_scale(vec3f_cross(c, dtheta), 0.5));
+    }
+
+    a->alpha = vec3f_add(a->alpha, dtheta);
+    a->acc   = vec3f_add(a->acc, acc);
+    a->time += dt;
+    a->dtheta_prev = dtheta;
+
+    if (++a->count < attitude_config.decim) {
+        attitude_stats.samples++;
+        return 0;
+    }
+
+    vec3f rot = vec3f_add(a->alpha, a->beta);
+    acc = vec3f_scale(a->acc, 1.0 / a->count);
+    dt  = a->time;
+
+    a->alpha = vec3f_zero;
+    a->beta  = vec3f_zero;
+    a->acc   = vec3f_zero;
+    a->time  = 0;
+    a->count = 0;
+
+    if (attitude_config.estimator != attitude_active) {
+        attitude_switch(attitude_active, attitude_config.estimator);
+        attitude_active = attitude_config.estimator;
+    }
+
+    switch (attitude_active) {
+    case ATTITUDE_MAHONY:   mahony_update(rot, acc, mag, dt);   break;
+    case ATTITUDE_EKF:      ekf_update(rot, acc, mag, dt);      break;
+    default:
+    case ATTITUDE_DCM:      dcm_update(rot, acc, mag, dt);      break;
+    }
+
+    // CPU cost of an estimator update, without the publication
+    //
+    struct attitude_stats *st = &attitude_stats;
+    uint32_t cycles = get_cycle_count() - t0;
+
+    st->cycles = cycles;
+    st->cycles_avg += (cycles - st->cycles_avg) * 0.01;
+    if (cycles > st->cycles_max)
+        st->cycles_max = cycles;
+    if (cycles > ATTITUDE_CYCLE_BUDGET)
+        st->overruns++;
+
+    st->samples++;
+    st->updates++;
+    return 1;
+}
+
+
+/**
+ * Publish the current estimate for attitude_read().
+ * Called by the sensor task after each update.
+ *
+ */
+void attitude_publish(uint32_t time)
+{
+    seqlock_write_begin(&published_lock);
+
+    struct attitude *a = &published;
+
+    a->time = time;
+
+    switch (attitude_active) {
+    case ATTITUDE_MAHONY:
+        a->q     = mahony.q;
+        a->omega = mahony.omega;
+        a->bias  = vec3f_scale(mahony.offset_i, -1);
+        a->sigma_att  = vec3f_zero;
+        a->sigma_bias = vec3f_zero;
+        break;
+
+    case ATTITUDE_EKF:
+        a->q     = ekf.q;
+        a->omega = ekf.omega;
+        a->bias  = ekf.bias;
+        a->sigma_att  = ekf_sigma_att();
+        a->sigma_bias = ekf_sigma_bias();
+        break;
+
+    default:
+    case ATTITUDE_DCM:
+        a->q     = mat3f_to_quatf(dcm.matrix);
+        a->omega = dcm.omega;
+        a->bias  = vec3f_scale(dcm.offset_i, -1);
+        a->sigma_att  = vec3f_zero;
+        a->sigma_bias = vec3f_zero;
+        break;
+    }
+
+    a->matrix = attitude_matrix();
+
+    seqlock_write_end(&published_lock);
+}
+
+
+/**
+ * Read the latest attitude. This never blocks the sensor
+ * task, but the caller must have a lower priority.
+ *
+ */
+void attitude_read(struct attitude *a)
+{
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&published_lock);
+        *a = published;
+    } while (seqlock_read_retry(&published_lock, seq));
+}
+
+
+/**
+ * Read the latest attitude from a task with a higher priority
+ * than the sensor task, see sensor_try_read().
+ *
+ * \returns 0, or -1 if the sensor task was interrupted in
+ *          the middle of an update (errno = EAGAIN)
+ */
+int attitude_try_read(struct attitude *a)
+{
+    uint32_t seq;
+
+    if (seqlock_try_read_begin(&published_lock, &seq)) {
+        *a = published;
+
+        if (!seqlock_read_retry(&published_lock, seq))
+            return 0;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+
+mat3f attitude_matrix(void)
+{
+    switch (attitude_active) {
+    case ATTITUDE_MAHONY:   return quatf_to_mat3f(mahony.q);
+    case ATTITUDE_EKF:      return quatf_to_mat3f(ekf.q);
+    default:
+    case ATTITUDE_DCM:      return dcm.matrix;
+    }
+}
+
+
+/**
+ * Roll, pitch and yaw angles. They are only needed
+ * for display, so they are not kept up to date.
+ *
+ */
+vec3f attitude_euler(void)
+{
+    switch (attitude_active) {
+    case ATTITUDE_MAHONY:   return quatf_to_euler(mahony.q);
+    case ATTITUDE_EKF:      return quatf_to_euler(ekf.q);
+    default:
+    case ATTITUDE_DCM:      return mat3f_to_euler(dcm.matrix);
+    }
+}
+
+// -------------------- Shell commands --------------------
+//
+#include "syscalls.h"
+#include "msg_packet.h"
 #include <string.h>
 
 
 void cmd_dcm_show(void)
 {
     struct dcm d;
-    ATOMIC_COPY(&d, &dcm, sizeof(d));
+
+    taskENTER_CRITICAL();
+    memcpy(&d, &dcm, sizeof(d));
+    taskEXIT_CRITICAL();
 
     printf("                x/roll    y/pitch      z/yaw\n");
     printf("down_ref  : %10.4f %10.4f %10.4f\n", d.down_ref.x, d.down_ref.y, d.down_ref.z);
@@ -118,7 +484,8 @@ void cmd_dcm_show(void)
     printf("offset_i  : %10.4f %10.4f %10.4f\n", d.offset_i.x, d.offset_i.y, d.offset_i.z);
     printf("\n");
     printf("dcm_omega : %10.4f %10.4f %10.4f\n", d.omega.x, d.omega.y, d.omega.z);
-    printf("dcm_euler : %10.4f %10.4f %10.4f\n", d.euler.x, d.euler.y, d.euler.z);
+    vec3f euler = mat3f_to_euler(d.matrix);
+    printf("dcm_euler : %10.4f %10.4f %10.4f\n", euler.x, euler.y, euler.z);
     printf("\n");
     printf("dcm_matrix: %10.4f %10.4f %10.4f\n", d.matrix.m00, d.matrix.m01, d.matrix.m02);
     printf("            %10.4f %10.4f %10.4f\n", d.matrix.m10, d.matrix.m11, d.matrix.m12);
@@ -126,3 +493,94 @@ void cmd_dcm_show(void)
     printf("\n");
     printf("debug     : %10.4f %10.4f %10.4f\n", d.debug.x, d.debug.y, d.debug.z);
 }
+
+
+static void send_attitude_msg(const struct attitude *a)
+{
+    struct msg_attitude msg;
+
+    msg.h.id       = MSG_ID_ATTITUDE;
+    msg.h.data_len = sizeof(msg) - sizeof(msg.h);
+
+    msg.estimator = attitude_active;
+    msg.time      = a->time;
+
+    msg.q[0] = a->q.w;  msg.q[1] = a->q.x;  msg.q[2] = a->q.y;  msg.q[3] = a->q.z;
+
+    msg.bias[0] = a->bias.x;
+    msg.bias[1] = a->bias.y;
+    msg.bias[2] = a->bias.z;
+
+    msg.sigma_att[0] = a->sigma_att.x;
+    msg.sigma_att[1] = a->sigma_att.y;
+    msg.sigma_att[2] = a->sigma_att.z;
+
+    msg.sigma_bias[0] = a->sigma_bias.x;
+    msg.sigma_bias[1] = a->sigma_bias.y;
+    msg.sigma_bias[2] = a->sigma_bias.z;
+
+    msg_send(&msg.h);
+}
+
+
+static void cmd_attitude_show(int argc, char *argv[])
+{
+    static const char *names[] = { "DCM", "Mahony", "EKF" };
+
+    struct attitude a;
+
+    if (argc == 2 && !strcmp(argv[1], "-b")) {
+        while (!stdin_chars_avail()) {
+            attitude_read(&a);
+            send_attitude_msg(&a);
+            vTaskDelay(50);
+        }
+        return;
+    }
+    else if (argc != 1) {
+        goto usage;
+    }
+
+    attitude_read(&a);
+
+    mat3f m = a.matrix;
+    vec3f e = vec3f_scale(quatf_to_euler(a.q), 180 / M_PI);
+    vec3f sa = vec3f_scale(a.sigma_att, 180 / M_PI);
+
+    const struct attitude_stats *st = &attitude_stats;
+
+    int n = attitude_active;
+
+    printf("estimator : %s\n", (n >= 0 && n < ARRAY_SIZE(names)) ? names[n] : "?");
+    printf("decim     : %d, coning %s\n", attitude_config.decim, attitude_config.coning ? "on" : "off");
+    printf("\n");
+    printf("                  roll      pitch        yaw\n");
+    printf("euler     : %10.4f %10.4f %10.4f deg\n", e.x, e.y, e.z);
+    printf("sigma     : %10.4f %10.4f %10.4f deg\n", sa.x, sa.y, sa.z);
+    printf("\n");
+    printf("matrix    : %10.4f %10.4f %10.4f\n", m.m00, m.m01, m.m02);
+    printf("            %10.4f %10.4f %10.4f\n", m.m10, m.m11, m.m12);
+    printf("            %10.4f %10.4f %10.4f\n", m.m20, m.m21, m.m22);
+    printf("\n");
+    printf("omega     : %10.4f %10.4f %10.4f rad/s\n", a.omega.x, a.omega.y, a.omega.z);
+    printf("bias      : %10.4f %10.4f %10.4f rad/s\n", a.bias.x, a.bias.y, a.bias.z);
+    printf("sigma     : %10.4f %10.4f %10.4f rad/s\n", a.sigma_bias.x, a.sigma_bias.y, a.sigma_bias.z);
+    printf("time      : %10lu us\n", a.time);
+    printf("\n");
+    printf("samples   : %10lu\n", st->samples);
+    printf("updates   : %10lu\n", st->updates);
+    printf("cycles    : %10.0f avg, %lu max (%.2f us avg)\n",
+        st->cycles_avg, st->cycles_max, st->cycles_avg * 1e6 / configCPU_CLOCK_HZ
+    );
+    printf("budget    : %10lu cycles, %lu overruns\n", ATTITUDE_CYCLE_BUDGET, st->overruns);
+    printf("ekf errors: %10d\n", ekf.errors);
+    return;
+
+usage:
+    printf("usage: %s [-b]\n", argv[0]);
+}
+
+
+#include "command.h"
+
+SHELL_CMD(attitude_show, (cmdfunc_t)cmd_attitude_show, "Show attitude estimate")
@@ -1,10 +1,20 @@
 #pragma once
 
 #include "matrix3f.h"
+#include <stdint.h>
+
+#define ATTITUDE_DCM        0
+#define ATTITUDE_MAHONY     1
+#define ATTITUDE_EKF        2
+
+struct attitude_config {
+    int   estimator;    ///< ATTITUDE_*
+    int   decim;        ///< IMU samples per estimator update
+    int   coning;       ///< coning compensation on/off
+};
 
 struct dcm {
     mat3f matrix;       ///< current direction cosine matrix
-    vec3f euler;        ///< roll, pitch and yaw angles
     vec3f omega;        ///< drift corrected angular rates
 
     vec3f offset_p;     ///< drift correction p-term
@@ -21,10 +31,94 @@ struct dcm {
     vec3f debug;
 };
 
+/**
+ * Quaternion attitude estimator with Mahony's
+ * complementary filter. Same gains as the DCM.
+ *
+ */
+struct mahony {
+    quatf q;            ///< body to earth rotation
+    vec3f omega;        ///< drift corrected angular rates
+    vec3f offset_i;     ///< drift correction i-term
+
+    vec3f down_ref;     ///< accelerometer "down" reference
+    float acc_kp;       ///< accelerometer p gain
+    float acc_ki;       ///< accelerometer i gain
+
+    vec3f north_ref;    ///< magnetometer "north" reference
+    float mag_kp;       ///< magnetometer p gain
+    float mag_ki;       ///< magnetometer i gain
+};
+
+/**
+ * Published attitude, see attitude_read()
+ *
+ */
+struct attitude {
+    uint32_t time;      ///< IMU sample time [us]
+    quatf q;            ///< body to earth rotation
+    mat3f matrix;       ///< same as a matrix
+    vec3f omega;        ///< drift corrected angular rates
+    vec3f bias;         ///< estimated gyro bias [rad/s]
+    vec3f sigma_att;    ///< attitude std. deviation [rad], EKF only
+    vec3f sigma_bias;   ///< gyro bias std. deviation [rad/s], EKF only
+};
+
+/**
+ * Gyro samples since the last estimator update,
+ * see attitude_update()
+ *
+ */
+struct attitude_accum {
+    vec3f alpha;        ///< sum of the rotation increments [rad]
+    vec3f beta;         ///< coning correction [rad]
+    vec3f dtheta_prev;  ///< last rotation increment [rad]
+    vec3f acc;          ///< sum of the accelerometer samples
+    float time;         ///< [s]
+    int   count;
+};
+
+/**
+ * CPU cost of attitude_update()
+ *
+ */
+struct attitude_stats {
+    uint32_t samples;   ///< gyro samples
+    uint32_t updates;   ///< estimator updates
+    uint32_t cycles;    ///< last update
+    uint32_t cycles_max;
+    uint32_t overruns;  ///< updates over the cycle budget
+    float    cycles_avg;
+};
+
+extern struct attitude_config attitude_config;
+extern int attitude_active;     ///< estimator in use, follows attitude_config
 extern struct dcm dcm;
+extern struct mahony mahony;
+extern struct attitude_accum attitude_accum;
+extern struct attitude_stats attitude_stats;
 
-extern void dcm_update(vec3f gyro, vec3f acc, float dt);
+// Estimators. rot is the gyro rotation [rad] in dt seconds.
+//
+extern void dcm_update(vec3f rot, vec3f acc, vec3f mag, float dt);
 extern void dcm_reset(void);
 
+extern void mahony_update(vec3f rot, vec3f acc, vec3f mag, float dt);
+extern void mahony_reset(void);
+
+// Run the selected estimator. Called by the sensor task.
+//
+extern int   attitude_update(vec3f gyro, vec3f acc, vec3f mag, float dt);
+extern void  attitude_publish(uint32_t time);
+extern mat3f attitude_matrix(void);
+extern vec3f attitude_euler(void);
+
+extern float attitude_heading_error(mat3f R, vec3f mag, vec3f north_ref);
+
+// For other tasks
+//
+extern void  attitude_read(struct attitude *a);
+extern int   attitude_try_read(struct attitude *a);
+
 extern void cmd_dcm_show(void);
 
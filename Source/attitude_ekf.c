@@ -0,0 +1,241 @@
+#include "attitude_ekf.h"
+#include "attitude.h"
+#include "matrixnf.h"
+#include "sensors.h"
+#include <string.h>
+
+#define N   EKF_STATES
+
+#define SIGMA_ATT_0     0.1     // [rad] initial attitude uncertainty
+#define SIGMA_BIAS_0    0.01    // [rad/s] initial bias uncertainty
+
+struct ekf ekf = {
+    .q          = QUAT_IDENTITY,
+    .down_ref   = { 0,  0, -1 },
+    .north_ref  = { 1,  0,  0 },
+    .gyro_noise = 1e-3,
+    .bias_noise = 1e-5,
+    .acc_noise  = 0.05,
+    .mag_noise  = 0,
+
+    .P = {
+        [0*N + 0] = SIGMA_ATT_0 * SIGMA_ATT_0,
+        [1*N + 1] = SIGMA_ATT_0 * SIGMA_ATT_0,
+        [2*N + 2] = SIGMA_ATT_0 * SIGMA_ATT_0,
+        [3*N + 3] = SIGMA_BIAS_0 * SIGMA_BIAS_0,
+        [4*N + 4] = SIGMA_BIAS_0 * SIGMA_BIAS_0,
+        [5*N + 5] = SIGMA_BIAS_0 * SIGMA_BIAS_0
+    }
+};
+
+
+static mat3f get_block(const float *P, int row, int col)
+{
+    const float *p = &P[row * N + col];
+
+    return (mat3f) {
+        p[0*N + 0], p[0*N + 1], p[0*N + 2],
+        p[1*N + 0], p[1*N + 1], p[1*N + 2],
+        p[2*N + 0], p[2*N + 1], p[2*N + 2]
+    };
+}
+
+
+static void put_block(float *P, int row, int col, mat3f M)
+{
+    float *p = &P[row * N + col];
+
+    p[0*N + 0] = M.m00;  p[0*N + 1] = M.m01;  p[0*N + 2] = M.m02;
+    p[1*N + 0] = M.m10;  p[1*N + 1] = M.m11;  p[1*N + 2] = M.m12;
+    p[2*N + 0] = M.m20;  p[2*N + 1] = M.m21;  p[2*N + 2] = M.m22;
+}
+
+
+/**
+ * Time update with the gyro rotation rot [rad] over dt seconds
+ *
+ * The error dynamics are
+ *
+ *   F = [ M  -I dt ]   M = exp(-[phi x])
+ *       [ 0   I    ]
+ *
+ * With P in 3x3 blocks, F P F^T + Q is
+ *
+ *   A' = M A M^T - dt (M B + (M B)^T) + dt^2 C + Qa
+ *   B' = M B - dt C
+ *   C' = C + Qb
+ *
+ * which is three 3x3 products instead of two 6x6 ones,
+ * and A' and C' are symmetric by construction.
+ *
+ */
+static void ekf_predict(vec3f rot, float dt)
+{
+    vec3f phi = vec3f_sub(rot, vec3f_scale(ekf.bias, dt));
+
+    ekf.q     = quatf_renorm(quatf_mul(ekf.q, quatf_from_rotvec(phi)));
+    ekf.omega = vec3f_scale(phi, 1 / dt);
+
+    mat3f M = mat3f_from_rotvec(vec3f_scale(phi, -1));
+    mat3f A = get_block(ekf.P, 0, 0);
+    mat3f B = get_block(ekf.P, 0, 3);
+    mat3f C = get_block(ekf.P, 3, 3);
+
+    mat3f MB = mat3f_mul(M, B);
+    mat3f Bn = mat3f_add(MB, mat3f_scale(C, -dt));
+
+    A = mat3f_mul(mat3f_mul(M, A), mat3f_trans(M));
+    A = mat3f_add(A, mat3f_scale(mat3f_add(MB, mat3f_trans(MB)), -dt));
+    A = mat3f_add(A, mat3f_scale(C, dt * dt));
+
+    float qa = ekf.gyro_noise * ekf.gyro_noise * dt;
+    float qb = ekf.bias_noise * ekf.bias_noise * dt;
+
+    A.m00 += qa;  A.m11 += qa;  A.m22 += qa;
+    C.m00 += qb;  C.m11 += qb;  C.m22 += qb;
+
+    put_block(ekf.P, 0, 0, A);
+    put_block(ekf.P, 0, 3, Bn);
+    put_block(ekf.P, 3, 0, mat3f_trans(Bn));
+    put_block(ekf.P, 3, 3, C);
+}
+
+
+/**
+ * Measurement update with the m x N Jacobian H, the
+ * innovation y = z - h(x) and the noise variance r.
+ *
+ * K = P H^T S^-1 is never formed. With U = P H^T, the
+ * Cholesky solve gives K^T = S^-1 U^T, and only the upper
+ * triangle of P - U K^T is computed.
+ *
+ * \returns 0, or -1 if S was not positive definite
+ */
+static int ekf_correct(const float *H, const float *y, float r, int m)
+{
+    float U[N*3], S[3*3], Kt[3*N], dx[N];
+
+    matnf_mul_trans(U, ekf.P, H, N, N, m);
+    matnf_mul(S, H, U, m, N, m);
+
+    for (int i=0; i<m; i++)
+        S[i*m + i] += r;
+
+    if (matnf_cholesky(S, S, m) < 0) {
+        ekf.errors++;
+        return -1;
+    }
+
+    matnf_trans(Kt, U, N, m);
+    matnf_chol_solve(Kt, S, Kt, m, N);
+
+    for (int i=0; i<N; i++) {
+        dx[i] = matnf_dot(&Kt[i], N, y, 1, m);
+
+        for (int j=i; j<N; j++) {
+            float p = ekf.P[i*N + j] - matnf_dot(&U[i*m], 1, &Kt[j], N, m);
+            ekf.P[i*N + j] = p;
+            ekf.P[j*N + i] = p;
+        }
+    }
+
+    // Move the error into the attitude and bias
+    //
+    ekf.q    = quatf_renorm(quatf_mul(ekf.q, quatf_from_rotvec((vec3f) { dx[0], dx[1], dx[2] })));
+    ekf.bias = vec3f_add(ekf.bias, (vec3f) { dx[3], dx[4], dx[5] });
+
+    return 0;
+}
+
+
+/**
+ * The accelerometer measures the direction of gravity in the
+ * body frame, d = R^T down_ref. For the attitude error e,
+ * d(e) = d + [d x] e.
+ *
+ * Linear acceleration shows up as a deviation from 1 g. It
+ * is added to the measurement noise.
+ *
+ */
+static void ekf_correct_acc(vec3f acc)
+{
+    float len = vec3f_len(acc);
+    if (len == 0)
+        return;
+
+    vec3f d = quatf_rotate(quatf_conj(ekf.q), ekf.down_ref);
+    vec3f z = vec3f_scale(acc, 1 / len);
+
+    const float H[3*N] = {
+           0, -d.z,  d.y,   0, 0, 0,
+         d.z,    0, -d.x,   0, 0, 0,
+        -d.y,  d.x,    0,   0, 0, 0
+    };
+
+    const float y[3] = { z.x - d.x, z.y - d.y, z.z - d.z };
+
+    float dyn = (len - STANDARD_GRAVITY) / STANDARD_GRAVITY;
+    float r   = ekf.acc_noise * ekf.acc_noise + dyn * dyn;
+
+    ekf_correct(H, y, r, 3);
+}
+
+
+/**
+ * The heading error is a rotation about the earth z axis,
+ * or R^T z in the body frame.
+ *
+ */
+static void ekf_correct_mag(vec3f mag)
+{
+    if (ekf.mag_noise <= 0 || vec3f_lensq(mag) == 0)
+        return;
+
+    mat3f R = quatf_to_mat3f(ekf.q);
+    vec3f h = mat3f_row(R, 2);
+
+    const float H[N] = { h.x, h.y, h.z, 0, 0, 0 };
+    const float y[1] = { attitude_heading_error(R, mag, ekf.north_ref) };
+
+    ekf_correct(H, y, ekf.mag_noise * ekf.mag_noise, 1);
+}
+
+
+void ekf_update(vec3f rot, vec3f acc, vec3f mag, float dt)
+{
+    ekf_predict(rot, dt);
+    ekf_correct_acc(acc);
+    ekf_correct_mag(mag);
+}
+
+
+void ekf_reset(void)
+{
+    ekf.q     = quatf_identity;
+    ekf.bias  = vec3f_zero;
+    ekf.omega = vec3f_zero;
+
+    memset(ekf.P, 0, sizeof(ekf.P));
+
+    for (int i=0; i<3; i++) {
+        ekf.P[i*N + i]         = SIGMA_ATT_0 * SIGMA_ATT_0;
+        ekf.P[(i+3)*N + (i+3)] = SIGMA_BIAS_0 * SIGMA_BIAS_0;
+    }
+}
+
+
+/**
+ * Standard deviations of the attitude [rad] and
+ * the gyro bias [rad/s], in the body frame
+ *
+ */
+vec3f ekf_sigma_att(void)
+{
+    return (vec3f) { sqrtf(ekf.P[0*N + 0]), sqrtf(ekf.P[1*N + 1]), sqrtf(ekf.P[2*N + 2]) };
+}
+
+
+vec3f ekf_sigma_bias(void)
+{
+    return (vec3f) { sqrtf(ekf.P[3*N + 3]), sqrtf(ekf.P[4*N + 4]), sqrtf(ekf.P[5*N + 5]) };
+}
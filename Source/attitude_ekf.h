@@ -0,0 +1,44 @@
+#pragma once
+
+#include "matrix3f.h"
+
+#define EKF_STATES  6
+
+/**
+ * Multiplicative extended Kalman filter for the attitude
+ * and the gyro bias.
+ *
+ * The state is the attitude error in the body frame and the
+ * gyro bias error. The attitude itself is kept as a quaternion
+ * and corrected after each measurement, so the linearization
+ * is always around the current estimate.
+ *
+ * P is in row-major order, see matrixnf.h:
+ *
+ *   P = [ A    B ]   A: attitude [rad^2]
+ *       [ B^T  C ]   C: bias [(rad/s)^2]
+ *
+ */
+struct ekf {
+    quatf q;            ///< body to earth rotation
+    vec3f bias;         ///< gyro bias [rad/s]
+    vec3f omega;        ///< bias corrected angular rates
+    float P[EKF_STATES * EKF_STATES];
+
+    vec3f down_ref;     ///< accelerometer "down" reference
+    vec3f north_ref;    ///< magnetometer "north" reference
+
+    float gyro_noise;   ///< [rad/s / sqrt(Hz)]
+    float bias_noise;   ///< bias random walk [rad/s^2 / sqrt(Hz)]
+    float acc_noise;    ///< accelerometer direction noise [rad]
+    float mag_noise;    ///< heading noise [rad], 0: off
+
+    int   errors;       ///< rejected measurements
+};
+
+extern struct ekf ekf;
+
+extern void  ekf_update(vec3f rot, vec3f acc, vec3f mag, float dt);
+extern void  ekf_reset(void);
+extern vec3f ekf_sigma_att(void);
+extern vec3f ekf_sigma_bias(void);
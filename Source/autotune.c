@@ -0,0 +1,323 @@
+#include "autotune.h"
+#include "flight_ctrl.h"
+#include "parameter.h"
+#include "util.h"
+#include <string.h>
+#include <math.h>
+
+#define SETTLE_PERIODS      2       // not measured
+#define MEASURE_PERIODS     4
+#define TIMEOUT             5.0     // [s]
+
+/**
+ * Relay feedback auto-tuner
+ *
+ * The output of one rate controller is replaced by a relay
+ * around its integrator, u = i +/- d, which switches with the
+ * sign of the rate. The loop settles into a limit cycle at
+ * the frequency where the plant has -180 degrees of phase.
+ * From the oscillation amplitude a and the relay hysteresis
+ * eps, the ultimate gain and period are
+ *
+ *   Ku = 4 d / (pi sqrt(a^2 - eps^2)),  Tu = period
+ *
+ * The gains follow the Tyreus-Luyben rules, which are less
+ * aggressive than Ziegler-Nichols:
+ *
+ *   PI:   kp = Ku / 3.2,  Ti = 2.2 Tu
+ *   PID:  kp = Ku / 2.2,  Ti = 2.2 Tu,  Td = Tu / 6.3
+ *
+ * The run is aborted on stick input, if the motors are
+ * stopped, or if the rate exceeds autotune.rate_max.
+ *
+ */
+struct autotune_config autotune_config = {
+    .relay      = 0.5,
+    .hysteresis = 0.05,
+    .rule       = AUTOTUNE_PI,
+    .rate_max   = 3,
+    .stick      = 0.1,
+    .max_change = 4
+};
+
+static volatile enum {
+    AUTOTUNE_IDLE,
+    AUTOTUNE_REQUESTED,
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE,
+    AUTOTUNE_ABORTED
+} autotune_state;
+
+static const char *volatile abort_reason;
+
+static volatile int request_axis;
+
+// Relay state, only used by the rate loop
+//
+static struct autotune_config run;
+static int      relay;
+static float    t, t_rise;
+static float    rate_min, rate_max;
+static int      periods;
+static float    sum_period, sum_amplitude;
+
+static struct autotune_result result;
+
+
+static void autotune_abort(const char *reason)
+{
+    abort_reason = reason;
+    autotune_state = AUTOTUNE_ABORTED;
+}
+
+
+static void autotune_begin(void)
+{
+    run = autotune_config;
+
+    relay = 1;
+    t = t_rise = 0;
+    rate_min = rate_max = 0;
+    periods = 0;
+    sum_period = sum_amplitude = 0;
+
+    memset(&result, 0, sizeof(result));
+    result.axis = request_axis;
+
+    autotune_state = AUTOTUNE_RUNNING;
+}
+
+
+/**
+ * \returns the axis which is being tuned, or -1
+ */
+int autotune_active(void)
+{
+    if (autotune_state == AUTOTUNE_REQUESTED)
+        autotune_begin();
+
+    return autotune_state == AUTOTUNE_RUNNING ? result.axis : -1;
+}
+
+
+static void rising_edge(void)
+{
+    if (periods >= SETTLE_PERIODS) {
+        sum_period    += t - t_rise;
+        sum_amplitude += (rate_max - rate_min) / 2;
+    }
+
+    t_rise = t;
+    rate_min = rate_max = 0;
+
+    if (++periods < SETTLE_PERIODS + MEASURE_PERIODS)
+        return;
+
+    float a   = sum_amplitude / MEASURE_PERIODS;
+    float eps = run.hysteresis;
+
+    if (a <= eps) {
+        autotune_abort("no oscillation");
+        return;
+    }
+
+    result.amplitude = a;
+    result.tu = sum_period / MEASURE_PERIODS;
+    result.ku = 4 * run.relay / (M_PI * sqrtf(a*a - eps*eps));
+
+    autotune_state = AUTOTUNE_DONE;
+}
+
+
+/**
+ * Relay output for the axis from autotune_active()
+ *
+ * \param u_trim  integrator of the axis [V]
+ * \param rate    measured rate [rad/s]
+ * \returns the controller output [V]
+ */
+float autotune_relay(float u_trim, float rate, float dt)
+{
+    if (autotune_state != AUTOTUNE_RUNNING)
+        return u_trim;
+
+    t += dt;
+
+    if (fabsf(rate) > run.rate_max) {
+        autotune_abort("rate limit");
+        return u_trim;
+    }
+
+    if (t > TIMEOUT) {
+        autotune_abort("timeout");
+        return u_trim;
+    }
+
+    rate_min = fminf(rate_min, rate);
+    rate_max = fmaxf(rate_max, rate);
+
+    // The relay drives the rate to zero, with hysteresis
+    //
+    if (relay > 0 && rate > run.hysteresis) {
+        relay = -1;
+    }
+    else if (relay < 0 && rate < -run.hysteresis) {
+        relay = 1;
+        rising_edge();
+    }
+
+    return u_trim + relay * run.relay;
+}
+
+
+void autotune_sticks(float roll, float pitch, float yaw)
+{
+    float s = fmaxf(fabsf(roll), fmaxf(fabsf(pitch), fabsf(yaw)));
+
+    if (autotune_state == AUTOTUNE_RUNNING && s > autotune_config.stick)
+        autotune_abort("stick input");
+}
+
+
+void autotune_stop(void)
+{
+    if (autotune_state == AUTOTUNE_RUNNING)
+        autotune_abort("motors stopped");
+}
+
+
+// -------------------- Gain calculation --------------------
+//
+#define PARAM_CTRL_AXIS(axis)   (320 + 10 * (axis))
+#define PARAM_KP                0
+#define PARAM_KI                1
+#define PARAM_KD                2
+
+
+static float bound_gain(int id, float k, float k_old, float max_change)
+{
+    const struct param_info *p = param_get_info(id);
+
+    // A rule which does not use the term (kd for PI) turns it
+    // off. Otherwise, limit the change against the current
+    // gain. Gains which are zero now can only be set by the rule.
+    //
+    if (k == 0)
+        return 0;
+
+    if (k_old > 0 && max_change >= 1)
+        k = clamp(k, k_old / max_change, k_old * max_change);
+
+    if (p)
+        k = clamp(k, p->flt.min, p->flt.max);
+
+    return k;
+}
+
+
+/**
+ * Calculate the gains and set them through the parameter
+ * table. They are not saved.
+ *
+ */
+static int autotune_apply(struct autotune_result *r)
+{
+    const struct ctrl_axis *c = &ctrl_axes[r->axis];
+    const int id = PARAM_CTRL_AXIS(r->axis);
+
+    float kp, ki, kd = 0;
+
+    if (autotune_config.rule == AUTOTUNE_PID) {
+        kp = r->ku / 2.2;
+        ki = kp / (2.2 * r->tu);
+        kd = kp * r->tu / 6.3;
+    }
+    else {
+        kp = r->ku / 3.2;
+        ki = kp / (2.2 * r->tu);
+    }
+
+    const float mc = autotune_config.max_change;
+
+    r->kp = bound_gain(id + PARAM_KP, kp, c->kp, mc);
+    r->ki = bound_gain(id + PARAM_KI, ki, c->ki, mc);
+    r->kd = bound_gain(id + PARAM_KD, kd, c->kd, mc);
+
+    if (param_set(id + PARAM_KP, r->kp) != PERR_OK ||
+        param_set(id + PARAM_KI, r->ki) != PERR_OK ||
+        param_set(id + PARAM_KD, r->kd) != PERR_OK)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+
+static void cmd_autotune(int argc, char *argv[])
+{
+    static const char *axes[] = { "roll", "pitch", "yaw" };
+
+    if (argc != 2)
+        goto usage;
+
+    int axis;
+    for (axis=0; axis<3; axis++)
+        if (!strcmp(argv[1], axes[axis]))
+            break;
+
+    if (axis == 3)
+        goto usage;
+
+    const struct ctrl_axis *c = &ctrl_axes[axis];
+
+    printf("old      : kp %.4f ki %.4f kd %.5f\n", c->kp, c->ki, c->kd);
+    printf("Hover, and keep the sticks centered..\n");
+
+    request_axis = axis;
+    autotune_state = AUTOTUNE_REQUESTED;
+
+    while (autotune_state < AUTOTUNE_DONE) {
+        if (stdin_chars_avail()) {
+            autotune_abort("user");
+            break;
+        }
+        vTaskDelay(10);
+    }
+
+    if (autotune_state == AUTOTUNE_ABORTED) {
+        printf("Aborted: %s\n", abort_reason);
+        autotune_state = AUTOTUNE_IDLE;
+        return;
+    }
+
+    struct autotune_result r = result;
+    autotune_state = AUTOTUNE_IDLE;
+
+    printf("Ku       : %.4f V/(rad/s)\n", r.ku);
+    printf("Tu       : %.1f ms\n", r.tu * 1e3);
+    printf("a        : %.3f rad/s\n", r.amplitude);
+
+    if (autotune_apply(&r) < 0) {
+        printf("Can't set the gains\n");
+        return;
+    }
+
+    printf("new      : kp %.4f ki %.4f kd %.5f\n", r.kp, r.ki, r.kd);
+    printf("Use param_save to keep them.\n");
+    return;
+
+usage:
+    printf("usage: %s <roll|pitch|yaw>\n", argv[0]);
+}
+
+
+SHELL_CMD(autotune, (cmdfunc_t)cmd_autotune, "Relay feedback PID tuning")
@@ -0,0 +1,33 @@
+#pragma once
+
+enum autotune_rule {
+    AUTOTUNE_PI,                // Tyreus-Luyben PI
+    AUTOTUNE_PID,               // Tyreus-Luyben PID
+    AUTOTUNE_RULE_MAX = AUTOTUNE_PID
+};
+
+
+struct autotune_config {
+    float   relay;              // relay amplitude [V]
+    float   hysteresis;         // [rad/s]
+    int     rule;               // enum autotune_rule
+    float   rate_max;           // abort above this rate [rad/s]
+    float   stick;              // abort above this stick input
+    float   max_change;         // gain change limit, factor
+};
+
+
+struct autotune_result {
+    int     axis;
+    float   ku;                 // ultimate gain [V/(rad/s)]
+    float   tu;                 // ultimate period [s]
+    float   amplitude;          // rate oscillation [rad/s]
+    float   kp, ki, kd;
+};
+
+extern struct autotune_config autotune_config;
+
+int   autotune_active(void);
+float autotune_relay(float u_trim, float rate, float dt);
+void  autotune_sticks(float roll, float pitch, float yaw);
+void  autotune_stop(void);
@@ -0,0 +1,609 @@
+#include "blackbox.h"
+#include "flight_ctrl.h"
+#include "bldc_task.h"
+#include "sensors.h"
+#include "attitude.h"
+#include "ustime.h"
+#include "util.h"
+#include "ff.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#define FRAME_MAX   (3 + 2 * 31)
+
+#define WRITER_POLL 100         // [ticks]
+
+/**
+ * Flight recorder
+ *
+ * The producer runs in the rate loop and packs frames into
+ * one of two RAM blocks. Full blocks are handed to the writer
+ * task, which writes them into the ring of the log file. The
+ * writer has a low priority and may be slow for a while. If
+ * both blocks are full, frames are dropped.
+ *
+ * The RAM disk holds 30 blocks. The default dividers record
+ * about 5.8 kB/s at a 1 kHz rate loop, so the log keeps the
+ * last 5 s. Rates and setpoints are logged at 250 Hz for step
+ * responses, the other fields at 50 Hz or less.
+ *
+ * The blocks are written as a whole, so FatFs can transfer
+ * them without copying them through its sector buffer.
+ *
+ */
+struct blackbox_config blackbox_config = {
+    .enable = 0,
+    .div = {
+        [BB_RATE]       = 4,
+        [BB_RATE_SP]    = 4,
+        [BB_PID]        = 20,
+        [BB_MOTOR_U]    = 20,
+        [BB_MOTOR_RPM]  = 20,
+        [BB_ACC]        = 20,
+        [BB_EULER]      = 100,
+        [BB_POWER]      = 200
+    }
+};
+
+struct blackbox_stats blackbox_stats;
+
+static const struct {
+    const char *name;
+    int         count;
+    float       scale;
+} fields[BB_NUM_FIELDS] = {
+    [BB_RATE]       = { "rate",      3, 1e-3 },
+    [BB_RATE_SP]    = { "rate_sp",   3, 1e-3 },
+    [BB_PID]        = { "pid",       9, 1e-3 },
+    [BB_MOTOR_U]    = { "motor_u",   4, 1e-3 },
+    [BB_MOTOR_RPM]  = { "motor_rpm", 4, 1    },
+    [BB_ACC]        = { "acc",       3, 1e-2 },
+    [BB_EULER]      = { "euler",     3, 1e-4 },
+    [BB_POWER]      = { "power",     2, 1e-3 }
+};
+
+static uint8_t  blocks[2][BLACKBOX_BLOCK_SIZE] __attribute__((aligned(4)));
+static volatile int block_full[2];
+
+static SemaphoreHandle_t writer_sem;
+
+// Producer state
+//
+static volatile int running;        // producer is logging
+static volatile int writer_busy;    // file not yet closed
+static volatile int forced;         // started from the shell
+static volatile int shell_busy;     // shell is using the file system
+
+static int      field_div[BB_NUM_FIELDS];
+static int      cur, pos;
+static uint16_t seq;
+static uint32_t tick, t_last;
+
+static struct sensor_data sensor;
+static vec3f euler;
+static float thrust;
+
+#define barrier()   __asm__ volatile ("" ::: "memory")
+
+
+static void put_values(uint8_t *frame, int *n, const float *x, int count, float scale)
+{
+    for (int i=0; i<count; i++) {
+        int16_t v = clamp(lrintf(x[i] / scale), -32768, 32767);
+        memcpy(&frame[*n], &v, 2);
+        *n += 2;
+    }
+}
+
+
+static int get_field(int f, float *x)
+{
+    switch (f) {
+    case BB_RATE:
+    case BB_RATE_SP:
+        for (int i=0; i<3; i++)
+            x[i] = f == BB_RATE ? ctrl_axes[i].rate : ctrl_axes[i].rate_sp;
+        return 3;
+
+    case BB_PID:
+        for (int i=0; i<3; i++) {
+            x[i*3 + 0] = ctrl_axes[i].i;
+            x[i*3 + 1] = ctrl_axes[i].d;
+            x[i*3 + 2] = ctrl_axes[i].u;
+        }
+        return 9;
+
+    case BB_MOTOR_U:
+    case BB_MOTOR_RPM:
+        for (int i=0; i<4; i++) {
+            const struct motor_state *m = &bldc_state.motors[i];
+            x[i] = f == BB_MOTOR_U ? m->u_d : m->rpm_filter.y[0];
+        }
+        return 4;
+
+    case BB_ACC: {
+        uint32_t t;
+        sensor_try_read(&sensor, &t);
+        x[0] = sensor.acc.x;  x[1] = sensor.acc.y;  x[2] = sensor.acc.z;
+        return 3;
+    }
+
+    case BB_EULER: {
+        struct attitude a;
+        if (attitude_try_read(&a) == 0)
+            euler = quatf_to_euler(a.q);
+
+        x[0] = euler.x;  x[1] = euler.y;  x[2] = euler.z;
+        return 3;
+    }
+
+    case BB_POWER:
+        x[0] = bldc_state.u_bat;
+        x[1] = thrust;
+        return 2;
+    }
+
+    return 0;
+}
+
+
+static void close_block(void)
+{
+    memset(&blocks[cur][pos], 0, BLACKBOX_BLOCK_SIZE - pos);
+
+    barrier();
+    block_full[cur] = 1;
+    xSemaphoreGive(writer_sem);
+
+    cur ^= 1;
+    pos = 0;
+}
+
+
+static int open_block(uint32_t t)
+{
+    if (block_full[cur]) {
+        blackbox_stats.dropped++;
+        return -1;
+    }
+
+    struct blackbox_block b = {
+        .sync = BLACKBOX_BLOCK_SYNC,
+        .seq  = seq++,
+        .time = t
+    };
+
+    memcpy(blocks[cur], &b, sizeof(b));
+    pos = sizeof(b);
+    t_last = t;
+
+    blackbox_stats.blocks++;
+    return 0;
+}
+
+
+/**
+ * Record one frame. Called from the rate loop.
+ *
+ * \param thrust  collective thrust command [V]
+ */
+void blackbox_update(int armed, float thrust_cmd)
+{
+    if (!writer_sem)
+        return;
+
+    thrust = thrust_cmd;
+
+    int run = forced || (armed && blackbox_config.enable);
+
+    if (!run) {
+        if (running) {
+            if (pos > 0)
+                close_block();
+
+            running = 0;
+            xSemaphoreGive(writer_sem);
+        }
+        return;
+    }
+
+    if (!running) {
+        // Wait until the last file has been closed
+        //
+        if (writer_busy || shell_busy || block_full[0] || block_full[1])
+            return;
+
+        for (int f=0; f<BB_NUM_FIELDS; f++)
+            field_div[f] = clamp(blackbox_config.div[f], 0, 255);
+
+        cur = pos = 0;
+        tick = 0;
+
+        writer_busy = 1;
+        running = 1;
+        xSemaphoreGive(writer_sem);
+    }
+
+    uint8_t frame[FRAME_MAX];
+    uint8_t mask = 0;
+    int n = 3;
+
+    for (int f=0; f<BB_NUM_FIELDS; f++) {
+        if (field_div[f] && tick % field_div[f] == 0) {
+            float x[9];
+            int count = get_field(f, x);
+
+            put_values(frame, &n, x, count, fields[f].scale);
+            mask |= 1 << f;
+        }
+    }
+
+    tick++;
+
+    if (!mask)
+        return;
+
+    uint32_t t  = get_us_time32();
+    uint32_t dt = t - t_last;
+
+    if (pos > 0 && (pos + n > BLACKBOX_BLOCK_SIZE || dt > 0xFFFF))
+        close_block();
+
+    if (pos == 0) {
+        if (open_block(t) < 0)
+            return;
+
+        dt = 0;
+    }
+
+    frame[0] = mask;
+    frame[1] = dt;
+    frame[2] = dt >> 8;
+
+    memcpy(&blocks[cur][pos], frame, n);
+    pos += n;
+    t_last = t;
+
+    blackbox_stats.frames++;
+}
+
+
+// -------------------- Writer task --------------------
+//
+#define LOG_MAX_BLOCKS  64
+
+static FATFS    fs;
+static FIL      file;
+static char     file_name[16];
+
+static int      log_blocks;             // ring size
+static int      log_slot;               // next block to write
+static uint32_t log_written;            // blocks in this recording
+static uint32_t slot_time[LOG_MAX_BLOCKS];
+
+
+/**
+ * Allocate the ring file with all free space
+ *
+ */
+static FRESULT log_alloc(void)
+{
+    DWORD nclst;
+    FATFS *pfs;
+
+    FRESULT res = f_getfree("", &nclst, &pfs);
+    if (res != FR_OK)
+        return res;
+
+    int n = (f_size(&file) + nclst * pfs->csize * 512 - BLACKBOX_HEADER_SIZE) / BLACKBOX_BLOCK_SIZE;
+    if (n > LOG_MAX_BLOCKS)
+        n = LOG_MAX_BLOCKS;
+
+    if (n < 2)
+        return FR_DENIED;   // disk full
+
+    DWORD size = BLACKBOX_HEADER_SIZE + n * BLACKBOX_BLOCK_SIZE;
+
+    res = f_lseek(&file, size);
+    if (res == FR_OK && f_size(&file) != size)
+        res = FR_DENIED;
+
+    // Keep the size over a reset
+    //
+    if (res == FR_OK)
+        res = f_sync(&file);
+
+    return res;
+}
+
+
+static int log_open(void)
+{
+    FRESULT res;
+
+    if (!fs.fs_type) {
+        res = f_mount(&fs, "", 1);
+        if (res != FR_OK)
+            goto error;
+    }
+
+    strcpy(file_name, BLACKBOX_FILE_NAME);
+
+    res = f_open(&file, file_name, FA_WRITE | FA_OPEN_ALWAYS);
+    if (res != FR_OK)
+        goto error;
+
+    if (f_size(&file) < BLACKBOX_HEADER_SIZE + 2 * BLACKBOX_BLOCK_SIZE) {
+        res = log_alloc();
+        if (res != FR_OK) {
+            f_close(&file);
+            f_unlink(file_name);
+            goto error;
+        }
+    }
+
+    log_blocks  = (f_size(&file) - BLACKBOX_HEADER_SIZE) / BLACKBOX_BLOCK_SIZE;
+    log_slot    = 0;
+    log_written = 0;
+
+    if (log_blocks > LOG_MAX_BLOCKS)
+        log_blocks = LOG_MAX_BLOCKS;
+
+    static union {
+        struct blackbox_header h;
+        uint8_t buf[BLACKBOX_HEADER_SIZE];
+    } hdr;
+
+    // Clear the blocks of the last recording, so they
+    // are not mixed up with this one
+    //
+    memset(&hdr, 0, sizeof(hdr));
+
+    UINT bw;
+    res = f_lseek(&file, BLACKBOX_HEADER_SIZE);
+
+    for (int i=0; i < log_blocks * (BLACKBOX_BLOCK_SIZE / BLACKBOX_HEADER_SIZE) && res == FR_OK; i++) {
+        res = f_write(&file, hdr.buf, sizeof(hdr.buf), &bw);
+        if (res == FR_OK && bw != sizeof(hdr.buf))
+            res = FR_DENIED;
+    }
+
+    hdr.h.magic      = BLACKBOX_MAGIC;
+    hdr.h.version    = BLACKBOX_VERSION;
+    hdr.h.block_size = BLACKBOX_BLOCK_SIZE;
+    hdr.h.num_fields = BB_NUM_FIELDS;
+
+    for (int f=0; f<BB_NUM_FIELDS; f++) {
+        strncpy(hdr.h.fields[f].name, fields[f].name, BLACKBOX_NAME_LEN);
+        hdr.h.fields[f].count = fields[f].count;
+        hdr.h.fields[f].div   = field_div[f];
+        hdr.h.fields[f].scale = fields[f].scale;
+    }
+
+    if (res == FR_OK)
+        res = f_lseek(&file, 0);
+
+    if (res == FR_OK)
+        res = f_write(&file, hdr.buf, sizeof(hdr.buf), &bw);
+
+    if (res == FR_OK && bw != sizeof(hdr.buf))
+        res = FR_DENIED;
+
+    if (res != FR_OK) {
+        f_close(&file);
+        goto error;
+    }
+
+    blackbox_stats.files++;
+    blackbox_stats.duration = 0;
+    return 0;
+
+error:
+    blackbox_stats.error = res;
+    file_name[0] = 0;
+    return -1;
+}
+
+
+static void log_close(void)
+{
+    FRESULT res = f_close(&file);
+    if (res != FR_OK)
+        blackbox_stats.error = res;
+}
+
+
+/**
+ * Write the full blocks in order, into the next slot of the
+ * ring. Blocks which can't be written are dropped.
+ *
+ */
+static int log_write(int *idx, int is_open)
+{
+    while (block_full[*idx]) {
+        if (is_open) {
+            FRESULT res = FR_OK;
+            UINT bw = BLACKBOX_BLOCK_SIZE;
+
+            if (log_slot == 0)
+                res = f_lseek(&file, BLACKBOX_HEADER_SIZE);
+
+            if (res == FR_OK)
+                res = f_write(&file, blocks[*idx], BLACKBOX_BLOCK_SIZE, &bw);
+
+            if (res != FR_OK || bw != BLACKBOX_BLOCK_SIZE) {
+                blackbox_stats.error = res != FR_OK ? res : FR_DENIED;
+                log_close();
+                is_open = 0;
+            }
+            else {
+                memcpy(&slot_time[log_slot], &blocks[*idx][offsetof(struct blackbox_block, time)], 4);
+
+                if (++log_slot == log_blocks)
+                    log_slot = 0;
+
+                log_written++;
+
+                // The oldest block is overwritten next
+                //
+                int oldest = log_written < (uint32_t)log_blocks ? 0 : log_slot;
+                blackbox_stats.duration = (t_last - slot_time[oldest]) * 1e-6;
+            }
+        }
+
+        if (!is_open)
+            blackbox_stats.lost++;
+
+        barrier();
+        block_full[*idx] = 0;
+        *idx ^= 1;
+    }
+
+    return is_open;
+}
+
+
+void blackbox_task(void *pvParameters)
+{
+    int is_open = 0, in_file = 0, idx = 0;
+
+    writer_sem = xSemaphoreCreateBinary();
+
+    for (;;) {
+        xSemaphoreTake(writer_sem, WRITER_POLL);
+
+        if (!writer_busy)
+            continue;
+
+        if (!in_file) {
+            is_open = log_open() == 0;
+            in_file = 1;
+            idx = 0;
+        }
+
+        is_open = log_write(&idx, is_open);
+
+        if (!running) {
+            is_open = log_write(&idx, is_open);
+
+            if (is_open)
+                log_close();
+
+            is_open = in_file = 0;
+            writer_busy = 0;
+        }
+    }
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+
+static void cmd_blackbox_ls(void)
+{
+    DIR dir;
+    FILINFO fi;
+
+    FRESULT res = f_opendir(&dir, "");
+    if (res != FR_OK) {
+        printf("error %d\n", res);
+        return;
+    }
+
+    while (f_readdir(&dir, &fi) == FR_OK && fi.fname[0])
+        printf("%-12s %8lu\n", fi.fname, fi.fsize);
+
+    f_closedir(&dir);
+
+    DWORD nclst;
+    FATFS *pfs;
+
+    if (f_getfree("", &nclst, &pfs) == FR_OK)
+        printf("%lu bytes free\n", nclst * pfs->csize * 512);
+}
+
+
+static void cmd_blackbox_erase(void)
+{
+    DIR dir;
+    FILINFO fi;
+
+    if (f_opendir(&dir, "") != FR_OK)
+        return;
+
+    while (f_readdir(&dir, &fi) == FR_OK && fi.fname[0])
+        f_unlink(fi.fname);
+
+    f_closedir(&dir);
+}
+
+
+static void cmd_blackbox(int argc, char *argv[])
+{
+    struct blackbox_stats *s = &blackbox_stats;
+
+    if (argc == 1) {
+        printf("state    : %s\n", running ? "running" : writer_busy ? "closing" : "idle");
+        printf("file     : %s\n", file_name);
+        printf("frames   : %10lu\n", s->frames);
+        printf("blocks   : %10lu\n", s->blocks);
+        printf("dropped  : %10lu frames\n", s->dropped);
+        printf("lost     : %10lu blocks\n", s->lost);
+        printf("files    : %10lu\n", s->files);
+        printf("duration : %10.1f s\n", s->duration);
+        printf("error    : %10d\n", s->error);
+        return;
+    }
+
+    if (argc != 2)
+        goto usage;
+
+    if (!strcmp(argv[1], "start")) {
+        forced = 1;
+        return;
+    }
+    else if (!strcmp(argv[1], "stop")) {
+        forced = 0;
+        return;
+    }
+    else if (!strcmp(argv[1], "-r")) {
+        memset(s, 0, sizeof(*s));
+        return;
+    }
+
+    // File system access is not reentrant
+    //
+    shell_busy = 1;
+
+    if (writer_busy) {
+        printf("Blackbox is running. Stop it first.\n");
+    }
+    else if (!fs.fs_type && f_mount(&fs, "", 1) != FR_OK) {
+        printf("Can't mount the disk\n");
+    }
+    else if (!strcmp(argv[1], "ls")) {
+        cmd_blackbox_ls();
+    }
+    else if (!strcmp(argv[1], "erase")) {
+        cmd_blackbox_erase();
+    }
+    else {
+        shell_busy = 0;
+        goto usage;
+    }
+
+    shell_busy = 0;
+    return;
+
+usage:
+    printf("usage: %s [start|stop|ls|erase|-r]\n", argv[0]);
+}
+
+
+SHELL_CMD(blackbox, (cmdfunc_t)cmd_blackbox, "Flight recorder")
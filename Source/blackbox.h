@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BLACKBOX_MAGIC          0x4c424244  // "DBBL"
+#define BLACKBOX_VERSION        2
+
+#define BLACKBOX_HEADER_SIZE    512
+#define BLACKBOX_BLOCK_SIZE     1024
+#define BLACKBOX_BLOCK_SYNC     0xb10c
+#define BLACKBOX_NAME_LEN       12
+#define BLACKBOX_FILE_NAME      "BLACKBOX.BBL"
+
+/**
+ * Flight log
+ *
+ * A log file starts with a struct blackbox_header, padded to
+ * BLACKBOX_HEADER_SIZE. It is followed by blocks of
+ * BLACKBOX_BLOCK_SIZE bytes, each starting with a struct
+ * blackbox_block. The blocks hold frames:
+ *
+ *   uint8_t  mask      fields in this frame, 0: end of block
+ *   uint16_t dt        time since the previous frame [us]
+ *   int16_t  values    for each field in the mask, in order
+ *
+ * A field is recorded in every div'th frame. The values are
+ * multiples of the field scale.
+ *
+ * Frames never cross a block boundary, so a log can be decoded
+ * from any block. The first frame of a block has dt = 0.
+ * All values are little endian.
+ *
+ * The log file is allocated once with all free space, and
+ * is used as a ring buffer. Each recording rewrites the header
+ * and clears the blocks, then overwrites the oldest block when
+ * the file is full. The blocks are put in order by their seq
+ * number, unused blocks have sync = 0.
+ *
+ */
+enum blackbox_field {
+    BB_RATE,            // angular rates [rad/s]
+    BB_RATE_SP,         // rate setpoints [rad/s]
+    BB_PID,             // I, D and output per axis [V]
+    BB_MOTOR_U,         // motor voltages [V]
+    BB_MOTOR_RPM,       // measured speeds [rpm]
+    BB_ACC,             // accelerometer [m/s^2]
+    BB_EULER,           // attitude [rad]
+    BB_POWER,           // battery voltage and thrust [V]
+    BB_NUM_FIELDS
+};
+
+
+struct blackbox_field_info {
+    char        name[BLACKBOX_NAME_LEN];
+    uint8_t     count;
+    uint8_t     div;
+    uint16_t    reserved;
+    float       scale;
+};
+
+
+struct blackbox_header {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    block_size;
+    uint8_t     num_fields;
+    uint8_t     reserved[3];
+    struct blackbox_field_info  fields[BB_NUM_FIELDS];
+};
+
+
+struct blackbox_block {
+    uint16_t    sync;
+    uint16_t    seq;
+    uint32_t    time;           // [us]
+};
+
+
+struct blackbox_config {
+    int         enable;         // log while armed
+    int         div[BB_NUM_FIELDS];
+};
+
+
+struct blackbox_stats {
+    uint32_t    frames;
+    uint32_t    blocks;
+    uint32_t    dropped;        // frames lost, writer too slow
+    uint32_t    lost;           // blocks not written
+    uint32_t    files;
+    float       duration;       // recorded time in the log [s]
+    int         error;          // last FatFs error
+};
+
+extern struct blackbox_config blackbox_config;
+extern struct blackbox_stats  blackbox_stats;
+
+void blackbox_update(int armed, float thrust);
+void blackbox_task(void *pvParameters);
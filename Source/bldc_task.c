@@ -2,6 +2,7 @@
 #include "bldc_driver.h"
 #include "debug_dac.h"
 #include "util.h"
+#include "ustime.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include <math.h>
@@ -240,6 +241,11 @@ void bldc_irq_handler(void)
 {
     check_limits();
 
+    if (bldc_state.t_sample != bldc_state.t_applied_sample) {
+        bldc_state.t_applied = get_us_time32();
+        bldc_state.t_applied_sample = bldc_state.t_sample;
+    }
+
     for (int id=0; id<4; id++) {
         struct motor_state *m = &bldc_state.motors[id];
 
@@ -65,6 +65,14 @@ struct bldc_state {
     // Motor states
     //
     struct motor_state  motors[4];
+
+    // Latency measurement, see flight_ctrl.c. t_sample is
+    // written after the setpoints. The IRQ stores the time
+    // it first used them in t_applied.
+    //
+    volatile uint32_t   t_sample;
+    volatile uint32_t   t_applied;
+    volatile uint32_t   t_applied_sample;
 };
 
 
@@ -0,0 +1,96 @@
+/**
+ * \file
+ * Control loop timer using TIM6
+ *
+ * Wakes up the inner rate loop at a fixed rate, independent
+ * of the RTOS tick. The interrupt only gives a semaphore, the
+ * loop itself runs in a high priority task.
+ *
+ */
+#include "ctrl_timer.h"
+#include "stm32f4xx.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include <errno.h>
+
+#define CTRL_TIMER_CLOCK    1000000     // [Hz]
+#define CTRL_TIMER_MAX_RATE 8000        // [Hz]
+
+static SemaphoreHandle_t  ctrl_timer_sem;
+
+
+void TIM6_DAC_IRQHandler(void)
+{
+    if (!(TIM6->SR & TIM_SR_UIF))
+        return;
+
+    TIM6->SR = ~TIM_SR_UIF;
+
+    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+    xSemaphoreGiveFromISR(ctrl_timer_sem, &xHigherPriorityTaskWoken);
+    portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
+}
+
+
+/**
+ * Start the timer, or change its rate.
+ *
+ * \param  rate  [Hz]
+ * \returns 0, or -1 if the rate is out of range (errno = EINVAL)
+ */
+int ctrl_timer_start(int rate)
+{
+    if (rate <= 0 || rate > CTRL_TIMER_MAX_RATE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!ctrl_timer_sem)
+        ctrl_timer_sem = xSemaphoreCreateBinary();
+
+    RCC->APB1ENR |= RCC_APB1Periph_TIM6;
+
+    // APB1 timers run at SYSCLK/4 * 2 = 84 MHz
+    //
+    TIM6->CR1 = 0;
+    TIM6->PSC = (SystemCoreClock / 2 / CTRL_TIMER_CLOCK) - 1;
+    TIM6->ARR = CTRL_TIMER_CLOCK / rate - 1;
+    TIM6->CNT = 0;
+    TIM6->EGR = TIM_EGR_UG;
+    TIM6->SR  = ~TIM_SR_UIF;
+    TIM6->DIER = TIM_DIER_UIE;
+
+    NVIC_Init(&(NVIC_InitTypeDef) {
+        .NVIC_IRQChannel = TIM6_DAC_IRQn,
+        .NVIC_IRQChannelPreemptionPriority =
+            configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY,
+        .NVIC_IRQChannelCmd = ENABLE
+    });
+
+    TIM6->CR1 = TIM_CR1_CEN;
+    return 0;
+}
+
+
+void ctrl_timer_stop(void)
+{
+    TIM6->CR1  = 0;
+    TIM6->DIER = 0;
+}
+
+
+/**
+ * Wait for the next timer period.
+ *
+ * \param  timeout  [ticks]
+ * \returns 0, or -1 on timeout (errno = ETIMEDOUT)
+ */
+int ctrl_timer_wait(uint32_t timeout)
+{
+    if (!ctrl_timer_sem || xSemaphoreTake(ctrl_timer_sem, timeout) != pdTRUE) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+int  ctrl_timer_start(int rate);
+void ctrl_timer_stop(void);
+int  ctrl_timer_wait(uint32_t timeout);
@@ -0,0 +1,197 @@
+#include "ellipsoid_fit.h"
+#include <errno.h>
+#include <string.h>
+
+
+void ellipsoid_fit_reset(struct ellipsoid_fit *f)
+{
+    memset(f, 0, sizeof(*f));
+}
+
+
+void ellipsoid_fit_add(struct ellipsoid_fit *f, vec3f p)
+{
+    const double x = p.x, y = p.y, z = p.z;
+
+    const double phi[9] = {
+        x*x, y*y, z*z, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z
+    };
+
+    for (int i=0; i<9; i++) {
+        for (int j=i; j<9; j++)
+            f->ata[i][j] += phi[i] * phi[j];
+
+        f->atb[i] += phi[i];
+    }
+
+    f->n++;
+}
+
+
+/**
+ * Solve A x = b by Gaussian elimination with partial pivoting.
+ * A and b are destroyed.
+ *
+ */
+static int solve9(double A[9][9], double b[9], double x[9])
+{
+    for (int k=0; k<9; k++) {
+        int p = k;
+        for (int i=k+1; i<9; i++) {
+            if (fabs(A[i][k]) > fabs(A[p][k]))
+                p = i;
+        }
+
+        if (fabs(A[p][k]) < 1e-12)
+            return -1;
+
+        if (p != k) {
+            for (int j=0; j<9; j++) {
+                double t = A[k][j];  A[k][j] = A[p][j];  A[p][j] = t;
+            }
+            double t = b[k];  b[k] = b[p];  b[p] = t;
+        }
+
+        for (int i=k+1; i<9; i++) {
+            double m = A[i][k] / A[k][k];
+            for (int j=k; j<9; j++)
+                A[i][j] -= m * A[k][j];
+
+            b[i] -= m * b[k];
+        }
+    }
+
+    for (int i=8; i>=0; i--) {
+        double s = b[i];
+        for (int j=i+1; j<9; j++)
+            s -= A[i][j] * x[j];
+
+        x[i] = s / A[i][i];
+    }
+
+    return 0;
+}
+
+
+/**
+ * Eigen decomposition of a symmetric matrix by Jacobi rotations.
+ * On return, A = V * diag(d) * V^T
+ *
+ */
+static void sym_eigen(mat3f A, mat3f *V, vec3f *d)
+{
+    float a[3][3], v[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    memcpy(a, &A, sizeof(a));
+
+    for (int sweep=0; sweep<20; sweep++) {
+        float off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+        if (off < 1e-20)
+            break;
+
+        for (int p=0; p<2; p++) {
+            for (int q=p+1; q<3; q++) {
+                if (a[p][q] == 0)
+                    continue;
+
+                float theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+                float t = copysignf(1, theta) / (fabsf(theta) + sqrtf(theta*theta + 1));
+                float c = 1 / sqrtf(t*t + 1);
+                float s = t * c;
+
+                for (int k=0; k<3; k++) {
+                    float akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+
+                for (int k=0; k<3; k++) {
+                    float apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+
+                for (int k=0; k<3; k++) {
+                    float vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    memcpy(V, v, sizeof(v));
+    *d = (vec3f) { a[0][0], a[1][1], a[2][2] };
+}
+
+
+/**
+ * Solve for the ellipsoid parameters.
+ *
+ * \param  center     ellipsoid center
+ * \param  transform  symmetric matrix which maps (p - center)
+ *                    onto the unit sphere
+ * \param  radius     geometric mean of the semi-axes
+ *
+ * \returns 1 on success, -1 if the data doesn't describe
+ *          an ellipsoid (e.g. too few orientations)
+ *
+ */
+int ellipsoid_fit_solve(const struct ellipsoid_fit *f, vec3f *center, mat3f *transform, float *radius)
+{
+    if (f->n < 9) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    double A[9][9], b[9], x[9];
+
+    for (int i=0; i<9; i++) {
+        for (int j=0; j<9; j++)
+            A[i][j] = (j >= i) ? f->ata[i][j] : f->ata[j][i];
+
+        b[i] = f->atb[i];
+    }
+
+    if (solve9(A, b, x) < 0) {
+        errno = EDOM;
+        return -1;
+    }
+
+    mat3f Q = {
+        x[0], x[3], x[4],
+        x[3], x[1], x[5],
+        x[4], x[5], x[2]
+    };
+    vec3f v = { x[6], x[7], x[8] };
+
+    // (p - c)^T Q (p - c) = 1 + c^T Q c,  with c = -Q^-1 v
+    //
+    vec3f c = vec3f_scale(vec3f_matmul(mat3f_inv(Q), v), -1);
+    float s = 1 + vec3f_dot(c, vec3f_matmul(Q, c));
+
+    if (!(s > 0)) {
+        errno = EDOM;
+        return -1;
+    }
+
+    Q = mat3f_scale(Q, 1 / s);
+
+    // transform = sqrt(Q) = V * sqrt(diag(d)) * V^T
+    //
+    mat3f V;
+    vec3f d;
+    sym_eigen(Q, &V, &d);
+
+    if (!(d.x > 0 && d.y > 0 && d.z > 0)) {
+        errno = EDOM;
+        return -1;
+    }
+
+    vec3f sd = { sqrtf(d.x), sqrtf(d.y), sqrtf(d.z) };
+
+    *center    = c;
+    *transform = mat3f_mul(mat3f_mul(V, mat3f_diag(sd)), mat3f_trans(V));
+    *radius    = 1 / cbrtf(sd.x * sd.y * sd.z);
+
+    return 1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "matrix3f.h"
+
+/**
+ * Incremental least-squares ellipsoid fit.
+ *
+ * Fits the general quadric
+ *
+ *   a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz
+ *         + 2g x  + 2h y  + 2i z  = 1
+ *
+ * Only the normal equations are accumulated, so the memory
+ * use doesn't depend on the number of samples. The input
+ * should be scaled to about unit magnitude.
+ *
+ */
+struct ellipsoid_fit {
+    double  ata[9][9];      // upper triangle
+    double  atb[9];
+    int     n;
+};
+
+void ellipsoid_fit_reset(struct ellipsoid_fit *f);
+void ellipsoid_fit_add(struct ellipsoid_fit *f, vec3f p);
+int  ellipsoid_fit_solve(const struct ellipsoid_fit *f, vec3f *center, mat3f *transform, float *radius);
@@ -93,6 +93,29 @@ void lp2_set_fc(struct lp2_filter *f, enum filter_type type, float fc)
 }
 
 
+
+/**
+ * Set the centre frequency of a notch filter.
+ * Uses the lp2_filter structure, so lp2_filter() and
+ * lp2_reset() work for notches as well.
+ *
+ * The -3 dB bandwidth is fc / q. The coefficients may be
+ * changed while the filter is running.
+ *
+ */
+void notch_set_fc(struct lp2_filter *f, float fc, float q)
+{
+    const float L = 1 / tanf(M_PI * fc);
+    const float n = 1 / (1 + L/q + L*L);
+
+    f->b[0] = (1 + L*L) * n;
+    f->b[1] = 2 * (1 - L*L) * n;
+    f->b[2] = f->b[0];
+    f->a[0] = 1;    // not used
+    f->a[1] = f->b[1];
+    f->a[2] = (1 - L/q + L*L) * n;
+}
+
 float lp2_filter(struct lp2_filter *f, float x)
 {
     // Shift the old samples
@@ -146,3 +169,182 @@ void avg_reset(struct avg_filter *f, int32_t x)
         f->buf[i] = x;
 }
 
+
+
+// ---------- FIR decimation filter ----------
+//
+
+/**
+ * Design a windowed-sinc low pass for decimation by ratio.
+ *
+ * The cut-off is placed at the output Nyquist frequency,
+ * a Hamming window keeps the side lobes below -40 dB.
+ *
+ */
+void fir_design(struct fir_decimator *f, int taps, int ratio)
+{
+    if (taps < 1)  taps = 1;
+    if (taps > FIR_MAX_TAPS)  taps = FIR_MAX_TAPS;
+    if (ratio < 1)  ratio = 1;
+
+    const float fc  = 0.5 / ratio;
+    const float mid = (taps - 1) / 2.0;
+
+    float sum = 0;
+    for (int i=0; i<taps; i++) {
+        float t = i - mid;
+        float h = (t == 0) ? 2 * fc : sinf(2 * M_PI * fc * t) / (M_PI * t);
+
+        if (taps > 1)
+            h *= 0.54 - 0.46 * cosf(2 * M_PI * i / (taps - 1));
+
+        f->h[i] = h;
+        sum += h;
+    }
+
+    // Normalize for unity DC gain
+    //
+    for (int i=0; i<taps; i++)
+        f->h[i] /= sum;
+
+    f->taps  = taps;
+    f->ratio = ratio;
+
+    fir_reset(f, 0);
+}
+
+
+/**
+ * Feed one input sample.
+ *
+ * \returns 1 if a new output sample is available in f->y
+ *
+ */
+int fir_decimate(struct fir_decimator *f, float x)
+{
+    f->x[f->index] = x;
+    f->x[f->index + f->taps] = x;
+
+    if (++f->index >= f->taps)
+        f->index = 0;
+
+    if (++f->phase < f->ratio)
+        return 0;
+
+    f->phase = 0;
+
+    // x[index .. index+taps-1] holds the last taps samples,
+    // oldest first. The filter is symmetric, so the order
+    // of the coefficients doesn't matter.
+    //
+    const float *xp = &f->x[f->index];
+
+    float y = 0;
+    for (int i=0; i<f->taps; i++)
+        y += f->h[i] * xp[i];
+
+    f->y = y;
+    return 1;
+}
+
+
+void fir_reset(struct fir_decimator *f, float x)
+{
+    for (int i=0; i<2 * FIR_MAX_TAPS; i++)
+        f->x[i] = x;
+
+    f->index = 0;
+    f->phase = 0;
+    f->y = x;
+}
+
+
+/**
+ * Group delay in input samples
+ *
+ */
+float fir_group_delay(const struct fir_decimator *f)
+{
+    return (f->taps - 1) / 2.0;
+}
+
+
+// ---------- CIC decimation filter ----------
+//
+
+void cic_design(struct cic_decimator *f, int order, int ratio)
+{
+    if (order < 1)  order = 1;
+    if (order > CIC_MAX_ORDER)  order = CIC_MAX_ORDER;
+    if (ratio < 1)  ratio = 1;
+
+    f->order = order;
+    f->ratio = ratio;
+
+    cic_reset(f);
+}
+
+
+/**
+ * Feed one input sample.
+ *
+ * \returns 1 if a new output sample is available in f->y
+ *
+ */
+int cic_decimate(struct cic_decimator *f, int32_t x)
+{
+    // Unsigned arithmetic, the wrap-around is intended
+    //
+    uint32_t v = x;
+
+    for (int i=0; i<f->order; i++)
+        v = f->integ[i] += v;
+
+    if (++f->phase < f->ratio)
+        return 0;
+
+    f->phase = 0;
+
+    for (int i=0; i<f->order; i++) {
+        uint32_t t = v;
+        v -= f->comb[i];
+        f->comb[i] = t;
+    }
+
+    f->y = v;
+    return 1;
+}
+
+
+void cic_reset(struct cic_decimator *f)
+{
+    for (int i=0; i<CIC_MAX_ORDER; i++)
+        f->integ[i] = f->comb[i] = 0;
+
+    f->phase = 0;
+    f->y = 0;
+}
+
+
+/**
+ * Group delay in input samples
+ *
+ */
+float cic_group_delay(const struct cic_decimator *f)
+{
+    return f->order * (f->ratio - 1) / 2.0;
+}
+
+
+/**
+ * DC gain (ratio^order)
+ *
+ */
+float cic_gain(const struct cic_decimator *f)
+{
+    float g = 1;
+    for (int i=0; i<f->order; i++)
+        g *= f->ratio;
+
+    return g;
+}
@@ -47,6 +47,43 @@ struct avg_filter {
 };
 
 
+/**
+ * FIR decimation filter.
+ * Only every ratio'th output is computed, the delay line is
+ * stored twice to avoid wrapping in the inner loop.
+ *
+ */
+#define FIR_MAX_TAPS    32
+
+struct fir_decimator {
+    float       h[FIR_MAX_TAPS];
+    float       x[2 * FIR_MAX_TAPS];
+    int         taps;
+    int         ratio;
+    int         index;
+    int         phase;
+    float       y;
+};
+
+
+/**
+ * Cascaded integrator-comb decimation filter.
+ * The integrators may overflow, the comb section cancels
+ * the wrap-around as long as the output fits into 32 bits.
+ *
+ */
+#define CIC_MAX_ORDER   4
+
+struct cic_decimator {
+    uint32_t    integ[CIC_MAX_ORDER];
+    uint32_t    comb[CIC_MAX_ORDER];
+    int         order;
+    int         ratio;
+    int         phase;
+    int32_t     y;          // output, gain is ratio^order
+};
+
+
 void    lp1_set_fc(struct lp1_filter *f, float fc);
 float   lp1_filter(struct lp1_filter *f, float x);
 void    lp1_reset(struct lp1_filter *f, float x);
@@ -54,7 +91,19 @@ void    lp1_reset(struct lp1_filter *f, float x);
 void    lp2_set_fc(struct lp2_filter *f, enum filter_type type, float fc);
 float   lp2_filter(struct lp2_filter *f, float x);
 void    lp2_reset(struct lp2_filter *f, float x);
+void    notch_set_fc(struct lp2_filter *f, float fc, float q);
 
 int32_t avg_filter(struct avg_filter *f, int32_t x);
 void    avg_reset(struct avg_filter *f, int32_t x);
 
+void    fir_design(struct fir_decimator *f, int taps, int ratio);
+int     fir_decimate(struct fir_decimator *f, float x);
+void    fir_reset(struct fir_decimator *f, float x);
+float   fir_group_delay(const struct fir_decimator *f);
+
+void    cic_design(struct cic_decimator *f, int order, int ratio);
+int     cic_decimate(struct cic_decimator *f, int32_t x);
+void    cic_reset(struct cic_decimator *f);
+float   cic_group_delay(const struct cic_decimator *f);
+float   cic_gain(const struct cic_decimator *f);
+
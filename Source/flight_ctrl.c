@@ -2,25 +2,425 @@
 #include "sensors.h"
 #include "bldc_task.h"
 #include "rc_input.h"
+#include "attitude.h"
+#include "mixer.h"
+#include "thrust_curve.h"
+#include "blackbox.h"
+#include "sysid.h"
+#include "autotune.h"
+#include "rpm_notch.h"
+#include "ctrl_timer.h"
 #include "util.h"
+#include "ustime.h"
+#include <string.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
 
+#define CTRL_TIMEOUT    2       // [ticks] without IMU samples
+#define CTRL_DT_MAX     0.005   // [s] longest controller step
+#define LATENCY_ALPHA   0.01    // running average coefficient
+
+// The sensor task publishes at most one IMU sample per tick.
+// The D-term filters and the motor noise notches run at this
+// rate in the outer loop, and at the gyro FIFO rate in the
+// inner loop.
+//
+#define CTRL_RATE       configTICK_RATE_HZ
+
 
 static struct sensor_data   sensor_data;
 static struct rc_input      rc_input;
 
-struct pid_ctrl   pid_pitch = { .kp = 1, .ki = 0, .kd = 0, .min = -5, .max = 5, .dt = 1e-3 };
-struct pid_ctrl   pid_roll  = { .kp = 1, .ki = 0, .kd = 0, .min = -5, .max = 5, .dt = 1e-3 };
-struct pid_ctrl   pid_yaw   = { .kp = 1, .ki = 0, .kd = 0, .min = -5, .max = 5, .dt = 1e-3 };
+struct ctrl_config ctrl_config = {
+    .mode       = CTRL_MODE_RATE,
+    .max_rate   = 1,
+    .max_angle  = 0.5,
+    .d_fc       = 50,
+    .u_max      = 5,
+    .rate_hz    = 0
+};
+
+struct ctrl_axis ctrl_axes[3] = {
+    [CTRL_ROLL]  = { .kp = 1, .i_max = 2, .angle_kp = 4 },
+    [CTRL_PITCH] = { .kp = 1, .i_max = 2, .angle_kp = 4 },
+    [CTRL_YAW]   = { .kp = 1, .i_max = 2 }
+};
+
+static float d_fc_active = -1;
+static float d_fs_active = -1;
+
+// Outer to inner loop. Single words, no lock needed.
+//
+static volatile int     ctrl_armed;
+static volatile float   ctrl_thrust;
+
+// Rate loop handover. The inner loop requests the rate loop,
+// the outer loop grants it between two of its own runs. Only
+// the outer loop writes inner_active, so the two loops never
+// run rate_loop() at the same time.
+//
+static volatile int     inner_request;
+static volatile int     inner_active;
+
+struct ctrl_loop_stats  ctrl_loop_stats[2];
+
+static volatile int loop_stats_reset;
 
 float   rc_pitch, rc_roll, rc_yaw, rc_thrust;
 
-float foo = 1;
-float bar = 0;
-float baz = 0;
+struct ctrl_latency ctrl_latency;
+
+static volatile int latency_reset;
+
+static const uint32_t latency_bins[CTRL_LATENCY_BINS - 1] = {
+    200, 400, 600, 800, 1000, 2000, 5000
+};
+
+/**
+ * Account the setpoints of the previous cycle, which should
+ * have been picked up by the BLDC interrupt in the meantime.
+ *
+ */
+static void latency_update(uint32_t t_sample, uint32_t t_wakeup, uint32_t t_last)
+{
+    struct ctrl_latency *l = &ctrl_latency;
+
+    if (latency_reset) {
+        memset(l, 0, sizeof(*l));
+        latency_reset = 0;
+    }
+
+    if (l->cycles > 0) {
+        if (bldc_state.t_applied_sample == t_last) {
+            uint32_t total = bldc_state.t_applied - t_last;
+
+            int bin = 0;
+            while (bin < CTRL_LATENCY_BINS - 1 && total >= latency_bins[bin])
+                bin++;
+
+            l->hist[bin]++;
+            l->total += (total - l->total) * LATENCY_ALPHA;
+            if (total > l->total_max)
+                l->total_max = total;
+        }
+        else {
+            l->missed++;
+        }
+    }
+
+    uint32_t wakeup = t_wakeup - t_sample;
+
+    l->wakeup += (wakeup - l->wakeup) * LATENCY_ALPHA;
+    if (wakeup > l->wakeup_max)
+        l->wakeup_max = wakeup;
+
+    l->cycles++;
+}
+
+
+/**
+ * Redesign the D-term filters if ctrl.d_fc or the gyro
+ * sample rate fs has changed. 0 turns them off.
+ *
+ */
+static void ctrl_update_filters(float fs)
+{
+    if (ctrl_config.d_fc == d_fc_active && fs == d_fs_active)
+        return;
+
+    float fc = clamp(ctrl_config.d_fc / fs, 0, 0.45);
+
+    for (int i=0; i<3; i++) {
+        struct ctrl_axis *c = &ctrl_axes[i];
+
+        lp2_set_fc(&c->d_filter, fc > 0 ? FILTER_BUTTERWORTH : FILTER_NONE, fc);
+        lp2_reset(&c->d_filter, 0);
+    }
+
+    d_fc_active = ctrl_config.d_fc;
+    d_fs_active = fs;
+}
+
+
+/**
+ * Reset the integrators and filters, e.g. while the motors
+ * are stopped. rate is the current measurement.
+ *
+ */
+static void ctrl_reset(struct ctrl_axis *c, float rate)
+{
+    c->rate = rate;
+    c->i = 0;
+    c->d = 0;
+    c->u = 0;
+
+    lp2_reset(&c->d_filter, 0);
+}
+
+
+static void angle_update(struct ctrl_axis *c, float angle, float stick)
+{
+    const float max_rate = ctrl_config.max_rate;
+
+    c->angle_sp = stick * ctrl_config.max_angle;
+    c->angle    = angle;
+    c->rate_sp  = clamp(c->angle_kp * (c->angle_sp - angle), -max_rate, max_rate);
+}
+
+
+/**
+ * \param dt    time step [s]
+ * \param dt_d  time since the last new measurement [s],
+ *              0 if there is none
+ */
+static float rate_update(struct ctrl_axis *c, float rate, float dt, float dt_d)
+{
+    const float u_max = ctrl_config.u_max;
+
+    float e = c->rate_sp - rate;
+
+    // Derivative on measurement
+    //
+    if (dt_d > 0) {
+        c->d = lp2_filter(&c->d_filter, (rate - c->rate) / dt_d);
+        c->rate = rate;
+    }
+
+    float u = c->kp * e + c->i - c->kd * c->d + c->kff * c->rate_sp;
+    c->u = clamp(u, -u_max, u_max);
+
+    // Stop integrating while the output saturates
+    // in the direction of the error
+    //
+    if (u == c->u || (u > c->u) != (e > 0))
+        c->i = clamp(c->i + c->ki * e * dt, -c->i_max, c->i_max);
+
+    return c->u;
+}
+
+
+/**
+ * Rate controllers and mixer. Called by the outer loop, or by
+ * the inner loop task if ctrl.rate_hz is set.
+ *
+ * \param fs        sample rate of the gyro in rate [Hz]
+ * \param t_sample  IMU sample time of rate, for the latency
+ *                  measurement
+ */
+static void rate_loop(const float rate[3], float dt, float dt_d, float fs, uint32_t t_sample)
+{
+    ctrl_update_filters(fs);
+
+    if (!ctrl_armed) {
+        for (int i=0; i<3; i++)
+            ctrl_reset(&ctrl_axes[i], rate[i]);
+
+        sysid_stop();
+        autotune_stop();
+        blackbox_update(0, 0);
+        return;
+    }
+
+    // The system identification adds its excitation to one
+    // axis. The setpoint is restored, because the outer loop
+    // doesn't update it in every cycle.
+    //
+    // The auto-tuner replaces the output of one axis by its
+    // relay, see autotune.c.
+    //
+    struct sysid_excitation x;
+    int sid = sysid_excite(&x, dt);
+    int tune_axis = sid ? -1 : autotune_active();
+
+    for (int i=0; i<3; i++) {
+        struct ctrl_axis *c = &ctrl_axes[i];
+
+        if (i == tune_axis) {
+            rate_update(c, rate[i], dt, dt_d);
+            c->u = clamp(autotune_relay(c->i, rate[i], dt), -ctrl_config.u_max, ctrl_config.u_max);
+            continue;
+        }
+
+        if (!sid || i != x.axis) {
+            rate_update(c, rate[i], dt, dt_d);
+            continue;
+        }
+
+        float rate_sp = c->rate_sp;
+        c->rate_sp += x.sp;
+
+        rate_update(c, rate[i], dt, dt_d);
+        c->u = clamp(c->u + x.u, -ctrl_config.u_max, ctrl_config.u_max);
+
+        sysid_record(c->rate_sp, c->u, rate[i]);
+        c->rate_sp = rate_sp;
+    }
+
+    // The board has four BLDC outputs. Larger frames
+    // need external ESCs for the remaining motors.
+    //
+    thrust_update_battery(bldc_state.u_bat, dt);
+
+    float u[MIXER_MAX_MOTORS];
+    int n = mixer_update(u, ctrl_thrust,
+        ctrl_axes[CTRL_ROLL].u, ctrl_axes[CTRL_PITCH].u, ctrl_axes[CTRL_YAW].u,
+        thrust_cmd_max(mixer_config.u_max)
+    );
+
+    for (int i=0; i<THRUST_MOTORS; i++)
+        bldc_state.motors[i].u_d = thrust_voltage(i, i < n ? u[i] : mixer_config.u_min);
+
+    // Publish the setpoints for the latency measurement
+    //
+    __asm__ volatile ("" ::: "memory");
+    bldc_state.t_sample = t_sample;
+
+    blackbox_update(1, ctrl_thrust);
+}
+
+
+static void gyro_to_rate(float rate[3], vec3f gyro)
+{
+    rate[CTRL_ROLL]  = -gyro.y;
+    rate[CTRL_PITCH] =  gyro.x;
+    rate[CTRL_YAW]   = -gyro.z;
+}
+
+
+/**
+ * CPU time and rate of a loop
+ *
+ */
+static void loop_stats_update(int loop, uint32_t t_start, uint32_t cycles)
+{
+    struct ctrl_loop_stats *s = &ctrl_loop_stats[loop];
+
+    if (loop_stats_reset & (1 << loop)) {
+        memset(s, 0, sizeof(*s));
+        loop_stats_reset &= ~(1 << loop);
+    }
+
+    if (s->runs > 0) {
+        float dt = t_start - s->t_last;
+
+        if (s->runs == 1)
+            s->interval = dt;
 
+        s->interval += (dt - s->interval) * LATENCY_ALPHA;
+        s->cycles_avg += (cycles - s->cycles_avg) * LATENCY_ALPHA;
+    }
+    else {
+        s->cycles_avg = cycles;
+    }
+
+    if (cycles > s->cycles_max)
+        s->cycles_max = cycles;
+
+    s->t_last = t_start;
+    s->runs++;
+}
+
+
+/**
+ * Inner rate loop
+ *
+ * With ctrl.rate_hz set, the rate controllers run in this task
+ * at the highest priority, woken up by TIM6. The outer loop
+ * keeps running with the IMU samples.
+ *
+ * The gyro comes from the FIFO samples of the IMU, so the loop
+ * needs mpu9150.fifo_enable. The samples are published once
+ * per sensor cycle, and taken at their own rate here, so the
+ * notches and the D-term see every sample. Use a loop rate
+ * equal to the FIFO rate. Without the FIFO, the rate loop
+ * stays in the outer loop.
+ *
+ * The task has a higher priority than the sensor task, so it
+ * mustn't wait for the sensor data.
+ *
+ */
+void ctrl_rate_task(void *pvParameters)
+{
+    struct sensor_data d;
+    int rate_hz = 0;
+
+    float rate[3] = { 0, 0, 0 };
+    uint32_t t_sample = 0, gyro_index = 0;
+    float samples = 0;
+
+    for (;;) {
+        if (ctrl_config.rate_hz != rate_hz) {
+            rate_hz = ctrl_config.rate_hz;
+
+            if (ctrl_timer_start(rate_hz) < 0) {
+                ctrl_timer_stop();
+                rate_hz = 0;
+            }
+        }
+
+        float fs = sensor_gyro_stream_rate();
+
+        if (!rate_hz || fs <= 0) {
+            inner_request = 0;
+            vTaskDelay(100);
+            continue;
+        }
+
+        if (ctrl_timer_wait(CTRL_TIMEOUT) < 0)
+            continue;
+
+        inner_request = 1;
+
+        if (!inner_active)
+            continue;
+
+        uint32_t t0 = get_us_time32();
+        uint32_t c0 = get_cycle_count();
+
+        // Up to two sensor cycles of samples are kept
+        //
+        float dt_d = 0;
+        vec3f gyro;
+
+        samples += fs / rate_hz;
+
+        while (samples >= 1 &&
+               sensor_gyro_stream_read(&gyro, &gyro_index, 2 * fs / CTRL_RATE) == 0)
+        {
+            gyro_to_rate(rate, gyro);
+            rpm_notch_filter(rate, fs);
+
+            dt_d += 1 / fs;
+            samples -= 1;
+        }
+
+        samples = fminf(samples, 1 + fs / rate_hz);
+
+        // For the latency measurement only
+        //
+        sensor_try_read(&d, &t_sample);
+
+        rate_loop(rate, 1.0 / rate_hz, dt_d, fs, t_sample);
+
+        loop_stats_update(CTRL_LOOP_INNER, t0, get_cycle_count() - c0);
+    }
+}
+
+
+/**
+ * Outer loop: RC input, arming and the angle controllers
+ *
+ * The controller is woken up by each new IMU sample, and
+ * writes the motor setpoints immediately. There's no phase
+ * offset to a separate tick. Without ctrl.rate_hz, the rate
+ * controllers run here as well.
+ *
+ * The controller axes follow the motor layout, see mixer.c:
+ * pitch is about the body x axis, roll and yaw are about
+ * the negative y and z axes.
+ *
+ */
 void flight_ctrl(void *pvParameters)
 {
     //uint32_t t0 = xTaskGetTickCount();
@@ -35,8 +435,25 @@ void flight_ctrl(void *pvParameters)
     int ok = 0;
     int old_ok = 0;
 
+    uint32_t t_sample = 0, t_last = 0;
+
     for (;;) {
-        sensor_read(&sensor_data);
+        int fresh = 0;
+
+        if (sensor_wait(&sensor_data, &t_sample, CTRL_TIMEOUT) == 0) {
+            fresh = 1;
+        }
+        else {
+            sensor_read(&sensor_data);
+            ctrl_latency.timeouts++;
+        }
+
+        uint32_t t_wakeup = get_us_time32();
+        uint32_t c0 = get_cycle_count();
+
+        if (fresh)
+            latency_update(t_sample, t_wakeup, t_last);
+
         rc_update(&rc_input);
 
         if (rc_input.valid && rc_input.channels[5] < 1500)
@@ -49,6 +466,8 @@ void flight_ctrl(void *pvParameters)
             rc_thrust += 0.5;
             rc_thrust *= 5;
 
+            autotune_sticks(rc_roll, rc_pitch, rc_yaw);
+
             ok = 1;
         }
         else {
@@ -60,45 +479,161 @@ void flight_ctrl(void *pvParameters)
             ok = 0;
         }
 
-        pid_pitch.kp = foo;
-        pid_roll.kp = foo;
-        pid_yaw.kp = foo;
-
-        pid_pitch.ki = bar;
-        pid_roll.ki = bar;
-        pid_yaw.ki = bar;
+        // Grant or take back the rate loop
+        //
+        inner_active = inner_request;
 
-        pid_pitch.kd = baz;
-        pid_roll.kd = baz;
-        pid_yaw.kd = baz;
+        float rate[3];
+        gyro_to_rate(rate, sensor_data.gyro);
 
-        pid_update(&pid_pitch, (rc_pitch - sensor_data.gyro.x), 0);
-        pid_update(&pid_roll , (rc_roll  + sensor_data.gyro.y), 0);
-        pid_update(&pid_yaw  , (rc_yaw   + sensor_data.gyro.z), 0);
+        // The notches must see each sample exactly once
+        //
+        if (!inner_active && fresh)
+            rpm_notch_filter(rate, CTRL_RATE);
 
+        struct ctrl_axis *roll  = &ctrl_axes[CTRL_ROLL];
+        struct ctrl_axis *pitch = &ctrl_axes[CTRL_PITCH];
+        struct ctrl_axis *yaw   = &ctrl_axes[CTRL_YAW];
 
-        if (ok) {
-            bldc_state.motors[ID_FL].u_d = clamp(rc_thrust + pid_pitch.u - pid_roll.u - pid_yaw.u, 1, 10);
-            bldc_state.motors[ID_FR].u_d = clamp(rc_thrust + pid_pitch.u + pid_roll.u + pid_yaw.u, 1, 10);
-            bldc_state.motors[ID_RL].u_d = clamp(rc_thrust - pid_pitch.u - pid_roll.u + pid_yaw.u, 1, 10);
-            bldc_state.motors[ID_RR].u_d = clamp(rc_thrust - pid_pitch.u + pid_roll.u - pid_yaw.u, 1, 10);
+        if (ok && fresh) {
+            if (ctrl_config.mode == CTRL_MODE_ANGLE) {
+                struct attitude a;
+                attitude_read(&a);
+                vec3f e = quatf_to_euler(a.q);
 
-            if (!old_ok) {
-                bldc_state.motors[ID_FL].state = STATE_START;
-                bldc_state.motors[ID_FR].state = STATE_START;
-                bldc_state.motors[ID_RL].state = STATE_START;
-                bldc_state.motors[ID_RR].state = STATE_START;
+                angle_update(roll,  -e.y, rc_roll);
+                angle_update(pitch,  e.x, rc_pitch);
+            }
+            else {
+                roll->rate_sp  = rc_roll  * ctrl_config.max_rate;
+                pitch->rate_sp = rc_pitch * ctrl_config.max_rate;
             }
+
+            yaw->rate_sp = rc_yaw * ctrl_config.max_rate;
         }
-        else {
-            bldc_state.motors[ID_FL].state = STATE_STOP;
-            bldc_state.motors[ID_FR].state = STATE_STOP;
-            bldc_state.motors[ID_RL].state = STATE_STOP;
-            bldc_state.motors[ID_RR].state = STATE_STOP;
+
+        ctrl_thrust = rc_thrust;
+        ctrl_armed  = ok;
+
+        if (!inner_active && (fresh || !ok)) {
+            float dt = (t_sample - t_last) * 1e-6;
+            if (dt <= 0 || dt > CTRL_DT_MAX)
+                dt = CTRL_DT_MAX;
+
+            rate_loop(rate, dt, dt, CTRL_RATE, t_sample);
+        }
+
+        for (int i=0; i<4; i++) {
+            struct motor_state *m = &bldc_state.motors[i];
+
+            if (!ok)
+                m->state = STATE_STOP;
+            else if (!old_ok)
+                m->state = STATE_START;
         }
 
         old_ok = ok;
+        t_last = t_sample;
 
-        vTaskDelay(1);
+        if (fresh)
+            loop_stats_update(CTRL_LOOP_OUTER, t_wakeup, get_cycle_count() - c0);
     }
 }
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static void cmd_ctrl_latency(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "-r")) {
+        latency_reset = 1;
+        return;
+    }
+    else if (argc != 1) {
+        goto usage;
+    }
+
+    const struct ctrl_latency *l = &ctrl_latency;
+
+    printf("cycles    : %10lu\n", l->cycles);
+    printf("timeouts  : %10lu\n", l->timeouts);
+    printf("missed    : %10lu\n", l->missed);
+    printf("\n");
+    printf("                avg        max\n");
+    printf("wakeup    : %7.0f us %7lu us\n", l->wakeup, l->wakeup_max);
+    printf("total     : %7.0f us %7lu us\n", l->total, l->total_max);
+    printf("\n");
+
+    // Print percentages
+    //
+    uint32_t n = 0;
+    for (int k=0; k<CTRL_LATENCY_BINS; k++)
+        n += l->hist[k];
+
+    printf("sensor to PWM   <200 <400 <600 <800  <1k  <2k  <5k >=5k us\n");
+    printf("               ");
+    for (int k=0; k<CTRL_LATENCY_BINS; k++)
+        printf(" %4.0f", n ? 100.0 * l->hist[k] / n : 0);
+
+    printf(" %%\n");
+    return;
+
+usage:
+    printf("usage: %s [-h|-r]\n", argv[0]);
+    printf("  -r  reset statistics\n");
+}
+
+
+static void cmd_ctrl_loops(int argc, char *argv[])
+{
+    static const char *names[] = { "outer", "inner" };
+
+    if (argc == 2 && !strcmp(argv[1], "-r")) {
+        loop_stats_reset = 3;
+        return;
+    }
+    else if (argc != 1) {
+        goto usage;
+    }
+
+    printf("inner loop: %s", inner_active ? "on" : "off");
+    if (ctrl_config.rate_hz)
+        printf(", %d Hz", ctrl_config.rate_hz);
+
+    if (ctrl_config.rate_hz && sensor_gyro_stream_rate() <= 0)
+        printf(", needs the gyro FIFO");
+    else if (ctrl_config.rate_hz)
+        printf(", gyro %.0f Hz", sensor_gyro_stream_rate());
+
+    printf("\n\n");
+    printf("loop          rate       runs   cycles avg      max      cpu\n");
+
+    for (int i=0; i<2; i++) {
+        const struct ctrl_loop_stats *s = &ctrl_loop_stats[i];
+
+        // CPU load from the mean cycles per run and the
+        // mean interval between the runs
+        //
+        float rate = s->interval > 0 ? 1e6 / s->interval : 0;
+        float load = s->cycles_avg * rate / configCPU_CLOCK_HZ;
+
+        printf("%-8s %7.1f Hz %10lu %12.0f %8lu %6.1f %%\n",
+            names[i], rate, s->runs, s->cycles_avg, s->cycles_max, load * 100
+        );
+    }
+
+    return;
+
+usage:
+    printf("usage: %s [-h|-r]\n", argv[0]);
+    printf("  -r  reset statistics\n");
+}
+
+
+SHELL_CMD(ctrl_latency, (cmdfunc_t)cmd_ctrl_latency, "Show sensor to motor latency")
+SHELL_CMD(ctrl_loops, (cmdfunc_t)cmd_ctrl_loops, "Show control loop rates and CPU time")
@@ -1,4 +1,110 @@
 #pragma once
 
+#include "filter.h"
+#include <stdint.h>
+
+enum ctrl_mode {
+    CTRL_MODE_RATE,             // sticks command the angular rates
+    CTRL_MODE_ANGLE,            // sticks command roll and pitch angles
+    CTRL_MODE_MAX = CTRL_MODE_ANGLE
+};
+
+enum {
+    CTRL_ROLL,
+    CTRL_PITCH,
+    CTRL_YAW
+};
+
+
+struct ctrl_config {
+    int     mode;               // enum ctrl_mode
+    float   max_rate;           // full stick rate [rad/s]
+    float   max_angle;          // full stick angle [rad]
+    float   d_fc;               // D-term low pass [Hz]
+    float   u_max;              // rate controller output limit [V]
+    int     rate_hz;            // inner rate loop [Hz], 0: with the outer loop
+};
+
+
+/**
+ * Rate controller for one axis, with an angle loop in front
+ * of it for roll and pitch
+ *
+ *   rate_sp = angle_kp * (angle_sp - angle)
+ *   u = kp * e + ki * int(e) - kd * lp(d/dt rate) + kff * rate_sp
+ *
+ * The D-term acts on the measured rate only, so setpoint steps
+ * don't kick the motors. The feed-forward term gives the fast
+ * setpoint response instead.
+ *
+ */
+struct ctrl_axis {
+    // Parameters
+    //
+    float   kp;                 // [V/(rad/s)]
+    float   ki;                 // [V/rad]
+    float   kd;                 // [V/(rad/s^2)]
+    float   kff;                // [V/(rad/s)]
+    float   i_max;              // integrator limit [V]
+    float   angle_kp;           // [1/s]
+
+    // State
+    //
+    float   angle_sp, angle;    // [rad]
+    float   rate_sp, rate;      // [rad/s]
+    float   i, d;
+    float   u;                  // [V]
+
+    struct  lp2_filter  d_filter;
+};
+
+#define CTRL_LATENCY_BINS   8
+
+/**
+ * Latency of the sensor to motor chain
+ *
+ * Each IMU sample wakes up the controller, whose setpoints are
+ * picked up by the next BLDC interrupt. The times are measured
+ * from the IMU sample time:
+ *
+ *   wakeup:  controller woken up
+ *   total:   setpoints first used by the BLDC interrupt
+ *
+ * The histogram counts the total latency, in the bins
+ *
+ *   <200, <400, <600, <800, <1000, <2000, <5000, >=5000 us
+ *
+ */
+struct ctrl_latency {
+    uint32_t    cycles;
+    uint32_t    timeouts;       // no IMU sample in time
+    uint32_t    missed;         // setpoints overwritten before use
+
+    float       wakeup;         // mean [us]
+    uint32_t    wakeup_max;     // [us]
+    float       total;          // mean [us]
+    uint32_t    total_max;      // [us]
+
+    uint32_t    hist[CTRL_LATENCY_BINS];
+};
+
+enum {
+    CTRL_LOOP_OUTER,
+    CTRL_LOOP_INNER
+};
+
+struct ctrl_loop_stats {
+    uint32_t    runs;
+    float       interval;       // mean [us]
+    float       cycles_avg;     // CPU cycles per run
+    uint32_t    cycles_max;
+    uint32_t    t_last;
+};
+
+extern struct ctrl_latency  ctrl_latency;
+extern struct ctrl_loop_stats ctrl_loop_stats[2];
+extern struct ctrl_config   ctrl_config;
+extern struct ctrl_axis     ctrl_axes[3];
 
 void flight_ctrl(void *pvParameters);
+void ctrl_rate_task(void *pvParameters);
@@ -0,0 +1,231 @@
+#include "gyro_tempco.h"
+#include "sensors.h"
+#include "util.h"
+#include <math.h>
+
+/**
+ * Online learning of the gyro bias over temperature
+ *
+ * The sensor data is sub-sampled and collected in windows.
+ * If the variance of the gyro axes and of |acc| are below
+ * the thresholds, and |acc| is close to 1 g, the vehicle is
+ * considered stationary. The window mean of the gyro is then
+ * a measurement of the bias at the window mean temperature.
+ *
+ * Each measurement goes into a weighted running average of
+ * the two neighbouring nodes, with their interpolation
+ * weights. The accumulated node weight is capped, so the
+ * model keeps adapting to aging.
+ *
+ * The learned nodes are parameters, use param_save to keep
+ * them across reboots.
+ *
+ */
+#define DECIM           10      // sub-sampling of the 1 kHz data
+#define WINDOW          200     // samples per window (2 s)
+#define WEIGHT_MAX      50      // windows
+
+struct gyro_tempco gyro_tempco = {
+    .enable       = 1,
+    .learn        = 1,
+    .t_min        = 15,
+    .t_step       = 5,
+    .acc_std_max  = 0.05,
+    .gyro_std_max = 0.005
+};
+
+static struct stats  acc_stats;
+static struct stats  gyro_stats[3];
+static struct stats  temp_stats;
+static int           decim_count;
+
+static uint32_t      windows_total;
+static uint32_t      windows_learned;
+
+
+static float node_pos(float temp)
+{
+    float x = (temp - gyro_tempco.t_min) / gyro_tempco.t_step;
+    return clamp(x, 0, GYRO_TEMPCO_NODES - 1);
+}
+
+
+/**
+ * Evaluate the model at the given temperature.
+ *
+ * Interpolates between the nearest learned nodes, and holds
+ * the value of the outermost learned node beyond them.
+ *
+ */
+vec3f gyro_tempco_bias(float temp)
+{
+    const struct gyro_tempco *m = &gyro_tempco;
+    float x = node_pos(temp);
+
+    int lo = -1, hi = -1;
+
+    for (int i=0; i<GYRO_TEMPCO_NODES; i++) {
+        if (m->weight[i] <= 0)
+            continue;
+
+        if (i <= x)
+            lo = i;
+
+        if (i >= x && hi < 0)
+            hi = i;
+    }
+
+    if (lo < 0 && hi < 0)  return vec3f_zero;
+    if (lo < 0)            return m->bias[hi];
+    if (hi < 0 || hi == lo)  return m->bias[lo];
+
+    float f = (x - lo) / (hi - lo);
+
+    return vec3f_add(
+        vec3f_scale(m->bias[lo], 1 - f),
+        vec3f_scale(m->bias[hi], f)
+    );
+}
+
+
+static void learn(vec3f bias, float temp)
+{
+    struct gyro_tempco *m = &gyro_tempco;
+
+    float x = node_pos(temp);
+    int   i = (int)x;
+    if (i > GYRO_TEMPCO_NODES - 2)
+        i = GYRO_TEMPCO_NODES - 2;
+
+    float f = x - i;
+
+    const int   node[2] = { i, i + 1 };
+    const float w[2]    = { 1 - f, f };
+
+    for (int k=0; k<2; k++) {
+        if (w[k] <= 0)
+            continue;
+
+        int n = node[k];
+
+        m->weight[n] += w[k];
+        if (m->weight[n] > WEIGHT_MAX)
+            m->weight[n] = WEIGHT_MAX;
+
+        vec3f e = vec3f_sub(bias, m->bias[n]);
+        m->bias[n] = vec3f_add(m->bias[n], vec3f_scale(e, w[k] / m->weight[n]));
+    }
+}
+
+
+/**
+ * Feed calibrated (but not yet temperature compensated)
+ * sensor data. Must be called at the sensor rate.
+ *
+ */
+void gyro_tempco_update(vec3f gyro, vec3f acc, float temp)
+{
+    if (!gyro_tempco.learn)
+        return;
+
+    if (++decim_count < DECIM)
+        return;
+
+    decim_count = 0;
+
+    if (temp_stats.n == 0) {
+        stats_reset(&acc_stats);
+        stats_reset(&temp_stats);
+        for (int i=0; i<3; i++)
+            stats_reset(&gyro_stats[i]);
+    }
+
+    stats_update(&acc_stats, vec3f_len(acc));
+    stats_update(&gyro_stats[0], gyro.x);
+    stats_update(&gyro_stats[1], gyro.y);
+    stats_update(&gyro_stats[2], gyro.z);
+    stats_update(&temp_stats, temp);
+
+    if (temp_stats.n < WINDOW)
+        return;
+
+    windows_total++;
+
+    int stationary =
+        acc_stats.std < gyro_tempco.acc_std_max &&
+        fabs(acc_stats.mean - STANDARD_GRAVITY) < 10 * gyro_tempco.acc_std_max &&
+        gyro_stats[0].std < gyro_tempco.gyro_std_max &&
+        gyro_stats[1].std < gyro_tempco.gyro_std_max &&
+        gyro_stats[2].std < gyro_tempco.gyro_std_max;
+
+    if (stationary) {
+        vec3f bias = { gyro_stats[0].mean, gyro_stats[1].mean, gyro_stats[2].mean };
+        learn(bias, temp_stats.mean);
+        windows_learned++;
+    }
+
+    temp_stats.n = 0;
+}
+
+
+/**
+ * Discard the current learning window
+ *
+ */
+void gyro_tempco_restart(void)
+{
+    decim_count = 0;
+    temp_stats.n = 0;
+}
+
+
+void gyro_tempco_reset(void)
+{
+    for (int i=0; i<GYRO_TEMPCO_NODES; i++) {
+        gyro_tempco.bias[i]   = vec3f_zero;
+        gyro_tempco.weight[i] = 0;
+    }
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include <stdio.h>
+#include <string.h>
+
+static void cmd_gyro_tempco(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "-r")) {
+        gyro_tempco_reset();
+        return;
+    }
+
+    if (argc != 1)
+        goto usage;
+
+    const struct gyro_tempco *m = &gyro_tempco;
+
+    printf(" temp     weight    bias x    bias y    bias z [mrad/s]\n");
+
+    for (int i=0; i<GYRO_TEMPCO_NODES; i++) {
+        printf("%5.1f %10.1f %9.3f %9.3f %9.3f\n",
+            m->t_min + i * m->t_step, m->weight[i],
+            m->bias[i].x * 1e3, m->bias[i].y * 1e3, m->bias[i].z * 1e3
+        );
+    }
+
+    printf("\n");
+    printf("windows: %lu, learned: %lu\n", windows_total, windows_learned);
+    printf("last window: |acc| std %.4f, gyro std %.4f %.4f %.4f\n",
+        acc_stats.std, gyro_stats[0].std, gyro_stats[1].std, gyro_stats[2].std
+    );
+
+    return;
+
+usage:
+    printf("usage: %s [-r]\n", argv[0]);
+}
+
+
+SHELL_CMD(gyro_tempco, (cmdfunc_t)cmd_gyro_tempco, "Show/reset gyro temperature model")
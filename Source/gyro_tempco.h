@@ -0,0 +1,32 @@
+#pragma once
+
+#include "matrix3f.h"
+
+#define GYRO_TEMPCO_NODES   8
+
+/**
+ * Piecewise-linear gyro bias vs. temperature model.
+ *
+ * Node i is at t_min + i * t_step. The node weights count
+ * the learned stationary windows, nodes with zero weight
+ * have not been learned yet.
+ *
+ */
+struct gyro_tempco {
+    int     enable;
+    int     learn;
+    float   t_min;              // [C]
+    float   t_step;             // [K]
+    float   acc_std_max;        // [m/s^2]
+    float   gyro_std_max;       // [rad/s]
+
+    vec3f   bias[GYRO_TEMPCO_NODES];     // [rad/s]
+    float   weight[GYRO_TEMPCO_NODES];
+};
+
+extern struct gyro_tempco gyro_tempco;
+
+vec3f gyro_tempco_bias(float temp);
+void  gyro_tempco_update(vec3f gyro, vec3f acc, float temp);
+void  gyro_tempco_reset(void);
+void  gyro_tempco_restart(void);
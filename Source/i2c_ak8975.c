@@ -1,6 +1,7 @@
 #include "i2c_ak8975.h"
 #include "i2c_driver.h"
 #include "sensors.h"
+#include "sensor_capture.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include <stdio.h>
@@ -145,6 +146,78 @@ int ak8975_init(void)
 }
 
 
+// -------------------- Sensor driver --------------------
+//
+static struct ak8975_regs  drv_regs;
+
+
+static int drv_start(void)
+{
+    int res = ak8975_start_single();
+    return (res < 0) ? res : MEAS_TIME;
+}
+
+
+static int drv_read(void)
+{
+    return ak8975_read(&drv_regs);
+}
+
+
+static int drv_convert(struct sensor_sample *s)
+{
+    struct ak8975_data data;
+
+    int res = ak8975_convert(&data, &drv_regs);
+    if (res < 0)
+        return res;
+
+    s->valid     = SENSOR_VALID_MAG;
+    s->clipflags = data.clipflags;
+    s->mag       = data.mag;
+
+    return 1;
+}
+
+
+static float drv_rate(void)
+{
+    return 1000.0 / MEAS_TIME;
+}
+
+
+static int drv_capture(int type, void *buf, int size)
+{
+    switch (type) {
+    case SENSOR_RAW_DATA:   return sensor_capture_copy(buf, size, &drv_regs, sizeof(drv_regs));
+    case SENSOR_RAW_CALIB:  return sensor_capture_copy(buf, size, &calib, sizeof(calib));
+    default:                return 0;
+    }
+}
+
+
+static int drv_restore(int type, const void *buf, int len)
+{
+    switch (type) {
+    case SENSOR_RAW_DATA:   return sensor_restore_copy(&drv_regs, sizeof(drv_regs), buf, len);
+    case SENSOR_RAW_CALIB:  return sensor_restore_copy(&calib, sizeof(calib), buf, len);
+    default:                return 0;
+    }
+}
+
+
+const struct sensor_driver ak8975_driver = {
+    .name    = "ak8975",
+    .init    = ak8975_init,
+    .start   = drv_start,
+    .read    = drv_read,
+    .convert = drv_convert,
+    .rate    = drv_rate,
+    .capture = drv_capture,
+    .restore = drv_restore
+};
+
+
 // -------------------- Shell commands --------------------
 //
 #include "command.h"
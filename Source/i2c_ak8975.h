@@ -1,6 +1,7 @@
 #pragma once
 
 #include "matrix3f.h"
+#include "sensor_driver.h"
 #include <stdint.h>
 
 struct ak8975_regs {
@@ -17,6 +18,8 @@ struct ak8975_data {
     vec3f     mag;
 };
 
+extern const struct sensor_driver ak8975_driver;
+
 int ak8975_start_single(void);
 int ak8975_read(struct ak8975_regs *regs);
 int ak8975_convert(struct ak8975_data *data, const struct ak8975_regs *regs);
@@ -1,6 +1,7 @@
 #include "i2c_bmp180.h"
 #include "i2c_driver.h"
 #include "sensors.h"
+#include "sensor_capture.h"
 #include <errno.h>
 
 #define I2C_ADDR            0xEE
@@ -200,6 +201,136 @@ int bmp180_init(void)
 }
 
 
+// -------------------- Sensor driver --------------------
+//
+static struct bmp180_regs  drv_regs;
+
+
+/**
+ * Alternate between temperature and pressure conversions
+ *
+ */
+static int drv_start(void)
+{
+    static int temp;
+    int res;
+
+    temp = !temp;
+
+    if (temp) {
+        res = bmp180_start_ut();
+        return (res < 0) ? res : GET_UT_TIME;
+    }
+    else {
+        res = bmp180_start_up();
+        return (res < 0) ? res : GET_UP_TIME;
+    }
+}
+
+
+static int drv_read(void)
+{
+    return bmp180_read(&drv_regs);
+}
+
+
+/**
+ * The temperature is new after a UT read. The pressure is
+ * only new after a UP read, and needs a UT read before it.
+ *
+ */
+static int drv_convert(struct sensor_sample *s)
+{
+    struct bmp180_data data;
+
+    const int mode_mask = ~(CTRL_MEAS_OSS_MASK | CTRL_MEAS_SCO);
+    int have_ut = (drv_regs.ut.ctrl_meas & mode_mask) == CTRL_MEAS_TEMP;
+    int have_up = (drv_regs.up.ctrl_meas & mode_mask) == CTRL_MEAS_PRESSURE;
+
+    if (!have_ut)
+        return 1;
+
+    int res = bmp180_convert(&data, &drv_regs);
+    if (res < 0)
+        return res;
+
+    s->valid = SENSOR_VALID_BARO_TEMP;
+    if (have_up && bmp180_state == READ_PRESSURE)
+        s->valid |= SENSOR_VALID_PRESSURE;
+
+    s->clipflags = data.clipflags;
+    s->pressure  = data.pressure;
+    s->baro_temp = data.temp;
+
+    return 1;
+}
+
+
+static float drv_rate(void)
+{
+    return 1000.0 / (GET_UT_TIME + GET_UP_TIME);
+}
+
+
+// Raw data for the sensor capture, with the conversion that
+// was read last. Older captures without it are replayed as
+// pressure reads.
+//
+struct drv_raw {
+    struct bmp180_regs  regs;
+    uint8_t             state;
+};
+
+
+static int drv_capture(int type, void *buf, int size)
+{
+    struct drv_raw raw = { drv_regs, bmp180_state };
+
+    switch (type) {
+    case SENSOR_RAW_DATA:   return sensor_capture_copy(buf, size, &raw, sizeof(raw));
+    case SENSOR_RAW_CALIB:  return sensor_capture_copy(buf, size, &calib, sizeof(calib));
+    default:                return 0;
+    }
+}
+
+
+static int drv_restore(int type, const void *buf, int len)
+{
+    struct drv_raw raw;
+    int res;
+
+    switch (type) {
+    case SENSOR_RAW_DATA:
+        if (len == sizeof(drv_regs)) {
+            bmp180_state = READ_PRESSURE;
+            return sensor_restore_copy(&drv_regs, sizeof(drv_regs), buf, len);
+        }
+
+        res = sensor_restore_copy(&raw, sizeof(raw), buf, len);
+        if (res >= 0) {
+            drv_regs     = raw.regs;
+            bmp180_state = raw.state;
+        }
+        return res;
+
+    case SENSOR_RAW_CALIB:  return sensor_restore_copy(&calib, sizeof(calib), buf, len);
+    default:                return 0;
+    }
+}
+
+
+const struct sensor_driver bmp180_driver = {
+    .name    = "bmp180",
+    .init    = bmp180_init,
+    .start   = drv_start,
+    .read    = drv_read,
+    .convert = drv_convert,
+    .rate    = drv_rate,
+    .capture = drv_capture,
+    .restore = drv_restore
+};
+
+
 // -------------------- Shell commands --------------------
 //
 #include "command.h"
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "sensor_driver.h"
 #include <stdint.h>
 
 struct bmp180_regs {
@@ -18,6 +19,8 @@ struct bmp180_data {
     float pressure;         // [hPa]
 };
 
+extern const struct sensor_driver bmp180_driver;
+
 int bmp180_start_ut(void);
 int bmp180_start_up(void);
 
@@ -1,5 +1,6 @@
 #include "i2c_driver.h"
 #include "util.h"
+#include "ustime.h"
 #include "stm32f4xx.h"
 #include "FreeRTOS.h"
 #include "semphr.h"
@@ -91,6 +92,10 @@ static struct {
     uint32_t    naks;
     uint32_t    timeouts;
     uint32_t    arlo, berr;
+    uint32_t    recoveries;
+    uint32_t    recovery_fails;     // SDA still held low
+    uint32_t    recovery_time;      // last [us]
+    uint32_t    recovery_time_max;  // [us]
 } i2c_stats;
 
 
@@ -235,10 +240,10 @@ static int i2c_transfer(uint8_t addr, void *buf, size_t len)
     if (I2C1->SR1 & I2C_SR1_AF) i2c_stats.naks++;
 
     if (res != pdPASS || sr1 & I2C_SR1_ARLO || sr1 & I2C_SR1_BERR) {
-        // Something went wrong on the bus.. try to reinitialize.
+        // Something went wrong on the bus.. try to recover.
         //
         i2c_stop();
-        i2c_init();
+        i2c_recover();
         errno = EBUSY;
         return -1;
     }
@@ -293,7 +298,61 @@ int i2c_write(uint8_t addr, uint8_t reg, const void *data, size_t size)
 }
 
 
-void i2c_init(void)
+/**
+ * Release a slave which holds SDA low.
+ *
+ * A slave that was interrupted in the middle of a read
+ * transfer keeps driving its data bits. Clocking SCL until
+ * SDA goes high (at most 8 data bits + NAK) and sending a
+ * STOP condition puts it back to idle.
+ *
+ * \returns 0 on success, -1 if SDA is still low
+ *
+ */
+static int i2c_clear_bus(void)
+{
+    // PB6  I2C1_SCL
+    // PB7  I2C1_SDA
+    //
+    GPIO_SetBits(GPIOB, GPIO_Pin_6 | GPIO_Pin_7);
+
+    GPIO_Init(GPIOB, &(GPIO_InitTypeDef) {
+        .GPIO_Pin   = GPIO_Pin_6 | GPIO_Pin_7,
+        .GPIO_Mode  = GPIO_Mode_OUT,
+        .GPIO_Speed = GPIO_Low_Speed,
+        .GPIO_OType = GPIO_OType_OD,
+        .GPIO_PuPd  = GPIO_PuPd_UP
+    });
+
+    delay_us(2);
+
+    for (int i=0; i<9 && !GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_7); i++) {
+        GPIO_ResetBits(GPIOB, GPIO_Pin_6);
+        delay_us(2);
+        GPIO_SetBits(GPIOB, GPIO_Pin_6);
+        delay_us(2);
+    }
+
+    // Send STOP condition
+    //
+    GPIO_ResetBits(GPIOB, GPIO_Pin_6);
+    delay_us(2);
+    GPIO_ResetBits(GPIOB, GPIO_Pin_7);
+    delay_us(2);
+    GPIO_SetBits(GPIOB, GPIO_Pin_6);
+    delay_us(2);
+    GPIO_SetBits(GPIOB, GPIO_Pin_7);
+    delay_us(2);
+
+    return GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_7) ? 0 : -1;
+}
+
+
+/**
+ * (Re-)initialize the I2C peripheral, DMA and GPIOs.
+ *
+ */
+static void i2c_hw_init(void)
 {
     // Enable peripheral clocks
     //
@@ -301,6 +360,12 @@ void i2c_init(void)
     RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
     RCC->APB1ENR |= RCC_APB1ENR_I2C1EN;
 
+    // Clear the bus while the pins are disconnected from the
+    // peripheral. The reset below also clears a stuck BUSY flag.
+    //
+    if (i2c_clear_bus() < 0)
+        i2c_stats.recovery_fails++;
+
     I2C_DeInit(I2C1);
     DMA_DeInit(DMA1_Stream0);   // RX_DMA
     DMA_DeInit(DMA1_Stream7);   // TX_DMA
@@ -316,46 +381,64 @@ void i2c_init(void)
         .I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit
     });
 
-    // PB6  I2C1_SCL
-    // PB7  I2C1_SDA
+    // Configure GPIOs for alternate function
     //
-    GPIO_SetBits(GPIOB, GPIO_Pin_6 | GPIO_Pin_7);
+    GPIO_PinAFConfig(GPIOB, GPIO_PinSource6, GPIO_AF_I2C1);
+    GPIO_PinAFConfig(GPIOB, GPIO_PinSource7, GPIO_AF_I2C1);
 
-    GPIO_InitTypeDef gpio = {
+    GPIO_Init(GPIOB, &(GPIO_InitTypeDef) {
         .GPIO_Pin   = GPIO_Pin_6 | GPIO_Pin_7,
-        .GPIO_Mode  = GPIO_Mode_OUT,
+        .GPIO_Mode  = GPIO_Mode_AF,
         .GPIO_Speed = GPIO_Low_Speed,
         .GPIO_OType = GPIO_OType_OD,
         .GPIO_PuPd  = GPIO_PuPd_UP
-    };
+    });
 
-    GPIO_Init(GPIOB, &gpio);
+    I2C_Cmd(I2C1, ENABLE);
+}
 
-    // Clear the bus by reading 8 data bits + NAK
-    //
-    for (int i=0; i<9; i++) {
-        GPIO_SetBits(GPIOB, GPIO_Pin_6);
-        delay_us(2);
-        GPIO_ResetBits(GPIOB, GPIO_Pin_6);
-        delay_us(2);
-    }
 
-    // Send STOP condition
-    //
-    GPIO_ResetBits(GPIOB, GPIO_Pin_7);
-    delay_us(2);
-    GPIO_SetBits(GPIOB, GPIO_Pin_6);
-    delay_us(2);
-    GPIO_SetBits(GPIOB, GPIO_Pin_7);
-    delay_us(2);
+/**
+ * Bus hang recovery. Must be called with the mutex held.
+ *
+ * This takes about 50 us, so the sensor data is only lost
+ * for the failed transfer. The devices may have lost their
+ * configuration, see i2c_recovery_count().
+ *
+ */
+void i2c_recover(void)
+{
+    uint32_t t0 = get_us_time32();
 
-    // Configure GPIOs for alternate function
+    i2c_hw_init();
+    xSemaphoreTake(i2c_irq_sem, 0);
+
+    uint32_t dt = get_us_time32() - t0;
+
+    i2c_stats.recoveries++;
+    i2c_stats.recovery_time = dt;
+    if (dt > i2c_stats.recovery_time_max)
+        i2c_stats.recovery_time_max = dt;
+}
+
+
+uint32_t i2c_recovery_count(void)
+{
+    return i2c_stats.recoveries;
+}
+
+
+void i2c_init(void)
+{
+    // Create a mutex for the read/write API and a normal semaphore for IRQs
+    // (xSemaphoreGiveFromISR doesn't work with mutexes)
     //
-    GPIO_PinAFConfig(GPIOB, GPIO_PinSource6, GPIO_AF_I2C1);
-    GPIO_PinAFConfig(GPIOB, GPIO_PinSource7, GPIO_AF_I2C1);
+    if (!i2c_mutex)   i2c_mutex   = xSemaphoreCreateMutex();
+    if (!i2c_irq_sem) i2c_irq_sem = xSemaphoreCreateBinary();
+
+    xSemaphoreTake(i2c_irq_sem, 0);
 
-    gpio.GPIO_Mode = GPIO_Mode_AF;
-    GPIO_Init(GPIOB, &gpio);
+    i2c_hw_init();
 
     // Set up event and error interrupts
     //
@@ -373,17 +456,6 @@ void i2c_init(void)
 
     nvic.NVIC_IRQChannel = DMA1_Stream0_IRQn;
     NVIC_Init(&nvic);
-
-    // Create a mutex for the read/write API and a normal semaphore for IRQs
-    // (xSemaphoreGiveFromISR doesn't work with mutexes)
-    //
-    if (!i2c_mutex)   i2c_mutex   = xSemaphoreCreateMutex();
-    if (!i2c_irq_sem) i2c_irq_sem = xSemaphoreCreateBinary();
-
-    xSemaphoreTake(i2c_irq_sem, 0);
-    xSemaphoreGive(i2c_mutex);
-
-    I2C_Cmd(I2C1, ENABLE);
 }
 
 
@@ -424,7 +496,22 @@ static void cmd_i2c_stats(void)
     printf("timeouts:   %10lu\n", i2c_stats.timeouts  );
     printf("arlo:       %10lu\n", i2c_stats.arlo      );
     printf("berr:       %10lu\n", i2c_stats.berr      );
+    printf("recoveries: %10lu\n", i2c_stats.recoveries);
+    printf("rec. fails: %10lu\n", i2c_stats.recovery_fails);
+    printf("rec. time:  %10lu us (max %lu us)\n",
+        i2c_stats.recovery_time, i2c_stats.recovery_time_max);
+}
+
+
+static void cmd_i2c_recover(void)
+{
+    xSemaphoreTake(i2c_mutex, portMAX_DELAY);
+    i2c_recover();
+    xSemaphoreGive(i2c_mutex);
+
+    printf("recovered in %lu us\n", i2c_stats.recovery_time);
 }
 
 SHELL_CMD(i2c_scan, (cmdfunc_t)cmd_i2c_scan, "Scan the I2C bus")
 SHELL_CMD(i2c_stats, (cmdfunc_t)cmd_i2c_stats, "Show I2C statistics")
+SHELL_CMD(i2c_recover, (cmdfunc_t)cmd_i2c_recover, "Reset the I2C bus")
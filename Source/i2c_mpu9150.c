@@ -1,90 +1,19 @@
 #include "i2c_mpu9150.h"
 #include "i2c_driver.h"
+#include "mpu_regs.h"
 #include "sensors.h"
+#include "ustime.h"
+#include "util.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include <stdio.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #define I2C_ADDR            0xD0
 
-// Registers taken from RM-MPU-9150A-00.pdf, v4.2
-//
-#define SELF_TEST_X         0x0D
-#define SELF_TEST_Y         0x0E
-#define SELF_TEST_Z         0x0F
-#define SELF_TEST_A         0x10
-
-#define SMPLRT_DIV          0x19
-#define CONFIG              0x1A
-#define GYRO_CONFIG         0x1B
-#define ACCEL_CONFIG        0x1C
-#define FIFO_EN             0x23
-#define INT_PIN_CFG         0x37
-
-#define ACCEL_XOUT_H        0x3B
-#define ACCEL_XOUT_L        0x3C
-#define ACCEL_YOUT_H        0x3D
-#define ACCEL_YOUT_L        0x3E
-#define ACCEL_ZOUT_H        0x3F
-#define ACCEL_ZOUT_L        0x40
-#define TEMP_OUT_H          0x41
-#define TEMP_OUT_L          0x42
-#define GYRO_XOUT_H         0x43
-#define GYRO_XOUT_L         0x44
-#define GYRO_YOUT_H         0x45
-#define GYRO_ZOUT_H         0x47
-#define GYRO_ZOUT_L         0x48
-
-#define PWR_MGMT_1          0x6B
-#define WHO_AM_I            0x75
-
-// MPU9150 register bits
-//
-#define PWR_MGMT_1_DEVICE_RESET     0x80
-#define PWR_MGMT_1_SLEEP            0x40
-#define PWR_MGMT_1_CYCLE            0x20
-#define PWR_MGMT_1_TEMP_DIS         0x08
-#define PWR_MGMT_1_CLKSEL_INTERNAL  0x00
-#define PWR_MGMT_1_CLKSEL_PLL_X     0x01
-#define PWR_MGMT_1_CLKSEL_PLL_Y     0x02
-#define PWR_MGMT_1_CLKSEL_PLL_Z     0x03
-#define PWR_MGMT_1_CLKSEL_PLL_32    0x04
-#define PWR_MGMT_1_CLKSEL_PLL_19M2  0x05
-#define PWR_MGMT_1_CLKSEL_STOP      0x07
-
-#define GYRO_CONFIG_XG_ST           0x80
-#define GYRO_CONFIG_YG_ST           0x40
-#define GYRO_CONFIG_ZG_ST           0x20
-#define GYRO_CONFIG_FS_SEL_250      0x00
-#define GYRO_CONFIG_FS_SEL_500      0x08
-#define GYRO_CONFIG_FS_SEL_1000     0x10
-#define GYRO_CONFIG_FS_SEL_2000     0x18
-
-#define ACCEL_CONFIG_XA_ST          0x80
-#define ACCEL_CONFIG_YA_ST          0x40
-#define ACCEL_CONFIG_ZA_ST          0x20
-#define ACCEL_CONFIG_AFS_SEL_2G     0x00
-#define ACCEL_CONFIG_AFS_SEL_4G     0x08
-#define ACCEL_CONFIG_AFS_SEL_8G     0x10
-#define ACCEL_CONFIG_AFS_SEL_16G    0x18
-
-#define CONFIG_DLPF_CFG_256         0x00
-#define CONFIG_DLPF_CFG_188         0x01
-#define CONFIG_DLPF_CFG_98          0x02
-#define CONFIG_DLPF_CFG_42          0x03
-#define CONFIG_DLPF_CFG_20          0x04
-#define CONFIG_DLPF_CFG_10          0x05
-#define CONFIG_DLPF_CFG_5           0x06
-
-#define INT_PIN_CFG_INT_LEVEL       0x80
-#define INT_PIN_CFG_INT_OPEN        0x40
-#define INT_PIN_CFG_LATCH_INT_EN    0x20
-#define INT_PIN_CFG_INT_RD_CLEAR    0x10
-#define INT_PIN_CFG_FSYNC_INT_LEVEL 0x08
-#define INT_PIN_CFG_FSYNC_INT_EN    0x04
-#define INT_PIN_CFG_I2C_BYPASS_EN   0x02
-
 // Default values from the data sheet
 //
 #define ACC_GAIN_2      (STANDARD_GRAVITY / 16384)
@@ -100,13 +29,52 @@
 #define GYRO_GAIN_1000  (M_TWOPI / (360 *  32.8))
 #define GYRO_GAIN_2000  (M_TWOPI / (360 *  16.4))
 
-// Full scale configuration
+static const float acc_gain[4] = {
+    ACC_GAIN_2, ACC_GAIN_4, ACC_GAIN_8, ACC_GAIN_16
+};
+
+static const float gyro_gain[4] = {
+    GYRO_GAIN_250, GYRO_GAIN_500, GYRO_GAIN_1000, GYRO_GAIN_2000
+};
+
+// Full scale values of the finest ranges
 //
-#define GYRO_CONFIG_FS_SEL      GYRO_CONFIG_FS_SEL_2000
-#define ACCEL_CONFIG_AFS_SEL    ACCEL_CONFIG_AFS_SEL_8G
+#define ACC_FULL_SCALE_2    (2 * STANDARD_GRAVITY)      // [m/s^2]
+#define GYRO_FULL_SCALE_250 (250 * M_TWOPI / 360)       // [rad/s]
 
-#define ACC_GAIN                ACC_GAIN_8
-#define GYRO_GAIN               GYRO_GAIN_2000
+// Fixed range from mpu_regs.h, used without auto_range
+//
+#define GYRO_FS_DEFAULT     (GYRO_CONFIG_FS_SEL >> 3)
+#define ACC_FS_DEFAULT      (ACCEL_CONFIG_AFS_SEL >> 3)
+
+// Range switching thresholds, relative to full scale.
+// Switch up before clipping. Switch down when the signal
+// has fit into the finer range for range_hold ms.
+//
+#define RANGE_UP            0.9
+#define RANGE_DOWN          0.6
+
+// Accelerometer output rate [Hz]
+//
+#define ACC_RATE            1000
+
+// Highest FIFO sample rate the I2C bus can keep up with,
+// see the gyro oversampling notes in sensors.c
+//
+#define FIFO_MAX_RATE       4000
+
+
+struct mpu9150_config mpu9150_config = {
+    .dlpf_cfg    = CONFIG_DLPF_CFG_256,
+    .smplrt_div  = 0,
+    .fifo_enable = 0,
+    .auto_range  = 1,
+    .range_hold  = 1000
+};
+
+struct mpu9150_range mpu9150_range;
+
+static uint32_t fifo_overflows;
 
 
 int mpu9150_read(struct mpu9150_regs *regs)
@@ -115,7 +83,9 @@ int mpu9150_read(struct mpu9150_regs *regs)
 }
 
 
-int mpu9150_convert(struct mpu9150_data *data, const struct mpu9150_regs *regs)
+int mpu9150_convert(
+    struct mpu9150_data *data, const struct mpu9150_regs *regs,
+    const struct mpu9150_range_tag *tag)
 {
     int16_t ax = (regs->acc_xout_h  << 8) | regs->acc_xout_l;
     int16_t ay = (regs->acc_yout_h  << 8) | regs->acc_yout_l;
@@ -138,18 +108,374 @@ int mpu9150_convert(struct mpu9150_data *data, const struct mpu9150_regs *regs)
 
     // Convert raw values to SI units
     //
-    data->acc.x  = ax * ACC_GAIN;
-    data->acc.y  = ay * ACC_GAIN;
-    data->acc.z  = az * ACC_GAIN;
+    float ag = acc_gain[tag->acc_fs & 3];
+    float gg = gyro_gain[tag->gyro_fs & 3];
+
+    data->acc.x  = ax * ag;
+    data->acc.y  = ay * ag;
+    data->acc.z  = az * ag;
     data->temp   = t  * TEMP_GAIN + TEMP_OFFSET;
-    data->gyro.x = gx * GYRO_GAIN;
-    data->gyro.y = gy * GYRO_GAIN;
-    data->gyro.z = gz * GYRO_GAIN;
+    data->gyro.x = gx * gg;
+    data->gyro.y = gy * gg;
+    data->gyro.z = gz * gg;
+
+    return 1;
+}
+
+
+/**
+ * Read all complete gyro samples from the FIFO.
+ *
+ * The FIFO size is not a multiple of the sample size, so
+ * the alignment is lost on overflow. The FIFO is reset in
+ * that case, and no samples are returned.
+ *
+ */
+int mpu9150_read_fifo(struct mpu9150_fifo *fifo)
+{
+    fifo->count = 0;
+
+    uint8_t buf[2];
+    int res = i2c_read(I2C_ADDR, FIFO_COUNTH, buf, sizeof(buf));
+    if (res < 0)
+        return res;
+
+    int bytes = (buf[0] << 8) | buf[1];
+
+    if (bytes > FIFO_SIZE - 6) {
+        fifo_overflows++;
+        i2c_write(I2C_ADDR, USER_CTRL, (char[]){ USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET }, 1);
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    int count = bytes / 6;
+    if (count > MPU9150_FIFO_SAMPLES)
+        count = MPU9150_FIFO_SAMPLES;
+
+    if (count == 0)
+        return 0;
+
+    res = i2c_read(I2C_ADDR, FIFO_R_W, fifo->data, count * 6);
+    if (res < 0)
+        return res;
+
+    fifo->count = count;
+    return count;
+}
+
+
+/**
+ * Convert the FIFO contents to MPU9150_FIFO_GAIN units.
+ * The samples are shifted up to the 250 dps LSB.
+ *
+ * \returns number of samples
+ *
+ */
+int mpu9150_convert_fifo(
+    int32_t gyro[][3], uint32_t *clipflags, const struct mpu9150_fifo *fifo,
+    const struct mpu9150_range_tag *tag)
+{
+    *clipflags = 0;
+
+    for (int i=0; i<fifo->count; i++) {
+        const uint8_t *p = &fifo->data[i * 6];
+        int shift = (i < tag->fifo_old) ? tag->fifo_old_fs : tag->gyro_fs;
+
+        for (int j=0; j<3; j++) {
+            int16_t g = (p[j*2] << 8) | p[j*2 + 1];
+
+            if (g == -32768 || g == 32767)
+                *clipflags |= CLIP_GYRO_X << j;
+
+            gyro[i][j] = g * (1 << shift);
+        }
+    }
+
+    return fifo->count;
+}
+
+
+/**
+ * Convert registers and FIFO contents to a generic sensor sample.
+ * Also used by the MPU6000 driver, which has the same register map.
+ *
+ */
+int mpu9150_convert_sample(
+    struct sensor_sample *s, int32_t fifo_buf[][3],
+    const struct mpu9150_regs *regs, const struct mpu9150_fifo *fifo,
+    const struct mpu9150_range_tag *tag)
+{
+    struct mpu9150_data data;
+    mpu9150_convert(&data, regs, tag);
+
+    // The sensor task keeps the last acc and gyro values
+    // while the output registers are settling
+    //
+    s->valid     = SENSOR_VALID_GYRO_TEMP;
+    s->clipflags = data.clipflags & CLIP_GYRO_TEMP;
+
+    if (!tag->acc_settling) {
+        s->valid     |= SENSOR_VALID_ACC;
+        s->clipflags |= data.clipflags & (CLIP_ACC_X | CLIP_ACC_Y | CLIP_ACC_Z);
+    }
+
+    if (!tag->gyro_settling) {
+        s->valid     |= SENSOR_VALID_GYRO;
+        s->clipflags |= data.clipflags & (CLIP_GYRO_X | CLIP_GYRO_Y | CLIP_GYRO_Z);
+    }
+
+    s->acc       = data.acc;
+    s->gyro      = data.gyro;
+    s->gyro_temp = data.temp;
+
+    if (mpu9150_config.fifo_enable) {
+        uint32_t clipflags;
+
+        s->gyro_fifo_count = mpu9150_convert_fifo(fifo_buf, &clipflags, fifo, tag);
+        s->gyro_fifo       = (const int32_t (*)[3])fifo_buf;
+        s->gyro_fifo_gain  = MPU9150_FIFO_GAIN;
+        s->clipflags      |= clipflags;
+        s->valid          |= SENSOR_VALID_GYRO_FIFO;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Output data rate of the sensor registers and the FIFO
+ *
+ */
+float mpu9150_sample_rate(void)
+{
+    int dlpf = mpu9150_config.dlpf_cfg;
+    float gyro_rate = (dlpf == 0 || dlpf == 7) ? 8000 : 1000;
+
+    return gyro_rate / (1 + mpu9150_config.smplrt_div);
+}
+
+
+/**
+ * Gyro delay of the on-chip low pass filter, from the data sheet
+ *
+ */
+float mpu9150_dlpf_delay(void)
+{
+    static const float delay[] = {
+        0.98e-3, 1.9e-3, 2.8e-3, 4.8e-3, 8.3e-3, 13.4e-3, 18.6e-3, 0.98e-3
+    };
+
+    return delay[mpu9150_config.dlpf_cfg & 7];
+}
+
+
+// -------------------- Range selection --------------------
+//
+void mpu9150_range_init(void)
+{
+    struct mpu9150_range *r = &mpu9150_range;
+
+    // Always start with the default range. The auto ranging
+    // will switch to a finer one after range_hold.
+    //
+    *r = (struct mpu9150_range) {
+        .gyro_fs      = GYRO_FS_DEFAULT,
+        .acc_fs       = ACC_FS_DEFAULT,
+        .prev_gyro_fs = GYRO_FS_DEFAULT,
+        .req_gyro_fs  = GYRO_FS_DEFAULT,
+        .req_acc_fs   = ACC_FS_DEFAULT,
+        .t_switch     = get_us_time32(),
+        .t_gyro_peak  = get_us_time32(),
+        .t_acc_peak   = get_us_time32()
+    };
+}
+
+
+/**
+ * Tag the freshly read buffers with their range.
+ * Must be called by the driver right after reading the
+ * output registers and fifo_count FIFO samples.
+ *
+ * The output registers switch to the new range with the
+ * first sample after the configuration write. The sample
+ * clock is not synchronized to the bus access, so a read
+ * up to one period later may still see either range. The
+ * registers are discarded until two periods have passed.
+ *
+ * The accelerometer is sampled at 1 kHz, independent of the
+ * gyro rate. Its registers need two accelerometer periods.
+ *
+ */
+void mpu9150_range_latch(struct mpu9150_range_tag *tag, int fifo_count)
+{
+    struct mpu9150_range *r = &mpu9150_range;
+
+    float    rate   = mpu9150_sample_rate();
+    uint32_t period = 1e6 / rate;
+    uint32_t acc_period = 1e6 / fminf(rate, ACC_RATE);
+    uint32_t t = get_us_time32() - r->t_switch;
+
+    tag->gyro_fs       = r->gyro_fs;
+    tag->acc_fs        = r->acc_fs;
+    tag->gyro_settling = t <= 2 * period;
+    tag->acc_settling  = t <= 2 * acc_period;
+
+    tag->fifo_old    = (r->fifo_old < fifo_count) ? r->fifo_old : fifo_count;
+    tag->fifo_old_fs = r->prev_gyro_fs;
+
+    r->fifo_old -= tag->fifo_old;
+}
+
+
+int mpu9150_range_pending(void)
+{
+    struct mpu9150_range *r = &mpu9150_range;
+
+    return r->req_gyro_fs != r->gyro_fs || r->req_acc_fs != r->acc_fs;
+}
+
+
+/**
+ * Called by the driver after writing GYRO_CONFIG and ACCEL_CONFIG
+ * with the requested range.
+ *
+ * \param fifo_count    number of (old range) samples in
+ *                      the FIFO after the write
+ *
+ */
+void mpu9150_range_switched(int fifo_count)
+{
+    struct mpu9150_range *r = &mpu9150_range;
+
+    r->prev_gyro_fs = r->gyro_fs;
+    r->gyro_fs      = r->req_gyro_fs;
+    r->acc_fs       = r->req_acc_fs;
+    r->fifo_old     = fifo_count;
+    r->t_switch     = get_us_time32();
+    r->switches++;
+}
+
+
+static int select_fs(int fs, float peak, int clipped, float full_scale_0, uint32_t *t_peak)
+{
+    uint32_t now = get_us_time32();
+
+    if (clipped || peak > RANGE_UP * full_scale_0 * (1 << fs)) {
+        *t_peak = now;
+        return (fs < 3) ? fs + 1 : fs;
+    }
+
+    if (fs == 0 || peak > RANGE_DOWN * full_scale_0 * (1 << (fs - 1))) {
+        *t_peak = now;
+        return fs;
+    }
+
+    if (now - *t_peak > mpu9150_config.range_hold * 1000u) {
+        *t_peak = now;
+        return fs - 1;
+    }
+
+    return fs;
+}
+
+
+/**
+ * Select the finest range that has not clipped within the
+ * last range_hold ms. Only data in the current device range
+ * is evaluated, so a pending switch is never re-triggered.
+ *
+ */
+void mpu9150_range_select(const struct mpu9150_range_tag *tag, const struct sensor_sample *s)
+{
+    struct mpu9150_range *r = &mpu9150_range;
+
+    if (!mpu9150_config.auto_range) {
+        r->req_gyro_fs = GYRO_FS_DEFAULT;
+        r->req_acc_fs  = ACC_FS_DEFAULT;
+        return;
+    }
+
+    if (mpu9150_range_pending() || r->fifo_old || tag->gyro_settling || tag->acc_settling)
+        return;
+
+    float gyro_peak = fmaxf(fmaxf(fabsf(s->gyro.x), fabsf(s->gyro.y)), fabsf(s->gyro.z));
+    float acc_peak  = fmaxf(fmaxf(fabsf(s->acc.x),  fabsf(s->acc.y)),  fabsf(s->acc.z));
+
+    if (s->valid & SENSOR_VALID_GYRO_FIFO) {
+        for (int i=0; i<s->gyro_fifo_count; i++) {
+            for (int j=0; j<3; j++)
+                gyro_peak = fmaxf(gyro_peak, abs(s->gyro_fifo[i][j]) * s->gyro_fifo_gain);
+        }
+    }
+
+    r->req_gyro_fs = select_fs(
+        r->gyro_fs, gyro_peak, s->clipflags & (CLIP_GYRO_X | CLIP_GYRO_Y | CLIP_GYRO_Z),
+        GYRO_FULL_SCALE_250, &r->t_gyro_peak
+    );
+
+    r->req_acc_fs = select_fs(
+        r->acc_fs, acc_peak, s->clipflags & (CLIP_ACC_X | CLIP_ACC_Y | CLIP_ACC_Z),
+        ACC_FULL_SCALE_2, &r->t_acc_peak
+    );
+}
+
+
+/**
+ * Write the configuration registers
+ *
+ */
+static int mpu9150_configure(void)
+{
+    const struct mpu9150_range *r = &mpu9150_range;
+
+    uint8_t fifo_en   = 0;
+    uint8_t user_ctrl = 0;
+
+    // Gyro oversampling through the FIFO
+    //
+    if (mpu9150_config.fifo_enable) {
+        fifo_en   = FIFO_EN_XG | FIFO_EN_YG | FIFO_EN_ZG;
+        user_ctrl = USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET;
+    }
+
+    const uint8_t regs[][2] = {
+        { PWR_MGMT_1,   PWR_MGMT_1_CLKSEL_PLL_X         },
+        { GYRO_CONFIG,  r->gyro_fs << 3                 },
+        { ACCEL_CONFIG, r->acc_fs  << 3                 },
+        { CONFIG,       mpu9150_config.dlpf_cfg         },
+        { SMPLRT_DIV,   mpu9150_config.smplrt_div       },
+        { FIFO_EN,      fifo_en                         },
+        { USER_CTRL,    user_ctrl                       },
+        { INT_PIN_CFG,  INT_PIN_CFG_I2C_BYPASS_EN       }   // for the magnetometer
+    };
+
+    for (int i=0; i<ARRAY_SIZE(regs); i++) {
+        int res = i2c_write(I2C_ADDR, regs[i][0], &regs[i][1], 1);
+        if (res < 0)
+            return res;
+    }
 
     return 1;
 }
 
 
+/**
+ * Restore the configuration after an I2C bus recovery.
+ * A pending range switch is dropped, and the FIFO is reset
+ * since its alignment may be lost.
+ *
+ */
+static int mpu9150_recover(void)
+{
+    mpu9150_range.req_gyro_fs = mpu9150_range.gyro_fs;
+    mpu9150_range.req_acc_fs  = mpu9150_range.acc_fs;
+    mpu9150_range.fifo_old    = 0;
+
+    return mpu9150_configure();
+}
+
+
 int mpu9150_init(void)
 {
     // TODO: Error handling
@@ -167,24 +493,210 @@ int mpu9150_init(void)
     i2c_write(I2C_ADDR, PWR_MGMT_1,   (char[]){ PWR_MGMT_1_CLKSEL_PLL_X }, 1);
     vTaskDelay(20);
 
-    // Configure gyro and accelerometer
+    // 8 kHz through the FIFO would overflow it
     //
-    i2c_write(I2C_ADDR, GYRO_CONFIG,  (char[]){ GYRO_CONFIG_FS_SEL }, 1);
-    i2c_write(I2C_ADDR, ACCEL_CONFIG, (char[]){ ACCEL_CONFIG_AFS_SEL }, 1);
+    if (mpu9150_config.fifo_enable && mpu9150_sample_rate() > FIFO_MAX_RATE) {
+        while (mpu9150_sample_rate() > FIFO_MAX_RATE)
+            mpu9150_config.smplrt_div++;
 
-    i2c_write(I2C_ADDR, CONFIG,       (char[]){ CONFIG_DLPF_CFG_256 }, 1);
-    i2c_write(I2C_ADDR, SMPLRT_DIV,   (char[]){ 0 }, 1);
+        printf("  FIFO: smplrt_div raised to %d\n", mpu9150_config.smplrt_div);
+    }
 
-    // Enable I2C bypass for the magnetometer
+    // Configure gyro, accelerometer, FIFO and I2C bypass
     //
-    i2c_write(I2C_ADDR, INT_PIN_CFG,  (char[]){ INT_PIN_CFG_I2C_BYPASS_EN }, 1);
+    mpu9150_range_init();
+    mpu9150_configure();
 
     return 1;
 }
 
 
+/**
+ * Raw data of a driver buffer for the sensor capture.
+ * Also used by the MPU6000 driver. The format is
+ *
+ *   mpu9150_regs, gyro_fs, acc_fs, fifo_old, fifo_old_fs,
+ *   FIFO sample count, FIFO data
+ *
+ * The range tag fields are one byte each, the settling
+ * flags are bit 7 of gyro_fs and acc_fs.
+ *
+ */
+int mpu9150_capture(
+    void *buf, int size, const struct mpu9150_regs *regs,
+    const struct mpu9150_fifo *fifo, const struct mpu9150_range_tag *tag)
+{
+    int n = fifo->count * 6;
+    int len = sizeof(*regs) + 5 + n;
+
+    if (len > size) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    uint8_t *p = buf;
+    memcpy(p, regs, sizeof(*regs));
+    p += sizeof(*regs);
+
+    *p++ = tag->gyro_fs | (tag->gyro_settling ? 0x80 : 0);
+    *p++ = tag->acc_fs  | (tag->acc_settling  ? 0x80 : 0);
+    *p++ = tag->fifo_old;
+    *p++ = tag->fifo_old_fs;
+    *p++ = fifo->count;
+
+    memcpy(p, fifo->data, n);
+    return len;
+}
+
+
+int mpu9150_restore(
+    const void *buf, int len, struct mpu9150_regs *regs,
+    struct mpu9150_fifo *fifo, struct mpu9150_range_tag *tag)
+{
+    const uint8_t *p = buf;
+
+    if (len < sizeof(*regs) + 5 ||
+        p[sizeof(*regs) + 4] > MPU9150_FIFO_SAMPLES ||
+        len != sizeof(*regs) + 5 + p[sizeof(*regs) + 4] * 6)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(regs, p, sizeof(*regs));
+    p += sizeof(*regs);
+
+    tag->gyro_settling = !!(*p & 0x80);
+    tag->gyro_fs       = *p++ & 0x7F;
+    tag->acc_settling  = !!(*p & 0x80);
+    tag->acc_fs        = *p++ & 0x7F;
+    tag->fifo_old    = *p++;
+    tag->fifo_old_fs = *p++;
+    fifo->count      = *p++;
+
+    memcpy(fifo->data, p, fifo->count * 6);
+    return len;
+}
+
+
+// -------------------- Sensor driver --------------------
+//
+static struct mpu9150_regs  drv_regs;
+static struct mpu9150_fifo  drv_fifo;
+static int32_t              drv_fifo_buf[MPU9150_FIFO_SAMPLES][3];
+static struct mpu9150_range_tag drv_tag;
+
+
+/**
+ * Write a pending range switch and count the FIFO
+ * samples which are still in the old range.
+ *
+ */
+static int drv_set_range(void)
+{
+    const struct mpu9150_range *r = &mpu9150_range;
+
+    int res = i2c_write(I2C_ADDR, GYRO_CONFIG, (char[]){ r->req_gyro_fs << 3 }, 1);
+    if (res >= 0)
+        res = i2c_write(I2C_ADDR, ACCEL_CONFIG, (char[]){ r->req_acc_fs << 3 }, 1);
+
+    int count = 0;
+    if (res >= 0 && mpu9150_config.fifo_enable) {
+        uint8_t buf[2];
+        res = i2c_read(I2C_ADDR, FIFO_COUNTH, buf, sizeof(buf));
+        count = ((buf[0] << 8) | buf[1]) / 6;
+    }
+
+    if (res < 0)
+        return res;
+
+    mpu9150_range_switched(count);
+    return 1;
+}
+
+
+static int drv_read(void)
+{
+    int res = mpu9150_read(&drv_regs);
+
+    if (res >= 0 && mpu9150_config.fifo_enable)
+        res = mpu9150_read_fifo(&drv_fifo);
+
+    mpu9150_range_latch(&drv_tag, drv_fifo.count);
+
+    if (res >= 0 && mpu9150_range_pending())
+        res = drv_set_range();
+
+    return res;
+}
+
+
+static int drv_convert(struct sensor_sample *s)
+{
+    int res = mpu9150_convert_sample(s, drv_fifo_buf, &drv_regs, &drv_fifo, &drv_tag);
+    mpu9150_range_select(&drv_tag, s);
+    return res;
+}
+
+
+static int drv_capture(int type, void *buf, int size)
+{
+    if (type != SENSOR_RAW_DATA)
+        return 0;
+
+    return mpu9150_capture(buf, size, &drv_regs, &drv_fifo, &drv_tag);
+}
+
+
+static int drv_restore(int type, const void *buf, int len)
+{
+    if (type != SENSOR_RAW_DATA)
+        return 0;
+
+    return mpu9150_restore(buf, len, &drv_regs, &drv_fifo, &drv_tag);
+}
+
+
+const struct sensor_driver mpu9150_driver = {
+    .name    = "mpu9150",
+    .init    = mpu9150_init,
+    .read    = drv_read,
+    .convert = drv_convert,
+    .rate    = mpu9150_sample_rate,
+    .delay   = mpu9150_dlpf_delay,
+    .recover = mpu9150_recover,
+    .capture = drv_capture,
+    .restore = drv_restore
+};
+
+
 // -------------------- Shell commands --------------------
 //
 #include "command.h"
 
+static void cmd_mpu9150_fifo(void)
+{
+    printf("sample rate    %8.1f Hz\n", mpu9150_sample_rate());
+    printf("dlpf delay     %8.2f ms\n", mpu9150_dlpf_delay() * 1e3);
+    printf("fifo enabled   %8d\n", mpu9150_config.fifo_enable);
+    printf("fifo overflows %8lu\n", fifo_overflows);
+}
+
+
+static void cmd_mpu9150_range(void)
+{
+    static const int gyro_dps[] = { 250, 500, 1000, 2000 };
+    static const int acc_g[]    = { 2, 4, 8, 16 };
+
+    const struct mpu9150_range *r = &mpu9150_range;
+
+    printf("auto range     %8d\n", mpu9150_config.auto_range);
+    printf("gyro range     %8d dps\n", gyro_dps[r->gyro_fs & 3]);
+    printf("acc range      %8d g\n", acc_g[r->acc_fs & 3]);
+    printf("switches       %8lu\n", r->switches);
+}
+
+
 SHELL_CMD(mpu9150_init, (cmdfunc_t)mpu9150_init, "Init MPU9150")
+SHELL_CMD(mpu9150_fifo, (cmdfunc_t)cmd_mpu9150_fifo, "Show MPU9150 FIFO status")
+SHELL_CMD(mpu9150_range, (cmdfunc_t)cmd_mpu9150_range, "Show MPU9150/6000 full scale ranges")
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "matrix3f.h"
+#include "sensor_driver.h"
 #include <stdint.h>
 
 struct mpu9150_regs {
@@ -19,6 +20,107 @@ struct mpu9150_data {
     float    temp;
 };
 
-int mpu9150_read(struct mpu9150_regs *regs);
-int mpu9150_convert(struct mpu9150_data *data, const struct mpu9150_regs *regs);
-int mpu9150_init(void);
+// Maximum number of gyro samples per mpu9150_read_fifo()
+//
+#define MPU9150_FIFO_SAMPLES    32
+
+struct mpu9150_fifo {
+    int      count;                             // number of samples
+    uint8_t  data[MPU9150_FIFO_SAMPLES * 6];    // gyro x, y, z (big endian)
+};
+
+// Gain of the samples returned by mpu9150_convert_fifo().
+// They are scaled to the LSB of the finest gyro range, so
+// the decimation filters don't depend on FS_SEL.
+//
+#define MPU9150_FIFO_GAIN       (M_TWOPI / (360 * 131.0))   // [rad/s / LSB]
+
+struct mpu9150_config {
+    int     dlpf_cfg;       // CONFIG_DLPF_CFG (0: 256 Hz, 8 kHz gyro rate)
+    int     smplrt_div;     // sample rate = gyro rate / (1 + smplrt_div)
+    int     fifo_enable;    // read gyro samples through the FIFO
+    int     auto_range;     // automatic full scale range selection
+    int     range_hold;     // [ms] before switching to a finer range
+};
+
+/**
+ * Full scale range state
+ *
+ * The range index is FS_SEL / AFS_SEL:
+ *
+ *   gyro:  0..3 = 250, 500, 1000, 2000 dps
+ *   acc:   0..3 = 2, 4, 8, 16 g
+ *
+ * A range switch is requested by mpu9150_range_select(), and
+ * written by the driver on its next bus access. The output
+ * registers and the FIFO may still hold samples of the old
+ * range at that time, so mpu9150_range_latch() tags every
+ * buffer with the range it was measured in. Output registers
+ * read shortly after the switch are discarded.
+ *
+ * The state is shared by the MPU9150 and MPU6000 drivers,
+ * only one of them is active at a time.
+ *
+ */
+struct mpu9150_range {
+    int         gyro_fs, acc_fs;            // device configuration
+    int         prev_gyro_fs;
+    int         req_gyro_fs, req_acc_fs;    // requested configuration
+    int         fifo_old;                   // FIFO samples left in prev_gyro_fs
+    uint32_t    t_switch;                   // [us]
+    uint32_t    t_gyro_peak, t_acc_peak;    // last sample that needed the range [us]
+    uint32_t    switches;
+};
+
+// Range of the samples in a driver buffer
+//
+struct mpu9150_range_tag {
+    int     gyro_fs, acc_fs;
+    int     gyro_settling;      // output registers may hold either range
+    int     acc_settling;
+    int     fifo_old;           // the first fifo_old FIFO samples ...
+    int     fifo_old_fs;        // ... are in this gyro range
+};
+
+extern struct mpu9150_config mpu9150_config;
+extern struct mpu9150_range  mpu9150_range;
+extern const struct sensor_driver mpu9150_driver;
+
+int   mpu9150_read(struct mpu9150_regs *regs);
+int   mpu9150_convert(
+    struct mpu9150_data *data, const struct mpu9150_regs *regs,
+    const struct mpu9150_range_tag *tag
+);
+
+int   mpu9150_read_fifo(struct mpu9150_fifo *fifo);
+int   mpu9150_convert_fifo(
+    int32_t gyro[][3], uint32_t *clipflags, const struct mpu9150_fifo *fifo,
+    const struct mpu9150_range_tag *tag
+);
+
+int   mpu9150_convert_sample(
+    struct sensor_sample *s, int32_t fifo_buf[][3],
+    const struct mpu9150_regs *regs, const struct mpu9150_fifo *fifo,
+    const struct mpu9150_range_tag *tag
+);
+
+int   mpu9150_capture(
+    void *buf, int size, const struct mpu9150_regs *regs,
+    const struct mpu9150_fifo *fifo, const struct mpu9150_range_tag *tag
+);
+
+int   mpu9150_restore(
+    const void *buf, int len, struct mpu9150_regs *regs,
+    struct mpu9150_fifo *fifo, struct mpu9150_range_tag *tag
+);
+
+void  mpu9150_range_init(void);
+void  mpu9150_range_latch(struct mpu9150_range_tag *tag, int fifo_count);
+void  mpu9150_range_select(const struct mpu9150_range_tag *tag, const struct sensor_sample *s);
+int   mpu9150_range_pending(void);
+void  mpu9150_range_switched(int fifo_count);
+
+float mpu9150_sample_rate(void);
+float mpu9150_dlpf_delay(void);
+
+int   mpu9150_init(void);
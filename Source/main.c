@@ -14,6 +14,8 @@
 #include "bldc_driver.h"
 #include "bldc_task.h"
 #include "flight_ctrl.h"
+#include "blackbox.h"
+#include "msg_rx.h"
 #include "debug_dac.h"
 #include "i2c_driver.h"
 #include "sensors.h"
@@ -32,6 +34,9 @@ static TaskHandle_t shell_handle;
 static TaskHandle_t usb_handle;
 static TaskHandle_t bldc_handle;
 static TaskHandle_t flight_handle;
+static TaskHandle_t rate_handle;
+static TaskHandle_t blackbox_handle;
+static TaskHandle_t msg_rx_handle;
 
 static void init_task(void *pvParameters)
 {
@@ -71,10 +76,35 @@ static void init_task(void *pvParameters)
     xTaskCreate(bldc_task, "bldc", 1024, NULL, 4, &bldc_handle);
     vTaskDelay(100);
 
+    // The flight controller is woken up by each IMU sample. It
+    // must have a lower priority than the sensor task, which
+    // blocks right after publishing the data (see sensor_wait).
+    //
     printf("Starting flight control task..\n");
     xTaskCreate(flight_ctrl, "flight_ctrl", 1024, NULL, 1, &flight_handle);
     vTaskDelay(100);
 
+    // The timer driven inner rate loop preempts everything
+    // else. It only runs if ctrl.rate_hz is set.
+    //
+    printf("Starting rate control task..\n");
+    xTaskCreate(ctrl_rate_task, "rate_ctrl", 512, NULL, 5, &rate_handle);
+    vTaskDelay(100);
+
+    // The blackbox writer may block in the file system for a
+    // while. The rate loop keeps recording into the other buffer.
+    //
+    printf("Starting blackbox task..\n");
+    xTaskCreate(blackbox_task, "blackbox", 512, NULL, 0, &blackbox_handle);
+    vTaskDelay(100);
+
+    // Setpoints from the PC must reach the flight controller
+    // before its next cycle, see rc_pc.c.
+    //
+    printf("Starting message receiver task..\n");
+    xTaskCreate(msg_rx_task, "msg_rx", 512, NULL, 2, &msg_rx_handle);
+    vTaskDelay(100);
+
     printf("Starting USB shell task..\n");
     term_usb_init();
 
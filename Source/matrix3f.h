@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
 #include "util.h"
 
 /**
@@ -41,6 +42,8 @@
 #define MAT3_ZERO       { 0, 0, 0,   0, 0, 0,   0, 0, 0 }
 #define MAT3_IDENTITY   { 1, 0, 0,   0, 1, 0,   0, 0, 1 }
 
+#define QUAT_IDENTITY   { 1, 0, 0, 0 }
+
 
 typedef struct {
     float  x, y;
@@ -61,6 +64,10 @@ typedef struct {
     float  m20, m21, m22;
 } mat3f;
 
+typedef struct {
+    float  w, x, y, z;
+} quatf;
+
 
 static const vec2f vec2f_zero     = VEC2_ZERO;
 static const vec2f vec2f_unit_x   = VEC2_UNIT_X;
@@ -77,6 +84,33 @@ static const vec3f vec3f_unit_z   = VEC3_UNIT_Z;
 static const mat3f mat3f_zero     = MAT3_ZERO;
 static const mat3f mat3f_identity = MAT3_IDENTITY;
 
+static const quatf quatf_identity = QUAT_IDENTITY;
+
+
+/**
+ * Fast reciprocal square root
+ *
+ * The Cortex-M4 needs 14 cycles each for VSQRT and VDIV, which
+ * stall the pipeline. The initial guess from the exponent bits
+ * and two Newton steps are about twice as fast, with a relative
+ * error below 5e-6. x must be positive and finite.
+ *
+ * The result is always a bit low. Use vec3f_renorm() and
+ * quatf_renorm() to keep an integrated state at unit length.
+ *
+ */
+static inline float rsqrtf_fast(const float x)
+{
+    union { float f; int32_t i; } u = { .f = x };
+
+    u.i = 0x5f375a86 - (u.i >> 1);
+
+    float y = u.f;
+    y = y * (1.5 - 0.5 * x * y * y);
+    y = y * (1.5 - 0.5 * x * y * y);
+    return y;
+}
+
 
 static inline vec3f vec3f_add(const vec3f a, const vec3f b)
 {
@@ -170,6 +204,26 @@ static inline vec3f vec3f_norm(const vec3f a)
     return vec3f_div(a, vec3f_len(a));
 }
 
+static inline vec3f vec3f_norm_fast(const vec3f a)
+{
+    return vec3f_scale(a, rsqrtf_fast(vec3f_lensq(a)));
+}
+
+/**
+ * Normalize a vector which is already close to unit length,
+ * e.g. after an integration step, with one Newton step from 1:
+ * 1/sqrt(x) ~ (3 - x) / 2.
+ *
+ * The error is second order in the distance from unit length.
+ * The bias of rsqrtf_fast() would accumulate in an integrator,
+ * this one doesn't.
+ *
+ */
+static inline vec3f vec3f_renorm(const vec3f a)
+{
+    return vec3f_scale(a, 1.5 - 0.5 * vec3f_lensq(a));
+}
+
 static inline vec3f vec3f_clamp(const vec3f a, const vec3f min, const vec3f max)
 {
     return (vec3f) {
@@ -219,6 +273,15 @@ static inline mat3f mat3f_add(const mat3f A, const mat3f B)
     };
 }
 
+static inline mat3f mat3f_scale(const mat3f A, const float c)
+{
+    return (mat3f) {
+        A.m00 * c, A.m01 * c, A.m02 * c,
+        A.m10 * c, A.m11 * c, A.m12 * c,
+        A.m20 * c, A.m21 * c, A.m22 * c
+    };
+}
+
 static inline float mat3f_det(const mat3f A)
 {
     float c00 = A.m11 * A.m22 - A.m12 * A.m21;
@@ -228,6 +291,39 @@ static inline float mat3f_det(const mat3f A)
     return  A.m00 * c00 + A.m01 * c10 + A.m02 * c20;
 }
 
+/**
+ * Inverse by the adjugate matrix.
+ * Returns a zero matrix if A is singular.
+ *
+ */
+static inline mat3f mat3f_inv(const mat3f A)
+{
+    float det = mat3f_det(A);
+    if (det == 0)
+        return mat3f_zero;
+
+    return mat3f_scale((mat3f) {
+        A.m11 * A.m22 - A.m12 * A.m21,
+        A.m02 * A.m21 - A.m01 * A.m22,
+        A.m01 * A.m12 - A.m02 * A.m11,
+        A.m12 * A.m20 - A.m10 * A.m22,
+        A.m00 * A.m22 - A.m02 * A.m20,
+        A.m02 * A.m10 - A.m00 * A.m12,
+        A.m10 * A.m21 - A.m11 * A.m20,
+        A.m01 * A.m20 - A.m00 * A.m21,
+        A.m00 * A.m11 - A.m01 * A.m10
+    }, 1 / det);
+}
+
+static inline mat3f mat3f_diag(const vec3f d)
+{
+    return (mat3f) {
+        d.x, 0,   0,
+        0,   d.y, 0,
+        0,   0,   d.z
+    };
+}
+
 static inline vec3f mat3f_row(const mat3f A, const int row)
 {
     assert(row >= 0 && row <= 3);
@@ -250,6 +346,28 @@ static inline vec3f mat3f_col(const mat3f A, const int col)
     }
 }
 
+/**
+ * Rotation matrix for a rotation vector phi (axis * angle),
+ * i.e. exp([phi x]) by Rodrigues' formula. The series are
+ * accurate to 1e-6 up to |phi| = 0.4 rad.
+ *
+ */
+static inline mat3f mat3f_from_rotvec(const vec3f phi)
+{
+    const float t2 = vec3f_lensq(phi);
+    const float a  = 1   - t2 * (1.0 / 6  - t2 * (1.0 / 120));
+    const float b  = 0.5 - t2 * (1.0 / 24 - t2 * (1.0 / 720));
+
+    const float xx = phi.x*phi.x, yy = phi.y*phi.y, zz = phi.z*phi.z;
+    const float xy = phi.x*phi.y, xz = phi.x*phi.z, yz = phi.y*phi.z;
+
+    return (mat3f) {
+        1 - b*(yy + zz),   b*xy - a*phi.z,   b*xz + a*phi.y,
+         b*xy + a*phi.z, 1 - b*(xx + zz),    b*yz - a*phi.x,
+         b*xz - a*phi.y,   b*yz + a*phi.x, 1 - b*(xx + yy)
+    };
+}
+
 static inline vec3f mat3f_to_euler(const mat3f A)
 {
     return (vec3f) {
@@ -266,3 +384,134 @@ static inline void mat3f_print(const mat3f m)
     printf("%8.3f %8.3f %8.3f\n", m.m20, m.m21, m.m22);
 }
 
+
+/**
+ * Unit quaternions
+ *
+ * A quaternion q rotates a vector like the matrix
+ * quatf_to_mat3f(q), i.e. from the body to the earth frame
+ * for the attitude estimators.
+ *
+ */
+static inline quatf quatf_mul(const quatf a, const quatf b)
+{
+    return (quatf) {
+        a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z,
+        a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y,
+        a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x,
+        a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w
+    };
+}
+
+static inline quatf quatf_conj(const quatf q)
+{
+    return (quatf) { q.w, -q.x, -q.y, -q.z };
+}
+
+static inline quatf quatf_norm(const quatf q)
+{
+    float k = 1 / sqrtf(q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+    return (quatf) { q.w * k, q.x * k, q.y * k, q.z * k };
+}
+
+static inline quatf quatf_norm_fast(const quatf q)
+{
+    float k = rsqrtf_fast(q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+    return (quatf) { q.w * k, q.x * k, q.y * k, q.z * k };
+}
+
+static inline quatf quatf_renorm(const quatf q)
+{
+    // See vec3f_renorm()
+    //
+    float k = 1.5 - 0.5 * (q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+    return (quatf) { q.w * k, q.x * k, q.y * k, q.z * k };
+}
+
+/**
+ * Quaternion for a rotation vector phi (axis * angle).
+ * Same accuracy as mat3f_from_rotvec().
+ *
+ */
+static inline quatf quatf_from_rotvec(const vec3f phi)
+{
+    const float t2 = vec3f_lensq(phi);
+    const float c  = 1   - t2 * (1.0 / 8  - t2 * (1.0 / 384));
+    const float s  = 0.5 - t2 * (1.0 / 48 - t2 * (1.0 / 3840));
+
+    return (quatf) { c, phi.x * s, phi.y * s, phi.z * s };
+}
+
+/**
+ * Rotate q by the body rates w [rad/s] for dt seconds.
+ * First order, q' = q + q * (0, w) * dt / 2, normalized.
+ * The step must be small, |w| dt < 0.1 rad.
+ *
+ */
+static inline quatf quatf_integrate(const quatf q, const vec3f w, const float dt)
+{
+    const vec3f h  = vec3f_scale(w, 0.5 * dt);
+    const quatf dq = quatf_mul(q, (quatf) { 0, h.x, h.y, h.z });
+
+    return quatf_renorm((quatf) { q.w + dq.w, q.x + dq.x, q.y + dq.y, q.z + dq.z });
+}
+
+static inline vec3f quatf_rotate(const quatf q, const vec3f v)
+{
+    // v + 2w (u x v) + 2 u x (u x v), with u = (x, y, z)
+    //
+    const vec3f u = { q.x, q.y, q.z };
+    vec3f t = vec3f_scale(vec3f_cross(u, v), 2);
+    return vec3f_add(vec3f_add(v, vec3f_scale(t, q.w)), vec3f_cross(u, t));
+}
+
+static inline mat3f quatf_to_mat3f(const quatf q)
+{
+    const float xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+    const float xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+    const float wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+    return (mat3f) {
+        1 - 2*(yy + zz),     2*(xy - wz),     2*(xz + wy),
+            2*(xy + wz), 1 - 2*(xx + zz),     2*(yz - wx),
+            2*(xz - wy),     2*(yz + wx), 1 - 2*(xx + yy)
+    };
+}
+
+static inline quatf mat3f_to_quatf(const mat3f A)
+{
+    // Use the largest diagonal term for numerical stability
+    //
+    float tr = A.m00 + A.m11 + A.m22;
+    quatf q;
+
+    if (tr > 0) {
+        float s = 0.5 / sqrtf(tr + 1);
+        q = (quatf) { 0.25 / s, (A.m21 - A.m12) * s, (A.m02 - A.m20) * s, (A.m10 - A.m01) * s };
+    }
+    else if (A.m00 > A.m11 && A.m00 > A.m22) {
+        float s = 2 * sqrtf(1 + A.m00 - A.m11 - A.m22);
+        q = (quatf) { (A.m21 - A.m12) / s, 0.25 * s, (A.m01 + A.m10) / s, (A.m02 + A.m20) / s };
+    }
+    else if (A.m11 > A.m22) {
+        float s = 2 * sqrtf(1 + A.m11 - A.m00 - A.m22);
+        q = (quatf) { (A.m02 - A.m20) / s, (A.m01 + A.m10) / s, 0.25 * s, (A.m12 + A.m21) / s };
+    }
+    else {
+        float s = 2 * sqrtf(1 + A.m22 - A.m00 - A.m11);
+        q = (quatf) { (A.m10 - A.m01) / s, (A.m02 + A.m20) / s, (A.m12 + A.m21) / s, 0.25 * s };
+    }
+
+    return quatf_norm(q);
+}
+
+static inline vec3f quatf_to_euler(const quatf q)
+{
+    // Same angles as mat3f_to_euler(quatf_to_mat3f(q))
+    //
+    return (vec3f) {
+        atan2f(2*(q.y*q.z + q.w*q.x), 1 - 2*(q.x*q.x + q.y*q.y)),
+        -asinf(clamp(2*(q.x*q.z - q.w*q.y), -1, 1)),
+        atan2f(2*(q.x*q.y + q.w*q.z), 1 - 2*(q.y*q.y + q.z*q.z))
+    };
+}
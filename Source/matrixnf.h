@@ -0,0 +1,228 @@
+#pragma once
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+
+/**
+ * Small matrix kernels for the EKF-sized problems
+ *
+ * Matrices are plain float arrays in row-major order, with the
+ * dimensions passed along, e.g. a 6x3 matrix is float A[6*3].
+ * All dimensions must be <= MATNF_MAX.
+ *
+ * The inner products are fully unrolled. If the functions are
+ * inlined with constant dimensions, the compiler drops the
+ * jump into the unrolled loop as well.
+ *
+ * The result may be an operand for the element-wise functions,
+ * but not for the products.
+ *
+ */
+#define MATNF_MAX   9
+
+
+/**
+ * Dot product of a[0], a[sa], .. and b[0], b[sb], ..
+ * The strides select rows or columns of a matrix.
+ *
+ */
+static inline float matnf_dot(const float *a, int sa, const float *b, int sb, int n)
+{
+    float s = 0;
+
+    assert(n <= MATNF_MAX);
+
+    switch (n) {
+    case 9: s += a[8*sa] * b[8*sb];   // fall through
+    case 8: s += a[7*sa] * b[7*sb];   // fall through
+    case 7: s += a[6*sa] * b[6*sb];   // fall through
+    case 6: s += a[5*sa] * b[5*sb];   // fall through
+    case 5: s += a[4*sa] * b[4*sb];   // fall through
+    case 4: s += a[3*sa] * b[3*sb];   // fall through
+    case 3: s += a[2*sa] * b[2*sb];   // fall through
+    case 2: s += a[1*sa] * b[1*sb];   // fall through
+    case 1: s += a[0*sa] * b[0*sb];   // fall through
+    default: break;
+    }
+
+    return s;
+}
+
+
+static inline void matnf_zero(float *C, int n, int m)
+{
+    for (int i=0; i<n*m; i++)
+        C[i] = 0;
+}
+
+static inline void matnf_identity(float *C, int n)
+{
+    for (int i=0; i<n; i++)
+        for (int j=0; j<n; j++)
+            C[i*n + j] = (i == j);
+}
+
+static inline void matnf_copy(float *C, const float *A, int n, int m)
+{
+    for (int i=0; i<n*m; i++)
+        C[i] = A[i];
+}
+
+static inline void matnf_add(float *C, const float *A, const float *B, int n, int m)
+{
+    for (int i=0; i<n*m; i++)
+        C[i] = A[i] + B[i];
+}
+
+static inline void matnf_sub(float *C, const float *A, const float *B, int n, int m)
+{
+    for (int i=0; i<n*m; i++)
+        C[i] = A[i] - B[i];
+}
+
+static inline void matnf_scale(float *C, const float *A, float c, int n, int m)
+{
+    for (int i=0; i<n*m; i++)
+        C[i] = A[i] * c;
+}
+
+/**
+ * C = A^T, A is n x m
+ *
+ */
+static inline void matnf_trans(float *C, const float *A, int n, int m)
+{
+    for (int i=0; i<n; i++)
+        for (int j=0; j<m; j++)
+            C[j*n + i] = A[i*m + j];
+}
+
+/**
+ * y = A x, A is n x m
+ *
+ */
+static inline void matnf_vecmul(float *y, const float *A, const float *x, int n, int m)
+{
+    for (int i=0; i<n; i++)
+        y[i] = matnf_dot(&A[i*m], 1, x, 1, m);
+}
+
+/**
+ * C = A B, A is n x m, B is m x p
+ *
+ */
+static inline void matnf_mul(float *C, const float *A, const float *B, int n, int m, int p)
+{
+    for (int i=0; i<n; i++)
+        for (int j=0; j<p; j++)
+            C[i*p + j] = matnf_dot(&A[i*m], 1, &B[j], p, m);
+}
+
+/**
+ * C = A B^T, A is n x m, B is p x m
+ *
+ * Both operands are read along the rows, which makes
+ * this the fastest way to compute P H^T or A P A^T.
+ *
+ */
+static inline void matnf_mul_trans(float *C, const float *A, const float *B, int n, int m, int p)
+{
+    for (int i=0; i<n; i++)
+        for (int j=0; j<p; j++)
+            C[i*p + j] = matnf_dot(&A[i*m], 1, &B[j*m], 1, m);
+}
+
+/**
+ * A = (A + A^T) / 2, removes the rounding errors which
+ * make a covariance matrix asymmetric.
+ *
+ */
+static inline void matnf_symmetrize(float *A, int n)
+{
+    for (int i=0; i<n; i++) {
+        for (int j=i+1; j<n; j++) {
+            float s = 0.5 * (A[i*n + j] + A[j*n + i]);
+            A[i*n + j] = s;
+            A[j*n + i] = s;
+        }
+    }
+}
+
+/**
+ * Cholesky decomposition A = L L^T of a symmetric positive
+ * definite matrix. Only the lower triangle of A is used.
+ * The upper triangle of L is set to zero. L may be A.
+ *
+ * \returns 0 on success, or -1 if A is not positive
+ *          definite (errno = EDOM).
+ */
+static inline int matnf_cholesky(float *L, const float *A, int n)
+{
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<i; j++) {
+            float s = A[i*n + j] - matnf_dot(&L[i*n], 1, &L[j*n], 1, j);
+            L[i*n + j] = s / L[j*n + j];
+        }
+
+        float d = A[i*n + i] - matnf_dot(&L[i*n], 1, &L[i*n], 1, i);
+        if (!(d > 0)) {
+            errno = EDOM;
+            return -1;
+        }
+
+        L[i*n + i] = sqrtf(d);
+
+        for (int j=i+1; j<n; j++)
+            L[i*n + j] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Solve L L^T X = B, where L is from matnf_cholesky()
+ * and B is n x m. X may be B.
+ *
+ */
+static inline void matnf_chol_solve(float *X, const float *L, const float *B, int n, int m)
+{
+    // Forward substitution, L Y = B
+    //
+    for (int i=0; i<n; i++) {
+        float r = 1 / L[i*n + i];
+        for (int k=0; k<m; k++)
+            X[i*m + k] = (B[i*m + k] - matnf_dot(&L[i*n], 1, &X[k], m, i)) * r;
+    }
+
+    // Back substitution, L^T X = Y
+    //
+    for (int i=n-1; i>=0; i--) {
+        float r = 1 / L[i*n + i];
+        for (int k=0; k<m; k++) {
+            float s = 0;
+            if (i < n-1)
+                s = matnf_dot(&L[(i+1)*n + i], n, &X[(i+1)*m + k], m, n-1-i);
+
+            X[i*m + k] = (X[i*m + k] - s) * r;
+        }
+    }
+}
+
+/**
+ * C = A^-1 for a symmetric positive definite A.
+ * C must not be A.
+ *
+ * \returns 0 on success, or -1 (errno = EDOM)
+ */
+static inline int matnf_inv_spd(float *C, const float *A, int n)
+{
+    float L[MATNF_MAX * MATNF_MAX];
+
+    if (matnf_cholesky(L, A, n) < 0)
+        return -1;
+
+    matnf_identity(C, n);
+    matnf_chol_solve(C, L, C, n, n);
+    return 0;
+}
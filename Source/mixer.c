@@ -0,0 +1,222 @@
+#include "mixer.h"
+#include "util.h"
+#include <string.h>
+
+#define C22 0.4142      // tan(22.5 deg)
+
+/**
+ * Frame tables
+ *
+ * The controller axes are those of flight_ctrl.c. Positive
+ * pitch speeds up the front motors, positive roll the right
+ * ones, and positive yaw every second motor.
+ *
+ * The quad frames use the BLDC channel order FL, FR, RL, RR.
+ * Quad + is quad X turned by 45 deg clockwise, so the front
+ * motor is on the FL channel. Hex and octo are numbered
+ * clockwise, starting at the front right.
+ *
+ */
+static const struct mixer_table frames[] = {
+    [MIXER_QUAD_X] = { 4, {
+        { -1,  1, -1 },
+        {  1,  1,  1 },
+        { -1, -1,  1 },
+        {  1, -1, -1 }
+    } },
+
+    [MIXER_QUAD_PLUS] = { 4, {
+        {  0,  1, -1 },
+        {  1,  0,  1 },
+        { -1,  0,  1 },
+        {  0, -1, -1 }
+    } },
+
+    [MIXER_HEX_X] = { 6, {
+        {  0.5,  1,  1 },
+        {  1,    0, -1 },
+        {  0.5, -1,  1 },
+        { -0.5, -1, -1 },
+        { -1,    0,  1 },
+        { -0.5,  1, -1 }
+    } },
+
+    [MIXER_OCTO_X] = { 8, {
+        {  C22,  1,    1 },
+        {  1,    C22, -1 },
+        {  1,   -C22,  1 },
+        {  C22, -1,   -1 },
+        { -C22, -1,    1 },
+        { -1,   -C22, -1 },
+        { -1,    C22,  1 },
+        { -C22,  1,   -1 }
+    } }
+};
+
+
+struct mixer_config mixer_config = {
+    .frame  = MIXER_QUAD_X,
+    .u_min  = 1,
+    .u_max  = 10
+};
+
+struct mixer_stats mixer_stats;
+
+
+const struct mixer_table *mixer_get_table(void)
+{
+    if (mixer_config.frame == MIXER_CUSTOM)
+        return &mixer_config.custom;
+    else if (mixer_config.frame >= 0 && mixer_config.frame < MIXER_CUSTOM)
+        return &frames[mixer_config.frame];
+    else
+        return &frames[MIXER_QUAD_X];
+}
+
+
+/**
+ * Mix the controller outputs into motor voltages, with
+ * roll and pitch first:
+ *
+ *   1. If roll and pitch alone don't fit into the motor
+ *      range, they are scaled down and yaw is dropped.
+ *   2. If roll, pitch and yaw don't fit, yaw is scaled down
+ *      as far as needed.
+ *   3. The collective thrust is moved up or down until all
+ *      motors are within the range.
+ *
+ * The thrust is only changed if the attitude can't be held
+ * otherwise. This keeps full control authority at full and
+ * zero throttle.
+ *
+ * \param u      motor voltages [V], MIXER_MAX_MOTORS entries
+ * \param u_max  upper limit, e.g. reduced by a low battery.
+ *               It is clipped to the configured range.
+ * \returns the number of motors
+ */
+int mixer_update(float *u, float thrust, float roll, float pitch, float yaw, float u_max)
+{
+    const struct mixer_table *t = mixer_get_table();
+    const int n = clamp(t->motors, 0, MIXER_MAX_MOTORS);
+
+    const float u_min = mixer_config.u_min;
+    u_max = clamp(u_max, u_min, mixer_config.u_max);
+
+    const float range = u_max - u_min;
+
+    float rp[MIXER_MAX_MOTORS], y[MIXER_MAX_MOTORS];
+    float rp_min = 0, rp_max = 0;
+
+    for (int i=0; i<n; i++) {
+        rp[i] = roll * t->m[i][0] + pitch * t->m[i][1];
+        y[i]  = yaw  * t->m[i][2];
+
+        rp_min = i ? fminf(rp_min, rp[i]) : rp[i];
+        rp_max = i ? fmaxf(rp_max, rp[i]) : rp[i];
+    }
+
+    mixer_stats.cycles++;
+
+    // 1. Roll and pitch
+    //
+    float k_yaw = 1;
+
+    if (rp_max - rp_min > range) {
+        float k = range / (rp_max - rp_min);
+
+        for (int i=0; i<n; i++)
+            rp[i] *= k;
+
+        k_yaw = 0;
+        mixer_stats.rp_limited++;
+    }
+    else {
+        // 2. Largest yaw scale k, so that for all pairs
+        //    rp[i] + k y[i] - (rp[j] + k y[j]) <= range
+        //
+        for (int i=0; i<n; i++) {
+            for (int j=0; j<n; j++) {
+                float dy = y[i] - y[j];
+                if (dy > 0)
+                    k_yaw = fminf(k_yaw, (range - (rp[i] - rp[j])) / dy);
+            }
+        }
+
+        if (k_yaw < 1)
+            mixer_stats.yaw_limited++;
+    }
+
+    // 3. Collective thrust
+    //
+    float m_min = 0, m_max = 0;
+
+    for (int i=0; i<n; i++) {
+        rp[i] += k_yaw * y[i];
+
+        m_min = i ? fminf(m_min, rp[i]) : rp[i];
+        m_max = i ? fmaxf(m_max, rp[i]) : rp[i];
+    }
+
+    float lo = u_min - m_min;
+    float hi = u_max - m_max;
+    float c  = clamp(thrust, lo, fmaxf(lo, hi));
+
+    if (c != thrust)
+        mixer_stats.thrust_shifted++;
+
+    for (int i=0; i<n; i++)
+        u[i] = clamp(c + rp[i], u_min, u_max);
+
+    return n;
+}
+
+
+void mixer_reset_stats(void)
+{
+    memset(&mixer_stats, 0, sizeof(mixer_stats));
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include <stdio.h>
+
+
+static void cmd_mixer_show(int argc, char *argv[])
+{
+    static const char *names[] = { "quad X", "quad +", "hex X", "octo X", "custom" };
+
+    if (argc == 2 && !strcmp(argv[1], "-r")) {
+        mixer_reset_stats();
+        return;
+    }
+    else if (argc != 1) {
+        goto usage;
+    }
+
+    const struct mixer_table *t = mixer_get_table();
+    const struct mixer_stats *s = &mixer_stats;
+
+    printf("frame     : %s, %d motors\n", names[clamp(mixer_config.frame, 0, MIXER_FRAME_MAX)], t->motors);
+    printf("range     : %.2f .. %.2f V\n", mixer_config.u_min, mixer_config.u_max);
+    printf("\n");
+    printf("motor       roll   pitch     yaw\n");
+
+    for (int i=0; i<t->motors && i<MIXER_MAX_MOTORS; i++)
+        printf("%5d    %7.3f %7.3f %7.3f\n", i, t->m[i][0], t->m[i][1], t->m[i][2]);
+
+    printf("\n");
+    printf("cycles         : %10lu\n", s->cycles);
+    printf("thrust shifted : %10lu\n", s->thrust_shifted);
+    printf("yaw limited    : %10lu\n", s->yaw_limited);
+    printf("r/p limited    : %10lu\n", s->rp_limited);
+    return;
+
+usage:
+    printf("usage: %s [-h|-r]\n", argv[0]);
+    printf("  -r  reset statistics\n");
+}
+
+
+SHELL_CMD(mixer_show, (cmdfunc_t)cmd_mixer_show, "Show motor mixer")
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#define MIXER_MAX_MOTORS    8
+
+enum mixer_frame {
+    MIXER_QUAD_X,
+    MIXER_QUAD_PLUS,
+    MIXER_HEX_X,
+    MIXER_OCTO_X,
+    MIXER_CUSTOM,
+    MIXER_FRAME_MAX = MIXER_CUSTOM
+};
+
+
+/**
+ * Mixing matrix
+ *
+ * Each motor gets the collective thrust plus the roll, pitch
+ * and yaw controller outputs times its coefficients. The
+ * columns are scaled to a maximum of 1, so the controller
+ * gains are similar for all frames.
+ *
+ */
+struct mixer_table {
+    int     motors;
+    float   m[MIXER_MAX_MOTORS][3];     // roll, pitch, yaw
+};
+
+
+struct mixer_config {
+    int     frame;                      // enum mixer_frame
+    float   u_min;                      // motor voltage range [V]
+    float   u_max;
+    struct  mixer_table custom;
+};
+
+
+struct mixer_stats {
+    uint32_t    cycles;
+    uint32_t    thrust_shifted;     // collective moved to fit
+    uint32_t    yaw_limited;        // yaw scaled down
+    uint32_t    rp_limited;         // roll and pitch scaled down
+};
+
+extern struct mixer_config  mixer_config;
+extern struct mixer_stats   mixer_stats;
+
+const struct mixer_table *mixer_get_table(void);
+
+int  mixer_update(float *u, float thrust, float roll, float pitch, float yaw, float u_max);
+void mixer_reset_stats(void);
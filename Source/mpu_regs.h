@@ -0,0 +1,105 @@
+#pragma once
+
+// Register map of the InvenSense MPU-6000 family.
+// Shared by the MPU9150 (I2C) and MPU6000 (SPI) drivers.
+//
+// Registers taken from RM-MPU-9150A-00.pdf, v4.2
+//
+#define SELF_TEST_X         0x0D
+#define SELF_TEST_Y         0x0E
+#define SELF_TEST_Z         0x0F
+#define SELF_TEST_A         0x10
+
+#define SMPLRT_DIV          0x19
+#define CONFIG              0x1A
+#define GYRO_CONFIG         0x1B
+#define ACCEL_CONFIG        0x1C
+#define FIFO_EN             0x23
+#define INT_PIN_CFG         0x37
+
+#define ACCEL_XOUT_H        0x3B
+#define ACCEL_XOUT_L        0x3C
+#define ACCEL_YOUT_H        0x3D
+#define ACCEL_YOUT_L        0x3E
+#define ACCEL_ZOUT_H        0x3F
+#define ACCEL_ZOUT_L        0x40
+#define TEMP_OUT_H          0x41
+#define TEMP_OUT_L          0x42
+#define GYRO_XOUT_H         0x43
+#define GYRO_XOUT_L         0x44
+#define GYRO_YOUT_H         0x45
+#define GYRO_ZOUT_H         0x47
+#define GYRO_ZOUT_L         0x48
+
+#define USER_CTRL           0x6A
+#define PWR_MGMT_1          0x6B
+#define FIFO_COUNTH         0x72
+#define FIFO_COUNTL         0x73
+#define FIFO_R_W            0x74
+#define WHO_AM_I            0x75
+
+// Register bits
+//
+#define PWR_MGMT_1_DEVICE_RESET     0x80
+#define PWR_MGMT_1_SLEEP            0x40
+#define PWR_MGMT_1_CYCLE            0x20
+#define PWR_MGMT_1_TEMP_DIS         0x08
+#define PWR_MGMT_1_CLKSEL_INTERNAL  0x00
+#define PWR_MGMT_1_CLKSEL_PLL_X     0x01
+#define PWR_MGMT_1_CLKSEL_PLL_Y     0x02
+#define PWR_MGMT_1_CLKSEL_PLL_Z     0x03
+#define PWR_MGMT_1_CLKSEL_PLL_32    0x04
+#define PWR_MGMT_1_CLKSEL_PLL_19M2  0x05
+#define PWR_MGMT_1_CLKSEL_STOP      0x07
+
+#define GYRO_CONFIG_XG_ST           0x80
+#define GYRO_CONFIG_YG_ST           0x40
+#define GYRO_CONFIG_ZG_ST           0x20
+#define GYRO_CONFIG_FS_SEL_250      0x00
+#define GYRO_CONFIG_FS_SEL_500      0x08
+#define GYRO_CONFIG_FS_SEL_1000     0x10
+#define GYRO_CONFIG_FS_SEL_2000     0x18
+
+#define ACCEL_CONFIG_XA_ST          0x80
+#define ACCEL_CONFIG_YA_ST          0x40
+#define ACCEL_CONFIG_ZA_ST          0x20
+#define ACCEL_CONFIG_AFS_SEL_2G     0x00
+#define ACCEL_CONFIG_AFS_SEL_4G     0x08
+#define ACCEL_CONFIG_AFS_SEL_8G     0x10
+#define ACCEL_CONFIG_AFS_SEL_16G    0x18
+
+#define CONFIG_DLPF_CFG_256         0x00
+#define CONFIG_DLPF_CFG_188         0x01
+#define CONFIG_DLPF_CFG_98          0x02
+#define CONFIG_DLPF_CFG_42          0x03
+#define CONFIG_DLPF_CFG_20          0x04
+#define CONFIG_DLPF_CFG_10          0x05
+#define CONFIG_DLPF_CFG_5           0x06
+
+#define FIFO_EN_TEMP                0x80
+#define FIFO_EN_XG                  0x40
+#define FIFO_EN_YG                  0x20
+#define FIFO_EN_ZG                  0x10
+#define FIFO_EN_ACCEL               0x08
+
+#define USER_CTRL_FIFO_EN           0x40
+#define USER_CTRL_I2C_MST_EN        0x20
+#define USER_CTRL_I2C_IF_DIS        0x10
+#define USER_CTRL_FIFO_RESET        0x04
+#define USER_CTRL_I2C_MST_RESET     0x02
+#define USER_CTRL_SIG_COND_RESET    0x01
+
+#define FIFO_SIZE                   1024
+
+#define INT_PIN_CFG_INT_LEVEL       0x80
+#define INT_PIN_CFG_INT_OPEN        0x40
+#define INT_PIN_CFG_LATCH_INT_EN    0x20
+#define INT_PIN_CFG_INT_RD_CLEAR    0x10
+#define INT_PIN_CFG_FSYNC_INT_LEVEL 0x08
+#define INT_PIN_CFG_FSYNC_INT_EN    0x04
+#define INT_PIN_CFG_I2C_BYPASS_EN   0x02
+
+// Full scale configuration
+//
+#define GYRO_CONFIG_FS_SEL      GYRO_CONFIG_FS_SEL_2000
+#define ACCEL_CONFIG_AFS_SEL    ACCEL_CONFIG_AFS_SEL_8G
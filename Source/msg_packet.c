@@ -0,0 +1,83 @@
+#include "msg_packet.h"
+#include "Shared/crc16.h"
+#include "Shared/cobsr.h"
+#include <stdio.h>
+
+/**
+ * Binary message transmission
+ *
+ * Uses the same framing as the bootloader: COBS/R encoded
+ * CRC + ID + data, followed by a zero end-of-packet marker.
+ * The packets are written to stdout, so they can be mixed
+ * with the shell output. The receiver resynchronizes on the
+ * zero bytes, which never occur in the text stream.
+ *
+ * Packets from the PC are received by msg_rx.c.
+ *
+ */
+
+// COBSR(CRC + ID + MSG_MAX_DATA_SIZE) + End-of-packet
+//
+#define MAX_BUF_LENGTH  ( MSG_MAX_PACKET_LEN + 1 )
+
+
+/**
+ * Calculate CRC header field over ID and data
+ *
+ */
+static crc16_t msg_calc_crc(const struct msg_header *msg)
+{
+    crc16_t crc = crc16_init();
+    crc = crc16_update(crc, (uint8_t*)&msg->id, 2 + msg->data_len);
+    crc = crc16_finalize(crc);
+    return crc;
+}
+
+
+int msg_send(struct msg_header *msg)
+{
+    uint8_t tx_buf[MAX_BUF_LENGTH];
+
+    msg->crc = msg_calc_crc(msg);
+
+    int res = cobsr_encode(
+        tx_buf, sizeof(tx_buf) - 1,         // 1 byte for end-of-packet
+        &msg->crc, 2 + 2 + msg->data_len    // +CRC +ID
+    );
+
+    if (res < 0)
+        return -1;
+
+    // add end-of-packet marker
+    //
+    tx_buf[res++] = 0;
+
+    fwrite(tx_buf, 1, res, stdout);
+    fflush(stdout);
+
+    return msg->data_len;
+}
+
+
+/**
+ * Decode a COBS/R packet without the end-of-packet marker
+ *
+ * \returns the data length, or -1 if the packet is broken
+ */
+int msg_decode(struct msg_header *msg, const void *buf, int len)
+{
+    int res = cobsr_decode(
+        &msg->crc, 2 + 2 + MSG_MAX_DATA_SIZE,   // +CRC +ID
+        buf, len
+    );
+
+    if (res < 2 + 2)
+        return -1;
+
+    msg->data_len = res -2 -2;     // -CRC -ID
+
+    if (msg_calc_crc(msg) != msg->crc)
+        return -1;
+
+    return msg->data_len;
+}
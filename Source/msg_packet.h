@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include "Shared/msg_structs.h"
+#include "Shared/cobsr.h"
+
+// COBSR(CRC + ID + MSG_MAX_DATA_SIZE)
+//
+#define MSG_MAX_PACKET_LEN  COBSR_ENCODE_DST_BUF_LEN_MAX(2 + 2 + MSG_MAX_DATA_SIZE)
+
+int msg_send(struct msg_header *msg);
+int msg_decode(struct msg_header *msg, const void *buf, int len);
@@ -0,0 +1,127 @@
+#include "msg_rx.h"
+#include "msg_packet.h"
+#include "rc_pc.h"
+#include "ustime.h"
+#include "task.h"
+#include "queue.h"
+
+#define RX_QUEUE_SIZE   4
+#define RX_TIMEOUT      10      // [ticks] between the bytes of a packet
+
+/**
+ * Binary message reception
+ *
+ * Packets from the PC use the framing of msg_packet.c, with
+ * an additional zero byte in front. The IRQs of the USB and
+ * XBee terminals pass each byte to msg_rx_byte(), which takes
+ * everything from a zero byte to the next one out of the
+ * shell input. The packets are decoded and handled by
+ * msg_rx_task().
+ *
+ */
+volatile struct msg_rx_stats msg_rx_stats;
+
+static QueueHandle_t rx_queue;
+
+
+/**
+ * Feed one received byte to the packet receiver. Called from
+ * the terminal IRQs.
+ *
+ * A packet which stops for RX_TIMEOUT is dropped, so a stray
+ * zero byte from a terminal only swallows a short piece of
+ * the input.
+ *
+ * \returns 1 if the byte was part of a packet, 0 if it is
+ *          shell input
+ */
+int msg_rx_byte(struct msg_rx *rx, uint8_t c, portBASE_TYPE *woken)
+{
+    if (!rx_queue)
+        return 0;
+
+    TickType_t t = xTaskGetTickCountFromISR();
+
+    if (rx->active && t - rx->t_last > RX_TIMEOUT) {
+        rx->active = 0;
+        msg_rx_stats.timeouts++;
+    }
+
+    if (!rx->active) {
+        if (c != 0)
+            return 0;
+
+        rx->active = 1;
+        rx->len    = 0;
+        rx->t_last = t;
+        return 1;
+    }
+
+    rx->t_last = t;
+
+    if (c != 0) {
+        if (rx->len < MSG_MAX_PACKET_LEN)
+            rx->packet.buf[rx->len] = c;
+
+        if (rx->len <= MSG_MAX_PACKET_LEN)
+            rx->len++;
+
+        return 1;
+    }
+
+    // Back-to-back packets have two zero bytes in between
+    //
+    if (rx->len == 0)
+        return 1;
+
+    rx->active = 0;
+
+    if (rx->len > MSG_MAX_PACKET_LEN) {
+        msg_rx_stats.errors++;
+        return 1;
+    }
+
+    rx->packet.t_rx = get_us_time32();
+    rx->packet.len  = rx->len;
+
+    if (!xQueueSendFromISR(rx_queue, &rx->packet, woken))
+        msg_rx_stats.overruns++;
+
+    return 1;
+}
+
+
+/**
+ * Decode and handle the received packets. The priority must
+ * be above the consumers of the messages, see rc_pc.c.
+ *
+ */
+void msg_rx_task(void *pvParameters)
+{
+    rx_queue = xQueueCreate(RX_QUEUE_SIZE, sizeof(struct msg_rx_packet));
+
+    for (;;) {
+        static struct msg_rx_packet p;
+        static struct msg_generic msg;
+
+        xQueueReceive(rx_queue, &p, portMAX_DELAY);
+
+        if (msg_decode(&msg.h, p.buf, p.len) < 0) {
+            msg_rx_stats.errors++;
+            continue;
+        }
+
+        msg_rx_stats.packets++;
+
+        switch (msg.h.id) {
+        case MSG_ID_SETPOINT:
+            if (rc_pc_receive(&msg.h, p.t_rx) < 0)
+                msg_rx_stats.errors++;
+            break;
+
+        default:
+            msg_rx_stats.unknown++;
+            break;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "msg_packet.h"
+#include "FreeRTOS.h"
+
+
+struct msg_rx_packet {
+    uint32_t    t_rx;           // time of the end-of-packet marker [us]
+    int         len;
+    uint8_t     buf[MSG_MAX_PACKET_LEN];
+};
+
+
+/**
+ * Receiver state of one link, only used by its IRQ
+ *
+ */
+struct msg_rx {
+    int         active;         // inside a packet
+    int         len;            // > MSG_MAX_PACKET_LEN: too long
+    TickType_t  t_last;
+    struct msg_rx_packet packet;
+};
+
+
+struct msg_rx_stats {
+    uint32_t    packets;
+    uint32_t    errors;         // framing, COBS/R and CRC errors
+    uint32_t    timeouts;
+    uint32_t    overruns;
+    uint32_t    unknown;        // unhandled message ids
+};
+
+extern volatile struct msg_rx_stats msg_rx_stats;
+
+int  msg_rx_byte(struct msg_rx *rx, uint8_t c, portBASE_TYPE *woken);
+void msg_rx_task(void *pvParameters);
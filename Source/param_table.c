@@ -5,13 +5,25 @@
 #include "debug_dac.h"
 #include "rc_input.h"
 #include "rc_ppm.h"
+#include "rc_pc.h"
 #include "dma_io_driver.h"
 #include "sensors.h"
+#include "i2c_mpu9150.h"
+#include "filter.h"
+#include "gyro_tempco.h"
+#include "altitude.h"
+#include "attitude.h"
+#include "attitude_ekf.h"
+#include "flight_ctrl.h"
+#include "mixer.h"
+#include "thrust_curve.h"
+#include "blackbox.h"
+#include "sysid.h"
+#include "autotune.h"
+#include "rpm_notch.h"
 
 static int board_address;
 
-extern float foo, bar, baz;
-
 const struct param_info  param_table[] = {
     {    1, P_INT32(&board_address    ), READONLY, .name = "board_address" },
     {    4, P_INT32((int*)&warnings.w ), NOEEPROM, .name = "warning_flags" },
@@ -68,6 +80,7 @@ const struct param_info  param_table[] = {
                     "  2: Individual servo channels\n"
                     "  3: Spektrum DSM2 satellite\n"
                     "  4: Futaba SBUS\n"
+                    "  5: PC setpoint messages\n"
     },
 
     {  201, P_INT32(&rc_config.expected_channels, 0, 0, RC_MAX_CHANNELS),
@@ -96,9 +109,224 @@ const struct param_info  param_table[] = {
             .help = "PPM sum signal synchronization pulse width"
     },
 
-    { 300, P_FLOAT(&foo) },
-    { 301, P_FLOAT(&bar) },
-    { 302, P_FLOAT(&baz) },
+    {  220, P_INT32(&rc_pc_config.timeout, 100, 20, 1000),
+            .name = "rc_pc.timeout", .unit = "ms",
+            .help = "Failsafe timeout for PC setpoint messages"
+    },
+
+    {  221, P_INT32(&rc_pc_config.max_age, 50, 1, 1000),
+            .name = "rc_pc.max_age", .unit = "ms",
+            .help = "Drop setpoint messages which are delayed by more than this"
+    },
+
+    // Flight controller
+    //
+    {  310, P_INT32(&ctrl_config.mode, CTRL_MODE_RATE, 0, CTRL_MODE_MAX),
+            .name = "ctrl.mode",
+            .help = "Flight control mode:\n"
+                    "  0: Rate (acro)\n"
+                    "  1: Angle (self-level)\n"
+    },
+
+    {  311, P_FLOAT(&ctrl_config.max_rate, 1, 0, 20),
+            .name = "ctrl.max_rate", .unit = "rad/s",
+            .help = "Angular rate at full stick deflection. "
+                    "Also limits the angle loop output."
+    },
+
+    {  312, P_FLOAT(&ctrl_config.max_angle, 0.5, 0, 1.5),
+            .name = "ctrl.max_angle", .unit = "rad",
+            .help = "Roll and pitch angle at full stick deflection in angle mode"
+    },
+
+    {  313, P_FLOAT(&ctrl_config.d_fc, 50, 0, 400),
+            .name = "ctrl.d_fc", .unit = "Hz",
+            .help = "Cut-off frequency of the D-term low pass filter, 0: off"
+    },
+
+    {  314, P_FLOAT(&ctrl_config.u_max, 5, 0, 10),
+            .name = "ctrl.u_max", .unit = "V",
+            .help = "Output limit of the rate controllers"
+    },
+
+    {  315, P_INT32(&ctrl_config.rate_hz, 0, 0, 4000),
+            .name = "ctrl.rate_hz", .unit = "Hz",
+            .help = "Rate of the timer driven inner rate loop, should be "
+                    "the gyro FIFO rate. Needs mpu9150.fifo_enable. "
+                    "0: Run the rate loop with each IMU sample."
+    },
+
+    {  320, P_FLOAT(&ctrl_axes[CTRL_ROLL].kp, 1, 0, 100),
+            .name = "ctrl.roll.kp", .unit = "V/(rad/s)",
+            .help = "Roll rate proportional gain"
+    },
+
+    {  321, P_FLOAT(&ctrl_axes[CTRL_ROLL].ki, 0, 0, 1000),
+            .name = "ctrl.roll.ki", .unit = "V/rad",
+            .help = "Roll rate integral gain"
+    },
+
+    {  322, P_FLOAT(&ctrl_axes[CTRL_ROLL].kd, 0, 0, 10),
+            .name = "ctrl.roll.kd", .unit = "V/(rad/s^2)",
+            .help = "Roll rate derivative gain, on the measured rate only"
+    },
+
+    {  323, P_FLOAT(&ctrl_axes[CTRL_ROLL].kff, 0, 0, 100),
+            .name = "ctrl.roll.kff", .unit = "V/(rad/s)",
+            .help = "Roll rate setpoint feed-forward"
+    },
+
+    {  324, P_FLOAT(&ctrl_axes[CTRL_ROLL].i_max, 2, 0, 10),
+            .name = "ctrl.roll.i_max", .unit = "V",
+            .help = "Roll rate integrator limit"
+    },
+
+    {  325, P_FLOAT(&ctrl_axes[CTRL_ROLL].angle_kp, 4, 0, 50),
+            .name = "ctrl.roll.angle_kp", .unit = "1/s",
+            .help = "Roll angle gain, rate setpoint per angle error"
+    },
+
+    {  330, P_FLOAT(&ctrl_axes[CTRL_PITCH].kp, 1, 0, 100),
+            .name = "ctrl.pitch.kp", .unit = "V/(rad/s)",
+            .help = "Pitch rate proportional gain"
+    },
+
+    {  331, P_FLOAT(&ctrl_axes[CTRL_PITCH].ki, 0, 0, 1000),
+            .name = "ctrl.pitch.ki", .unit = "V/rad",
+            .help = "Pitch rate integral gain"
+    },
+
+    {  332, P_FLOAT(&ctrl_axes[CTRL_PITCH].kd, 0, 0, 10),
+            .name = "ctrl.pitch.kd", .unit = "V/(rad/s^2)",
+            .help = "Pitch rate derivative gain, on the measured rate only"
+    },
+
+    {  333, P_FLOAT(&ctrl_axes[CTRL_PITCH].kff, 0, 0, 100),
+            .name = "ctrl.pitch.kff", .unit = "V/(rad/s)",
+            .help = "Pitch rate setpoint feed-forward"
+    },
+
+    {  334, P_FLOAT(&ctrl_axes[CTRL_PITCH].i_max, 2, 0, 10),
+            .name = "ctrl.pitch.i_max", .unit = "V",
+            .help = "Pitch rate integrator limit"
+    },
+
+    {  335, P_FLOAT(&ctrl_axes[CTRL_PITCH].angle_kp, 4, 0, 50),
+            .name = "ctrl.pitch.angle_kp", .unit = "1/s",
+            .help = "Pitch angle gain, rate setpoint per angle error"
+    },
+
+    {  340, P_FLOAT(&ctrl_axes[CTRL_YAW].kp, 1, 0, 100),
+            .name = "ctrl.yaw.kp", .unit = "V/(rad/s)",
+            .help = "Yaw rate proportional gain"
+    },
+
+    {  341, P_FLOAT(&ctrl_axes[CTRL_YAW].ki, 0, 0, 1000),
+            .name = "ctrl.yaw.ki", .unit = "V/rad",
+            .help = "Yaw rate integral gain"
+    },
+
+    {  342, P_FLOAT(&ctrl_axes[CTRL_YAW].kd, 0, 0, 10),
+            .name = "ctrl.yaw.kd", .unit = "V/(rad/s^2)",
+            .help = "Yaw rate derivative gain, on the measured rate only"
+    },
+
+    {  343, P_FLOAT(&ctrl_axes[CTRL_YAW].kff, 0, 0, 100),
+            .name = "ctrl.yaw.kff", .unit = "V/(rad/s)",
+            .help = "Yaw rate setpoint feed-forward"
+    },
+
+    {  344, P_FLOAT(&ctrl_axes[CTRL_YAW].i_max, 2, 0, 10),
+            .name = "ctrl.yaw.i_max", .unit = "V",
+            .help = "Yaw rate integrator limit"
+    },
+
+    // Motor mixer
+    //
+    {  350, P_INT32(&mixer_config.frame, MIXER_QUAD_X, 0, MIXER_FRAME_MAX),
+            .name = "mixer.frame",
+            .help = "Frame type:\n"
+                    "  0: Quad X\n"
+                    "  1: Quad +\n"
+                    "  2: Hex X\n"
+                    "  3: Octo X\n"
+                    "  4: Custom, see mixer.m*\n"
+    },
+
+    {  351, P_INT32(&mixer_config.custom.motors, 4, 1, MIXER_MAX_MOTORS),
+            .name = "mixer.motors",
+            .help = "Number of motors of the custom frame"
+    },
+
+    {  352, P_FLOAT(&mixer_config.u_min, 1, 0, 25),
+            .name = "mixer.u_min", .unit = "V",
+            .help = "Minimum motor voltage while armed"
+    },
+
+    {  353, P_FLOAT(&mixer_config.u_max, 10, 0, 25),
+            .name = "mixer.u_max", .unit = "V",
+            .help = "Maximum motor voltage"
+    },
+
+    // Custom mixing matrix, roll/pitch/yaw coefficients per motor
+    //
+    {  360, P_FLOAT(&mixer_config.custom.m[0][0], 0, -1, 1), .name = "mixer.m0.roll" },
+    {  361, P_FLOAT(&mixer_config.custom.m[0][1], 0, -1, 1), .name = "mixer.m0.pitch" },
+    {  362, P_FLOAT(&mixer_config.custom.m[0][2], 0, -1, 1), .name = "mixer.m0.yaw" },
+
+    {  364, P_FLOAT(&mixer_config.custom.m[1][0], 0, -1, 1), .name = "mixer.m1.roll" },
+    {  365, P_FLOAT(&mixer_config.custom.m[1][1], 0, -1, 1), .name = "mixer.m1.pitch" },
+    {  366, P_FLOAT(&mixer_config.custom.m[1][2], 0, -1, 1), .name = "mixer.m1.yaw" },
+
+    {  368, P_FLOAT(&mixer_config.custom.m[2][0], 0, -1, 1), .name = "mixer.m2.roll" },
+    {  369, P_FLOAT(&mixer_config.custom.m[2][1], 0, -1, 1), .name = "mixer.m2.pitch" },
+    {  370, P_FLOAT(&mixer_config.custom.m[2][2], 0, -1, 1), .name = "mixer.m2.yaw" },
+
+    {  372, P_FLOAT(&mixer_config.custom.m[3][0], 0, -1, 1), .name = "mixer.m3.roll" },
+    {  373, P_FLOAT(&mixer_config.custom.m[3][1], 0, -1, 1), .name = "mixer.m3.pitch" },
+    {  374, P_FLOAT(&mixer_config.custom.m[3][2], 0, -1, 1), .name = "mixer.m3.yaw" },
+
+    {  376, P_FLOAT(&mixer_config.custom.m[4][0], 0, -1, 1), .name = "mixer.m4.roll" },
+    {  377, P_FLOAT(&mixer_config.custom.m[4][1], 0, -1, 1), .name = "mixer.m4.pitch" },
+    {  378, P_FLOAT(&mixer_config.custom.m[4][2], 0, -1, 1), .name = "mixer.m4.yaw" },
+
+    {  380, P_FLOAT(&mixer_config.custom.m[5][0], 0, -1, 1), .name = "mixer.m5.roll" },
+    {  381, P_FLOAT(&mixer_config.custom.m[5][1], 0, -1, 1), .name = "mixer.m5.pitch" },
+    {  382, P_FLOAT(&mixer_config.custom.m[5][2], 0, -1, 1), .name = "mixer.m5.yaw" },
+
+    {  384, P_FLOAT(&mixer_config.custom.m[6][0], 0, -1, 1), .name = "mixer.m6.roll" },
+    {  385, P_FLOAT(&mixer_config.custom.m[6][1], 0, -1, 1), .name = "mixer.m6.pitch" },
+    {  386, P_FLOAT(&mixer_config.custom.m[6][2], 0, -1, 1), .name = "mixer.m6.yaw" },
+
+    {  388, P_FLOAT(&mixer_config.custom.m[7][0], 0, -1, 1), .name = "mixer.m7.roll" },
+    {  389, P_FLOAT(&mixer_config.custom.m[7][1], 0, -1, 1), .name = "mixer.m7.pitch" },
+    {  390, P_FLOAT(&mixer_config.custom.m[7][2], 0, -1, 1), .name = "mixer.m7.yaw" },
+
+    // Thrust linearisation
+    //
+    {  399, P_FLOAT(&thrust_config.rpm_ref, 7420, 100, 50000),
+            .name = "thrust.rpm_ref", .unit = "rpm",
+            .help = "Measured motor speed at full thrust"
+    },
+    {  400, P_INT32(&thrust_config.linearize, 0, 0, 1),
+            .name = "thrust.linearize",
+            .help = "Linearize thrust over motor voltage"
+    },
+    {  401, P_FLOAT(&thrust_config.u_ref, 11.1, 1, 25),
+            .name = "thrust.u_ref", .unit = "V",
+            .help = "Command for full thrust"
+    },
+
+    // Thrust curve per motor, f(r) = (1-expo) r + expo r^2
+    //
+    {  402, P_FLOAT(&thrust_config.curve[0].expo, 0.7, 0, 1), .name = "thrust.m0.expo" },
+    {  403, P_FLOAT(&thrust_config.curve[0].u_0,  0.5, 0, 5), .name = "thrust.m0.u_0", .unit = "V" },
+    {  404, P_FLOAT(&thrust_config.curve[1].expo, 0.7, 0, 1), .name = "thrust.m1.expo" },
+    {  405, P_FLOAT(&thrust_config.curve[1].u_0,  0.5, 0, 5), .name = "thrust.m1.u_0", .unit = "V" },
+    {  406, P_FLOAT(&thrust_config.curve[2].expo, 0.7, 0, 1), .name = "thrust.m2.expo" },
+    {  407, P_FLOAT(&thrust_config.curve[2].u_0,  0.5, 0, 5), .name = "thrust.m2.u_0", .unit = "V" },
+    {  408, P_FLOAT(&thrust_config.curve[3].expo, 0.7, 0, 1), .name = "thrust.m3.expo" },
+    {  409, P_FLOAT(&thrust_config.curve[3].u_0,  0.5, 0, 5), .name = "thrust.m3.u_0", .unit = "V" },
 
     // Debug DAC outputs
     //
@@ -132,6 +360,126 @@ const struct param_info  param_table[] = {
             .help = "Offset for DAC channel 1"
     },
 
+    // Blackbox, log every n-th frame of the rate loop, 0: off
+    //
+    {  430, P_INT32(&blackbox_config.enable, 0, 0, 1),
+            .name = "blackbox.enable",
+            .help = "Log while armed"
+    },
+    {  431, P_INT32(&blackbox_config.div[BB_RATE], 4, 0, 255),
+            .name = "blackbox.rate",
+            .help = "Angular rates"
+    },
+    {  432, P_INT32(&blackbox_config.div[BB_RATE_SP], 4, 0, 255),
+            .name = "blackbox.rate_sp",
+            .help = "Rate setpoints"
+    },
+    {  433, P_INT32(&blackbox_config.div[BB_PID], 20, 0, 255),
+            .name = "blackbox.pid",
+            .help = "PID terms"
+    },
+    {  434, P_INT32(&blackbox_config.div[BB_MOTOR_U], 20, 0, 255),
+            .name = "blackbox.motor_u",
+            .help = "Motor voltages"
+    },
+    {  435, P_INT32(&blackbox_config.div[BB_MOTOR_RPM], 20, 0, 255),
+            .name = "blackbox.motor_rpm",
+            .help = "Motor speeds"
+    },
+    {  436, P_INT32(&blackbox_config.div[BB_ACC], 20, 0, 255),
+            .name = "blackbox.acc",
+            .help = "Accelerometer"
+    },
+    {  437, P_INT32(&blackbox_config.div[BB_EULER], 100, 0, 255),
+            .name = "blackbox.euler",
+            .help = "Attitude"
+    },
+    {  438, P_INT32(&blackbox_config.div[BB_POWER], 200, 0, 255),
+            .name = "blackbox.power",
+            .help = "Battery voltage and thrust"
+    },
+
+    // System identification
+    //
+    {  440, P_INT32(&sysid_config.axis, CTRL_ROLL, CTRL_ROLL, CTRL_YAW),
+            .name = "sysid.axis",
+            .help = "0: roll, 1: pitch, 2: yaw"
+    },
+    {  441, P_INT32(&sysid_config.signal, SYSID_CHIRP, 0, SYSID_SIGNAL_MAX),
+            .name = "sysid.signal",
+            .help = "0: chirp, 1: PRBS"
+    },
+    {  442, P_INT32(&sysid_config.inject, SYSID_OUTPUT, 0, SYSID_INJECT_MAX),
+            .name = "sysid.inject",
+            .help = "0: rate setpoint, 1: controller output"
+    },
+    {  443, P_FLOAT(&sysid_config.amplitude, 0.5, 0, 5),
+            .name = "sysid.amplitude", .unit = "V, rad/s",
+            .help = "Excitation amplitude"
+    },
+    {  444, P_FLOAT(&sysid_config.f_start, 1, 0.1, 500),
+            .name = "sysid.f_start", .unit = "Hz",
+            .help = "Chirp start frequency"
+    },
+    {  445, P_FLOAT(&sysid_config.f_end, 100, 0.1, 500),
+            .name = "sysid.f_end", .unit = "Hz",
+            .help = "Chirp end frequency"
+    },
+    {  446, P_FLOAT(&sysid_config.duration, 4, 0.1, 60),
+            .name = "sysid.duration", .unit = "s",
+            .help = "Chirp duration, limited by the buffer"
+    },
+    {  447, P_INT32(&sysid_config.prbs_order, 9, 5, 12),
+            .name = "sysid.prbs_order",
+            .help = "PRBS length 2^n - 1"
+    },
+    {  448, P_INT32(&sysid_config.prbs_hold, 2, 1, 100),
+            .name = "sysid.prbs_hold",
+            .help = "Loop cycles per PRBS bit"
+    },
+
+    // Relay feedback auto-tuner
+    //
+    {  450, P_FLOAT(&autotune_config.relay, 0.5, 0.05, 5),
+            .name = "autotune.relay", .unit = "V",
+            .help = "Relay amplitude"
+    },
+    {  451, P_FLOAT(&autotune_config.hysteresis, 0.05, 0, 1),
+            .name = "autotune.hysteresis", .unit = "rad/s",
+            .help = "Relay hysteresis, above the gyro noise"
+    },
+    {  452, P_INT32(&autotune_config.rule, AUTOTUNE_PI, 0, AUTOTUNE_RULE_MAX),
+            .name = "autotune.rule",
+            .help = "0: PI, 1: PID"
+    },
+    {  453, P_FLOAT(&autotune_config.rate_max, 3, 0.1, 20),
+            .name = "autotune.rate_max", .unit = "rad/s",
+            .help = "Abort above this rate"
+    },
+    {  454, P_FLOAT(&autotune_config.stick, 0.1, 0, 1),
+            .name = "autotune.stick",
+            .help = "Abort above this stick input"
+    },
+    {  455, P_FLOAT(&autotune_config.max_change, 4, 1, 100),
+            .name = "autotune.max_change",
+            .help = "Maximum gain change, factor"
+    },
+
+    // Motor noise notch filters
+    //
+    {  460, P_INT32(&rpm_notch_config.harmonics, 1, 0, RPM_NOTCH_HARMONICS),
+            .name = "rpm_notch.harmonics",
+            .help = "Notches per motor, 0: off"
+    },
+    {  461, P_FLOAT(&rpm_notch_config.q, 3, 0.5, 20),
+            .name = "rpm_notch.q",
+            .help = "Centre frequency / bandwidth"
+    },
+    {  462, P_FLOAT(&rpm_notch_config.f_min, 60, 10, 400),
+            .name = "rpm_notch.f_min", .unit = "Hz",
+            .help = "Lowest notch frequency"
+    },
+
     {  500, P_INT32(&ws2812_brightness, 128, 0, 255),
             .name = "ws2812_brightness",
             .help = "Overall brightness for WS2128 leds. Adjust this parameter "
@@ -140,6 +488,239 @@ const struct param_info  param_table[] = {
 
     {  600, P_FLOAT(&sensor_calib.gyro_offset.z) },
 
+    {  610, P_INT32(&mpu9150_config.dlpf_cfg, 0, 0, 6),
+            .name = "mpu9150.dlpf_cfg",
+            .help = "MPU9150 low pass filter (requires reboot):\n"
+                    "  0: 256 Hz, 8 kHz gyro rate\n"
+                    "  1: 188 Hz,   2: 98 Hz,  3: 42 Hz\n"
+                    "  4:  20 Hz,   5: 10 Hz,  6:  5 Hz\n"
+    },
+
+    {  611, P_INT32(&mpu9150_config.smplrt_div, 0, 0, 255),
+            .name = "mpu9150.smplrt_div",
+            .help = "MPU9150 sample rate divider (requires reboot)"
+    },
+
+    {  612, P_INT32(&mpu9150_config.fifo_enable, 0, 0, 1),
+            .name = "mpu9150.fifo_enable",
+            .help = "Oversample the gyro through the FIFO (requires reboot). "
+                    "More than 4 kHz will saturate the I2C bus."
+    },
+
+    {  613, P_INT32(&mpu9150_config.auto_range, 1, 0, 1),
+            .name = "mpu9150.auto_range",
+            .help = "Select the finest gyro/acc range which doesn't clip. "
+                    "Otherwise 2000 dps and 8 g are used."
+    },
+
+    {  614, P_INT32(&mpu9150_config.range_hold, 1000, 10, 60000),
+            .name = "mpu9150.range_hold", .unit = "ms",
+            .help = "Time without peaks before switching to a finer range"
+    },
+
+    {  620, P_INT32(&sensor_config.gyro_decim, SENSOR_DECIM_FIR, 0, 2),
+            .name = "sensor.gyro_decim",
+            .help = "Gyro decimation filter (requires reboot):\n"
+                    "  0: None, use latest sample\n"
+                    "  1: Windowed-sinc FIR\n"
+                    "  2: CIC\n"
+    },
+
+    {  621, P_INT32(&sensor_config.gyro_fir_taps, 16, 1, FIR_MAX_TAPS),
+            .name = "sensor.gyro_fir_taps",
+            .help = "Number of FIR decimation filter taps (requires reboot)"
+    },
+
+    {  622, P_INT32(&sensor_config.gyro_cic_order, 2, 1, CIC_MAX_ORDER),
+            .name = "sensor.gyro_cic_order",
+            .help = "Order of the CIC decimation filter (requires reboot)"
+    },
+
+    {  623, P_INT32(&sensor_config.imu, SENSOR_IMU_MPU9150, 0, SENSOR_IMU_MOCK),
+            .name = "sensor.imu",
+            .help = "Select the inertial sensor (requires reboot):\n"
+                    "  0: MPU9150 (I2C)\n"
+                    "  1: MPU6000 (SPI3, CS on PD2)\n"
+                    "  2: Mock sensor, no hardware access\n"
+    },
+
+    {  630, P_FLOAT(&altitude_config.qnh, STANDARD_PRESSURE, 800, 1100),
+            .name = "altitude.qnh", .unit = "hPa",
+            .help = "Sea level pressure for the altitude (QNH)"
+    },
+
+    {  631, P_FLOAT(&altitude_config.qfe, 0, 0, 1100), NOEEPROM,
+            .name = "altitude.qfe", .unit = "hPa",
+            .help = "Field pressure for the height (QFE). "
+                    "Set on the first reading after reset, or by alt_zero."
+    },
+
+    {  632, P_FLOAT(&altitude_config.tau, 2, 0.1, 100),
+            .name = "altitude.tau", .unit = "s",
+            .help = "Baro/accelerometer crossover time constant"
+    },
+
+    {  640, P_INT32(&attitude_config.estimator, ATTITUDE_MAHONY, 0, ATTITUDE_EKF),
+            .name = "attitude.estimator",
+            .help = "Select the attitude estimator:\n"
+                    "  0: Direction cosine matrix\n"
+                    "  1: Quaternion (Mahony)\n"
+                    "  2: Extended Kalman filter\n"
+    },
+
+    {  641, P_FLOAT(&mahony.acc_kp, 1, 0, 100),
+            .name = "mahony.acc_kp",
+            .help = "Accelerometer correction p gain"
+    },
+
+    {  642, P_FLOAT(&mahony.acc_ki, 0.001, 0, 1),
+            .name = "mahony.acc_ki",
+            .help = "Accelerometer correction i gain"
+    },
+
+    {  643, P_FLOAT(&mahony.mag_kp, 0, 0, 100),
+            .name = "mahony.mag_kp",
+            .help = "Magnetometer heading correction p gain (0: off)"
+    },
+
+    {  644, P_FLOAT(&mahony.mag_ki, 0, 0, 1),
+            .name = "mahony.mag_ki",
+            .help = "Magnetometer heading correction i gain"
+    },
+
+    {  645, P_FLOAT(&dcm.mag_kp, 0, 0, 100),
+            .name = "dcm.mag_kp",
+            .help = "Magnetometer heading correction p gain (0: off)"
+    },
+
+    {  646, P_FLOAT(&dcm.mag_ki, 0, 0, 1),
+            .name = "dcm.mag_ki",
+            .help = "Magnetometer heading correction i gain"
+    },
+
+    {  647, P_INT32(&attitude_config.decim, 1, 1, 10),
+            .name = "attitude.decim",
+            .help = "IMU samples per estimator update"
+    },
+
+    {  648, P_INT32(&attitude_config.coning, 1, 0, 1),
+            .name = "attitude.coning",
+            .help = "Coning compensation of the gyro integration"
+    },
+
+    {  650, P_FLOAT(&ekf.gyro_noise, 1e-3, 0, 1),
+            .name = "ekf.gyro_noise", .unit = "rad/s/sqrt(Hz)",
+            .help = "Gyro noise density"
+    },
+
+    {  651, P_FLOAT(&ekf.bias_noise, 1e-5, 0, 1),
+            .name = "ekf.bias_noise", .unit = "rad/s^2/sqrt(Hz)",
+            .help = "Gyro bias random walk"
+    },
+
+    {  652, P_FLOAT(&ekf.acc_noise, 0.05, 0.001, 1),
+            .name = "ekf.acc_noise", .unit = "rad",
+            .help = "Accelerometer direction noise"
+    },
+
+    {  653, P_FLOAT(&ekf.mag_noise, 0, 0, 10),
+            .name = "ekf.mag_noise", .unit = "rad",
+            .help = "Magnetometer heading noise (0: off)"
+    },
+
+    {  700, P_INT32(&gyro_tempco.enable, 1, 0, 1),
+            .name = "gyro_tempco.enable",
+            .help = "Apply the gyro bias temperature model"
+    },
+
+    {  701, P_INT32(&gyro_tempco.learn, 1, 0, 1),
+            .name = "gyro_tempco.learn",
+            .help = "Learn the gyro bias model while stationary"
+    },
+
+    {  702, P_FLOAT(&gyro_tempco.t_min, 15, -40, 85),
+            .name = "gyro_tempco.t_min", .unit = "C",
+            .help = "Temperature of the first model node. "
+                    "Reset the model (gyro_tempco -r) after changing it."
+    },
+
+    {  703, P_FLOAT(&gyro_tempco.t_step, 5, 1, 20),
+            .name = "gyro_tempco.t_step", .unit = "K",
+            .help = "Temperature spacing of the model nodes. "
+                    "Reset the model (gyro_tempco -r) after changing it."
+    },
+
+    {  704, P_FLOAT(&gyro_tempco.acc_std_max, 0.05, 0, 1),
+            .name = "gyro_tempco.acc_std_max", .unit = "m/s^2",
+            .help = "Maximum |acc| standard deviation for stationary detection"
+    },
+
+    {  705, P_FLOAT(&gyro_tempco.gyro_std_max, 0.005, 0, 1),
+            .name = "gyro_tempco.gyro_std_max", .unit = "rad/s",
+            .help = "Maximum gyro standard deviation for stationary detection"
+    },
+
+    {  710, P_FLOAT(&gyro_tempco.bias[0].x, 0) },
+    {  711, P_FLOAT(&gyro_tempco.bias[0].y, 0) },
+    {  712, P_FLOAT(&gyro_tempco.bias[0].z, 0) },
+    {  713, P_FLOAT(&gyro_tempco.weight[0], 0) },
+    {  714, P_FLOAT(&gyro_tempco.bias[1].x, 0) },
+    {  715, P_FLOAT(&gyro_tempco.bias[1].y, 0) },
+    {  716, P_FLOAT(&gyro_tempco.bias[1].z, 0) },
+    {  717, P_FLOAT(&gyro_tempco.weight[1], 0) },
+    {  718, P_FLOAT(&gyro_tempco.bias[2].x, 0) },
+    {  719, P_FLOAT(&gyro_tempco.bias[2].y, 0) },
+    {  720, P_FLOAT(&gyro_tempco.bias[2].z, 0) },
+    {  721, P_FLOAT(&gyro_tempco.weight[2], 0) },
+    {  722, P_FLOAT(&gyro_tempco.bias[3].x, 0) },
+    {  723, P_FLOAT(&gyro_tempco.bias[3].y, 0) },
+    {  724, P_FLOAT(&gyro_tempco.bias[3].z, 0) },
+    {  725, P_FLOAT(&gyro_tempco.weight[3], 0) },
+    {  726, P_FLOAT(&gyro_tempco.bias[4].x, 0) },
+    {  727, P_FLOAT(&gyro_tempco.bias[4].y, 0) },
+    {  728, P_FLOAT(&gyro_tempco.bias[4].z, 0) },
+    {  729, P_FLOAT(&gyro_tempco.weight[4], 0) },
+    {  730, P_FLOAT(&gyro_tempco.bias[5].x, 0) },
+    {  731, P_FLOAT(&gyro_tempco.bias[5].y, 0) },
+    {  732, P_FLOAT(&gyro_tempco.bias[5].z, 0) },
+    {  733, P_FLOAT(&gyro_tempco.weight[5], 0) },
+    {  734, P_FLOAT(&gyro_tempco.bias[6].x, 0) },
+    {  735, P_FLOAT(&gyro_tempco.bias[6].y, 0) },
+    {  736, P_FLOAT(&gyro_tempco.bias[6].z, 0) },
+    {  737, P_FLOAT(&gyro_tempco.weight[6], 0) },
+    {  738, P_FLOAT(&gyro_tempco.bias[7].x, 0) },
+    {  739, P_FLOAT(&gyro_tempco.bias[7].y, 0) },
+    {  740, P_FLOAT(&gyro_tempco.bias[7].z, 0) },
+    {  741, P_FLOAT(&gyro_tempco.weight[7], 0) },
+
+    // Ellipsoid calibration, see sensor_calibrate
+    //
+    {  800, P_FLOAT(&sensor_calib.acc_offset.x, 0) },
+    {  801, P_FLOAT(&sensor_calib.acc_offset.y, 0) },
+    {  802, P_FLOAT(&sensor_calib.acc_offset.z, 0) },
+    {  803, P_FLOAT(&sensor_calib.acc_matrix.m00, 1) },
+    {  804, P_FLOAT(&sensor_calib.acc_matrix.m01, 0) },
+    {  805, P_FLOAT(&sensor_calib.acc_matrix.m02, 0) },
+    {  806, P_FLOAT(&sensor_calib.acc_matrix.m10, 0) },
+    {  807, P_FLOAT(&sensor_calib.acc_matrix.m11, 1) },
+    {  808, P_FLOAT(&sensor_calib.acc_matrix.m12, 0) },
+    {  809, P_FLOAT(&sensor_calib.acc_matrix.m20, 0) },
+    {  810, P_FLOAT(&sensor_calib.acc_matrix.m21, 0) },
+    {  811, P_FLOAT(&sensor_calib.acc_matrix.m22, 1) },
+
+    {  820, P_FLOAT(&sensor_calib.mag_offset.x, 0) },
+    {  821, P_FLOAT(&sensor_calib.mag_offset.y, 0) },
+    {  822, P_FLOAT(&sensor_calib.mag_offset.z, 0) },
+    {  823, P_FLOAT(&sensor_calib.mag_matrix.m00, 1) },
+    {  824, P_FLOAT(&sensor_calib.mag_matrix.m01, 0) },
+    {  825, P_FLOAT(&sensor_calib.mag_matrix.m02, 0) },
+    {  826, P_FLOAT(&sensor_calib.mag_matrix.m10, 0) },
+    {  827, P_FLOAT(&sensor_calib.mag_matrix.m11, 1) },
+    {  828, P_FLOAT(&sensor_calib.mag_matrix.m12, 0) },
+    {  829, P_FLOAT(&sensor_calib.mag_matrix.m20, 0) },
+    {  830, P_FLOAT(&sensor_calib.mag_matrix.m21, 0) },
+    {  831, P_FLOAT(&sensor_calib.mag_matrix.m22, 1) },
+
     { 1000, P_FLOAT(&bldc_state.motors[0].u_d, 0, -25, 25 ), NOEEPROM },
     { 1001, P_FLOAT(&bldc_state.motors[0].u_pwm, 0, -25, 25 ), NOEEPROM },
     { 1004, P_INT32(&bldc_state.motors[0].step, 0, 0, 7), NOEEPROM },
@@ -0,0 +1,181 @@
+#include "ram_disk.h"
+#include "diskio.h"
+#include <string.h>
+
+#define RAM_DISK_SIZE   (RAM_DISK_SECTORS * RAM_DISK_SECTOR_SIZE)
+
+#define ROOT_ENTRIES    16      // one sector
+#define FAT_SECTORS     ((((RAM_DISK_SECTORS + 2) * 3 / 2) + RAM_DISK_SECTOR_SIZE - 1) / RAM_DISK_SECTOR_SIZE)
+
+/**
+ * RAM disk for FatFs
+ *
+ * The disk is in the CCM RAM, which is not cleared by the
+ * startup code. Files survive a watchdog or software reset,
+ * and are only lost on power down.
+ *
+ * The volume is too small for f_mkfs(), which needs at least
+ * 128 sectors. ram_disk_format() writes a FAT12 file system
+ * with one sector per cluster instead.
+ *
+ */
+static uint8_t  disk[RAM_DISK_SIZE] __attribute__((section(".ccmbss"), aligned(4)));
+static DSTATUS  disk_stat = STA_NOINIT;
+
+
+static void put_word(uint8_t *p, uint16_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+
+void ram_disk_format(void)
+{
+    memset(disk, 0, RAM_DISK_SIZE);
+
+    uint8_t *bs = &disk[0];
+
+    memcpy(&bs[0], "\xEB\x3C\x90" "DRQUAD32", 11);
+    put_word(&bs[11], RAM_DISK_SECTOR_SIZE);    // bytes per sector
+    bs[13] = 1;                                 // sectors per cluster
+    put_word(&bs[14], 1);                       // reserved sectors
+    bs[16] = 1;                                 // number of FATs
+    put_word(&bs[17], ROOT_ENTRIES);
+    put_word(&bs[19], RAM_DISK_SECTORS);        // total sectors
+    bs[21] = 0xF8;                              // media type
+    put_word(&bs[22], FAT_SECTORS);
+    put_word(&bs[24], 1);                       // sectors per track
+    put_word(&bs[26], 1);                       // heads
+    bs[36] = 0x80;                              // drive number
+    bs[38] = 0x29;                              // extended boot signature
+    memcpy(&bs[43], "BLACKBOX   " "FAT12   ", 19);
+    put_word(&bs[510], 0xAA55);
+
+    // Media type and end of chain for the two reserved clusters
+    //
+    uint8_t *fat = &disk[RAM_DISK_SECTOR_SIZE];
+    fat[0] = 0xF8;
+    fat[1] = 0xFF;
+    fat[2] = 0xFF;
+}
+
+
+uint8_t *ram_disk_data(int *len)
+{
+    *len = RAM_DISK_SIZE;
+    return disk;
+}
+
+
+DSTATUS disk_initialize(BYTE pdrv)
+{
+    if (pdrv != 0)
+        return STA_NOINIT;
+
+    if (disk[510] != 0x55 || disk[511] != 0xAA)
+        ram_disk_format();
+
+    disk_stat = 0;
+    return disk_stat;
+}
+
+
+DSTATUS disk_status(BYTE pdrv)
+{
+    return pdrv == 0 ? disk_stat : STA_NOINIT;
+}
+
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    if (pdrv != 0 || sector + count > RAM_DISK_SECTORS)
+        return RES_PARERR;
+
+    memcpy(buff, &disk[sector * RAM_DISK_SECTOR_SIZE], count * RAM_DISK_SECTOR_SIZE);
+    return RES_OK;
+}
+
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    if (pdrv != 0 || sector + count > RAM_DISK_SECTORS)
+        return RES_PARERR;
+
+    memcpy(&disk[sector * RAM_DISK_SECTOR_SIZE], buff, count * RAM_DISK_SECTOR_SIZE);
+    return RES_OK;
+}
+
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+    if (pdrv != 0)
+        return RES_PARERR;
+
+    switch (cmd) {
+    case CTRL_SYNC:
+        return RES_OK;
+
+    case GET_SECTOR_COUNT:
+        *(DWORD*)buff = RAM_DISK_SECTORS;
+        return RES_OK;
+
+    case GET_SECTOR_SIZE:
+        *(WORD*)buff = RAM_DISK_SECTOR_SIZE;
+        return RES_OK;
+
+    case GET_BLOCK_SIZE:
+        *(DWORD*)buff = 1;
+        return RES_OK;
+
+    default:
+        return RES_PARERR;
+    }
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+#include <stdio.h>
+
+/**
+ * The dump has the same format as the sensor capture.
+ * See Tools/blackbox_decode.
+ *
+ */
+static void cmd_ram_disk_dump(void)
+{
+    printf("# ram disk, %d bytes\n", RAM_DISK_SIZE);
+
+    for (int i=0; i<RAM_DISK_SIZE; i+=32) {
+        // Skip unused sectors
+        //
+        if (i % RAM_DISK_SECTOR_SIZE == 0) {
+            int used = 0;
+            for (int j=i; j<i+RAM_DISK_SECTOR_SIZE; j++)
+                used |= disk[j];
+
+            if (!used) {
+                i += RAM_DISK_SECTOR_SIZE - 32;
+                continue;
+            }
+        }
+
+        printf(":%05x ", i);
+        for (int j=i; j<i+32; j++)
+            printf("%02x", disk[j]);
+        printf("\n");
+
+        if (stdin_chars_avail()) {
+            printf("# aborted\n");
+            return;
+        }
+    }
+
+    printf("# end\n");
+}
+
+
+SHELL_CMD(ram_disk_dump, (cmdfunc_t)cmd_ram_disk_dump, "Dump the RAM disk")
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+#define RAM_DISK_SECTOR_SIZE    512
+#define RAM_DISK_SECTORS        64
+
+uint8_t *ram_disk_data(int *len);
+void     ram_disk_format(void);
@@ -2,6 +2,7 @@
 #include "rc_ppm.h"
 #include "rc_dsm2.h"
 #include "rc_sbus.h"
+#include "rc_pc.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -19,6 +20,7 @@ static const char *rc_strmode(int mode)
     case RC_MODE_SERVO: return "SERVO";
     case RC_MODE_DSM2:  return "DSM2";
     case RC_MODE_SBUS:  return "SBUS";
+    case RC_MODE_PC:    return "PC";
     default:            return "Unknown";
     }
 }
@@ -30,6 +32,7 @@ void rc_update(struct rc_input *rc)
     case RC_MODE_PPM:   rc_ppm_update(rc);  break;
     case RC_MODE_DSM2:  rc_dsm2_update(rc); break;
     case RC_MODE_SBUS:  rc_sbus_update(rc); break;
+    case RC_MODE_PC:    rc_pc_update(rc);   break;
 //     case RC_MODE_SERVO: rc_dma_update(rc);  break;  //TODO
     case RC_MODE_NONE:
     default:
@@ -51,6 +54,7 @@ void rc_init(void)
     case RC_MODE_SERVO: /* TODO */      break;
     case RC_MODE_DSM2:  rc_dsm2_init(); break;
     case RC_MODE_SBUS:  rc_sbus_init(); break;
+    case RC_MODE_PC:    /* msg_rx_task */ break;
     default: break;
     }
 }
@@ -12,8 +12,9 @@ enum {
     RC_MODE_SERVO,
     RC_MODE_DSM2,
     RC_MODE_SBUS,
+    RC_MODE_PC,
 
-    RC_MODE_MAX = RC_MODE_SBUS
+    RC_MODE_MAX = RC_MODE_PC
 };
 
 
@@ -0,0 +1,282 @@
+/**
+ * Stick commands from the PC
+ *
+ * MSG_ID_SETPOINT messages from msg_rx_task() are converted
+ * to RC pulse widths. The flight controller handles them like
+ * any other receiver, including the arming switch on channel
+ * 5 and the failsafe.
+ *
+ * A message is only accepted if its sequence number is newer
+ * than the last one, and if it isn't older than max_age. The
+ * PC clock is not synchronized, so the age is measured against
+ * the fastest message: the smallest difference between the
+ * reception time and the PC time. This reference creeps up by
+ * AGE_CREEP per message to follow the clock drift.
+ *
+ * Without an accepted message for the failsafe timeout, the
+ * input becomes invalid and the motors are disarmed. The next
+ * message starts a new session with a new sequence number and
+ * age reference.
+ *
+ */
+#include "rc_pc.h"
+#include "seqlock.h"
+#include "ustime.h"
+#include "util.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <string.h>
+#include <math.h>
+
+#define AVG_ALPHA   0.01    // running average coefficient
+#define AGE_CREEP   5       // [us] per message
+
+struct rc_pc_config rc_pc_config = {
+    .timeout    = 100,
+    .max_age    = 50
+};
+
+struct rc_pc_stats rc_pc_stats;
+
+struct rc_pc_setpoint {
+    uint16_t    seq;
+    uint32_t    time;           // PC time [us]
+    uint32_t    t_rx;           // reception time [us]
+    TickType_t  tick;
+    int         arm;
+    float       roll, pitch, yaw, thrust;
+};
+
+// Written by msg_rx_task. The readers have a lower priority.
+//
+static struct seqlock           published_lock;
+static struct rc_pc_setpoint    published;
+static volatile int             have_setpoint;
+
+static int          session;
+static uint16_t     last_seq;
+static uint32_t     age_ref;
+static TickType_t   t_accepted;
+
+// Reader state
+//
+static uint16_t     used_seq;
+static int          was_valid;
+
+
+static void avg_max_update(float *avg, uint32_t *max, uint32_t x)
+{
+    *avg += (x - *avg) * AVG_ALPHA;
+
+    if (x > *max)
+        *max = x;
+}
+
+
+/**
+ * Handle a MSG_ID_SETPOINT message, called by msg_rx_task()
+ *
+ * \param t_rx  reception time [us]
+ * \returns 0, or -1 if the message is malformed
+ */
+int rc_pc_receive(const struct msg_header *msg, uint32_t t_rx)
+{
+    const struct msg_setpoint *m = (const struct msg_setpoint*)msg;
+
+    if (msg->data_len != sizeof(*m) - sizeof(m->h))
+        return -1;
+
+    if (!isfinite(m->roll) || !isfinite(m->pitch) || !isfinite(m->yaw) || !isfinite(m->thrust))
+        return -1;
+
+    rc_pc_stats.received++;
+
+    TickType_t t = xTaskGetTickCount();
+    if (t - t_accepted > rc_pc_config.timeout / portTICK_PERIOD_MS)
+        session = 0;
+
+    uint32_t delay = t_rx - m->time;
+
+    if (session) {
+        int16_t d = m->seq - last_seq;
+        if (d <= 0) {
+            rc_pc_stats.old++;
+            return 0;
+        }
+
+        rc_pc_stats.lost += d - 1;
+        age_ref += AGE_CREEP;
+    }
+    else {
+        session = 1;
+        age_ref = delay;
+    }
+
+    last_seq = m->seq;
+
+    if ((int32_t)(delay - age_ref) < 0)
+        age_ref = delay;
+
+    uint32_t age = delay - age_ref;
+    avg_max_update(&rc_pc_stats.age_avg, &rc_pc_stats.age_max, age);
+
+    if (age > rc_pc_config.max_age * 1000) {
+        rc_pc_stats.stale++;
+        return 0;
+    }
+
+    seqlock_write_begin(&published_lock);
+
+    published = (struct rc_pc_setpoint) {
+        .seq    = m->seq,
+        .time   = m->time,
+        .t_rx   = t_rx,
+        .tick   = t,
+        .arm    = m->flags & SETPOINT_ARM,
+        .roll   = m->roll,
+        .pitch  = m->pitch,
+        .yaw    = m->yaw,
+        .thrust = m->thrust
+    };
+
+    seqlock_write_end(&published_lock);
+
+    have_setpoint = 1;
+    t_accepted = t;
+
+    rc_pc_stats.accepted++;
+    avg_max_update(&rc_pc_stats.decode_avg, &rc_pc_stats.decode_max, get_us_time32() - t_rx);
+
+    return 0;
+}
+
+
+static void rc_pc_read(struct rc_pc_setpoint *s)
+{
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&published_lock);
+        *s = published;
+    } while (seqlock_read_retry(&published_lock, seq));
+}
+
+
+/**
+ * The pulse widths are the inverse of the stick mapping
+ * in flight_ctrl().
+ *
+ */
+void rc_pc_update(struct rc_input *rc)
+{
+    memset(rc, 0, sizeof(*rc));
+
+    if (!have_setpoint)
+        return;
+
+    struct rc_pc_setpoint s;
+    rc_pc_read(&s);
+
+    int valid = xTaskGetTickCount() - s.tick <= rc_pc_config.timeout / portTICK_PERIOD_MS;
+
+    if (was_valid && !valid)
+        rc_pc_stats.failsafes++;
+
+    was_valid = valid;
+
+    if (valid && s.seq != used_seq) {
+        used_seq = s.seq;
+        avg_max_update(&rc_pc_stats.use_avg, &rc_pc_stats.use_max, get_us_time32() - s.t_rx);
+    }
+
+    rc->timestamp    = s.tick;
+    rc->valid        = valid;
+    rc->rssi         = valid ? 100 : 0;
+    rc->num_channels = 6;
+
+    rc->channels[0] = lrintf(1500 + 500 * clamp(s.roll,   -1, 1));
+    rc->channels[1] = lrintf(1500 - 500 * clamp(s.pitch,  -1, 1));
+    rc->channels[2] = lrintf(2000 - 1000 * clamp(s.thrust, 0, 1));
+    rc->channels[3] = lrintf(1500 - 500 * clamp(s.yaw,    -1, 1));
+    rc->channels[4] = 1500;
+    rc->channels[5] = s.arm ? 1000 : 2000;
+}
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+#include "msg_rx.h"
+#include <stdio.h>
+
+
+static void send_ack_msg(void)
+{
+    struct msg_setpoint_ack msg;
+    struct rc_pc_setpoint s;
+
+    rc_pc_read(&s);
+
+    msg.h.id       = MSG_ID_SETPOINT_ACK;
+    msg.h.data_len = sizeof(msg) - sizeof(msg.h);
+
+    msg.seq      = s.seq;
+    msg.time     = s.time;
+    msg.hold     = get_us_time32() - s.t_rx;
+    msg.received = rc_pc_stats.received;
+    msg.lost     = rc_pc_stats.lost;
+    msg.stale    = rc_pc_stats.stale;
+    msg.errors   = msg_rx_stats.errors;
+
+    msg_send(&msg.h);
+}
+
+
+static void cmd_rc_pc_stats(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "-b")) {
+        while (!stdin_chars_avail()) {
+            if (have_setpoint)
+                send_ack_msg();
+
+            vTaskDelay(20);
+        }
+        return;
+    }
+    else if (argc == 2 && !strcmp(argv[1], "-r")) {
+        memset(&rc_pc_stats, 0, sizeof(rc_pc_stats));
+        memset((void*)&msg_rx_stats, 0, sizeof(msg_rx_stats));
+        return;
+    }
+    else if (argc != 1) {
+        goto usage;
+    }
+
+    const struct rc_pc_stats *st = &rc_pc_stats;
+    const volatile struct msg_rx_stats *rx = &msg_rx_stats;
+
+    printf("packets   : %10lu\n", rx->packets);
+    printf("errors    : %10lu\n", rx->errors);
+    printf("timeouts  : %10lu\n", rx->timeouts);
+    printf("overruns  : %10lu\n", rx->overruns);
+    printf("unknown   : %10lu\n", rx->unknown);
+    printf("\n");
+    printf("received  : %10lu\n", st->received);
+    printf("accepted  : %10lu\n", st->accepted);
+    printf("lost      : %10lu\n", st->lost);
+    printf("old       : %10lu\n", st->old);
+    printf("stale     : %10lu\n", st->stale);
+    printf("failsafes : %10lu\n", st->failsafes);
+    printf("\n");
+    printf("                avg        max\n");
+    printf("age       : %10.1f %10lu us\n", st->age_avg,    st->age_max);
+    printf("decode    : %10.1f %10lu us\n", st->decode_avg, st->decode_max);
+    printf("use       : %10.1f %10lu us\n", st->use_avg,    st->use_max);
+    return;
+
+usage:
+    printf("usage: %s [-b|-r]\n", argv[0]);
+}
+
+
+SHELL_CMD(rc_pc_stats, (cmdfunc_t)cmd_rc_pc_stats, "Show PC setpoint link statistics")
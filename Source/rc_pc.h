@@ -0,0 +1,32 @@
+#pragma once
+
+#include "rc_input.h"
+#include "msg_packet.h"
+
+struct rc_pc_config {
+    int     timeout;            // failsafe [ms]
+    int     max_age;            // [ms]
+};
+
+
+struct rc_pc_stats {
+    uint32_t    received;
+    uint32_t    accepted;
+    uint32_t    lost;           // sequence gaps
+    uint32_t    old;            // duplicate or reordered
+    uint32_t    stale;          // older than max_age
+    uint32_t    failsafes;
+
+    float       age_avg;        // delay above the fastest message [us]
+    uint32_t    age_max;
+    float       decode_avg;     // end-of-packet to published [us]
+    uint32_t    decode_max;
+    float       use_avg;        // end-of-packet to rc_pc_update() [us]
+    uint32_t    use_max;
+};
+
+extern struct rc_pc_config rc_pc_config;
+extern struct rc_pc_stats  rc_pc_stats;
+
+int  rc_pc_receive(const struct msg_header *msg, uint32_t t_rx);
+void rc_pc_update(struct rc_input *rc);
@@ -0,0 +1,143 @@
+#include "rpm_notch.h"
+#include "bldc_task.h"
+#include "filter.h"
+#include <string.h>
+#include <math.h>
+
+#define F_STEP      0.5         // [Hz] redesign threshold
+#define F_MAX       0.45        // highest notch frequency / fs
+
+/**
+ * Motor noise notch filters
+ *
+ * Each motor shakes the frame at its rotation frequency and
+ * the harmonics of it. The gyro picks this up, and the D-term
+ * amplifies it. A notch per motor and harmonic follows the
+ * measured rpm, so the noise is removed without the phase lag
+ * of a lower D-term cut-off.
+ *
+ * The three axes see the same frequencies. The coefficients
+ * are designed once for the roll filter and copied. They are
+ * only redesigned if the frequency has moved by more than
+ * F_STEP, which is small against the notch bandwidth.
+ *
+ * Below f_min, and when the motor is stopped, the notch is
+ * switched to a pass-through filter. The direct form I of
+ * lp2_filter() keeps its state across these changes.
+ *
+ */
+struct rpm_notch_config rpm_notch_config = {
+    .harmonics  = 1,
+    .q          = 3,
+    .f_min      = 60
+};
+
+struct rpm_notch {
+    float   f_c;                // [Hz] 0: pass-through
+    struct  lp2_filter axis[3];
+};
+
+static struct rpm_notch notches[RPM_NOTCH_MOTORS][RPM_NOTCH_HARMONICS];
+static float fs_active;
+static float q_active;
+
+
+static void notch_update(struct rpm_notch *n, float f, float fs)
+{
+    if (f < rpm_notch_config.f_min || f > F_MAX * fs)
+        f = 0;
+
+    if (f == n->f_c || (f && n->f_c && fabsf(f - n->f_c) < F_STEP))
+        return;
+
+    if (f)
+        notch_set_fc(&n->axis[0], f / fs, rpm_notch_config.q);
+    else
+        lp2_set_fc(&n->axis[0], FILTER_NONE, 0);
+
+    for (int i=1; i<3; i++) {
+        memcpy(n->axis[i].b, n->axis[0].b, sizeof(n->axis[i].b));
+        memcpy(n->axis[i].a, n->axis[0].a, sizeof(n->axis[i].a));
+    }
+
+    n->f_c = f;
+}
+
+
+/**
+ * Filter one new gyro sample in place
+ *
+ * \param rate  roll, pitch and yaw rate [rad/s]
+ * \param fs    gyro sample rate [Hz]
+ */
+void rpm_notch_filter(float rate[3], float fs)
+{
+    // Redesign everything if the parameters have changed
+    //
+    if (fs != fs_active || rpm_notch_config.q != q_active) {
+        for (int m=0; m<RPM_NOTCH_MOTORS; m++)
+            for (int h=0; h<RPM_NOTCH_HARMONICS; h++)
+                notches[m][h].f_c = -1;
+
+        fs_active = fs;
+        q_active  = rpm_notch_config.q;
+    }
+
+    for (int m=0; m<RPM_NOTCH_MOTORS; m++) {
+        float f = fabsf(bldc_state.motors[m].rpm_filter.y[0]) / 60;
+
+        for (int h=0; h<RPM_NOTCH_HARMONICS; h++) {
+            struct rpm_notch *n = &notches[m][h];
+
+            if (h >= rpm_notch_config.harmonics) {
+                // Keep the state up to date, so the notch
+                // can be switched on without a jump.
+                //
+                if (n->f_c)
+                    notch_update(n, 0, fs);
+
+                for (int i=0; i<3; i++)
+                    lp2_reset(&n->axis[i], rate[i]);
+
+                continue;
+            }
+
+            notch_update(n, f * (h + 1), fs);
+
+            for (int i=0; i<3; i++)
+                rate[i] = lp2_filter(&n->axis[i], rate[i]);
+        }
+    }
+}
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include <stdio.h>
+
+
+static void cmd_rpm_notch_show(void)
+{
+    printf("harmonics : %d\n", rpm_notch_config.harmonics);
+    printf("q         : %.2f\n", rpm_notch_config.q);
+    printf("f_min     : %.1f Hz\n", rpm_notch_config.f_min);
+    printf("fs        : %.1f Hz\n", fs_active);
+    printf("\n");
+    printf("motor      rpm   notches\n");
+
+    for (int m=0; m<RPM_NOTCH_MOTORS; m++) {
+        printf("%5d %8.0f  ", m, bldc_state.motors[m].rpm_filter.y[0]);
+
+        for (int h=0; h<rpm_notch_config.harmonics && h<RPM_NOTCH_HARMONICS; h++) {
+            if (notches[m][h].f_c > 0)
+                printf(" %6.1f Hz", notches[m][h].f_c);
+            else
+                printf("      off ");
+        }
+
+        printf("\n");
+    }
+}
+
+
+SHELL_CMD(rpm_notch_show, (cmdfunc_t)cmd_rpm_notch_show, "Show motor noise notch filters")
@@ -0,0 +1,14 @@
+#pragma once
+
+#define RPM_NOTCH_MOTORS        4
+#define RPM_NOTCH_HARMONICS     3
+
+struct rpm_notch_config {
+    int     harmonics;          // 0: off
+    float   q;                  // centre frequency / bandwidth
+    float   f_min;              // [Hz] off below this frequency
+};
+
+extern struct rpm_notch_config rpm_notch_config;
+
+void rpm_notch_filter(float rate[3], float fs);
@@ -0,0 +1,196 @@
+#include "sensor_capture.h"
+#include <string.h>
+#include <errno.h>
+
+#define CAPTURE_SIZE    (28 * 1024)
+
+/**
+ * Raw sensor capture
+ *
+ * The capture buffer is in the CCM RAM, which it shares with
+ * the RAM disk. It holds about 1 s of data with the MPU9150
+ * FIFO enabled, or 3 s without.
+ *
+ * Records are appended by the sensor task. A cycle is only
+ * visible after sensor_capture_commit(), so a full buffer
+ * never ends with a partial cycle.
+ *
+ */
+static uint8_t  capture_buf[CAPTURE_SIZE] __attribute__((section(".ccmbss")));
+static int      capture_pos;
+static volatile int capture_len;
+
+static volatile enum {
+    CAPTURE_IDLE,
+    CAPTURE_REQUESTED,
+    CAPTURE_RUNNING,
+    CAPTURE_STOPPED
+} capture_state;
+
+
+/**
+ * Called by the sensor task before each cycle.
+ *
+ * \returns 1 if a capture was requested. The caller must
+ *          write the START, BLOB and CALIB records.
+ */
+int sensor_capture_begin(void)
+{
+    if (capture_state != CAPTURE_REQUESTED)
+        return 0;
+
+    capture_pos = 0;
+    capture_len = 0;
+    capture_state = CAPTURE_RUNNING;
+
+    return 1;
+}
+
+
+int sensor_capture_active(void)
+{
+    return capture_state == CAPTURE_RUNNING;
+}
+
+
+int sensor_capture_write(int type, int index, const void *data, int len)
+{
+    if (capture_state != CAPTURE_RUNNING)
+        return 0;
+
+    struct sensor_capture_record r = {
+        .type  = type,
+        .index = index,
+        .len   = len
+    };
+
+    if (capture_pos + sizeof(r) + len > CAPTURE_SIZE) {
+        capture_state = CAPTURE_STOPPED;
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memcpy(&capture_buf[capture_pos], &r, sizeof(r));
+    memcpy(&capture_buf[capture_pos + sizeof(r)], data, len);
+    capture_pos += sizeof(r) + len;
+
+    return 1;
+}
+
+
+void sensor_capture_commit(void)
+{
+    if (capture_state == CAPTURE_RUNNING)
+        capture_len = capture_pos;
+}
+
+
+void sensor_capture_stop(void)
+{
+    if (capture_state != CAPTURE_IDLE)
+        capture_state = CAPTURE_STOPPED;
+}
+
+
+const uint8_t *sensor_capture_data(int *len)
+{
+    *len = capture_len;
+    return capture_buf;
+}
+
+
+int sensor_capture_copy(void *buf, int size, const void *data, int len)
+{
+    if (len > size) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memcpy(buf, data, len);
+    return len;
+}
+
+
+int sensor_restore_copy(void *data, int size, const void *buf, int len)
+{
+    if (len != size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(data, buf, len);
+    return len;
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+
+/**
+ * The dump is a hex listing, which can be cut from a
+ * terminal log. See Tools/sensor_replay.
+ *
+ */
+static void cmd_sensor_capture(int argc, char *argv[])
+{
+    static const char *states[] = { "idle", "requested", "running", "stopped" };
+
+    if (argc == 1) {
+        printf("state  %s\n", states[capture_state]);
+        printf("used   %d of %d bytes\n", capture_len, CAPTURE_SIZE);
+    }
+    else if (argc == 2 && !strcmp(argv[1], "start")) {
+        capture_state = CAPTURE_REQUESTED;
+
+        // Wait until the capture has been started by the sensor
+        // task, so the end of the last one isn't dumped.
+        //
+        while (capture_state == CAPTURE_REQUESTED && !stdin_chars_avail())
+            vTaskDelay(1);
+
+        printf("Capture started\n");
+    }
+    else if (argc == 2 && !strcmp(argv[1], "stop")) {
+        sensor_capture_stop();
+    }
+    else if (argc == 2 && !strcmp(argv[1], "dump")) {
+        if (capture_state == CAPTURE_RUNNING) {
+            printf("Capture is running. Stop it first.\n");
+            return;
+        }
+
+        int len = capture_len;
+
+        printf("# sensor capture, %d bytes\n", len);
+
+        for (int i=0; i<len; i+=32) {
+            printf(":%05x ", i);
+            for (int j=i; j<i+32 && j<len; j++)
+                printf("%02x", capture_buf[j]);
+            printf("\n");
+
+            if (stdin_chars_avail()) {
+                printf("# aborted\n");
+                return;
+            }
+        }
+
+        printf("# end\n");
+    }
+    else {
+        goto usage;
+    }
+
+    return;
+
+usage:
+    printf("usage: %s [start|stop|dump]\n", argv[0]);
+}
+
+
+SHELL_CMD(sensor_capture, (cmdfunc_t)cmd_sensor_capture, "Capture raw sensor data")
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "sensors.h"
+#include "matrix3f.h"
+#include <stdint.h>
+
+#define SENSOR_CAPTURE_MAGIC    0x50414353  // "SCAP"
+#define SENSOR_CAPTURE_VERSION  5
+
+#define SENSOR_CAPTURE_NAME_LEN 16
+#define SENSOR_CHECK_INTERVAL   100         // cycles between CHECK records
+
+/**
+ * Raw sensor capture stream
+ *
+ * The stream is a sequence of records. Each record has a
+ * 4 byte header, followed by len bytes of payload:
+ *
+ *   START  index: number of drivers
+ *          payload: magic, version, driver names
+ *   BLOB   index: sensor_capture_blobs[] entry
+ *          payload: memory contents at the start of the capture
+ *   CALIB  index: driver, payload: SENSOR_RAW_CALIB data
+ *   CYCLE  index: mask of updated drivers, payload: time [us]
+ *   DATA   index: driver, payload: SENSOR_RAW_DATA data
+ *   CHECK  payload: struct sensor_data and attitude_matrix()
+ *
+ * A CYCLE is followed by the DATA of its updated drivers.
+ * CHECK records hold the results of the preceding cycle, so
+ * a replay can be compared bit by bit.
+ *
+ * Records are packed without alignment, and all values are
+ * little endian.
+ *
+ */
+enum sensor_capture_type {
+    SENSOR_CAPTURE_START = 1,
+    SENSOR_CAPTURE_BLOB,
+    SENSOR_CAPTURE_CALIB,
+    SENSOR_CAPTURE_CYCLE,
+    SENSOR_CAPTURE_DATA,
+    SENSOR_CAPTURE_CHECK
+};
+
+struct sensor_capture_record {
+    uint8_t     type;
+    uint8_t     index;
+    uint16_t    len;
+};
+
+struct sensor_capture_check {
+    struct sensor_data  data;
+    mat3f               attitude;
+};
+
+/**
+ * State which is needed to reproduce the sensor processing,
+ * defined in sensors.c
+ *
+ */
+struct sensor_capture_blob {
+    void       *ptr;
+    int         size;
+};
+
+extern const struct sensor_capture_blob sensor_capture_blobs[];
+extern const int sensor_capture_num_blobs;
+
+int  sensor_capture_begin(void);
+int  sensor_capture_active(void);
+int  sensor_capture_write(int type, int index, const void *data, int len);
+void sensor_capture_commit(void);
+void sensor_capture_stop(void);
+
+const uint8_t *sensor_capture_data(int *len);
+
+// Helpers for the driver capture() and restore() functions
+//
+int  sensor_capture_copy(void *buf, int size, const void *data, int len);
+int  sensor_restore_copy(void *data, int size, const void *buf, int len);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "matrix3f.h"
+#include <stdint.h>
+
+#define SENSOR_VALID_ACC        1
+#define SENSOR_VALID_GYRO       2
+#define SENSOR_VALID_GYRO_TEMP  4
+#define SENSOR_VALID_GYRO_FIFO  8
+#define SENSOR_VALID_MAG        16
+#define SENSOR_VALID_PRESSURE   32
+#define SENSOR_VALID_BARO_TEMP  64
+
+
+/**
+ * Uncalibrated sensor sample in SI units.
+ * Only the fields flagged in .valid are set by a driver.
+ *
+ */
+struct sensor_sample {
+    uint32_t    valid;          // SENSOR_VALID_*
+    uint32_t    clipflags;      // CLIP_*
+
+    vec3f       acc;            // [m/s^2]
+    vec3f       gyro;           // [rad/s]
+    float       gyro_temp;      // [C]
+    vec3f       mag;            // [T]
+    float       pressure;       // [hPa]
+    float       baro_temp;      // [C]
+
+    // Oversampled gyro data, owned by the driver
+    //
+    const int32_t (*gyro_fifo)[3];
+    int         gyro_fifo_count;
+    float       gyro_fifo_gain; // [rad/s / LSB]
+};
+
+
+// Raw data types for capture() and restore()
+//
+#define SENSOR_RAW_DATA     0   // bus data of the last read()
+#define SENSOR_RAW_CALIB    1   // factory calibration read by init()
+
+
+/**
+ * Sensor driver interface
+ *
+ *   init()     probe and configure the device
+ *   start()    trigger a conversion (NULL for free-running devices),
+ *              returns the conversion time in ms
+ *   read()     fetch the raw data from the bus
+ *   convert()  raw data -> SI units, returns < 0 if there's no new data
+ *   rate()     output data rate [Hz]
+ *   delay()    group delay of the on-chip filters [s] (may be NULL)
+ *   recover()  restore the device configuration after an I2C bus
+ *              recovery, without the delays of init() (may be NULL)
+ *   capture()  copy SENSOR_RAW_* data to buf, returns its length
+ *              (may be NULL, see sensor_capture.c)
+ *   restore()  load captured data for a replay of convert()
+ *
+ * All functions except convert() may access the bus.
+ *
+ */
+struct sensor_driver {
+    const char *name;
+    int     (*init)(void);
+    int     (*start)(void);
+    int     (*read)(void);
+    int     (*convert)(struct sensor_sample *s);
+    float   (*rate)(void);
+    float   (*delay)(void);
+    int     (*recover)(void);
+    int     (*capture)(int type, void *buf, int size);
+    int     (*restore)(int type, const void *buf, int len);
+};
@@ -0,0 +1,60 @@
+#include "sensor_mock.h"
+#include "sensors.h"
+#include "sensor_sched.h"
+
+/**
+ * Mock sensor driver
+ *
+ * Returns sensor_mock_sample on every read, without any bus
+ * access. Used to run the sensor pipeline without hardware,
+ * e.g. on the host or on a bare board (sensor.imu = 2).
+ *
+ */
+struct sensor_sample sensor_mock_sample = {
+    .valid      = SENSOR_VALID_ACC      | SENSOR_VALID_GYRO     |
+                  SENSOR_VALID_GYRO_TEMP| SENSOR_VALID_MAG      |
+                  SENSOR_VALID_PRESSURE | SENSOR_VALID_BARO_TEMP,
+    .acc        = { 0, 0, -STANDARD_GRAVITY },
+    .gyro       = { 0, 0, 0 },
+    .gyro_temp  = 25,
+    .mag        = { 20e-6, 0, -44e-6 },
+    .pressure   = STANDARD_PRESSURE,
+    .baro_temp  = 25
+};
+
+static struct sensor_sample  mock_regs;
+
+
+static int mock_init(void)
+{
+    return 1;
+}
+
+
+static int mock_read(void)
+{
+    mock_regs = sensor_mock_sample;
+    return 1;
+}
+
+
+static int mock_convert(struct sensor_sample *s)
+{
+    *s = mock_regs;
+    return 1;
+}
+
+
+static float mock_rate(void)
+{
+    return 1e6 / SENSOR_SLOT_TIME;
+}
+
+
+const struct sensor_driver sensor_mock_driver = {
+    .name    = "mock",
+    .init    = mock_init,
+    .read    = mock_read,
+    .convert = mock_convert,
+    .rate    = mock_rate
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "sensor_driver.h"
+
+extern struct sensor_sample         sensor_mock_sample;
+extern const struct sensor_driver   sensor_mock_driver;
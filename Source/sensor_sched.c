@@ -0,0 +1,204 @@
+#include "sensor_sched.h"
+#include "ustime.h"
+#include <stdio.h>
+
+/**
+ * Declarative sensor bus scheduler
+ *
+ * Replaces the hand-tuned slot table in poll_i2c(). The drivers
+ * only state their period and conversion time, the slots are
+ * planned at run-time.
+ *
+ */
+static struct sensor_job *sched_jobs;
+static int       sched_num_jobs;
+
+static uint32_t  sched_slot;
+static uint32_t  sched_busy_devices;
+
+static uint64_t  sched_bus_us;
+static uint32_t  sched_max_slot_us;
+
+
+static int is_due(uint32_t slot)
+{
+    return (int32_t)(sched_slot - slot) >= 0;
+}
+
+
+static uint32_t device_mask(const struct sensor_job *job)
+{
+    return job->device ? 1 << job->device : 0;
+}
+
+
+static void next_due(struct sensor_job *job)
+{
+    job->runs++;
+    job->due += job->period;
+
+    // Don't build up a backlog if the job can't keep up
+    //
+    if (is_due(job->due))
+        job->due = sched_slot + job->period;
+}
+
+
+static int run_job(struct sensor_job *job, int (*fn)(void), int *used_us)
+{
+    uint32_t t0 = get_us_time32();
+    int res = fn();
+    uint32_t dt = get_us_time32() - t0;
+
+    // Low-pass the measured bus time for slot planning
+    //
+    job->bus_time += (dt - job->bus_time) * 0.1;
+
+    *used_us += dt;
+    if (res < 0)
+        job->errors++;
+
+    return res;
+}
+
+
+/**
+ * Run one scheduler slot. Must be called every SENSOR_SLOT_TIME.
+ *
+ * \returns bit mask of the jobs which read new data
+ *
+ */
+uint32_t sensor_sched_poll(void)
+{
+    uint32_t done = 0;
+    int used_us = 0;
+
+    // First pass: collect finished conversions and run the
+    // read-only jobs. The first job always runs, all others
+    // must fit into the remaining slot budget.
+    //
+    for (int i=0; i<sched_num_jobs; i++) {
+        struct sensor_job *job = &sched_jobs[i];
+
+        int ready = job->start ? job->pending && is_due(job->ready) : is_due(job->due);
+        if (!ready)
+            continue;
+
+        if (i > 0 && used_us + job->bus_time > SENSOR_SLOT_BUDGET) {
+            job->deferred++;
+            continue;
+        }
+
+        uint32_t t_read = get_us_time32();
+
+        if (run_job(job, job->read, &used_us) >= 0) {
+            job->t_sample = job->start ? job->t_start : t_read;
+            done |= 1 << i;
+        }
+
+        if (job->start) {
+            job->pending = 0;
+            sched_busy_devices &= ~device_mask(job);
+        }
+        else {
+            next_due(job);
+        }
+    }
+
+    // Second pass: start new conversions. This is done after
+    // all reads, so a device released in this slot goes to
+    // the next waiting job in table order.
+    //
+    for (int i=0; i<sched_num_jobs; i++) {
+        struct sensor_job *job = &sched_jobs[i];
+
+        if (!job->start || job->pending || !is_due(job->due))
+            continue;
+
+        if (sched_busy_devices & device_mask(job))
+            continue;
+
+        if (used_us + job->bus_time > SENSOR_SLOT_BUDGET) {
+            job->deferred++;
+            continue;
+        }
+
+        uint32_t t_start = get_us_time32();
+        int res = run_job(job, job->start, &used_us);
+
+        if (res >= 0) {
+            job->t_start = t_start;
+            job->latency = res;
+            job->ready   = sched_slot + res;
+            job->pending = 1;
+            sched_busy_devices |= device_mask(job);
+        }
+
+        next_due(job);
+    }
+
+    sched_bus_us += used_us;
+    if (used_us > sched_max_slot_us)
+        sched_max_slot_us = used_us;
+
+    sched_slot++;
+
+    return done;
+}
+
+
+void sensor_sched_init(struct sensor_job *jobs, int num_jobs)
+{
+    sched_jobs = jobs;
+    sched_num_jobs = num_jobs;
+    sched_slot = 0;
+    sched_busy_devices = 0;
+    sched_bus_us = 0;
+    sched_max_slot_us = 0;
+
+    // Stagger the start of the jobs, so they don't all
+    // compete for the first slot.
+    //
+    for (int i=0; i<num_jobs; i++) {
+        struct sensor_job *job = &jobs[i];
+
+        job->due      = i;
+        job->pending  = 0;
+        job->latency  = 0;
+        job->runs     = 0;
+        job->errors   = 0;
+        job->deferred = 0;
+        job->bus_time = 0;
+    }
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+
+static void cmd_sensor_sched(void)
+{
+    float t = sched_slot * (SENSOR_SLOT_TIME * 1e-6);
+
+    printf("job            period  latency     rate      bus     runs   deferred   errors\n");
+
+    for (int i=0; i<sched_num_jobs; i++) {
+        struct sensor_job *job = &sched_jobs[i];
+
+        printf("%-12s %5d ms %5d ms %6.1f Hz %5.0f us %8lu %10lu %8lu\n",
+            job->name, job->period, job->latency,
+            t > 0 ? job->runs / t : 0, job->bus_time,
+            job->runs, job->deferred, job->errors
+        );
+    }
+
+    printf("\n");
+    printf("bus utilization %6.1f %%\n",
+        sched_slot ? 100.0 * sched_bus_us / ((double)sched_slot * SENSOR_SLOT_TIME) : 0
+    );
+    printf("max. slot time  %6lu us (budget %d us)\n", sched_max_slot_us, SENSOR_SLOT_BUDGET);
+}
+
+
+SHELL_CMD(sensor_sched, (cmdfunc_t)cmd_sensor_sched, "Show sensor scheduler statistics")
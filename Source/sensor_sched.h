@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Sensor bus job
+ *
+ * start() triggers a conversion and returns its latency in
+ * slots, read() fetches the result when it's done. Jobs
+ * without start() are simply read every period slots.
+ *
+ * Jobs with the same (non-zero) device id are serialized, i.e.
+ * only one of them may have a conversion in progress.
+ *
+ * The table order is the priority order. Each slot, the jobs
+ * are run until the slot budget is used up. The rest is
+ * deferred to the next slot, so the first job (the gyro) is
+ * never delayed by the slow sensors.
+ *
+ */
+struct sensor_job {
+    const char *name;
+    int     period;         // [slots]
+    int     device;         // exclusive device id, 0: none
+    int   (*start)(void);
+    int   (*read)(void);
+
+    // Runtime state and statistics
+    //
+    uint32_t    due;        // slot of the next start
+    uint32_t    ready;      // slot of the pending read
+    int         latency;    // of the last conversion [slots]
+    int         pending;
+    uint32_t    t_start;    // start of the pending conversion [us]
+    uint32_t    t_sample;   // start of the last data read [us]
+    uint32_t    runs;
+    uint32_t    errors;
+    uint32_t    deferred;
+    float       bus_time;   // average bus time per call [us]
+};
+
+#define SENSOR_SLOT_TIME    1000    // [us]
+#define SENSOR_SLOT_BUDGET  600     // [us]
+
+void     sensor_sched_init(struct sensor_job *jobs, int num_jobs);
+uint32_t sensor_sched_poll(void);
@@ -0,0 +1,64 @@
+#include "sensor_stats.h"
+#include <string.h>
+#include <math.h>
+
+#define ALPHA   0.01        // running average coefficient
+
+
+static const uint32_t bin_limits[SENSOR_STATS_BINS - 1] = {
+    50, 100, 200, 500, 1000, 2000, 5000
+};
+
+
+void sensor_stats_sample(struct sensor_stats *s, uint32_t t_sample, uint32_t t_publish, uint32_t clipflags)
+{
+    uint32_t latency = t_publish - t_sample;
+
+    if (s->samples == 0) {
+        s->latency = latency;
+    }
+    else {
+        float dt = t_sample - s->t_last;
+
+        if (s->samples == 1)
+            s->interval = dt;
+
+        // Jitter relative to the mean interval
+        //
+        uint32_t dev = fabsf(dt - s->interval);
+
+        int bin = 0;
+        while (bin < SENSOR_STATS_BINS - 1 && dev >= bin_limits[bin])
+            bin++;
+
+        s->hist[bin]++;
+
+        s->interval += (dt - s->interval) * ALPHA;
+        s->rate = s->interval > 0 ? 1e6 / s->interval : 0;
+        s->latency += (latency - s->latency) * ALPHA;
+    }
+
+    if (latency > s->latency_max)
+        s->latency_max = latency;
+
+    // Count clipping events, not clipped samples
+    //
+    if (clipflags & ~s->clipflags)
+        s->clip_events++;
+
+    s->clipflags = clipflags;
+    s->t_last = t_sample;
+    s->samples++;
+}
+
+
+void sensor_stats_error(struct sensor_stats *s)
+{
+    s->conv_errors++;
+}
+
+
+void sensor_stats_reset(struct sensor_stats *s)
+{
+    memset(s, 0, sizeof(*s));
+}
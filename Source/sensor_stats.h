@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SENSOR_STATS_BINS   8
+
+/**
+ * Per-sensor health statistics
+ *
+ * The latency is measured from the start of the conversion
+ * (or the register read, for free-running devices) to the
+ * publication of the calibrated data.
+ *
+ * The jitter histogram counts the deviation of the sample
+ * interval from its running mean, in the bins
+ *
+ *   <50, <100, <200, <500, <1000, <2000, <5000, >=5000 us
+ *
+ */
+struct sensor_stats {
+    uint32_t    samples;
+    uint32_t    conv_errors;    // convert() failures
+    uint32_t    clip_events;    // rising edges of clipflags
+
+    float       rate;           // [Hz]
+    float       interval;       // mean sample interval [us]
+    float       latency;        // mean latency [us]
+    uint32_t    latency_max;    // [us]
+
+    uint32_t    hist[SENSOR_STATS_BINS];
+
+    uint32_t    t_last;
+    uint32_t    clipflags;
+};
+
+void sensor_stats_sample(struct sensor_stats *s, uint32_t t_sample, uint32_t t_publish, uint32_t clipflags);
+void sensor_stats_error(struct sensor_stats *s);
+void sensor_stats_reset(struct sensor_stats *s);
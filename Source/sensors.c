@@ -1,132 +1,769 @@
 #include "sensors.h"
+#include "sensor_driver.h"
+#include "sensor_mock.h"
 #include "i2c_mpu9150.h"
 #include "i2c_ak8975.h"
 #include "i2c_bmp180.h"
+#include "spi_mpu6000.h"
+#include "i2c_driver.h"
+#include "filter.h"
+#include "gyro_tempco.h"
+#include "sensor_sched.h"
+#include "sensor_stats.h"
+#include "sensor_capture.h"
+#include "ellipsoid_fit.h"
+#include "attitude.h"
+#include "attitude_ekf.h"
+#include "altitude.h"
 #include "ustime.h"
+#include "seqlock.h"
+#include "util.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
+#include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <errno.h>
+
+#define SENSOR_DT_MAX   0.01    // [s] longest estimator step
 
 /**
  * Design rationale
  *
  * The individual sensor drivers (i2c_mp9150, etc.) return
  * data in SI units with factory calibration (if available).
+ * They are accessed only through struct sensor_driver, and
+ * selected with sensor.imu.
  *
  * System calibration is done by sensors.c and should be
  * independent of the actual sensors ICs used.
  *
+ * The accelerometer and magnetometer are calibrated by
+ *
+ *   x = matrix * (gain * raw + offset)
+ *
+ * The matrix corrects scale, cross-axis sensitivity and
+ * (for the magnetometer) soft iron effects. Offset and matrix
+ * are found by an ellipsoid fit, see sensor_calibrate.
+ *
  */
 struct sensor_calib sensor_calib = {
     .acc_gain     = { 1, 1, 1 },
     .acc_offset   = { 0, 0, 0 },
+    .acc_matrix   = MAT3_IDENTITY,
     .gyro_gain    = { 1, 1, 1 },
     .gyro_offset  = { 0, 0, 0 },
     .mag_gain     = { 1, 1, 1 },
     .mag_offset   = { 0, 0, 0 },
+    .mag_matrix   = MAT3_IDENTITY,
     .temp_gain    = 1,
     .temp_offset  = 0
 };
 
-// .pressure_qfe: pressure at field evelation
-//      The barometric altimeter setting that will cause an altimeter
-//      to read zero when at the reference datum of a particular airfield
-//
-// .pressure_qnh:
-//      The barometric altimeter setting that will cause the altimeter
-//      to read airfield elevation when on the airfield.
-//
+/**
+ * Gyro oversampling
+ *
+ * With mpu9150.fifo_enable set, the gyro is sampled at up to
+ * 8 kHz and decimated to the 1 kHz task rate. This keeps the
+ * aliased motor vibrations out of the control loop, without
+ * the group delay of the on-chip low pass filters.
+ *
+ * Each FIFO sample is 6 bytes, or 54 bit times on the 400 kHz
+ * I2C bus plus the register reads of the other sensors. The
+ * bus is saturated at about 4 kHz, so 8 kHz (smplrt_div = 0)
+ * will overflow the FIFO. The MPU9150 driver raises smplrt_div
+ * to 1 in that case.
+ *
+ * The sample rate must be a multiple of the task rate, that
+ * is smplrt_div = 1, 3 or 7 at 8 kHz gyro rate.
+ *
+ * The total gyro delay is
+ *
+ *   FIR:  DLPF delay + (taps - 1) / 2 / f_sample
+ *   CIC:  DLPF delay + order * (ratio - 1) / 2 / f_sample
+ *
+ * See sensor_gyro_delay() and the gyro_decim command.
+ *
+ */
+struct sensor_config sensor_config = {
+    .imu            = SENSOR_IMU_MPU9150,
+    .gyro_decim     = SENSOR_DECIM_FIR,
+    .gyro_fir_taps  = 16,
+    .gyro_cic_order = 2
+};
 
-static struct  mpu9150_regs   mpu9150_regs;
-static struct  ak8975_regs    ak8975_regs;
-static struct  bmp180_regs    bmp180_regs;
+// The QFE/QNH pressure references for the altimeter
+// are in altitude.c
+//
 
-static struct  mpu9150_data   mpu9150_data;
-static struct  ak8975_data    ak8975_data;
-static struct  bmp180_data    bmp180_data;
+static const struct sensor_driver *sensor_drivers[SENSOR_MAX_DRIVERS];
+static struct  sensor_job     sensor_jobs[SENSOR_MAX_DRIVERS];
+static uint32_t               sensor_clipflags[SENSOR_MAX_DRIVERS];
+static struct  sensor_stats   driver_stats[SENSOR_MAX_DRIVERS];
+static volatile int           driver_stats_reset;
+static int                    sensor_num_drivers;
 
+static struct  sensor_sample  sensor_raw;
+static struct  sensor_sample  sensor_raw_copy;
 static struct  sensor_data    sensor_data;
+static struct  seqlock        sensor_data_lock;
+static uint32_t               sensor_data_time;
 static SemaphoreHandle_t      sensor_data_sem;
 
+static struct  fir_decimator  gyro_fir[3];
+static struct  cic_decimator  gyro_cic[3];
+static int     gyro_decim_ratio;
+static int     gyro_decim_active;
+
+// Oversampled gyro stream for the inner rate loop, see
+// sensor_gyro_stream_read()
+//
+#define GYRO_STREAM_SIZE    128     // power of two
+#define GYRO_STAGE_MAX      32      // FIFO samples per cycle
+
+static vec3f    gyro_stage[GYRO_STAGE_MAX];
+static int      gyro_stage_count;
+static vec3f    gyro_stream[GYRO_STREAM_SIZE];
+static volatile uint32_t gyro_stream_head;
+static float    gyro_stream_rate;
+
+static uint32_t sensor_t_last;
+static uint32_t capture_cycles;
+
+
+/**
+ * State which affects the results of sensor_process(), besides
+ * the raw data. The sample pointer at the end of sensor_raw
+ * is skipped, so the layout is the same on the host.
+ *
+ */
+const struct sensor_capture_blob sensor_capture_blobs[] = {
+    { &sensor_calib,      sizeof(sensor_calib)      },
+    { &sensor_config,     sizeof(sensor_config)     },
+    { &mpu9150_config,    sizeof(mpu9150_config)    },
+    { &mpu9150_range,     sizeof(mpu9150_range)     },
+    { &gyro_tempco,       sizeof(gyro_tempco)       },
+    { &attitude_config,   sizeof(attitude_config)   },
+    { &attitude_active,   sizeof(attitude_active)   },
+    { &dcm,               sizeof(dcm)               },
+    { &mahony,            sizeof(mahony)            },
+    { &attitude_accum,    sizeof(attitude_accum)    },
+    { &ekf,               sizeof(ekf)               },
+    { &altitude_config,   sizeof(altitude_config)   },
+    { gyro_fir,           sizeof(gyro_fir)          },
+    { gyro_cic,           sizeof(gyro_cic)          },
+    { &gyro_decim_ratio,  sizeof(gyro_decim_ratio)  },
+    { &gyro_decim_active, sizeof(gyro_decim_active) },
+    { sensor_clipflags,   sizeof(sensor_clipflags)  },
+    { &sensor_t_last,     sizeof(sensor_t_last)     },
+    { &sensor_raw,        offsetof(struct sensor_sample, gyro_fifo) }
+};
+
+const int sensor_capture_num_blobs = ARRAY_SIZE(sensor_capture_blobs);
+
+
+/**
+ * Add a driver to the scheduler.
+ *
+ * Drivers with a start() function are restarted as soon as
+ * their last conversion is read. Free-running devices are
+ * polled at their output data rate, but at most once per slot.
+ *
+ */
+static void register_driver(const struct sensor_driver *drv)
+{
+    if (sensor_num_drivers >= SENSOR_MAX_DRIVERS)
+        return;
+
+    int period = 1;
+    if (!drv->start) {
+        float rate = drv->rate();
+        if (rate > 0 && rate < 1e6 / SENSOR_SLOT_TIME)
+            period = lrintf(1e6 / SENSOR_SLOT_TIME / rate);
+    }
+
+    int n = sensor_num_drivers++;
+
+    sensor_drivers[n] = drv;
+    sensor_jobs[n] = (struct sensor_job) {
+        .name   = drv->name,
+        .period = period,
+        .start  = drv->start,
+        .read   = drv->read
+    };
+}
+
+
+static void add_driver(const struct sensor_driver *drv)
+{
+    if (drv->init() < 0) {
+        printf("%s: init failed (%s)\n", drv->name, strerror(errno));
+        return;
+    }
+
+    register_driver(drv);
+}
+
+
+static void gyro_decim_init(float sample_rate)
+{
+    int ratio = lrintf(sample_rate / configTICK_RATE_HZ);
+    if (ratio < 1)
+        ratio = 1;
+
+    // The decimated gyro would run at a different rate than
+    // the sensor task, and samples get lost or repeated.
+    //
+    if (fabsf(sample_rate - ratio * configTICK_RATE_HZ) > 1) {
+        printf("gyro: %.0f Hz is not a multiple of %d Hz, decimated rate is %.0f Hz\n",
+            sample_rate, configTICK_RATE_HZ, sample_rate / ratio);
+    }
+
+    for (int i=0; i<3; i++) {
+        fir_design(&gyro_fir[i], sensor_config.gyro_fir_taps, ratio);
+        cic_design(&gyro_cic[i], sensor_config.gyro_cic_order, ratio);
+    }
+
+    gyro_decim_ratio = ratio;
+    gyro_stream_rate = sample_rate;
+}
+
+
+/**
+ * Use a set of drivers without initializing the devices.
+ * This is for the replay tool, see sensor_capture.h
+ *
+ */
+void sensor_set_drivers(const struct sensor_driver *const drivers[], int n)
+{
+    sensor_num_drivers = 0;
+    for (int i=0; i<n; i++)
+        register_driver(drivers[i]);
+
+    if (sensor_num_drivers > 0)
+        gyro_decim_init(sensor_drivers[0]->rate());
+}
+
+
+/**
+ * Feed oversampled gyro data into the decimation filters.
+ * The last output is kept if there was no new sample.
+ *
+ */
+static void gyro_decim_update(const struct sensor_sample *s)
+{
+    gyro_decim_active = 1;
+
+    for (int i=0; i<s->gyro_fifo_count; i++) {
+        float out[3];
+        int   valid = 0;
+
+        if (gyro_stage_count < GYRO_STAGE_MAX) {
+            gyro_stage[gyro_stage_count++] = (vec3f) {
+                s->gyro_fifo[i][0] * s->gyro_fifo_gain,
+                s->gyro_fifo[i][1] * s->gyro_fifo_gain,
+                s->gyro_fifo[i][2] * s->gyro_fifo_gain
+            };
+        }
+
+        for (int j=0; j<3; j++) {
+            int32_t x = s->gyro_fifo[i][j];
+
+            switch (sensor_config.gyro_decim) {
+            case SENSOR_DECIM_FIR:
+                valid = fir_decimate(&gyro_fir[j], x);
+                out[j] = gyro_fir[j].y;
+                break;
+
+            case SENSOR_DECIM_CIC:
+                valid = cic_decimate(&gyro_cic[j], x);
+                out[j] = gyro_cic[j].y / cic_gain(&gyro_cic[j]);
+                break;
+
+            default:
+            case SENSOR_DECIM_NONE:
+                valid = 1;
+                out[j] = x;
+                break;
+            }
+        }
+
+        if (valid) {
+            sensor_raw.gyro.x = out[0] * s->gyro_fifo_gain;
+            sensor_raw.gyro.y = out[1] * s->gyro_fifo_gain;
+            sensor_raw.gyro.z = out[2] * s->gyro_fifo_gain;
+        }
+    }
+}
+
 
-static void poll_i2c(void)
+/**
+ * Merge a new driver sample into the raw sensor data
+ *
+ */
+static void merge_sample(int index, const struct sensor_sample *s)
 {
-    static int state;
+    struct sensor_sample *r = &sensor_raw;
 
-    mpu9150_read(&mpu9150_regs);
+    if (s->valid & SENSOR_VALID_ACC)        r->acc       = s->acc;
+    if (s->valid & SENSOR_VALID_GYRO)       r->gyro      = s->gyro;
+    if (s->valid & SENSOR_VALID_GYRO_TEMP)  r->gyro_temp = s->gyro_temp;
+    if (s->valid & SENSOR_VALID_MAG)        r->mag       = s->mag;
+    if (s->valid & SENSOR_VALID_PRESSURE)   r->pressure  = s->pressure;
+    if (s->valid & SENSOR_VALID_BARO_TEMP)  r->baro_temp = s->baro_temp;
 
-    switch (state) {
-    case 0:
-    case 10:
-        ak8975_read(&ak8975_regs);
-        ak8975_start_single();
-        break;
+    if (s->valid & SENSOR_VALID_GYRO_FIFO)
+        gyro_decim_update(s);
 
-    case 1:
-        bmp180_read(&bmp180_regs);
-        bmp180_start_up();
-        break;
+    r->valid |= s->valid;
 
-    case 16:
-        bmp180_read(&bmp180_regs);
-        bmp180_start_ut();
-        break;
+    sensor_clipflags[index] = s->clipflags;
+
+    r->clipflags = 0;
+    for (int i=0; i<sensor_num_drivers; i++)
+        r->clipflags |= sensor_clipflags[i];
+}
+
+
+/**
+ * Total group delay of the gyro signal path
+ *
+ */
+float sensor_gyro_delay(void)
+{
+    const struct sensor_driver *imu = sensor_drivers[0];
+    if (!imu)
+        return 0;
+
+    float fs = imu->rate();
+    float delay = imu->delay ? imu->delay() : 0;
+
+    if (!gyro_decim_active)
+        return delay;
+
+    switch (sensor_config.gyro_decim) {
+    case SENSOR_DECIM_FIR:  delay += fir_group_delay(&gyro_fir[0]) / fs;  break;
+    case SENSOR_DECIM_CIC:  delay += cic_group_delay(&gyro_cic[0]) / fs;  break;
     }
 
-    if (++state == 20)
-        state = 0;
+    return delay;
 }
 
 
+/**
+ * Read the calibrated sensor data. This never blocks the
+ * sensor task, but the caller must have a lower priority.
+ *
+ */
 void sensor_read(struct sensor_data *d)
 {
-    xSemaphoreTake(sensor_data_sem, portMAX_DELAY);
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&sensor_data_lock);
+        memcpy(d, &sensor_data, sizeof(*d));
+    } while (seqlock_read_retry(&sensor_data_lock, seq));
+}
+
+
+/**
+ * Wait for the next IMU sample and read the calibrated data.
+ * The caller must have a lower priority than the sensor task,
+ * and there should be only one caller.
+ *
+ * \param d        calibrated sensor data
+ * \param t_sample IMU sample time [us], for latency measurements
+ * \param timeout  [ticks]
+ * \returns 0, or -1 if there was no new sample (errno = ETIMEDOUT)
+ */
+int sensor_wait(struct sensor_data *d, uint32_t *t_sample, uint32_t timeout)
+{
+    uint32_t seq;
+
+    if (!sensor_data_sem || xSemaphoreTake(sensor_data_sem, timeout) != pdTRUE) {
+        if (!sensor_data_sem)
+            vTaskDelay(timeout);
+
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    do {
+        seq = seqlock_read_begin(&sensor_data_lock);
+        memcpy(d, &sensor_data, sizeof(*d));
+        *t_sample = sensor_data_time;
+    } while (seqlock_read_retry(&sensor_data_lock, seq));
+
+    return 0;
+}
+
+
+/**
+ * Read the calibrated data from a task with a higher priority
+ * than the sensor task. Fails instead of waiting, if the data
+ * is being updated.
+ *
+ * \returns 0, or -1 if the sensor task was interrupted in
+ *          the middle of an update (errno = EAGAIN)
+ */
+int sensor_try_read(struct sensor_data *d, uint32_t *t_sample)
+{
+    uint32_t seq;
+
+    if (seqlock_try_read_begin(&sensor_data_lock, &seq)) {
+        memcpy(d, &sensor_data, sizeof(*d));
+        *t_sample = sensor_data_time;
+
+        if (!seqlock_read_retry(&sensor_data_lock, seq))
+            return 0;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+
+/**
+ * Sample rate of the gyro stream [Hz], 0 if the IMU has no
+ * FIFO samples.
+ *
+ */
+float sensor_gyro_stream_rate(void)
+{
+    return gyro_decim_active ? gyro_stream_rate : 0;
+}
 
-    memcpy(d, &sensor_data, sizeof(*d));
 
-    xSemaphoreGive(sensor_data_sem);
+/**
+ * Read the next calibrated FIFO gyro sample, in order. Never
+ * blocks, so it can be used from a task with a higher priority
+ * than the sensor task.
+ *
+ * The samples are published once per sensor cycle. A reader
+ * more than max_lag samples behind skips the older ones.
+ *
+ * \param index    position of the reader, start with 0
+ * \returns 0, or -1 if there is no new sample
+ */
+int sensor_gyro_stream_read(vec3f *gyro, uint32_t *index, int max_lag)
+{
+    uint32_t head = gyro_stream_head;
+    __asm__ volatile ("" ::: "memory");
+
+    if (max_lag > GYRO_STREAM_SIZE - GYRO_STAGE_MAX)
+        max_lag = GYRO_STREAM_SIZE - GYRO_STAGE_MAX;
+
+    if (head - *index > (uint32_t)max_lag)
+        *index = head - max_lag;
+
+    if (*index == head) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    *gyro = gyro_stream[*index % GYRO_STREAM_SIZE];
+    (*index)++;
+
+    return 0;
+}
+
+
+/**
+ * Read the uncalibrated sensor data.
+ * The gyro FIFO pointer is not valid outside the sensor task.
+ *
+ */
+void sensor_read_raw(struct sensor_sample *s)
+{
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&sensor_data_lock);
+        memcpy(s, &sensor_raw_copy, sizeof(*s));
+    } while (seqlock_read_retry(&sensor_data_lock, seq));
+
+    s->gyro_fifo = NULL;
+    s->gyro_fifo_count = 0;
+}
+
+
+/**
+ * Convert, calibrate and publish the data of the updated
+ * drivers, and run the estimators.
+ *
+ * The estimators run on every new IMU sample. Their time
+ * step is taken from the IMU sample times, so the jitter of
+ * the sensor task doesn't affect the integration.
+ *
+ * \param updated  bit mask of drivers with new raw data
+ * \param t        IMU sample time, if it was updated [us]
+ * \returns the drivers which delivered valid data
+ */
+uint32_t sensor_process(uint32_t updated, uint32_t t)
+{
+    // Convert to SI units and apply calibration
+    //
+    int baro_updated = 0;
+
+    for (int i=0; i<sensor_num_drivers; i++) {
+        if (!(updated & (1 << i)))
+            continue;
+
+        struct sensor_sample s = { .valid = 0 };
+        if (sensor_drivers[i]->convert(&s) >= 0) {
+            merge_sample(i, &s);
+
+            if (s.valid & SENSOR_VALID_PRESSURE)
+                baro_updated = 1;
+        }
+        else {
+            sensor_stats_error(&driver_stats[i]);
+            updated &= ~(1 << i);
+        }
+    }
+
+    const struct sensor_sample *r = &sensor_raw;
+    struct sensor_data d;
+
+    d.clipflags = r->clipflags;
+
+    d.acc  = vec3f_fma(r->acc , sensor_calib.acc_gain , sensor_calib.acc_offset );
+    d.gyro = vec3f_fma(r->gyro, sensor_calib.gyro_gain, sensor_calib.gyro_offset);
+    d.mag  = vec3f_fma(r->mag , sensor_calib.mag_gain , sensor_calib.mag_offset );
+
+    d.acc  = vec3f_matmul(sensor_calib.acc_matrix, d.acc);
+    d.mag  = vec3f_matmul(sensor_calib.mag_matrix, d.mag);
+
+    d.gyro_temp = r->gyro_temp * sensor_calib.temp_gain + sensor_calib.temp_offset;
+
+    d.baro_temp = r->baro_temp;
+    d.pressure  = r->pressure;
+
+    // Temperature compensation of the gyro bias.
+    // The model is learned from the uncompensated data.
+    //
+    gyro_tempco_update(d.gyro, d.acc, d.gyro_temp);
+
+    vec3f gyro_bias = { 0, 0, 0 };
+    if (gyro_tempco.enable)
+        gyro_bias = gyro_tempco_bias(d.gyro_temp);
+
+    d.gyro = vec3f_sub(d.gyro, gyro_bias);
+
+    // Calibrate the FIFO samples the same way, and append them
+    // to the stream. The slots above the head are not read.
+    //
+    for (int i=0; i<gyro_stage_count; i++) {
+        vec3f g = vec3f_fma(gyro_stage[i], sensor_calib.gyro_gain, sensor_calib.gyro_offset);
+        gyro_stream[(gyro_stream_head + i) % GYRO_STREAM_SIZE] = vec3f_sub(g, gyro_bias);
+    }
+
+    __asm__ volatile ("" ::: "memory");
+    gyro_stream_head += gyro_stage_count;
+    gyro_stage_count = 0;
+
+    // Attitude and altitude estimation.
+    // acc is (0, 0, -g) at rest, so the upward
+    // acceleration is -(R * acc).z - g
+    //
+    if (baro_updated)
+        altitude_baro(d.pressure);
+
+    if ((updated & 1) && vec3f_lensq(d.acc) > 0) {
+        // The integrators need small steps. Gaps, e.g. from an
+        // I2C bus recovery, are bridged with the maximum step.
+        //
+        float dt = (t - sensor_t_last) * 1e-6;
+        sensor_t_last = t;
+
+        if (dt > SENSOR_DT_MAX)
+            dt = SENSOR_DT_MAX;
+
+        if (attitude_update(d.gyro, d.acc, d.mag, dt))
+            attitude_publish(t);
+
+        float acc_up = -vec3f_dot(mat3f_row(attitude_matrix(), 2), d.acc) - STANDARD_GRAVITY;
+        altitude_update(acc_up, dt);
+    }
+
+    seqlock_write_begin(&sensor_data_lock);
+    sensor_data = d;
+    sensor_raw_copy = sensor_raw;
+    if (updated & 1)
+        sensor_data_time = t;
+    seqlock_write_end(&sensor_data_lock);
+
+    // Health statistics of the drivers which delivered
+    // data in this cycle.
+    //
+    uint32_t t_publish = get_us_time32();
+
+    if (driver_stats_reset) {
+        for (int i=0; i<sensor_num_drivers; i++)
+            sensor_stats_reset(&driver_stats[i]);
+
+        driver_stats_reset = 0;
+    }
+
+    for (int i=0; i<sensor_num_drivers; i++) {
+        if (updated & (1 << i)) {
+            sensor_stats_sample(
+                &driver_stats[i], sensor_jobs[i].t_sample,
+                t_publish, sensor_clipflags[i]
+            );
+        }
+    }
+
+    return updated;
+}
+
+
+/**
+ * Write the state for a replay. The gyro_tempco window is
+ * restarted, its statistics are not captured.
+ *
+ */
+static void capture_start(void)
+{
+    uint8_t buf[4 + 4 + SENSOR_MAX_DRIVERS * SENSOR_CAPTURE_NAME_LEN] = { 0 };
+    const uint32_t magic = SENSOR_CAPTURE_MAGIC, version = SENSOR_CAPTURE_VERSION;
+
+    memcpy(&buf[0], &magic, 4);
+    memcpy(&buf[4], &version, 4);
+
+    for (int i=0; i<sensor_num_drivers; i++)
+        strncpy((char*)&buf[8 + i * SENSOR_CAPTURE_NAME_LEN], sensor_drivers[i]->name, SENSOR_CAPTURE_NAME_LEN - 1);
+
+    sensor_capture_write(
+        SENSOR_CAPTURE_START, sensor_num_drivers,
+        buf, 8 + sensor_num_drivers * SENSOR_CAPTURE_NAME_LEN
+    );
+
+    gyro_tempco_restart();
+
+    for (int i=0; i<sensor_capture_num_blobs; i++) {
+        const struct sensor_capture_blob *b = &sensor_capture_blobs[i];
+        sensor_capture_write(SENSOR_CAPTURE_BLOB, i, b->ptr, b->size);
+    }
+
+    for (int i=0; i<sensor_num_drivers; i++) {
+        const struct sensor_driver *drv = sensor_drivers[i];
+        uint8_t calib[64];
+        int len = drv->capture ? drv->capture(SENSOR_RAW_CALIB, calib, sizeof(calib)) : 0;
+
+        if (len > 0)
+            sensor_capture_write(SENSOR_CAPTURE_CALIB, i, calib, len);
+    }
+
+    capture_cycles = 0;
+}
+
+
+static void capture_cycle(uint32_t updated, uint32_t t)
+{
+    if (!sensor_capture_active())
+        return;
+
+    sensor_capture_write(SENSOR_CAPTURE_CYCLE, updated, &t, sizeof(t));
+
+    for (int i=0; i<sensor_num_drivers; i++) {
+        const struct sensor_driver *drv = sensor_drivers[i];
+        uint8_t data[256];
+
+        if (!(updated & (1 << i)) || !drv->capture)
+            continue;
+
+        int len = drv->capture(SENSOR_RAW_DATA, data, sizeof(data));
+        if (len > 0)
+            sensor_capture_write(SENSOR_CAPTURE_DATA, i, data, len);
+    }
+}
+
+
+static void capture_check(void)
+{
+    if (!sensor_capture_active())
+        return;
+
+    if (++capture_cycles % SENSOR_CHECK_INTERVAL == 0) {
+        struct sensor_capture_check c = {
+            .data     = sensor_data,
+            .attitude = attitude_matrix()
+        };
+        sensor_capture_write(SENSOR_CAPTURE_CHECK, 0, &c, sizeof(c));
+    }
+
+    sensor_capture_commit();
 }
 
 
 void sensor_task(void *param)
 {
+    // The IMU must be the first driver, so its latency
+    // isn't affected by the other sensors.
+    //
+    // The AK8975 is only reachable through the I2C bypass of
+    // the MPU9150. It is dropped if the MPU9150 isn't used.
+    //
+    switch (sensor_config.imu) {
+    default:
+    case SENSOR_IMU_MPU9150:  add_driver(&mpu9150_driver);  break;
+    case SENSOR_IMU_MPU6000:  add_driver(&mpu6000_driver);  break;
+    case SENSOR_IMU_MOCK:     add_driver(&sensor_mock_driver);  break;
+    }
+
+    if (sensor_config.imu != SENSOR_IMU_MOCK) {
+        add_driver(&ak8975_driver);
+        add_driver(&bmp180_driver);
+    }
+
+    if (sensor_num_drivers > 0)
+        gyro_decim_init(sensor_drivers[0]->rate());
+
+    sensor_sched_init(sensor_jobs, sensor_num_drivers);
+
     sensor_data_sem = xSemaphoreCreateBinary();
-    xSemaphoreGive(sensor_data_sem);
 
-    mpu9150_init();
-    ak8975_init();
-    bmp180_init();
+    sensor_t_last = get_us_time32();
+    uint32_t i2c_recoveries = i2c_recovery_count();
 
     for (;;) {
 
-        // I/O-Bound sensor polling
+        // Restore the device configurations after an I2C bus
+        // hang. The devices may have seen a partial transfer
+        // or a power glitch.
         //
-        poll_i2c();
+        if (i2c_recovery_count() != i2c_recoveries) {
+            i2c_recoveries = i2c_recovery_count();
 
-        // Convert to SI units and apply calibration
-        // TODO: Move to a separate task
-        //
-        mpu9150_convert(&mpu9150_data, &mpu9150_regs);
-        ak8975_convert(&ak8975_data, &ak8975_regs);
-        bmp180_convert(&bmp180_data, &bmp180_regs);
-
-        xSemaphoreTake(sensor_data_sem, portMAX_DELAY);
+            for (int i=0; i<sensor_num_drivers; i++) {
+                if (sensor_drivers[i]->recover)
+                    sensor_drivers[i]->recover();
+            }
+        }
 
-        struct sensor_data *d = &sensor_data;
+        // I/O-Bound sensor polling
+        //
+        uint32_t updated = sensor_sched_poll();
+        uint32_t t = (updated & 1) ? sensor_jobs[0].t_sample : get_us_time32();
 
-        d->clipflags = mpu9150_data.clipflags | ak8975_data.clipflags | bmp180_data.clipflags;
+        if (sensor_capture_begin())
+            capture_start();
 
-        d->acc  = vec3f_fma(mpu9150_data.acc , sensor_calib.acc_gain , sensor_calib.acc_offset );
-        d->gyro = vec3f_fma(mpu9150_data.gyro, sensor_calib.gyro_gain, sensor_calib.gyro_offset);
-        d->mag  = vec3f_fma(ak8975_data.mag  , sensor_calib.mag_gain , sensor_calib.mag_offset );
+        capture_cycle(updated, t);
 
-        d->gyro_temp = mpu9150_data.temp * sensor_calib.temp_gain + sensor_calib.temp_offset;
+        // TODO: Move to a separate task
+        //
+        updated = sensor_process(updated, t);
 
-        d->baro_temp = bmp180_data.temp;
-        d->pressure  = bmp180_data.pressure;
+        // Wake up the flight controller. It runs as soon
+        // as this task blocks in vTaskDelay().
+        //
+        if (updated & 1)
+            xSemaphoreGive(sensor_data_sem);
 
-        xSemaphoreGive(sensor_data_sem);
+        capture_check();
 
         vTaskDelay(1);
     }
@@ -139,6 +776,7 @@ void sensor_task(void *param)
 #include "ansi.h"
 #include "util.h"
 #include "syscalls.h"
+#include "msg_packet.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -246,4 +884,227 @@ usage:
 }
 
 
+static void cmd_gyro_decim(void)
+{
+    static const char *names[] = { "none", "FIR", "CIC" };
+    int decim = sensor_config.gyro_decim;
+
+    const struct sensor_driver *imu = sensor_drivers[0];
+    if (!imu)
+        return;
+
+    printf("imu            %8s\n", imu->name);
+    printf("fifo active    %8d\n", gyro_decim_active);
+    printf("sample rate    %8.1f Hz\n", imu->rate());
+    printf("ratio          %8d\n", gyro_decim_ratio);
+    printf("filter         %8s\n", (decim >= 0 && decim < ARRAY_SIZE(names)) ? names[decim] : "?");
+    printf("FIR taps       %8d\n", gyro_fir[0].taps);
+    printf("CIC order      %8d\n", gyro_cic[0].order);
+    printf("dlpf delay     %8.3f ms\n", imu->delay ? imu->delay() * 1e3 : 0);
+    printf("total delay    %8.3f ms\n", sensor_gyro_delay() * 1e3);
+}
+
+
+/**
+ * Ellipsoid calibration
+ *
+ * The raw samples of a perfect sensor lie on a sphere when it
+ * is rotated in a homogeneous field. Offsets, scale errors,
+ * axis misalignment and soft iron distortion turn the sphere
+ * into an arbitrary ellipsoid. The fit finds the center and
+ * the symmetric matrix that maps the ellipsoid back to a
+ * sphere with the nominal radius.
+ *
+ * The accelerometer must be held still in each orientation,
+ * samples are rejected while the gyro sees rotation.
+ *
+ */
+static void cmd_sensor_calibrate(int argc, char *argv[])
+{
+    static struct ellipsoid_fit fit;
+
+    if (argc != 2)
+        goto usage;
+
+    int is_acc;
+    if (!strcmp(argv[1], "acc"))
+        is_acc = 1;
+    else if (!strcmp(argv[1], "mag"))
+        is_acc = 0;
+    else
+        goto usage;
+
+    // Scale the samples to about unit magnitude
+    //
+    const float k = is_acc ? STANDARD_GRAVITY : 50e-6;
+    const vec3f gain = is_acc ? sensor_calib.acc_gain : sensor_calib.mag_gain;
+
+    printf(
+        "Rotate the %s slowly through all orientations.\n"
+        "Press any key to stop.\n\n",
+        is_acc ? "board and hold it still in each position" : "board"
+    );
+
+    ellipsoid_fit_reset(&fit);
+
+    const vec3f zero = { 0, 0, 0 };
+    vec3f last = zero;
+    vec3f center = { 0, 0, 0 };
+    mat3f transform = MAT3_IDENTITY;
+    float radius = 1;
+
+    while (!stdin_chars_avail()) {
+        vTaskDelay(20);
+
+        struct sensor_sample s;
+        struct sensor_data d;
+        sensor_read_raw(&s);
+        sensor_read(&d);
+
+        vec3f p = vec3f_scale(vec3f_fma(is_acc ? s.acc : s.mag, gain, zero), 1 / k);
+
+        if (is_acc && vec3f_len(d.gyro) > 0.1)
+            continue;
+
+        if (vec3f_len(vec3f_sub(p, last)) < 0.05)
+            continue;
+
+        last = p;
+        ellipsoid_fit_add(&fit, p);
+
+        if (fit.n % 10 == 0 &&
+            ellipsoid_fit_solve(&fit, &center, &transform, &radius) > 0)
+        {
+            printf(
+                "\r%4d samples, center %7.3f %7.3f %7.3f, radius %6.3f",
+                fit.n, center.x, center.y, center.z, radius
+            );
+        }
+    }
+    printf("\n\n");
+
+    if (ellipsoid_fit_solve(&fit, &center, &transform, &radius) < 0) {
+        printf("Fit failed (%d samples). Cover more orientations.\n", fit.n);
+        return;
+    }
+
+    // Undo the scaling. The magnetometer keeps the mean
+    // field strength, the accelerometer is set to 1 g.
+    //
+    const float r = is_acc ? STANDARD_GRAVITY : radius * k;
+
+    vec3f offset = vec3f_scale(center, -k);
+    mat3f matrix = mat3f_scale(transform, r / k);
+
+    if (is_acc) {
+        sensor_calib.acc_offset = offset;
+        sensor_calib.acc_matrix = matrix;
+    }
+    else {
+        sensor_calib.mag_offset = offset;
+        sensor_calib.mag_matrix = matrix;
+    }
+
+    printf("offset\n");
+    vec3f_print(offset);
+    printf("\nmatrix\n");
+    mat3f_print(matrix);
+    printf("\nUse param_save to store the calibration.\n");
+    return;
+
+usage:
+    printf("usage: %s acc|mag\n", argv[0]);
+}
+
+
+static void send_stats_msg(int index)
+{
+    const struct sensor_stats *s = &driver_stats[index];
+    struct msg_sensor_stats msg;
+
+    msg.h.id       = MSG_ID_SENSOR_STATS;
+    msg.h.data_len = sizeof(msg) - sizeof(msg.h);
+
+    msg.index       = index;
+    strncpy(msg.name, sensor_drivers[index]->name, sizeof(msg.name));
+    msg.rate        = s->rate;
+    msg.latency     = s->latency;
+    msg.latency_max = s->latency_max;
+    msg.samples     = s->samples;
+    msg.conv_errors = s->conv_errors;
+    msg.bus_errors  = sensor_jobs[index].errors;
+    msg.clip_events = s->clip_events;
+
+    for (int i=0; i<SENSOR_STATS_BINS; i++)
+        msg.hist[i] = s->hist[i] > 0xFFFF ? 0xFFFF : s->hist[i];
+
+    msg_send(&msg.h);
+}
+
+
+static void cmd_sensor_stats(int argc, char *argv[])
+{
+    if (argc == 2) {
+        if (!strcmp(argv[1], "-r")) {
+            driver_stats_reset = 1;
+            return;
+        }
+        else if (!strcmp(argv[1], "-b")) {
+            while (!stdin_chars_avail()) {
+                for (int i=0; i<sensor_num_drivers; i++)
+                    send_stats_msg(i);
+
+                vTaskDelay(1000);
+            }
+            return;
+        }
+        else {
+            goto usage;
+        }
+    }
+    else if (argc != 1) {
+        goto usage;
+    }
+
+    printf("sensor        rate  latency      max  samples   conv.err  bus.err     clip\n");
+
+    for (int i=0; i<sensor_num_drivers; i++) {
+        const struct sensor_stats *s = &driver_stats[i];
+
+        printf("%-10s %4.0f Hz %5.0f us %5lu us %8lu %10lu %8lu %8lu\n",
+            sensor_drivers[i]->name, s->rate, s->latency, s->latency_max,
+            s->samples, s->conv_errors, sensor_jobs[i].errors, s->clip_events
+        );
+    }
+
+    printf("\ninterval jitter  <50 <100 <200 <500  <1k  <2k  <5k >=5k us\n");
+
+    for (int i=0; i<sensor_num_drivers; i++) {
+        const struct sensor_stats *s = &driver_stats[i];
+
+        // Print percentages, so the drivers are comparable
+        //
+        uint32_t n = 0;
+        for (int k=0; k<SENSOR_STATS_BINS; k++)
+            n += s->hist[k];
+
+        printf("%-16s", sensor_drivers[i]->name);
+        for (int k=0; k<SENSOR_STATS_BINS; k++)
+            printf(" %4.0f", n ? 100.0 * s->hist[k] / n : 0);
+
+        printf(" %%\n");
+    }
+
+    return;
+
+usage:
+    printf("usage: %s [-h|-r|-b]\n", argv[0]);
+    printf("  -r  reset statistics\n");
+    printf("  -b  send binary telemetry once per second\n");
+}
+
+
 SHELL_CMD(sensor_show, (cmdfunc_t)cmd_sensor_show, "Show sensor data")
+SHELL_CMD(gyro_decim, (cmdfunc_t)cmd_gyro_decim, "Show gyro decimation filter")
+SHELL_CMD(sensor_stats, (cmdfunc_t)cmd_sensor_stats, "Show sensor health statistics")
+SHELL_CMD(sensor_calibrate, (cmdfunc_t)cmd_sensor_calibrate, "Ellipsoid calibration of acc or mag")
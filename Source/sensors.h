@@ -24,12 +24,39 @@
 struct sensor_calib {
     vec3f   acc_gain;
     vec3f   acc_offset;
+    mat3f   acc_matrix;
     float   temp_gain;
     float   temp_offset;
     vec3f   gyro_gain;
     vec3f   gyro_offset;
     vec3f   mag_gain;
     vec3f   mag_offset;
+    mat3f   mag_matrix;
+};
+
+
+#define SENSOR_MAX_DRIVERS  8
+
+
+enum sensor_imu {
+    SENSOR_IMU_MPU9150,
+    SENSOR_IMU_MPU6000,
+    SENSOR_IMU_MOCK
+};
+
+
+enum sensor_decim {
+    SENSOR_DECIM_NONE,
+    SENSOR_DECIM_FIR,
+    SENSOR_DECIM_CIC
+};
+
+
+struct sensor_config {
+    int     imu;                // enum sensor_imu
+    int     gyro_decim;         // enum sensor_decim
+    int     gyro_fir_taps;
+    int     gyro_cic_order;
 };
 
 
@@ -45,7 +72,23 @@ struct sensor_data {
     float   baro_temp;      // [C]
 };
 
-extern struct sensor_calib sensor_calib;
+extern struct sensor_calib  sensor_calib;
+extern struct sensor_config sensor_config;
+
+float sensor_gyro_delay(void);
+
+struct sensor_sample;
+struct sensor_driver;
 
 void sensor_read(struct sensor_data *d);
+int  sensor_wait(struct sensor_data *d, uint32_t *t_sample, uint32_t timeout);
+int  sensor_try_read(struct sensor_data *d, uint32_t *t_sample);
+float sensor_gyro_stream_rate(void);
+int  sensor_gyro_stream_read(vec3f *gyro, uint32_t *index, int max_lag);
+void sensor_read_raw(struct sensor_sample *s);
 void sensor_task(void *param);
+
+// Used by the replay tool
+//
+void sensor_set_drivers(const struct sensor_driver *const drivers[], int n);
+uint32_t sensor_process(uint32_t updated, uint32_t t);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Sequence lock for data with a single writer
+ *
+ * The writer never blocks. Readers copy the data and retry if
+ * the sequence number was odd or has changed in between.
+ *
+ * Readers must have a lower priority than the writer. A reader
+ * which preempts the writer in the middle of an update would
+ * spin forever. The STM32F4 has a single core, so compiler
+ * barriers are sufficient.
+ *
+ *   writer:                     reader:
+ *
+ *   seqlock_write_begin(&l);    do {
+ *   data = ...;                     seq = seqlock_read_begin(&l);
+ *   seqlock_write_end(&l);          copy = data;
+ *                               } while (seqlock_read_retry(&l, seq));
+ *
+ */
+struct seqlock {
+    volatile uint32_t   seq;
+};
+
+#define seqlock_barrier()   __asm__ volatile ("" ::: "memory")
+
+
+static inline void seqlock_write_begin(struct seqlock *l)
+{
+    l->seq++;
+    seqlock_barrier();
+}
+
+static inline void seqlock_write_end(struct seqlock *l)
+{
+    seqlock_barrier();
+    l->seq++;
+}
+
+static inline uint32_t seqlock_read_begin(const struct seqlock *l)
+{
+    uint32_t seq;
+
+    while ((seq = l->seq) & 1)
+        ;
+
+    seqlock_barrier();
+    return seq;
+}
+
+static inline int seqlock_read_retry(const struct seqlock *l, uint32_t seq)
+{
+    seqlock_barrier();
+    return l->seq != seq;
+}
+
+/**
+ * Non-blocking read_begin for readers with a higher priority
+ * than the writer. They would spin forever in
+ * seqlock_read_begin().
+ *
+ * \returns 0 if a write is in progress
+ */
+static inline int seqlock_try_read_begin(const struct seqlock *l, uint32_t *seq)
+{
+    *seq = l->seq;
+    seqlock_barrier();
+    return !(*seq & 1);
+}
@@ -0,0 +1,183 @@
+#include "spi_driver.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include <errno.h>
+
+// The SPI2 pins of the old board (PB10, PC2, PC3) are used
+// for motor PWM and ADC inputs now. SPI3 is routed to the
+// expansion header instead.
+//
+#define SPI                 SPI3
+#define RX_DMA              DMA1_Stream2    // Channel 0: SPI3_RX
+#define TX_DMA              DMA1_Stream5    // Channel 0: SPI3_TX
+
+#define SPI_TIMEOUT         10              // [ms]
+
+static SemaphoreHandle_t  spi_mutex;
+static SemaphoreHandle_t  spi_dma_sem;
+static GPIO_TypeDef      *cs_gpio;          // Current chip select GPIO
+static int                cs_pin;           // Current chip select Pin
+
+
+/**
+ * SPI3 receive DMA complete interrupt
+ *
+ */
+void DMA1_Stream2_IRQHandler(void)
+{
+    DMA1->LIFCR = DMA_LIFCR_CTCIF2;
+
+    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+    xSemaphoreGiveFromISR(spi_dma_sem, &xHigherPriorityTaskWoken);
+    portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
+}
+
+
+/**
+ * Begin a SPI transaction.
+ *
+ * \param  gpio      Chip select GPIO
+ * \param  pin       Chip select pin
+ * \param  init      SPI configuration (clock, polarity, phase)
+ *
+ */
+void spi_begin(GPIO_TypeDef *gpio, int pin, const SPI_InitTypeDef *init)
+{
+    xSemaphoreTake(spi_mutex, portMAX_DELAY);
+
+    SPI_Cmd(SPI, DISABLE);
+    SPI_Init(SPI, (SPI_InitTypeDef *)init);
+    SPI_I2S_DMACmd(SPI, SPI_I2S_DMAReq_Rx, ENABLE);
+    SPI_I2S_DMACmd(SPI, SPI_I2S_DMAReq_Tx, ENABLE);
+    SPI_Cmd(SPI, ENABLE);
+
+    cs_gpio = gpio;
+    cs_pin  = pin;
+    GPIO_ResetBits(cs_gpio, cs_pin);
+}
+
+
+/**
+ * Send data bytes over SPI.
+ *
+ * \param  out   Pointer to output buffer
+ * \param  in    Pointer to input buffer
+ * \param  len   Length of transfer
+ *
+ * [in] and [out] may point to overlapping memory areas.
+ * One of them can be NULL for write- or read-only transfers.
+ *
+ */
+int spi_transfer(const void *out, void *in, int len)
+{
+    static uint8_t  in_dummy, out_dummy;
+
+    // Set up DMA channels
+    //
+    RX_DMA->CR   = TX_DMA->CR   = 0;
+    while ((RX_DMA->CR | TX_DMA->CR) & DMA_SxCR_EN);
+
+    DMA1->LIFCR = DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2  |
+                  DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 |
+                  DMA_LIFCR_CFEIF2;
+
+    DMA1->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5  |
+                  DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 |
+                  DMA_HIFCR_CFEIF5;
+
+    RX_DMA->NDTR = TX_DMA->NDTR = len;
+    RX_DMA->PAR  = TX_DMA->PAR  = (uint32_t)&SPI->DR;
+
+    // Start DMA channels
+    //
+    if (in) {
+        // SPI -> *in++, TCIE
+        RX_DMA->M0AR = (uint32_t)in;
+        RX_DMA->CR   = DMA_SxCR_MINC | DMA_SxCR_TCIE | DMA_SxCR_EN;
+    }
+    else {
+        // SPI -> in_dummy, TCIE
+        RX_DMA->M0AR = (uint32_t)&in_dummy;
+        RX_DMA->CR   = DMA_SxCR_TCIE | DMA_SxCR_EN;
+    }
+
+    if (out) {
+        // *out++ -> SPI
+        TX_DMA->M0AR = (uint32_t)out;
+        TX_DMA->CR   = DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_EN;
+    }
+    else {
+        // out_dummy -> SPI
+        TX_DMA->M0AR = (uint32_t)&out_dummy;
+        TX_DMA->CR   = DMA_SxCR_DIR_0 | DMA_SxCR_EN;
+    }
+
+    // Wait for the receive DMA to finish
+    //
+    if (xSemaphoreTake(spi_dma_sem, SPI_TIMEOUT) != pdPASS) {
+        RX_DMA->CR = TX_DMA->CR = 0;
+        errno = EBUSY;
+        return -1;
+    }
+
+    return len;
+}
+
+
+/**
+ * End a SPI transaction.
+ *
+ */
+void spi_end(void)
+{
+    // Wait for the last byte to be shifted out
+    //
+    while (SPI->SR & SPI_SR_BSY);
+
+    GPIO_SetBits(cs_gpio, cs_pin);
+    xSemaphoreGive(spi_mutex);
+}
+
+
+/**
+ * Initialize the SPI interface
+ *
+ */
+void spi_init(void)
+{
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOCEN | RCC_AHB1ENR_DMA1EN;
+    RCC->APB1ENR |= RCC_APB1ENR_SPI3EN;
+
+    // Create a mutex (w/ priority inheritance) for the SPI channel
+    // and a normal semaphore for DMA
+    // (xSemaphoreGiveFromISR doesn't work with mutexes)
+    //
+    if (!spi_mutex)   spi_mutex   = xSemaphoreCreateMutex();
+    if (!spi_dma_sem) spi_dma_sem = xSemaphoreCreateBinary();
+
+    // PC10  SPI3_SCK
+    // PC11  SPI3_MISO
+    // PC12  SPI3_MOSI
+    //
+    GPIO_PinAFConfig(GPIOC, GPIO_PinSource10, GPIO_AF_SPI3);
+    GPIO_PinAFConfig(GPIOC, GPIO_PinSource11, GPIO_AF_SPI3);
+    GPIO_PinAFConfig(GPIOC, GPIO_PinSource12, GPIO_AF_SPI3);
+
+    GPIO_Init(GPIOC, &(GPIO_InitTypeDef) {
+        .GPIO_Pin   = GPIO_Pin_10 | GPIO_Pin_11 | GPIO_Pin_12,
+        .GPIO_Mode  = GPIO_Mode_AF,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_OType = GPIO_OType_PP,
+        .GPIO_PuPd  = GPIO_PuPd_DOWN
+    });
+
+    // Initialize DMA interrupts
+    //
+    NVIC_Init(&(NVIC_InitTypeDef){
+        .NVIC_IRQChannel = DMA1_Stream2_IRQn,
+        .NVIC_IRQChannelPreemptionPriority =
+                configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY,
+        .NVIC_IRQChannelSubPriority = 0,
+        .NVIC_IRQChannelCmd = ENABLE
+    });
+}
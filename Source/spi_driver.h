@@ -0,0 +1,9 @@
+#pragma once
+
+#include "stm32f4xx.h"
+
+void  spi_begin(GPIO_TypeDef *gpio, int pin, const SPI_InitTypeDef *init);
+int   spi_transfer(const void *out, void *in, int len);
+void  spi_end(void);
+
+void  spi_init(void);
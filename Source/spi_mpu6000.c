@@ -0,0 +1,285 @@
+#include "spi_mpu6000.h"
+#include "spi_driver.h"
+#include "mpu_regs.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+#include <errno.h>
+
+// The MPU6000 has the same register map and data format as
+// the MPU9150, so the conversion functions and the mpu9150.*
+// parameters are shared. Only the bus access is different.
+//
+#define CS_GPIO             GPIOD
+#define CS_PIN              GPIO_Pin_2
+
+#define READ_FLAG           0x80
+#define WHO_AM_I_MPU6000    0x68
+
+
+// Configuration registers may only be written at up to 1 MHz,
+// sensor and FIFO registers can be read at up to 20 MHz.
+//
+static const SPI_InitTypeDef spi_slow = {
+    .SPI_Direction          = SPI_Direction_2Lines_FullDuplex,
+    .SPI_Mode               = SPI_Mode_Master,
+    .SPI_DataSize           = SPI_DataSize_8b,
+    .SPI_CPOL               = SPI_CPOL_High,
+    .SPI_CPHA               = SPI_CPHA_2Edge,
+    .SPI_NSS                = SPI_NSS_Soft,
+    .SPI_BaudRatePrescaler  = SPI_BaudRatePrescaler_64,    // 656 kHz
+    .SPI_FirstBit           = SPI_FirstBit_MSB,
+    .SPI_CRCPolynomial      = 7
+};
+
+static const SPI_InitTypeDef spi_fast = {
+    .SPI_Direction          = SPI_Direction_2Lines_FullDuplex,
+    .SPI_Mode               = SPI_Mode_Master,
+    .SPI_DataSize           = SPI_DataSize_8b,
+    .SPI_CPOL               = SPI_CPOL_High,
+    .SPI_CPHA               = SPI_CPHA_2Edge,
+    .SPI_NSS                = SPI_NSS_Soft,
+    .SPI_BaudRatePrescaler  = SPI_BaudRatePrescaler_4,     // 10.5 MHz
+    .SPI_FirstBit           = SPI_FirstBit_MSB,
+    .SPI_CRCPolynomial      = 7
+};
+
+static uint32_t fifo_overflows;
+
+
+static int read_regs(uint8_t reg, void *data, int len, const SPI_InitTypeDef *spi)
+{
+    uint8_t addr = reg | READ_FLAG;
+
+    spi_begin(CS_GPIO, CS_PIN, spi);
+
+    int res = spi_transfer(&addr, NULL, 1);
+    if (res >= 0)
+        res = spi_transfer(NULL, data, len);
+
+    spi_end();
+
+    return res;
+}
+
+
+static int write_reg(uint8_t reg, uint8_t value)
+{
+    uint8_t buf[2] = { reg, value };
+
+    spi_begin(CS_GPIO, CS_PIN, &spi_slow);
+    int res = spi_transfer(buf, NULL, sizeof(buf));
+    spi_end();
+
+    return res;
+}
+
+
+int mpu6000_read(struct mpu9150_regs *regs)
+{
+    return read_regs(ACCEL_XOUT_H, regs, sizeof(*regs), &spi_fast);
+}
+
+
+/**
+ * Read all complete gyro samples from the FIFO.
+ * See mpu9150_read_fifo().
+ *
+ */
+int mpu6000_read_fifo(struct mpu9150_fifo *fifo)
+{
+    fifo->count = 0;
+
+    uint8_t buf[2];
+    int res = read_regs(FIFO_COUNTH, buf, sizeof(buf), &spi_fast);
+    if (res < 0)
+        return res;
+
+    int bytes = (buf[0] << 8) | buf[1];
+
+    if (bytes > FIFO_SIZE - 6) {
+        fifo_overflows++;
+        write_reg(USER_CTRL, USER_CTRL_I2C_IF_DIS | USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET);
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    int count = bytes / 6;
+    if (count > MPU9150_FIFO_SAMPLES)
+        count = MPU9150_FIFO_SAMPLES;
+
+    if (count == 0)
+        return 0;
+
+    res = read_regs(FIFO_R_W, fifo->data, count * 6, &spi_fast);
+    if (res < 0)
+        return res;
+
+    fifo->count = count;
+    return count;
+}
+
+
+int mpu6000_init(void)
+{
+    printf("Initializing MPU6000..\n");
+
+    spi_init();
+
+    GPIO_SetBits(CS_GPIO, CS_PIN);
+    GPIO_Init(CS_GPIO, &(GPIO_InitTypeDef) {
+        .GPIO_Pin   = CS_PIN,
+        .GPIO_Mode  = GPIO_Mode_OUT,
+        .GPIO_Speed = GPIO_Speed_50MHz,
+        .GPIO_OType = GPIO_OType_PP,
+        .GPIO_PuPd  = GPIO_PuPd_NOPULL
+    });
+
+    // Reset device
+    //
+    write_reg(PWR_MGMT_1, PWR_MGMT_1_DEVICE_RESET);
+    vTaskDelay(100);
+    write_reg(PWR_MGMT_1, PWR_MGMT_1_CLKSEL_PLL_X);
+    vTaskDelay(20);
+
+    // Disable the I2C interface, as recommended by the data sheet
+    //
+    write_reg(USER_CTRL, USER_CTRL_I2C_IF_DIS);
+
+    uint8_t who_am_i;
+    int res = read_regs(WHO_AM_I, &who_am_i, 1, &spi_slow);
+    if (res < 0) return res;
+
+    printf("  WHO_AM_I: 0x%02x\n", who_am_i);
+
+    if (who_am_i != WHO_AM_I_MPU6000) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Configure gyro and accelerometer
+    //
+    mpu9150_range_init();
+
+    write_reg(GYRO_CONFIG,  mpu9150_range.gyro_fs << 3);
+    write_reg(ACCEL_CONFIG, mpu9150_range.acc_fs  << 3);
+
+    write_reg(CONFIG,       mpu9150_config.dlpf_cfg);
+    write_reg(SMPLRT_DIV,   mpu9150_config.smplrt_div);
+
+    // Gyro oversampling through the FIFO.
+    // Unlike the I2C bus, SPI can keep up with 8 kHz.
+    //
+    if (mpu9150_config.fifo_enable) {
+        write_reg(FIFO_EN,   FIFO_EN_XG | FIFO_EN_YG | FIFO_EN_ZG);
+        write_reg(USER_CTRL, USER_CTRL_I2C_IF_DIS | USER_CTRL_FIFO_EN | USER_CTRL_FIFO_RESET);
+    }
+    else {
+        write_reg(FIFO_EN,   0);
+    }
+
+    return 1;
+}
+
+
+// -------------------- Sensor driver --------------------
+//
+static struct mpu9150_regs  drv_regs;
+static struct mpu9150_fifo  drv_fifo;
+static int32_t              drv_fifo_buf[MPU9150_FIFO_SAMPLES][3];
+static struct mpu9150_range_tag drv_tag;
+
+
+/**
+ * Write a pending range switch, see i2c_mpu9150.c
+ *
+ */
+static int drv_set_range(void)
+{
+    const struct mpu9150_range *r = &mpu9150_range;
+
+    int res = write_reg(GYRO_CONFIG, r->req_gyro_fs << 3);
+    if (res >= 0)
+        res = write_reg(ACCEL_CONFIG, r->req_acc_fs << 3);
+
+    int count = 0;
+    if (res >= 0 && mpu9150_config.fifo_enable) {
+        uint8_t buf[2];
+        res = read_regs(FIFO_COUNTH, buf, sizeof(buf), &spi_fast);
+        count = ((buf[0] << 8) | buf[1]) / 6;
+    }
+
+    if (res < 0)
+        return res;
+
+    mpu9150_range_switched(count);
+    return 1;
+}
+
+
+static int drv_read(void)
+{
+    int res = mpu6000_read(&drv_regs);
+
+    if (res >= 0 && mpu9150_config.fifo_enable)
+        res = mpu6000_read_fifo(&drv_fifo);
+
+    mpu9150_range_latch(&drv_tag, drv_fifo.count);
+
+    if (res >= 0 && mpu9150_range_pending())
+        res = drv_set_range();
+
+    return res;
+}
+
+
+static int drv_convert(struct sensor_sample *s)
+{
+    int res = mpu9150_convert_sample(s, drv_fifo_buf, &drv_regs, &drv_fifo, &drv_tag);
+    mpu9150_range_select(&drv_tag, s);
+    return res;
+}
+
+
+static int drv_capture(int type, void *buf, int size)
+{
+    if (type != SENSOR_RAW_DATA)
+        return 0;
+
+    return mpu9150_capture(buf, size, &drv_regs, &drv_fifo, &drv_tag);
+}
+
+
+static int drv_restore(int type, const void *buf, int len)
+{
+    if (type != SENSOR_RAW_DATA)
+        return 0;
+
+    return mpu9150_restore(buf, len, &drv_regs, &drv_fifo, &drv_tag);
+}
+
+
+const struct sensor_driver mpu6000_driver = {
+    .name    = "mpu6000",
+    .init    = mpu6000_init,
+    .read    = drv_read,
+    .convert = drv_convert,
+    .rate    = mpu9150_sample_rate,
+    .delay   = mpu9150_dlpf_delay,
+    .capture = drv_capture,
+    .restore = drv_restore
+};
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+
+static void cmd_mpu6000_fifo(void)
+{
+    printf("fifo overflows %8lu\n", fifo_overflows);
+}
+
+
+SHELL_CMD(mpu6000_init, (cmdfunc_t)mpu6000_init, "Init MPU6000")
+SHELL_CMD(mpu6000_fifo, (cmdfunc_t)cmd_mpu6000_fifo, "Show MPU6000 FIFO status")
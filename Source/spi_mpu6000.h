@@ -0,0 +1,10 @@
+#pragma once
+
+#include "i2c_mpu9150.h"
+#include "sensor_driver.h"
+
+extern const struct sensor_driver mpu6000_driver;
+
+int mpu6000_read(struct mpu9150_regs *regs);
+int mpu6000_read_fifo(struct mpu9150_fifo *fifo);
+int mpu6000_init(void);
@@ -0,0 +1,322 @@
+#include "sysid.h"
+#include "flight_ctrl.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+/**
+ * System identification
+ *
+ * A chirp or PRBS signal is added to the rate setpoint or to
+ * the controller output of one axis. Each rate loop cycle
+ * records the reference (the setpoint or the injected output),
+ * the controller output and the measured rate.
+ *
+ * With the reference r, the output u and the rate y, the
+ * plant is estimated as G_ry / G_ru. This works in closed
+ * loop, because r is not correlated with the disturbances.
+ * See Tools/sysid.py.
+ *
+ */
+struct sysid_config sysid_config = {
+    .axis       = CTRL_ROLL,
+    .signal     = SYSID_CHIRP,
+    .inject     = SYSID_OUTPUT,
+    .amplitude  = 0.5,
+    .f_start    = 1,
+    .f_end      = 100,
+    .duration   = 4,
+    .prbs_order = 9,
+    .prbs_hold  = 2
+};
+
+// Galois LFSR feedback masks for maximum length sequences
+//
+static const uint16_t prbs_masks[] = {
+    [5]  = 0x014,  [6]  = 0x030,  [7]  = 0x060,  [8]  = 0x0B8,
+    [9]  = 0x110,  [10] = 0x240,  [11] = 0x500,  [12] = 0xE08
+};
+
+#define PRBS_ORDER_MIN  5
+#define PRBS_ORDER_MAX  12
+
+#define SYSID_SCALE     1e-3    // [rad/s] or [V] per LSB
+
+struct sysid_sample {
+    int16_t     ref;
+    int16_t     u;
+    int16_t     rate;
+};
+
+static volatile enum {
+    SYSID_IDLE,
+    SYSID_REQUESTED,
+    SYSID_RUNNING,
+    SYSID_DONE
+} sysid_state;
+
+static struct sysid_sample *samples;
+
+// Run state. The configuration is copied at the start, so it
+// can't change in the middle of a run.
+//
+static struct sysid_config  run;
+static volatile int         num_samples;
+static int                  max_samples;
+static float                run_dt;
+static float                phase;
+static uint16_t             lfsr;
+static int                  hold;
+static float                excitation;
+
+
+static void sysid_begin(float dt)
+{
+    run = sysid_config;
+    run.axis = clamp(run.axis, CTRL_ROLL, CTRL_YAW);
+    run.prbs_order = clamp(run.prbs_order, PRBS_ORDER_MIN, PRBS_ORDER_MAX);
+    run.prbs_hold  = clamp(run.prbs_hold, 1, 1000);
+
+    max_samples = SYSID_SAMPLES;
+    if (run.signal == SYSID_CHIRP)
+        max_samples = clamp(run.duration / dt, 1, SYSID_SAMPLES);
+
+    run_dt = dt;
+    phase = 0;
+    lfsr = 1;
+    hold = 0;
+    num_samples = 0;
+
+    sysid_state = SYSID_RUNNING;
+}
+
+
+static float chirp(int n)
+{
+    float t = n * run_dt;
+    float T = max_samples * run_dt;
+    float f = run.f_start * powf(run.f_end / run.f_start, t / T);
+
+    float y = sinf(phase);
+
+    phase += M_TWOPI * f * run_dt;
+    if (phase > M_TWOPI)
+        phase -= M_TWOPI;
+
+    return y;
+}
+
+
+static float prbs(void)
+{
+    if (hold == 0) {
+        int lsb = lfsr & 1;
+
+        lfsr >>= 1;
+        if (lsb)
+            lfsr ^= prbs_masks[run.prbs_order];
+    }
+
+    if (++hold >= run.prbs_hold)
+        hold = 0;
+
+    return (lfsr & 1) ? 1 : -1;
+}
+
+
+/**
+ * Called by the rate loop while armed.
+ *
+ * \param dt  rate loop period [s]
+ * \returns 1 if the excitation in x is active
+ */
+int sysid_excite(struct sysid_excitation *x, float dt)
+{
+    if (sysid_state == SYSID_REQUESTED)
+        sysid_begin(dt);
+
+    if (sysid_state != SYSID_RUNNING)
+        return 0;
+
+    if (num_samples >= max_samples) {
+        sysid_state = SYSID_DONE;
+        return 0;
+    }
+
+    float y = run.signal == SYSID_PRBS ? prbs() : chirp(num_samples);
+    y *= run.amplitude;
+    excitation = y;
+
+    x->axis = run.axis;
+    x->sp = run.inject == SYSID_SETPOINT ? y : 0;
+    x->u  = run.inject == SYSID_OUTPUT   ? y : 0;
+
+    return 1;
+}
+
+
+static int16_t to_int16(float x)
+{
+    return clamp(lrintf(x / SYSID_SCALE), -32768, 32767);
+}
+
+
+/**
+ * Record the response to the excitation
+ *
+ * \param rate_sp  rate setpoint including the excitation [rad/s]
+ * \param u        controller output including the excitation [V]
+ * \param rate     measured rate [rad/s]
+ */
+void sysid_record(float rate_sp, float u, float rate)
+{
+    if (sysid_state != SYSID_RUNNING || num_samples >= max_samples)
+        return;
+
+    struct sysid_sample *s = &samples[num_samples];
+
+    s->ref  = to_int16(run.inject == SYSID_SETPOINT ? rate_sp : excitation);
+    s->u    = to_int16(u);
+    s->rate = to_int16(rate);
+
+    num_samples++;
+}
+
+
+/**
+ * Ends a run early, e.g. when the motors are stopped.
+ * The samples so far are kept.
+ *
+ */
+void sysid_stop(void)
+{
+    if (sysid_state == SYSID_RUNNING)
+        sysid_state = SYSID_DONE;
+}
+
+
+/**
+ * Start a run with the next armed rate loop cycle
+ *
+ * \returns 0, or -1 if the buffer can't be allocated
+ *          (errno = ENOMEM)
+ */
+static int sysid_request(void)
+{
+    if (!samples)
+        samples = malloc(SYSID_SAMPLES * sizeof(*samples));
+
+    if (!samples) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    sysid_state = SYSID_REQUESTED;
+    return 0;
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include "syscalls.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdio.h>
+
+static void sysid_dump(void)
+{
+    static const char *signals[] = { "chirp", "prbs" };
+    static const char *injects[] = { "setpoint", "output" };
+
+    const struct ctrl_axis *c = &ctrl_axes[run.axis];
+
+    // The header has everything which is needed to
+    // reproduce the excitation and the controller.
+    //
+    printf("# sysid dump\n");
+    printf("# axis %d signal %s inject %s amplitude %g\n",
+        run.axis, signals[run.signal], injects[run.inject], run.amplitude
+    );
+
+    printf("# f_start %g f_end %g prbs_order %d prbs_hold %d\n",
+        run.f_start, run.f_end, run.prbs_order, run.prbs_hold
+    );
+
+    printf("# dt %.9f samples %d\n", run_dt, num_samples);
+    printf("# kp %g ki %g kd %g kff %g d_fc %g\n",
+        c->kp, c->ki, c->kd, c->kff, ctrl_config.d_fc
+    );
+
+    printf("# ref u rate\n");
+
+    for (int i=0; i<num_samples; i++) {
+        const struct sysid_sample *s = &samples[i];
+
+        printf("%.3f %.3f %.3f\n",
+            s->ref * SYSID_SCALE, s->u * SYSID_SCALE, s->rate * SYSID_SCALE
+        );
+
+        if (stdin_chars_avail()) {
+            printf("# aborted\n");
+            return;
+        }
+    }
+
+    printf("# end\n");
+}
+
+
+static void cmd_sysid(int argc, char *argv[])
+{
+    static const char *states[] = { "idle", "requested", "running", "done" };
+
+    if (argc == 1) {
+        printf("state    : %s\n", states[sysid_state]);
+        printf("samples  : %d of %d\n", num_samples, SYSID_SAMPLES);
+    }
+    else if (argc == 2 && !strcmp(argv[1], "start")) {
+        if (sysid_request() < 0) {
+            perror("sysid");
+            return;
+        }
+
+        printf("Waiting for the motors..\n");
+
+        while (sysid_state != SYSID_DONE && !stdin_chars_avail())
+            vTaskDelay(10);
+
+        if (sysid_state != SYSID_DONE) {
+            sysid_stop();
+            sysid_state = SYSID_IDLE;
+            printf("Aborted\n");
+            return;
+        }
+
+        printf("%d samples recorded\n", num_samples);
+    }
+    else if (argc == 2 && !strcmp(argv[1], "stop")) {
+        sysid_stop();
+    }
+    else if (argc == 2 && !strcmp(argv[1], "dump")) {
+        if (sysid_state != SYSID_DONE) {
+            printf("No data\n");
+            return;
+        }
+
+        sysid_dump();
+    }
+    else {
+        goto usage;
+    }
+
+    return;
+
+usage:
+    printf("usage: %s [start|stop|dump]\n", argv[0]);
+}
+
+
+SHELL_CMD(sysid, (cmdfunc_t)cmd_sysid, "System identification")
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SYSID_SAMPLES   4096
+
+enum sysid_signal {
+    SYSID_CHIRP,                // exponential sine sweep
+    SYSID_PRBS,                 // maximum length sequence
+    SYSID_SIGNAL_MAX = SYSID_PRBS
+};
+
+enum sysid_inject {
+    SYSID_SETPOINT,             // added to the rate setpoint [rad/s]
+    SYSID_OUTPUT,               // added to the controller output [V]
+    SYSID_INJECT_MAX = SYSID_OUTPUT
+};
+
+
+struct sysid_config {
+    int     axis;               // CTRL_ROLL, CTRL_PITCH, CTRL_YAW
+    int     signal;             // enum sysid_signal
+    int     inject;             // enum sysid_inject
+    float   amplitude;          // [rad/s] or [V]
+    float   f_start;            // chirp [Hz]
+    float   f_end;
+    float   duration;           // chirp [s]
+    int     prbs_order;         // sequence length 2^n - 1
+    int     prbs_hold;          // loop cycles per bit
+};
+
+
+/**
+ * Excitation for one rate loop cycle
+ *
+ */
+struct sysid_excitation {
+    int     axis;
+    float   sp;                 // [rad/s]
+    float   u;                  // [V]
+};
+
+extern struct sysid_config sysid_config;
+
+int  sysid_excite(struct sysid_excitation *x, float dt);
+void sysid_record(float rate_sp, float u, float rate);
+void sysid_stop(void);
@@ -1,4 +1,5 @@
 #include "term_usb.h"
+#include "msg_rx.h"
 #include "usbd_cdc_core.h"
 #include "usbd_usr.h"
 #include "usbd_desc.h"
@@ -24,6 +25,8 @@ static volatile struct usb_stats {
 static QueueHandle_t rx_queue;
 static QueueHandle_t tx_queue;
 
+static struct msg_rx msg_rx;
+
 
 // -------------------- USB CDC Functions --------------------
 //
@@ -77,7 +80,9 @@ static uint16_t VCP_DataRx(uint8_t *buf, uint32_t len)
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
 
     for (int i=0; i<len; i++) {
-        if (xQueueSendFromISR(rx_queue, &buf[i], &xHigherPriorityTaskWoken))
+        if (msg_rx_byte(&msg_rx, buf[i], &xHigherPriorityTaskWoken))
+            usb_stats.rx_bytes++;
+        else if (xQueueSendFromISR(rx_queue, &buf[i], &xHigherPriorityTaskWoken))
             usb_stats.rx_bytes++;
         else
             usb_stats.rx_overrun++;
@@ -1,4 +1,5 @@
 #include "term_xbee.h"
+#include "msg_rx.h"
 #include "command.h"
 #include "stm32f4xx.h"
 #include "FreeRTOS.h"
@@ -22,6 +23,8 @@ static volatile struct xbee_stats {
 static QueueHandle_t rx_queue = NULL;
 static QueueHandle_t tx_queue = NULL;
 
+static struct msg_rx msg_rx;
+
 
 void USART3_IRQHandler(void)
 {
@@ -30,7 +33,9 @@ void USART3_IRQHandler(void)
     if (USART3->SR & USART_SR_RXNE) {
         char  c = USART3->DR;
 
-        if (xQueueSendFromISR(rx_queue, &c, &xHigherPriorityTaskWoken))
+        if (msg_rx_byte(&msg_rx, c, &xHigherPriorityTaskWoken))
+            xbee_stats.rx_bytes++;
+        else if (xQueueSendFromISR(rx_queue, &c, &xHigherPriorityTaskWoken))
             xbee_stats.rx_bytes++;
         else
             xbee_stats.rx_overrun++;
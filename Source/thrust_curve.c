@@ -0,0 +1,183 @@
+#include "thrust_curve.h"
+#include "bldc_task.h"
+#include "util.h"
+#include <math.h>
+
+// The BLDC driver limits the duty cycle to 5..95%, which
+// leaves +/-90% of the battery voltage for the motor.
+//
+#define U_BAT_USABLE    0.9
+
+#define U_BAT_TAU       1.0     // battery filter time constant [s]
+
+/**
+ * Output linearisation
+ *
+ * The controllers and the mixer work in "linear volts": a
+ * command c asks for c / u_ref of the full thrust. This is
+ * converted to a motor speed with the inverse thrust curve,
+ * and to the motor voltage with K_v, so the loop gain doesn't
+ * change with the throttle.
+ *
+ * The curve is over the measured rpm, e.g. from a thrust
+ * stand or the motor_rpm blackbox field. rpm_ref is the speed
+ * at full thrust.
+ *
+ * The BLDC driver scales the PWM duty cycle with the measured
+ * battery voltage. The voltage which is actually available is
+ * passed on to the mixer as upper limit, so the desaturation
+ * works with the real thrust envelope of a discharged pack.
+ *
+ */
+struct thrust_config thrust_config = {
+    .linearize  = 0,
+    .u_ref      = 11.1,
+    .rpm_ref    = 7420,
+    .curve      = {
+        { .expo = 0.7, .u_0 = 0.5 },
+        { .expo = 0.7, .u_0 = 0.5 },
+        { .expo = 0.7, .u_0 = 0.5 },
+        { .expo = 0.7, .u_0 = 0.5 }
+    }
+};
+
+static float u_bat_filtered;
+
+
+/**
+ * Update the battery filter
+ *
+ * \param u_bat battery voltage [V]
+ * \param dt    time step [s], the loop rate is configurable
+ *
+ */
+void thrust_update_battery(float u_bat, float dt)
+{
+    if (u_bat_filtered == 0)
+        u_bat_filtered = u_bat;
+    else
+        u_bat_filtered += (u_bat - u_bat_filtered) * dt / (U_BAT_TAU + dt);
+}
+
+
+// Normalized rpm for the normalized thrust f
+//
+static float curve_inverse(const struct thrust_curve *c, float f)
+{
+    float e = clamp(c->expo, 0, 1);
+
+    if (f <= 0)
+        return 0;
+
+    if (e < 1e-3)
+        return f;
+
+    float b = 1 - e;
+    return (sqrtf(b*b + 4*e*f) - b) / (2*e);
+}
+
+
+static float curve_forward(const struct thrust_curve *c, float r)
+{
+    float e = clamp(c->expo, 0, 1);
+
+    if (r <= 0)
+        return 0;
+
+    return (1 - e) * r + e * r * r;
+}
+
+
+/**
+ * Largest command which the motors can follow with the
+ * current battery voltage. With the linearisation on, the
+ * mixer range is in commands, not in motor voltages.
+ *
+ * \param u_max  configured motor voltage limit [V]
+ */
+float thrust_cmd_max(float u_max)
+{
+    float u = u_max;
+
+    if (u_bat_filtered > 0)
+        u = fminf(u, u_bat_filtered * U_BAT_USABLE);
+
+    const float K_v = bldc_params.K_v;
+
+    if (!thrust_config.linearize || K_v <= 0 || thrust_config.rpm_ref <= 0)
+        return u;
+
+    float c_max = 0;
+
+    for (int id=0; id<THRUST_MOTORS; id++) {
+        const struct thrust_curve *c = &thrust_config.curve[id];
+        float r = K_v * (u - c->u_0) / thrust_config.rpm_ref;
+        float f = curve_forward(c, r) * thrust_config.u_ref;
+
+        c_max = id ? fminf(c_max, f) : f;
+    }
+
+    return c_max;
+}
+
+
+/**
+ * Expected rpm for the command cmd [V]
+ *
+ */
+float thrust_rpm(int id, float cmd)
+{
+    const struct thrust_curve *c = &thrust_config.curve[id];
+    const float K_v = bldc_params.K_v;
+
+    if (!thrust_config.linearize)
+        return K_v * fmaxf(cmd - c->u_0, 0);
+
+    return curve_inverse(c, cmd / thrust_config.u_ref) * thrust_config.rpm_ref;
+}
+
+
+/**
+ * Motor voltage for the command cmd [V]
+ *
+ */
+float thrust_voltage(int id, float cmd)
+{
+    const float K_v = bldc_params.K_v;
+
+    if (!thrust_config.linearize || K_v <= 0 || thrust_config.rpm_ref <= 0)
+        return cmd;
+
+    return thrust_config.curve[id].u_0 + thrust_rpm(id, cmd) / K_v;
+}
+
+
+// -------------------- Shell commands --------------------
+//
+#include "command.h"
+#include <stdio.h>
+
+
+static void cmd_thrust_show(void)
+{
+    printf("linearize : %d\n", thrust_config.linearize);
+    printf("u_ref     : %.2f V\n", thrust_config.u_ref);
+    printf("rpm_ref   : %.0f rpm, K_v %.0f rpm/V\n", thrust_config.rpm_ref, bldc_params.K_v);
+    printf("u_bat     : %.2f V filtered, %.2f V usable\n", u_bat_filtered, u_bat_filtered * U_BAT_USABLE);
+    printf("cmd max   : %.2f V\n", thrust_cmd_max(thrust_config.u_ref));
+    printf("\n");
+    printf("motor   expo    u_0    cmd 25%%    50%%    75%%   100%%\n");
+
+    for (int id=0; id<THRUST_MOTORS; id++) {
+        const struct thrust_curve *c = &thrust_config.curve[id];
+
+        printf("%5d %6.2f %6.2f V ", id, c->expo, c->u_0);
+        for (int k=1; k<=4; k++)
+            printf(" %6.2f", thrust_voltage(id, thrust_config.u_ref * k / 4));
+
+        printf(" V\n");
+    }
+}
+
+
+SHELL_CMD(thrust_show, (cmdfunc_t)cmd_thrust_show, "Show thrust curves")
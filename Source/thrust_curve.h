@@ -0,0 +1,34 @@
+#pragma once
+
+#define THRUST_MOTORS   4
+
+/**
+ * Thrust curve of one motor and propeller
+ *
+ * The normalized thrust over the normalized rpm r is
+ *
+ *   f(r) = (1 - expo) r + expo r^2
+ *
+ * with r = rpm / rpm_ref. The motor starts to turn at u_0,
+ * above that the rpm is K_v (u - u_0).
+ *
+ */
+struct thrust_curve {
+    float   expo;           // 0: linear, 1: quadratic
+    float   u_0;            // [V]
+};
+
+
+struct thrust_config {
+    int     linearize;
+    float   u_ref;          // [V] command for full thrust
+    float   rpm_ref;        // [rpm] speed at full thrust
+    struct  thrust_curve curve[THRUST_MOTORS];
+};
+
+extern struct thrust_config thrust_config;
+
+void  thrust_update_battery(float u_bat, float dt);
+float thrust_cmd_max(float u_max);
+float thrust_rpm(int id, float cmd);
+float thrust_voltage(int id, float cmd);
@@ -78,11 +78,26 @@ void delay_ms(uint32_t ms)
 
 
 /**
- * Set up TIM7 as a 16bit microsecond-timer.
+ * Get the CPU cycle counter, for profiling.
+ * It wraps around after 25 s at 168 MHz.
+ *
+ */
+uint32_t get_cycle_count(void)
+{
+    return DWT->CYCCNT;
+}
+
+
+/**
+ * Set up TIM7 as a 16bit microsecond-timer,
+ * and enable the DWT cycle counter.
  *
  */
 void init_us_timer(void)
 {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
     // Enable peripheral clocks
     //
     RCC->APB1ENR |= RCC_APB1Periph_TIM7;
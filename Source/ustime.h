@@ -4,6 +4,7 @@
 
 uint64_t get_us_time64(void);
 uint32_t get_us_time32(void);
+uint32_t get_cycle_count(void);
 
 void     delay_us(uint32_t us);
 void     delay_ms(uint32_t ms);
@@ -0,0 +1,317 @@
+/**
+ * Decode flight logs from the RAM disk
+ *
+ * Mounts a dump of the RAM disk with the firmware's disk
+ * driver and FatFs, and prints a log as CSV.
+ *
+ * usage: blackbox_decode [-l] dump.txt [file]
+ *
+ *   -l  list the files on the disk
+ *
+ * Without a file name, the last log is decoded. The dump is
+ * the hex listing of "ram_disk_dump". Lines which don't start
+ * with ':' are ignored, so a complete terminal log can be used.
+ *
+ * Each frame is one line. Fields which are recorded at a lower
+ * rate are left empty in the other lines. The blocks of the
+ * ring are decoded from the oldest to the newest.
+ *
+ */
+#include "blackbox.h"
+#include "ram_disk.h"
+#include "ff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+static int opt_list;
+
+
+static int load_dump(const char *fname)
+{
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        perror(fname);
+        return -1;
+    }
+
+    int size;
+    uint8_t *disk = ram_disk_data(&size);
+    char line[256];
+
+    memset(disk, 0, size);
+
+    // Unused sectors are not dumped, so the offsets
+    // may skip ahead.
+    //
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] != ':')
+            continue;
+
+        char *p;
+        int n = strtol(&line[1], &p, 16);
+
+        while (*p == ' ')
+            p++;
+
+        unsigned byte;
+        while (sscanf(p, "%2x", &byte) == 1) {
+            if (n >= size) {
+                fprintf(stderr, "%s: offset 0x%05x is beyond the disk\n", fname, n);
+                fclose(f);
+                return -1;
+            }
+
+            disk[n++] = byte;
+            p += 2;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+
+static int list_files(char *last)
+{
+    DIR dir;
+    FILINFO fi;
+
+    FRESULT res = f_opendir(&dir, "");
+    if (res != FR_OK)
+        return -res;
+
+    last[0] = 0;
+
+    while (f_readdir(&dir, &fi) == FR_OK && fi.fname[0]) {
+        if (opt_list)
+            printf("%-12s %8u\n", fi.fname, fi.fsize);
+
+        if (strstr(fi.fname, ".BBL") && strcmp(fi.fname, last) > 0)
+            strcpy(last, fi.fname);
+    }
+
+    f_closedir(&dir);
+    return 0;
+}
+
+
+static void print_header(const struct blackbox_header *h)
+{
+    printf("t");
+
+    for (int f=0; f<h->num_fields; f++) {
+        const struct blackbox_field_info *fi = &h->fields[f];
+        if (!fi->div)
+            continue;
+
+        for (int k=0; k<fi->count; k++)
+            printf(",%.*s%d", BLACKBOX_NAME_LEN, fi->name, k);
+    }
+
+    printf("\n");
+}
+
+
+/**
+ * Print the frames of a block
+ *
+ * \returns the number of frames, or -1 if the block is broken
+ */
+static int decode_block(const struct blackbox_header *h, const uint8_t *buf, uint32_t t0)
+{
+    struct blackbox_block b;
+    memcpy(&b, buf, sizeof(b));
+
+    if (b.sync != BLACKBOX_BLOCK_SYNC)
+        return -1;
+
+    int pos = sizeof(b), frames = 0;
+    uint32_t t = b.time;
+
+    while (pos + 3 <= h->block_size && buf[pos]) {
+        uint8_t  mask = buf[pos];
+        uint16_t dt   = buf[pos+1] | buf[pos+2] << 8;
+        pos += 3;
+        t += dt;
+
+        printf("%.6f", (t - t0) * 1e-6);
+
+        for (int f=0; f<h->num_fields; f++) {
+            const struct blackbox_field_info *fi = &h->fields[f];
+            if (!fi->div)
+                continue;
+
+            for (int k=0; k<fi->count; k++) {
+                if (!(mask & (1 << f))) {
+                    printf(",");
+                    continue;
+                }
+
+                if (pos + 2 > h->block_size)
+                    return -1;
+
+                int16_t v;
+                memcpy(&v, &buf[pos], 2);
+                pos += 2;
+
+                printf(",%g", v * fi->scale);
+            }
+        }
+
+        printf("\n");
+        frames++;
+    }
+
+    return frames;
+}
+
+
+static uint16_t seq_ref;
+
+static uint16_t block_seq(const uint8_t *buf)
+{
+    uint16_t seq;
+    memcpy(&seq, &buf[offsetof(struct blackbox_block, seq)], sizeof(seq));
+    return seq;
+}
+
+static int block_sync(const uint8_t *buf)
+{
+    uint16_t sync;
+    memcpy(&sync, &buf[offsetof(struct blackbox_block, sync)], sizeof(sync));
+    return sync;
+}
+
+// Oldest block first. A ring holds far less than 32768
+// blocks, so the sequence numbers can wrap around.
+//
+static int cmp_seq(const void *a, const void *b)
+{
+    int16_t sa = block_seq(*(const uint8_t **)a) - seq_ref;
+    int16_t sb = block_seq(*(const uint8_t **)b) - seq_ref;
+
+    return sa - sb;
+}
+
+
+static int decode_file(const char *fname)
+{
+    FIL file;
+    UINT br;
+
+    FRESULT res = f_open(&file, fname, FA_READ);
+    if (res != FR_OK) {
+        fprintf(stderr, "%s: can't open, error %d\n", fname, res);
+        return -1;
+    }
+
+    static union {
+        struct blackbox_header h;
+        uint8_t buf[BLACKBOX_HEADER_SIZE];
+    } hdr;
+
+    res = f_read(&file, hdr.buf, sizeof(hdr.buf), &br);
+    if (res != FR_OK || br != sizeof(hdr.buf) ||
+        hdr.h.magic != BLACKBOX_MAGIC || hdr.h.version > BLACKBOX_VERSION ||
+        hdr.h.num_fields > BB_NUM_FIELDS || hdr.h.block_size > BLACKBOX_BLOCK_SIZE ||
+        hdr.h.block_size < sizeof(struct blackbox_block))
+    {
+        fprintf(stderr, "%s: not a blackbox log\n", fname);
+        f_close(&file);
+        return -1;
+    }
+
+    // Read the ring, and put the used blocks in order
+    //
+    int num_blocks = (f_size(&file) - sizeof(hdr.buf)) / hdr.h.block_size;
+    uint8_t *data = malloc(num_blocks * hdr.h.block_size + 1);
+    const uint8_t **order = malloc(num_blocks * sizeof(*order) + 1);
+
+    int blocks = 0, broken = 0, frames = 0;
+
+    for (int i=0; i<num_blocks; i++) {
+        uint8_t *buf = &data[i * hdr.h.block_size];
+
+        res = f_read(&file, buf, hdr.h.block_size, &br);
+        if (res != FR_OK || br != hdr.h.block_size)
+            break;
+
+        if (block_sync(buf) == 0)
+            continue;       // unused
+
+        if (!blocks)
+            seq_ref = block_seq(buf);
+
+        order[blocks++] = buf;
+    }
+
+    f_close(&file);
+
+    qsort(order, blocks, sizeof(*order), cmp_seq);
+
+    print_header(&hdr.h);
+
+    uint32_t t0 = 0;
+    if (blocks)
+        memcpy(&t0, &order[0][offsetof(struct blackbox_block, time)], sizeof(t0));
+
+    for (int i=0; i<blocks; i++) {
+        int n = decode_block(&hdr.h, order[i], t0);
+        if (n < 0)
+            broken++;
+        else
+            frames += n;
+    }
+
+    free(order);
+    free(data);
+
+    fprintf(stderr, "%s: %d frames in %d blocks, %d broken\n", fname, frames, blocks, broken);
+    return broken ? -1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i=1; i<argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-l"))
+            opt_list = 1;
+        else
+            goto usage;
+    }
+
+    if (i != argc - 1 && i != argc - 2)
+        goto usage;
+
+    if (load_dump(argv[i]) < 0)
+        return 1;
+
+    static FATFS fs;
+    FRESULT res = f_mount(&fs, "", 1);
+    if (res != FR_OK) {
+        fprintf(stderr, "%s: can't mount, error %d\n", argv[i], res);
+        return 1;
+    }
+
+    char last[16];
+    if (list_files(last) < 0)
+        return 1;
+
+    if (opt_list)
+        return 0;
+
+    const char *fname = i == argc - 2 ? argv[i+1] : last;
+    if (!fname[0]) {
+        fprintf(stderr, "%s: no logs\n", argv[i]);
+        return 1;
+    }
+
+    return decode_file(fname) < 0 ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-l] dump.txt [file]\n", argv[0]);
+    return 2;
+}
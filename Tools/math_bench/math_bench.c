@@ -0,0 +1,633 @@
+/**
+ * Accuracy and speed of the matrix3f.h and matrixnf.h functions
+ *
+ * Each function is compared to a double precision reference on
+ * random inputs and timed in a loop. The time is in host clock
+ * ticks (the TSC on x86).
+ *
+ * The host numbers don't carry over to the Cortex-M4 directly:
+ * x86 has a fast square root and divider, and vectorizes the
+ * matrix kernels. The fast functions pay off on the M4, where
+ * VSQRT and VDIV take 14 cycles each.
+ *
+ * The exit status is 1 if an error exceeds its limit.
+ *
+ */
+#include "matrix3f.h"
+#include "matrixnf.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS_UNIT  "tsc"
+static uint64_t ticks(void) { return __rdtsc(); }
+#else
+#define TICKS_UNIT  "ns"
+static uint64_t ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+#define NUM_VEC     1024
+#define NUM_MAT     64
+#define REPEAT      200
+
+static int failed;
+
+
+// -------------------- Random inputs --------------------
+//
+static uint32_t rng_state = 0x12345678;
+
+static float frand(float min, float max)
+{
+    // xorshift32, the same numbers on every host
+    //
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    return min + (max - min) * (rng_state >> 8) * (1.0 / (1 << 24));
+}
+
+static vec3f rand_vec3f(float r)
+{
+    return (vec3f) { frand(-r, r), frand(-r, r), frand(-r, r) };
+}
+
+static quatf rand_quatf(void)
+{
+    return quatf_norm((quatf) { frand(-1, 1), frand(-1, 1), frand(-1, 1), frand(-1, 1) });
+}
+
+/**
+ * Random symmetric positive definite matrix M M^T + n I.
+ * The condition number stays small enough for float.
+ *
+ */
+static void rand_spd(float *A, int n)
+{
+    float M[MATNF_MAX * MATNF_MAX];
+
+    for (int i=0; i<n*n; i++)
+        M[i] = frand(-1, 1);
+
+    matnf_mul_trans(A, M, M, n, n, n);
+
+    for (int i=0; i<n; i++)
+        A[i*n + i] += n;
+}
+
+
+// -------------------- Reporting --------------------
+//
+#define BENCH(body)                                     \
+    ({                                                  \
+        uint64_t t0 = ticks();                          \
+        for (int r=0; r<REPEAT; r++) { body; }          \
+        (double)(ticks() - t0) / REPEAT;                \
+    })
+
+static void report(const char *name, double err, double limit, double t)
+{
+    int ok = err <= limit;
+
+    printf("%-24s %10.3g %10.3g %10.1f  %s\n", name, err, limit, t, ok ? "ok" : "FAIL");
+
+    if (!ok)
+        failed = 1;
+}
+
+static double max_d(double a, double b)
+{
+    return a > b ? a : b;
+}
+
+
+// -------------------- Scalar and vector functions --------------------
+//
+static float  in_f[NUM_VEC], out_f[NUM_VEC];
+static vec3f  in_v[NUM_VEC], out_v[NUM_VEC];
+static quatf  in_q[NUM_VEC], in_q2[NUM_VEC], out_q[NUM_VEC];
+
+static void test_rsqrt(void)
+{
+    for (int i=0; i<NUM_VEC; i++)
+        in_f[i] = expf(frand(-14, 14));
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_f[i] = 1 / sqrtf(in_f[i])
+    );
+
+    double err = 0;
+    for (int i=0; i<NUM_VEC; i++)
+        err = max_d(err, fabs(out_f[i] * sqrt(in_f[i]) - 1));
+
+    report("1/sqrtf", err, 1e-6, t / NUM_VEC);
+
+    t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_f[i] = rsqrtf_fast(in_f[i])
+    );
+
+    err = 0;
+    for (int i=0; i<NUM_VEC; i++)
+        err = max_d(err, fabs(out_f[i] * sqrt(in_f[i]) - 1));
+
+    report("rsqrtf_fast", err, 5e-6, t / NUM_VEC);
+}
+
+
+static double vec3_norm_error(void)
+{
+    double err = 0;
+
+    for (int i=0; i<NUM_VEC; i++) {
+        vec3f a = in_v[i], b = out_v[i];
+        double l = sqrt((double)a.x*a.x + (double)a.y*a.y + (double)a.z*a.z);
+
+        err = max_d(err, fabs(b.x - a.x / l));
+        err = max_d(err, fabs(b.y - a.y / l));
+        err = max_d(err, fabs(b.z - a.z / l));
+    }
+
+    return err;
+}
+
+static void test_vec3f_norm(void)
+{
+    for (int i=0; i<NUM_VEC; i++)
+        in_v[i] = rand_vec3f(20);
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_v[i] = vec3f_norm(in_v[i])
+    );
+
+    report("vec3f_norm", vec3_norm_error(), 1e-6, t / NUM_VEC);
+
+    t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_v[i] = vec3f_norm_fast(in_v[i])
+    );
+
+    report("vec3f_norm_fast", vec3_norm_error(), 5e-6, t / NUM_VEC);
+
+    // Near unit length, like the DCM rows after one step
+    //
+    for (int i=0; i<NUM_VEC; i++)
+        in_v[i] = vec3f_scale(vec3f_norm(rand_vec3f(1)), frand(0.999, 1.001));
+
+    t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_v[i] = vec3f_renorm(in_v[i])
+    );
+
+    report("vec3f_renorm", vec3_norm_error(), 2e-6, t / NUM_VEC);
+}
+
+
+static double quat_norm_error(void)
+{
+    double err = 0;
+
+    for (int i=0; i<NUM_VEC; i++) {
+        quatf a = in_q[i], b = out_q[i];
+        double l = sqrt((double)a.w*a.w + (double)a.x*a.x + (double)a.y*a.y + (double)a.z*a.z);
+
+        err = max_d(err, fabs(b.w - a.w / l));
+        err = max_d(err, fabs(b.x - a.x / l));
+        err = max_d(err, fabs(b.y - a.y / l));
+        err = max_d(err, fabs(b.z - a.z / l));
+    }
+
+    return err;
+}
+
+static void test_quatf_norm(void)
+{
+    // Typical input: a unit quaternion after one integration step
+    //
+    for (int i=0; i<NUM_VEC; i++) {
+        float k = frand(0.999, 1.001);
+        quatf q = rand_quatf();
+        in_q[i] = (quatf) { q.w * k, q.x * k, q.y * k, q.z * k };
+    }
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_q[i] = quatf_norm(in_q[i])
+    );
+
+    report("quatf_norm", quat_norm_error(), 1e-6, t / NUM_VEC);
+
+    t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_q[i] = quatf_norm_fast(in_q[i])
+    );
+
+    report("quatf_norm_fast", quat_norm_error(), 5e-6, t / NUM_VEC);
+
+    t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_q[i] = quatf_renorm(in_q[i])
+    );
+
+    report("quatf_renorm", quat_norm_error(), 2e-6, t / NUM_VEC);
+}
+
+
+static void test_quatf_mul(void)
+{
+    for (int i=0; i<NUM_VEC; i++) {
+        in_q[i]  = rand_quatf();
+        in_q2[i] = rand_quatf();
+    }
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_q[i] = quatf_mul(in_q[i], in_q2[i])
+    );
+
+    double err = 0;
+    for (int i=0; i<NUM_VEC; i++) {
+        double aw = in_q[i].w,  ax = in_q[i].x,  ay = in_q[i].y,  az = in_q[i].z;
+        double bw = in_q2[i].w, bx = in_q2[i].x, by = in_q2[i].y, bz = in_q2[i].z;
+
+        err = max_d(err, fabs(out_q[i].w - (aw*bw - ax*bx - ay*by - az*bz)));
+        err = max_d(err, fabs(out_q[i].x - (aw*bx + ax*bw + ay*bz - az*by)));
+        err = max_d(err, fabs(out_q[i].y - (aw*by - ax*bz + ay*bw + az*bx)));
+        err = max_d(err, fabs(out_q[i].z - (aw*bz + ax*by - ay*bx + az*bw)));
+    }
+
+    report("quatf_mul", err, 1e-6, t / NUM_VEC);
+}
+
+
+/**
+ * Rotate v by q in double precision, as the matrix of q
+ *
+ */
+static void rotate_ref(quatf q, vec3f v, double r[3])
+{
+    double w = q.w, x = q.x, y = q.y, z = q.z;
+    double R[3][3] = {
+        { 1 - 2*(y*y + z*z),     2*(x*y - w*z),     2*(x*z + w*y) },
+        {     2*(x*y + w*z), 1 - 2*(x*x + z*z),     2*(y*z - w*x) },
+        {     2*(x*z - w*y),     2*(y*z + w*x), 1 - 2*(x*x + y*y) }
+    };
+
+    for (int i=0; i<3; i++)
+        r[i] = R[i][0] * v.x + R[i][1] * v.y + R[i][2] * v.z;
+}
+
+static void test_quatf_rotate(void)
+{
+    for (int i=0; i<NUM_VEC; i++) {
+        in_q[i] = rand_quatf();
+        in_v[i] = vec3f_norm(rand_vec3f(1));
+    }
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_v[i] = quatf_rotate(in_q[i], in_v[i])
+    );
+
+    double err = 0;
+    for (int i=0; i<NUM_VEC; i++) {
+        double r[3];
+        rotate_ref(in_q[i], in_v[i], r);
+
+        err = max_d(err, fabs(out_v[i].x - r[0]));
+        err = max_d(err, fabs(out_v[i].y - r[1]));
+        err = max_d(err, fabs(out_v[i].z - r[2]));
+    }
+
+    report("quatf_rotate", err, 2e-6, t / NUM_VEC);
+
+    // Same rotation by the matrix, for comparison
+    //
+    static mat3f in_m[NUM_VEC];
+    for (int i=0; i<NUM_VEC; i++)
+        in_m[i] = quatf_to_mat3f(in_q[i]);
+
+    t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_v[i] = vec3f_matmul(in_m[i], in_v[i])
+    );
+
+    err = 0;
+    for (int i=0; i<NUM_VEC; i++) {
+        double r[3];
+        rotate_ref(in_q[i], in_v[i], r);
+
+        err = max_d(err, fabs(out_v[i].x - r[0]));
+        err = max_d(err, fabs(out_v[i].y - r[1]));
+        err = max_d(err, fabs(out_v[i].z - r[2]));
+    }
+
+    report("vec3f_matmul", err, 2e-6, t / NUM_VEC);
+}
+
+
+/**
+ * Rotation vectors up to 0.4 rad, e.g. 10 ms at 2000 deg/s.
+ * The error is the largest element difference to the exact
+ * quaternion or matrix.
+ *
+ */
+static void test_rotvec(void)
+{
+    static mat3f out_m[NUM_VEC];
+
+    for (int i=0; i<NUM_VEC; i++)
+        in_v[i] = vec3f_scale(vec3f_norm(rand_vec3f(1)), frand(0, 0.4));
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_q[i] = quatf_from_rotvec(in_v[i])
+    );
+
+    double t2 = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_m[i] = mat3f_from_rotvec(in_v[i])
+    );
+
+    double err = 0, err2 = 0;
+    for (int i=0; i<NUM_VEC; i++) {
+        double x = in_v[i].x, y = in_v[i].y, z = in_v[i].z;
+        double a = sqrt(x*x + y*y + z*z);
+        double s = a > 0 ? sin(a / 2) / a : 0.5;
+        double c = cos(a / 2);
+
+        err = max_d(err, fabs(out_q[i].w - c));
+        err = max_d(err, fabs(out_q[i].x - x * s));
+        err = max_d(err, fabs(out_q[i].y - y * s));
+        err = max_d(err, fabs(out_q[i].z - z * s));
+
+        quatf q = { c, x * s, y * s, z * s };
+        mat3f m = quatf_to_mat3f(q);
+        const float *pm = &m.m00, *po = &out_m[i].m00;
+
+        for (int j=0; j<9; j++)
+            err2 = max_d(err2, fabs(po[j] - pm[j]));
+    }
+
+    report("quatf_from_rotvec", err, 1e-6, t / NUM_VEC);
+    report("mat3f_from_rotvec", err2, 2e-6, t2 / NUM_VEC);
+}
+
+
+/**
+ * The error is the angle between the first order step and
+ * the exact rotation, for rates up to 2000 deg/s at 1 kHz.
+ *
+ */
+static void test_quatf_integrate(void)
+{
+    const float dt = 0.001;
+
+    for (int i=0; i<NUM_VEC; i++) {
+        in_q[i] = rand_quatf();
+        in_v[i] = rand_vec3f(2000 * M_PI / 180 / sqrtf(3));
+    }
+
+    double t = BENCH(
+        for (int i=0; i<NUM_VEC; i++)
+            out_q[i] = quatf_integrate(in_q[i], in_v[i], dt)
+    );
+
+    double err = 0;
+    for (int i=0; i<NUM_VEC; i++) {
+        // q * exp(w dt / 2)
+        //
+        double wx = in_v[i].x, wy = in_v[i].y, wz = in_v[i].z;
+        double wn = sqrt(wx*wx + wy*wy + wz*wz);
+        double c  = cos(wn * dt / 2), s = sin(wn * dt / 2) / wn;
+        double ew = c, ex = wx * s, ey = wy * s, ez = wz * s;
+
+        double aw = in_q[i].w, ax = in_q[i].x, ay = in_q[i].y, az = in_q[i].z;
+        double rw = aw*ew - ax*ex - ay*ey - az*ez;
+        double rx = aw*ex + ax*ew + ay*ez - az*ey;
+        double ry = aw*ey - ax*ez + ay*ew + az*ex;
+        double rz = aw*ez + ax*ey - ay*ex + az*ew;
+
+        // Angle of conj(r) * q. Not acos() of the dot product,
+        // which would turn the norm error into an angle.
+        //
+        double qw = out_q[i].w, qx = out_q[i].x, qy = out_q[i].y, qz = out_q[i].z;
+        double dw = rw*qw + rx*qx + ry*qy + rz*qz;
+        double dx = rw*qx - rx*qw - ry*qz + rz*qy;
+        double dy = rw*qy + rx*qz - ry*qw - rz*qx;
+        double dz = rw*qz - rx*qy + ry*qx - rz*qw;
+
+        err = max_d(err, 2 * atan2(sqrt(dx*dx + dy*dy + dz*dz), fabs(dw)));
+    }
+
+    report("quatf_integrate [rad]", err, 1e-5, t / NUM_VEC);
+}
+
+
+// -------------------- Small matrix kernels --------------------
+//
+static float in_a[NUM_MAT][MATNF_MAX * MATNF_MAX];
+static float in_b[NUM_MAT][MATNF_MAX * MATNF_MAX];
+static float out_c[NUM_MAT][MATNF_MAX * MATNF_MAX];
+
+/**
+ * Maximum error of C = A B (or A B^T), relative
+ * to the largest element of the product.
+ *
+ */
+static double mul_error(int n, int trans)
+{
+    double err = 0;
+
+    for (int k=0; k<NUM_MAT; k++) {
+        double scale = 0, e = 0;
+
+        for (int i=0; i<n; i++) {
+            for (int j=0; j<n; j++) {
+                double s = 0;
+                for (int l=0; l<n; l++)
+                    s += (double)in_a[k][i*n + l] * (trans ? in_b[k][j*n + l] : in_b[k][l*n + j]);
+
+                scale = max_d(scale, fabs(s));
+                e = max_d(e, fabs(out_c[k][i*n + j] - s));
+            }
+        }
+
+        err = max_d(err, e / scale);
+    }
+
+    return err;
+}
+
+/**
+ * The kernels are called with constant dimensions, like
+ * an estimator would do.
+ *
+ */
+#define TEST_MUL(N)                                                     \
+    static void test_mul_##N(void)                                      \
+    {                                                                   \
+        char name[32];                                                  \
+                                                                        \
+        for (int k=0; k<NUM_MAT; k++) {                                 \
+            for (int i=0; i<N*N; i++) {                                 \
+                in_a[k][i] = frand(-1, 1);                              \
+                in_b[k][i] = frand(-1, 1);                              \
+            }                                                           \
+        }                                                               \
+                                                                        \
+        double t = BENCH(                                               \
+            for (int k=0; k<NUM_MAT; k++)                               \
+                matnf_mul(out_c[k], in_a[k], in_b[k], N, N, N)          \
+        );                                                              \
+        snprintf(name, sizeof(name), "matnf_mul %dx%d", N, N);          \
+        report(name, mul_error(N, 0), 1e-6, t / NUM_MAT);               \
+                                                                        \
+        t = BENCH(                                                      \
+            for (int k=0; k<NUM_MAT; k++)                               \
+                matnf_mul_trans(out_c[k], in_a[k], in_b[k], N, N, N)    \
+        );                                                              \
+        snprintf(name, sizeof(name), "matnf_mul_trans %dx%d", N, N);    \
+        report(name, mul_error(N, 1), 1e-6, t / NUM_MAT);               \
+    }
+
+TEST_MUL(3)
+TEST_MUL(6)
+TEST_MUL(9)
+
+
+/**
+ * The solver and inverse are checked by the residual
+ * max |A X - B| / max |B|.
+ *
+ */
+static double residual(const float *A, const float *X, const float *B, int n, int m)
+{
+    double e = 0, scale = 0;
+
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<m; j++) {
+            double s = 0;
+            for (int l=0; l<n; l++)
+                s += (double)A[i*n + l] * X[l*m + j];
+
+            e = max_d(e, fabs(s - B[i*m + j]));
+            scale = max_d(scale, fabs(B[i*m + j]));
+        }
+    }
+
+    return e / scale;
+}
+
+/**
+ * Decomposition error max |L L^T - A| / max |A|
+ *
+ */
+static double chol_error(const float *A, const float *L, int n)
+{
+    double e = 0, scale = 0;
+
+    for (int i=0; i<n; i++) {
+        for (int j=0; j<n; j++) {
+            double s = 0;
+            for (int l=0; l<n; l++)
+                s += (double)L[i*n + l] * L[j*n + l];
+
+            e = max_d(e, fabs(s - A[i*n + j]));
+            scale = max_d(scale, fabs(A[i*n + j]));
+        }
+    }
+
+    return e / scale;
+}
+
+#define TEST_SOLVE(N)                                                   \
+    static void test_solve_##N(void)                                    \
+    {                                                                   \
+        static float L[NUM_MAT][N*N], X[NUM_MAT][N];                    \
+        char name[32];                                                  \
+        int res = 0;                                                    \
+                                                                        \
+        for (int k=0; k<NUM_MAT; k++) {                                 \
+            rand_spd(in_a[k], N);                                       \
+            for (int i=0; i<N; i++)                                     \
+                in_b[k][i] = frand(-1, 1);                              \
+        }                                                               \
+                                                                        \
+        double t = BENCH(                                               \
+            for (int k=0; k<NUM_MAT; k++)                               \
+                res |= matnf_cholesky(L[k], in_a[k], N)                 \
+        );                                                              \
+        double t2 = BENCH(                                              \
+            for (int k=0; k<NUM_MAT; k++)                               \
+                matnf_chol_solve(X[k], L[k], in_b[k], N, 1)             \
+        );                                                              \
+                                                                        \
+        double err = res ? INFINITY : 0;                                \
+        for (int k=0; k<NUM_MAT; k++)                                   \
+            err = max_d(err, chol_error(in_a[k], L[k], N));             \
+                                                                        \
+        snprintf(name, sizeof(name), "matnf_cholesky %dx%d", N, N);     \
+        report(name, err, 1e-6, t / NUM_MAT);                           \
+                                                                        \
+        err = res ? INFINITY : 0;                                       \
+        for (int k=0; k<NUM_MAT; k++)                                   \
+            err = max_d(err, residual(in_a[k], X[k], in_b[k], N, 1));   \
+                                                                        \
+        snprintf(name, sizeof(name), "matnf_chol_solve %dx%d", N, N);   \
+        report(name, err, 1e-5, t2 / NUM_MAT);                          \
+                                                                        \
+        t = BENCH(                                                      \
+            for (int k=0; k<NUM_MAT; k++)                               \
+                res |= matnf_inv_spd(out_c[k], in_a[k], N)              \
+        );                                                              \
+                                                                        \
+        float I[N*N];                                                   \
+        matnf_identity(I, N);                                           \
+                                                                        \
+        err = res ? INFINITY : 0;                                       \
+        for (int k=0; k<NUM_MAT; k++)                                   \
+            err = max_d(err, residual(in_a[k], out_c[k], I, N, N));     \
+                                                                        \
+        snprintf(name, sizeof(name), "matnf_inv_spd %dx%d", N, N);      \
+        report(name, err, 1e-5, t / NUM_MAT);                           \
+    }
+
+TEST_SOLVE(3)
+TEST_SOLVE(6)
+TEST_SOLVE(9)
+
+
+int main(void)
+{
+    printf("%-24s %10s %10s %10s\n", "function", "max error", "limit", TICKS_UNIT "/call");
+
+    test_rsqrt();
+    test_vec3f_norm();
+    test_quatf_norm();
+    test_quatf_mul();
+    test_quatf_rotate();
+    test_quatf_integrate();
+    test_rotvec();
+
+    test_mul_3();
+    test_mul_6();
+    test_mul_9();
+
+    test_solve_3();
+    test_solve_6();
+    test_solve_9();
+
+    return failed;
+}
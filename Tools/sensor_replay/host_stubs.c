@@ -0,0 +1,78 @@
+/**
+ * Hardware stubs for the sensor replay tool
+ *
+ * The drivers are only used through convert() and restore(),
+ * so the bus functions just fail.
+ *
+ */
+#include "host_stubs.h"
+#include "ustime.h"
+#include "i2c_driver.h"
+#include "sensor_driver.h"
+#include <errno.h>
+
+uint32_t host_time;
+
+
+uint32_t get_us_time32(void)
+{
+    return host_time;
+}
+
+
+uint64_t get_us_time64(void)
+{
+    return host_time;
+}
+
+
+uint32_t get_cycle_count(void)
+{
+    return 0;
+}
+
+
+void delay_us(uint32_t us)
+{
+    host_time += us;
+}
+
+
+void delay_ms(uint32_t ms)
+{
+    host_time += ms * 1000;
+}
+
+
+int i2c_read(uint8_t addr, uint8_t reg, void *data, size_t size)
+{
+    errno = EIO;
+    return -1;
+}
+
+
+int i2c_write(uint8_t addr, uint8_t reg, const void *data, size_t size)
+{
+    errno = EIO;
+    return -1;
+}
+
+
+void i2c_recover(void)
+{
+}
+
+
+uint32_t i2c_recovery_count(void)
+{
+    return 0;
+}
+
+
+// The MPU6000 driver needs the SPI hardware. Its captures
+// are replayed with the MPU9150 driver, which has the same
+// data format.
+//
+const struct sensor_driver mpu6000_driver = {
+    .name = "mpu6000"
+};
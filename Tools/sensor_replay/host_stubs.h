@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Replay clock, returned by get_us_time32()
+//
+extern uint32_t host_time;
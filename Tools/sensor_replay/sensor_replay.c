@@ -0,0 +1,614 @@
+/**
+ * Replay a raw sensor capture on the PC
+ *
+ * Runs the firmware's sensor drivers, calibration and
+ * attitude estimation on a capture from the sensor_capture
+ * command, and compares the results with the CHECK records.
+ *
+ * The firmware is compiled with -ffp-contract=off, and the
+ * float operations are IEEE 754 on both sides. The results
+ * should match bit by bit, except for the altitude, which
+ * isn't part of the capture.
+ *
+ * usage: sensor_replay [-c] [-v] [-b] capture.txt
+ *        sensor_replay -t
+ *
+ *   -c  print the calibrated data and attitude as CSV
+ *   -v  print every mismatch, not only the first one
+ *   -b  benchmark the attitude estimators, see bench_cycle()
+ *   -t  check the tilt convergence of the estimators,
+ *       see converge_check()
+ *
+ * The capture is the hex listing of "sensor_capture dump".
+ * Lines which don't start with ':' are ignored, so a complete
+ * terminal log can be used.
+ *
+ */
+#include "host_stubs.h"
+#include "sensor_capture.h"
+#include "sensor_driver.h"
+#include "sensor_mock.h"
+#include "sensors.h"
+#include "gyro_tempco.h"
+#include "attitude.h"
+#include "attitude_ekf.h"
+#include "i2c_mpu9150.h"
+#include "i2c_ak8975.h"
+#include "i2c_bmp180.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#define BENCH_REPEAT    100
+
+#define CONVERGE_TILT   0.1     // [rad] initial tilt error
+#define CONVERGE_TIME   5       // [s]
+#define CONVERGE_LIMIT  0.005   // [rad] remaining tilt error
+
+static const struct {
+    const char *name;
+    const struct sensor_driver *drv;
+} host_drivers[] = {
+    { "mpu9150",  &mpu9150_driver     },
+    { "mpu6000",  &mpu9150_driver     },
+    { "ak8975",   &ak8975_driver      },
+    { "bmp180",   &bmp180_driver      },
+    { "mock",     &sensor_mock_driver }
+};
+
+static const struct sensor_driver *drivers[SENSOR_MAX_DRIVERS];
+static int num_drivers;
+
+static int opt_csv;
+static int opt_verbose;
+static int opt_bench;
+static int opt_converge;
+
+static uint32_t cycles, checks, mismatches;
+static uint32_t t_first, t_last;
+
+static struct {
+    struct dcm      dcm;
+    struct mahony   mahony;
+    struct ekf      ekf;
+    uint64_t        ns[3];
+    uint64_t        tsc[3];
+    uint32_t        updates;
+    double          err_sum[2], err_max[2];
+} bench;
+
+
+static uint8_t *load_capture(const char *fname, int *len)
+{
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        perror(fname);
+        return NULL;
+    }
+
+    int size = 65536, n = 0;
+    uint8_t *buf = malloc(size);
+    char line[256];
+
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] != ':')
+            continue;
+
+        char *p;
+        int offset = strtol(&line[1], &p, 16);
+        if (offset != n) {
+            fprintf(stderr, "%s: bad offset 0x%05x, expected 0x%05x\n", fname, offset, n);
+            goto error;
+        }
+
+        while (*p == ' ')
+            p++;
+
+        unsigned byte;
+        while (sscanf(p, "%2x", &byte) == 1) {
+            if (n == size)
+                buf = realloc(buf, size *= 2);
+
+            buf[n++] = byte;
+            p += 2;
+        }
+    }
+
+    fclose(f);
+    *len = n;
+    return buf;
+
+error:
+    fclose(f);
+    free(buf);
+    return NULL;
+}
+
+
+static const struct sensor_driver *find_driver(const char *name)
+{
+    for (int i=0; i<ARRAY_SIZE(host_drivers); i++) {
+        if (!strcmp(host_drivers[i].name, name))
+            return host_drivers[i].drv;
+    }
+    return NULL;
+}
+
+
+static int replay_start(int n, const uint8_t *data, int len)
+{
+    uint32_t magic, version;
+
+    if (len < 8 || len != 8 + n * SENSOR_CAPTURE_NAME_LEN || n > SENSOR_MAX_DRIVERS) {
+        fprintf(stderr, "bad START record\n");
+        return -1;
+    }
+
+    memcpy(&magic, &data[0], 4);
+    memcpy(&version, &data[4], 4);
+
+    if (magic != SENSOR_CAPTURE_MAGIC || version != SENSOR_CAPTURE_VERSION) {
+        fprintf(stderr, "unknown capture format %08x, version %u\n", magic, version);
+        return -1;
+    }
+
+    for (int i=0; i<n; i++) {
+        char name[SENSOR_CAPTURE_NAME_LEN + 1] = { 0 };
+        memcpy(name, &data[8 + i * SENSOR_CAPTURE_NAME_LEN], SENSOR_CAPTURE_NAME_LEN);
+
+        drivers[i] = find_driver(name);
+        if (!drivers[i]) {
+            fprintf(stderr, "unknown driver \"%s\"\n", name);
+            return -1;
+        }
+
+        fprintf(stderr, "driver %d: %s\n", i, name);
+    }
+
+    num_drivers = n;
+
+    // The captured state overwrites the default
+    // decimation filters.
+    //
+    sensor_set_drivers(drivers, num_drivers);
+    gyro_tempco_restart();
+
+    return 1;
+}
+
+
+static int replay_blob(int index, const uint8_t *data, int len)
+{
+    if (index >= sensor_capture_num_blobs || sensor_capture_blobs[index].size != len) {
+        fprintf(stderr, "blob %d: size mismatch (%d bytes)\n", index, len);
+        return -1;
+    }
+
+    memcpy(sensor_capture_blobs[index].ptr, data, len);
+    return 1;
+}
+
+
+static int replay_restore(int type, int index, const uint8_t *data, int len)
+{
+    if (index >= num_drivers || !drivers[index]->restore ||
+        drivers[index]->restore(type, data, len) < 0)
+    {
+        fprintf(stderr, "driver %d: can't restore %d bytes\n", index, len);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint64_t time_tsc(void)
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+
+/**
+ * Start each estimator with a tilt error at several headings,
+ * and check that the accelerometer correction removes it. The
+ * vehicle is level and at rest.
+ *
+ * The correction is computed in the body frame, so it must
+ * work the same way at any heading.
+ *
+ * \returns the number of failed runs
+ */
+static int converge_check(void)
+{
+    static const char *names[] = { "DCM", "Mahony", "EKF" };
+
+    const float dt  = 0.001;
+    const vec3f acc = { 0, 0, -STANDARD_GRAVITY };
+
+    int failed = 0;
+
+    fprintf(stderr, "estimator  yaw [deg]  tilt [rad]\n");
+
+    for (int est=0; est<3; est++) {
+        for (int yaw=0; yaw<360; yaw+=90) {
+            // mat3f_from_rotvec() is only accurate for small
+            // angles, so the heading is built directly.
+            //
+            float c = cosf(yaw * M_PI / 180), s = sinf(yaw * M_PI / 180);
+            mat3f R = mat3f_mul(
+                (mat3f) { c, -s, 0,  s, c, 0,  0, 0, 1 },
+                mat3f_from_rotvec((vec3f) { CONVERGE_TILT, 0, 0 })
+            );
+
+            dcm_reset();
+            mahony_reset();
+            ekf_reset();
+
+            dcm.matrix = R;
+            mahony.q   = mat3f_to_quatf(R);
+            ekf.q      = mahony.q;
+
+            for (int i=0; i<CONVERGE_TIME / dt; i++) {
+                switch (est) {
+                case 0: dcm_update(vec3f_zero, acc, vec3f_zero, dt);    break;
+                case 1: mahony_update(vec3f_zero, acc, vec3f_zero, dt); break;
+                case 2: ekf_update(vec3f_zero, acc, vec3f_zero, dt);    break;
+                }
+            }
+
+            switch (est) {
+            case 0: R = dcm.matrix;                 break;
+            case 1: R = quatf_to_mat3f(mahony.q);   break;
+            case 2: R = quatf_to_mat3f(ekf.q);      break;
+            }
+
+            // Angle between the estimated down direction
+            // R^T down_ref and the accelerometer
+            //
+            vec3f down = vec3f_scale(mat3f_row(R, 2), -1);
+            double ca = vec3f_dot(down, acc) / (vec3f_len(down) * STANDARD_GRAVITY);
+            double tilt = acos(ca > 1 ? 1 : ca < -1 ? -1 : ca);
+
+            int ok = tilt < CONVERGE_LIMIT;
+            if (!ok)
+                failed++;
+
+            fprintf(stderr, "%-10s %9d  %10.6f%s\n", names[est], yaw, tilt, ok ? "" : "  FAILED");
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * Run the DCM, the quaternion estimator and the EKF side by
+ * side on the calibrated data, independent of attitude.estimator.
+ * Each update is repeated BENCH_REPEAT times from the same state
+ * for the timing.
+ *
+ * There is no reference attitude in a capture, so the accuracy
+ * is the angle between the DCM and the other estimates.
+ *
+ */
+static void bench_cycle(const struct sensor_data *d, float dt)
+{
+    const struct dcm    saved_dcm    = dcm;
+    const struct mahony saved_mahony = mahony;
+    const struct ekf    saved_ekf    = ekf;
+
+    if (bench.updates == 0) {
+        bench.dcm = dcm;
+        bench.mahony = mahony;
+        bench.mahony.q        = mat3f_to_quatf(dcm.matrix);
+        bench.mahony.offset_i = dcm.offset_i;
+        bench.mahony.acc_kp   = dcm.acc_kp;
+        bench.mahony.acc_ki   = dcm.acc_ki;
+        bench.mahony.mag_kp   = dcm.mag_kp;
+        bench.mahony.mag_ki   = dcm.mag_ki;
+        bench.ekf = ekf;
+        bench.ekf.q    = bench.mahony.q;
+        bench.ekf.bias = vec3f_scale(dcm.offset_i, -1);
+    }
+
+    if (vec3f_lensq(d->acc) == 0)
+        return;
+
+    // One gyro sample per update, as with attitude.decim = 1
+    //
+    vec3f rot = vec3f_scale(d->gyro, dt);
+
+    uint64_t t0 = time_ns(), c0 = time_tsc();
+    for (int i=0; i<BENCH_REPEAT; i++) {
+        dcm = bench.dcm;
+        dcm_update(rot, d->acc, d->mag, dt);
+    }
+    bench.ns[0]  += time_ns() - t0;
+    bench.tsc[0] += time_tsc() - c0;
+    bench.dcm = dcm;
+
+    t0 = time_ns(), c0 = time_tsc();
+    for (int i=0; i<BENCH_REPEAT; i++) {
+        mahony = bench.mahony;
+        mahony_update(rot, d->acc, d->mag, dt);
+    }
+    bench.ns[1]  += time_ns() - t0;
+    bench.tsc[1] += time_tsc() - c0;
+    bench.mahony = mahony;
+
+    t0 = time_ns(), c0 = time_tsc();
+    for (int i=0; i<BENCH_REPEAT; i++) {
+        ekf = bench.ekf;
+        ekf_update(rot, d->acc, d->mag, dt);
+    }
+    bench.ns[2]  += time_ns() - t0;
+    bench.tsc[2] += time_tsc() - c0;
+    bench.ekf = ekf;
+
+    dcm = saved_dcm;
+    mahony = saved_mahony;
+    ekf = saved_ekf;
+
+    // Angle of the rotation between the estimates
+    //
+    const quatf q[2] = { bench.mahony.q, bench.ekf.q };
+
+    for (int k=0; k<2; k++) {
+        mat3f e = mat3f_mul(mat3f_trans(bench.dcm.matrix), quatf_to_mat3f(q[k]));
+        double c = (e.m00 + e.m11 + e.m22 - 1) / 2;
+        double err = acos(c > 1 ? 1 : c < -1 ? -1 : c) * 180 / M_PI;
+
+        bench.err_sum[k] += err;
+        if (err > bench.err_max[k])
+            bench.err_max[k] = err;
+    }
+
+    bench.updates++;
+}
+
+
+static void bench_report(void)
+{
+    static const char *names[] = { "DCM", "Mahony", "EKF" };
+
+    if (!bench.updates)
+        return;
+
+    double n = (double)bench.updates * BENCH_REPEAT;
+
+    fprintf(stderr, "\nestimator   ns/update");
+#ifdef HAVE_RDTSC
+    fprintf(stderr, "  tsc/update");
+#endif
+    fprintf(stderr, "\n");
+
+    for (int i=0; i<3; i++) {
+        fprintf(stderr, "%-10s %10.1f", names[i], bench.ns[i] / n);
+#ifdef HAVE_RDTSC
+        fprintf(stderr, "  %10.1f", bench.tsc[i] / n);
+#endif
+        fprintf(stderr, "\n");
+    }
+
+    fprintf(stderr, "\n");
+    for (int k=0; k<2; k++) {
+        fprintf(stderr,
+            "DCM vs. %-6s: %.4f deg mean, %.4f deg max difference (%u updates)\n",
+            names[k+1], bench.err_sum[k] / bench.updates, bench.err_max[k], bench.updates
+        );
+    }
+}
+
+
+static void replay_cycle(uint32_t updated, uint32_t t)
+{
+    float dt = (t - t_last) * 1e-6;
+
+    host_time = t;
+    sensor_process(updated, t);
+
+    if (cycles++ == 0)
+        t_first = t;
+
+    t_last = t;
+
+    struct sensor_data d;
+    sensor_read(&d);
+
+    if (opt_bench && cycles > 1)
+        bench_cycle(&d, dt);
+
+    if (opt_csv) {
+        vec3f euler = attitude_euler();
+
+        printf(
+            "%u, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g, %g\n", t,
+            d.acc.x, d.acc.y, d.acc.z, d.gyro.x, d.gyro.y, d.gyro.z,
+            d.mag.x * 1e6, d.mag.y * 1e6, d.mag.z * 1e6, d.pressure, d.gyro_temp,
+            euler.x, euler.y, euler.z
+        );
+    }
+}
+
+
+static int replay_check(const uint8_t *data, int len)
+{
+    struct sensor_capture_check c, r;
+
+    if (len != sizeof(c)) {
+        fprintf(stderr, "bad CHECK record\n");
+        return -1;
+    }
+
+    memcpy(&c, data, sizeof(c));
+
+    memset(&r, 0, sizeof(r));
+    sensor_read(&r.data);
+    r.attitude = attitude_matrix();
+
+    checks++;
+
+    if (!memcmp(&c, &r, sizeof(c)))
+        return 1;
+
+    if (mismatches++ == 0 || opt_verbose) {
+        const float *fc = (const float*)&c, *fr = (const float*)&r;
+
+        fprintf(stderr, "mismatch in cycle %u, t = %u us\n", cycles, t_last);
+
+        for (int i=0; i<sizeof(c) / 4; i++) {
+            if (memcmp(&fc[i], &fr[i], 4))
+                fprintf(stderr, "  word %2d: capture %.9g, replay %.9g\n", i, fc[i], fr[i]);
+        }
+    }
+
+    return 1;
+}
+
+
+static int replay(const uint8_t *buf, int len)
+{
+    int pos = 0;
+    int pending = 0;
+    uint32_t updated = 0, t = 0;
+
+    while (pos + sizeof(struct sensor_capture_record) <= len) {
+        struct sensor_capture_record r;
+        memcpy(&r, &buf[pos], sizeof(r));
+        pos += sizeof(r);
+
+        if (pos + r.len > len) {
+            fprintf(stderr, "truncated record at offset 0x%05x\n", pos);
+            return -1;
+        }
+
+        const uint8_t *data = &buf[pos];
+        pos += r.len;
+
+        // A cycle is processed when all of its data is restored
+        //
+        if (pending &&
+            (r.type == SENSOR_CAPTURE_CYCLE || r.type == SENSOR_CAPTURE_CHECK))
+        {
+            replay_cycle(updated, t);
+            pending = 0;
+        }
+
+        int res = 1;
+
+        switch (r.type) {
+        case SENSOR_CAPTURE_START:
+            res = replay_start(r.index, data, r.len);
+            break;
+
+        case SENSOR_CAPTURE_BLOB:
+            res = replay_blob(r.index, data, r.len);
+            break;
+
+        case SENSOR_CAPTURE_CALIB:
+            res = replay_restore(SENSOR_RAW_CALIB, r.index, data, r.len);
+            break;
+
+        case SENSOR_CAPTURE_DATA:
+            res = replay_restore(SENSOR_RAW_DATA, r.index, data, r.len);
+            break;
+
+        case SENSOR_CAPTURE_CYCLE:
+            if (r.len != sizeof(t)) {
+                fprintf(stderr, "bad CYCLE record\n");
+                return -1;
+            }
+
+            memcpy(&t, data, sizeof(t));
+            updated = r.index;
+            pending = 1;
+            break;
+
+        case SENSOR_CAPTURE_CHECK:
+            res = replay_check(data, r.len);
+            break;
+
+        default:
+            fprintf(stderr, "unknown record type %d\n", r.type);
+            return -1;
+        }
+
+        if (res < 0)
+            return res;
+    }
+
+    if (pending)
+        replay_cycle(updated, t);
+
+    return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i;
+    for (i=1; i<argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-c"))
+            opt_csv = 1;
+        else if (!strcmp(argv[i], "-v"))
+            opt_verbose = 1;
+        else if (!strcmp(argv[i], "-b"))
+            opt_bench = 1;
+        else if (!strcmp(argv[i], "-t"))
+            opt_converge = 1;
+        else
+            goto usage;
+    }
+
+    if (opt_converge && i == argc)
+        return converge_check() ? 1 : 0;
+
+    if (i != argc - 1)
+        goto usage;
+
+    int len;
+    uint8_t *buf = load_capture(argv[i], &len);
+    if (!buf)
+        return 1;
+
+    clock_t c0 = clock();
+    int res = replay(buf, len);
+    double elapsed = (double)(clock() - c0) / CLOCKS_PER_SEC;
+
+    free(buf);
+
+    fprintf(stderr,
+        "%u cycles, %.3f s of data replayed in %.3f s\n"
+        "%u of %u checks failed\n",
+        cycles, (t_last - t_first) * 1e-6, elapsed,
+        mismatches, checks
+    );
+
+    bench_report();
+
+    return (res < 0 || mismatches) ? 1 : 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-c] [-v] [-b] capture.txt\n", argv[0]);
+    fprintf(stderr, "       %s -t\n", argv[0]);
+    return 2;
+}
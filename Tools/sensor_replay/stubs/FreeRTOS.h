@@ -0,0 +1,20 @@
+#pragma once
+
+// Minimal FreeRTOS replacement for the replay tool.
+// The sensor processing runs in a single thread.
+//
+#include <stdint.h>
+
+typedef uint32_t    TickType_t;
+typedef long        BaseType_t;
+
+#define configTICK_RATE_HZ      1000
+#define configCPU_CLOCK_HZ      168000000
+
+#define portMAX_DELAY           ((TickType_t)0xFFFFFFFF)
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
@@ -0,0 +1,10 @@
+#pragma once
+
+// Forced include for all sources.
+// Definitions which newlib has, but glibc doesn't.
+//
+#include <math.h>
+
+#ifndef M_TWOPI
+#define M_TWOPI     (M_PI * 2.0)
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include "ustime.h"
+
+static inline void vTaskDelay(TickType_t ticks)
+{
+}
+
+
+static inline TickType_t xTaskGetTickCount(void)
+{
+    return get_us_time32() / 1000;
+}
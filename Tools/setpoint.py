@@ -0,0 +1,278 @@
+#!/usr/bin/env python
+#
+# Send stick commands to the vehicle, for rc.mode 5
+#
+# usage: setpoint.py [-j] [-r rate] port [baudrate]
+#
+#   -j  read the sticks from a joystick (needs pygame)
+#   -r  message rate [Hz], default 50
+#
+# The port is a serial port or a pyserial URL, for example
+# socket://192.168.1.10:2000 for a WiFly module.
+#
+# Without -j, the setpoints are read from stdin, one per line:
+#
+#   roll pitch yaw thrust arm
+#
+# with the sticks in -1..1, the thrust in 0..1 and arm 0 or 1.
+# "sleep <seconds>" waits before the next line. The last
+# setpoint is repeated at the message rate. At the end of the
+# input, the vehicle is disarmed.
+#
+# With -j, the first button must be held to arm.
+#
+# The round trip time is measured with "rc_pc_stats -b" on the
+# vehicle shell, and printed to stderr every second. The link
+# latency is about half of it.
+#
+from __future__ import print_function
+import sys
+import time
+import struct
+import threading
+import serial
+
+MSG_ID_SETPOINT = 0x0020
+MSG_ID_SETPOINT_ACK = 0x0021
+SETPOINT_ARM = 0x01
+
+
+def crc16(data):
+    """ CRC-16, poly 0x8005 reflected, as Shared/crc16.c """
+    crc = 0
+    for b in bytearray(data):
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def cobsr_encode(src):
+    src = bytearray(src)
+    dst = bytearray([0])
+    code_pos, code = 0, 1
+    last = 0
+
+    for i, b in enumerate(src):
+        last = b
+        if b == 0:
+            dst[code_pos] = code
+            code_pos, code = len(dst), 1
+            dst.append(0)
+        else:
+            dst.append(b)
+            code += 1
+            if code == 0xFF and i < len(src) - 1:
+                dst[code_pos] = code
+                code_pos, code = len(dst), 1
+                dst.append(0)
+
+    if last < code:
+        dst[code_pos] = code
+    else:
+        # COBS/R: the last byte replaces the length code
+        dst[code_pos] = last
+        dst.pop()
+
+    return bytes(dst)
+
+
+def cobsr_decode(src):
+    src = bytearray(src)
+    dst = bytearray()
+    i = 0
+
+    while i < len(src):
+        code = src[i]
+        if code == 0:
+            raise ValueError("zero byte in packet")
+
+        i += 1
+        block = src[i:i + code - 1]
+        i += code - 1
+        dst += block
+
+        if len(block) < code - 1:
+            # COBS/R: the length code was the last byte
+            dst.append(code)
+            break
+
+        if i < len(src) and code != 0xFF:
+            dst.append(0)
+
+    return bytes(dst)
+
+
+def encode_msg(msg_id, data):
+    body = struct.pack('<H', msg_id) + data
+    return b'\0' + cobsr_encode(struct.pack('<H', crc16(body)) + body) + b'\0'
+
+
+def decode_msg(packet):
+    raw = cobsr_decode(packet)
+    if len(raw) < 4:
+        raise ValueError("packet too short")
+
+    crc, = struct.unpack('<H', raw[:2])
+    if crc16(raw[2:]) != crc:
+        raise ValueError("CRC error")
+
+    msg_id, = struct.unpack('<H', raw[2:4])
+    return msg_id, raw[4:]
+
+
+def us_time():
+    return int(time.time() * 1e6) & 0xFFFFFFFF
+
+
+class Setpoint(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.values = (0.0, 0.0, 0.0, 0.0, 0)
+        self.done = False
+
+
+def read_stdin(sp):
+    for line in sys.stdin:
+        w = line.split()
+        if not w or w[0].startswith('#'):
+            continue
+
+        if w[0] == 'sleep':
+            time.sleep(float(w[1]))
+            continue
+
+        try:
+            r, p, y, t, a = [float(x) for x in w[:5]]
+        except ValueError:
+            print("bad setpoint: %s" % line.strip(), file=sys.stderr)
+            continue
+
+        with sp.lock:
+            sp.values = (r, p, y, t, int(a))
+
+    sp.done = True
+
+
+def read_joystick(sp, rate):
+    import pygame
+    pygame.init()
+    pygame.joystick.init()
+
+    js = pygame.joystick.Joystick(0)
+    js.init()
+    print("joystick: %s" % js.get_name(), file=sys.stderr)
+
+    while not sp.done:
+        pygame.event.pump()
+        with sp.lock:
+            sp.values = (
+                js.get_axis(0), -js.get_axis(1), js.get_axis(3),
+                (1 - js.get_axis(2)) / 2, js.get_button(0)
+            )
+        time.sleep(1.0 / rate)
+
+
+class Latency(object):
+    def __init__(self):
+        self.rtt = []
+        self.ack = None
+
+    def update(self, data):
+        seq, t, hold, received, lost, stale, errors = struct.unpack('<HIIIIII', data[:26])
+        rtt = (us_time() - t - hold) & 0xFFFFFFFF
+        if rtt < 10000000:
+            self.rtt.append(rtt)
+        self.ack = (received, lost, stale, errors)
+
+    def report(self):
+        if not self.rtt:
+            print("no acknowledgements", file=sys.stderr)
+            return
+
+        r = sorted(self.rtt)
+        print("rtt min %.1f avg %.1f max %.1f ms, received %d lost %d stale %d errors %d" % (
+            (r[0] / 1e3, sum(r) / len(r) / 1e3, r[-1] / 1e3) + self.ack), file=sys.stderr)
+        self.rtt = []
+
+
+def main():
+    args = sys.argv[1:]
+    opt_joystick = False
+    rate = 50.0
+
+    while args and args[0].startswith('-'):
+        a = args.pop(0)
+        if a == '-j':
+            opt_joystick = True
+        elif a == '-r' and args:
+            rate = float(args.pop(0))
+        else:
+            args = []
+            break
+
+    if len(args) not in (1, 2):
+        print("usage: %s [-j] [-r rate] port [baudrate]" % sys.argv[0], file=sys.stderr)
+        return 2
+
+    port = serial.serial_for_url(args[0], int(args[1]) if len(args) > 1 else 115200, timeout=0)
+
+    port.write(b'\rrc_pc_stats -b\r')
+
+    sp = Setpoint()
+    reader = read_joystick if opt_joystick else read_stdin
+    th = threading.Thread(target=reader, args=(sp, rate) if opt_joystick else (sp,))
+    th.daemon = True
+    th.start()
+
+    lat = Latency()
+    rx_buf = b''
+    seq = 0
+    t_report = time.time() + 1
+    t_next = time.time()
+
+    try:
+        while not sp.done:
+            with sp.lock:
+                r, p, y, t, a = sp.values
+
+            seq = (seq + 1) & 0xFFFF
+            data = struct.pack('<HBIffff', seq, SETPOINT_ARM if a else 0, us_time(), r, p, y, t)
+            port.write(encode_msg(MSG_ID_SETPOINT, data))
+
+            rx_buf += port.read(4096)
+            packets = rx_buf.split(b'\0')
+            rx_buf = packets.pop()
+
+            for packet in packets:
+                try:
+                    msg_id, data = decode_msg(packet)
+                except ValueError:
+                    continue    # shell output
+                if msg_id == MSG_ID_SETPOINT_ACK:
+                    lat.update(data)
+
+            if time.time() > t_report:
+                lat.report()
+                t_report += 1
+
+            t_next += 1.0 / rate
+            time.sleep(max(0, t_next - time.time()))
+
+    except KeyboardInterrupt:
+        pass
+
+    # Disarm, and stop the acknowledgements
+    #
+    for _ in range(int(rate / 5) + 1):
+        seq = (seq + 1) & 0xFFFF
+        port.write(encode_msg(MSG_ID_SETPOINT, struct.pack('<HBIffff', seq, 0, us_time(), 0, 0, 0, 0)))
+        time.sleep(1.0 / rate)
+
+    port.write(b'\r')
+    port.close()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,237 @@
+#!/usr/bin/env python
+#
+# Frequency response and gain suggestion from a "sysid dump"
+#
+# usage: sysid.py [-p] dump.txt
+#
+#   -p  plot the frequency response (needs matplotlib)
+#
+# The plant from the controller output u [V] to the rate
+# y [rad/s] is estimated as G_ry / G_ru, with the cross spectra
+# to the reference r. This is unbiased in closed loop, because
+# the reference is not correlated with the disturbances.
+#
+# A rate axis is roughly an integrator with a motor lag T and
+# a dead time tau:
+#
+#   P(s) = K e^(-s tau) / (s (1 + s T))
+#
+# The gains are suggested with the symmetric optimum for the
+# sum of the small time constants T_s = T + tau:
+#
+#   kp = 1 / (2 K T_s),  ki = kp / (4 T_s)
+#
+# This gives about 37 degrees of phase margin. The crossover
+# and phase margin of the current and the suggested gains are
+# computed with the model.
+#
+from __future__ import print_function
+import sys
+import numpy as np
+
+
+def load_dump(fname):
+    header = {}
+    rows = []
+
+    for line in open(fname):
+        w = line.split()
+        if not w:
+            continue
+
+        if w[0] == '#':
+            # "# key value key value ..."
+            for k, v in zip(w[1::2], w[2::2]):
+                header[k] = v
+            continue
+
+        try:
+            rows.append([float(x) for x in w[:3]])
+        except ValueError:
+            pass
+
+    if 'dt' not in header or not rows:
+        raise ValueError("%s: not a sysid dump" % fname)
+
+    return header, np.array(rows)
+
+
+def cross_spectra(r, u, y, nperseg):
+    """ Welch averages of G_rr, G_ry, G_ru and G_yy """
+
+    win = np.hanning(nperseg)
+    step = nperseg // 2
+
+    G = np.zeros((4, nperseg // 2 + 1), dtype=complex)
+    n = 0
+
+    for i in range(0, len(r) - nperseg + 1, step):
+        R = np.fft.rfft(win * (r[i:i+nperseg] - np.mean(r[i:i+nperseg])))
+        U = np.fft.rfft(win * (u[i:i+nperseg] - np.mean(u[i:i+nperseg])))
+        Y = np.fft.rfft(win * (y[i:i+nperseg] - np.mean(y[i:i+nperseg])))
+
+        G += [np.conj(R) * R, np.conj(R) * Y, np.conj(R) * U, np.conj(Y) * Y]
+        n += 1
+
+    return G / n
+
+
+def model(w, K, T, tau):
+    s = 1j * w
+    return K * np.exp(-s * tau) / (s * (1 + s * T))
+
+
+def fit_model(w, P, weight):
+    """ Grid search over T and tau, K by least squares """
+
+    best = None
+
+    for T in np.linspace(0.002, 0.2, 100):
+        for tau in np.linspace(0, 0.02, 41):
+            m = model(w, 1, T, tau)
+
+            # Fit the log magnitude, so all frequencies count
+            # the same, and the phase.
+            #
+            K = np.exp(np.sum(weight * np.log(np.abs(P) / np.abs(m))) / np.sum(weight))
+            e = np.log(P / (K * m))
+            e = np.real(e) ** 2 + np.angle(np.exp(1j * np.imag(e))) ** 2
+            cost = np.sum(weight * e)
+
+            if best is None or cost < best[0]:
+                best = (cost, K, T, tau)
+
+    return best[1:]
+
+
+def controller(w, kp, ki, kd, d_fc):
+    s = 1j * w
+    C = kp + ki / s
+
+    if kd:
+        # Second order Butterworth D-term filter
+        #
+        wc = 2 * np.pi * d_fc
+        lp = wc**2 / (s**2 + np.sqrt(2) * wc * s + wc**2) if d_fc > 0 else 1
+        C = C + kd * s * lp
+
+    return C
+
+
+def margins(f, L):
+    """ Crossover frequency [Hz] and phase margin [deg] """
+
+    mag = np.abs(L)
+    i = np.where((mag[:-1] >= 1) & (mag[1:] < 1))[0]
+    if not len(i):
+        return None, None
+
+    i = i[0]
+    phase = np.degrees(np.unwrap(np.angle(L)))
+    return f[i], 180 + phase[i]
+
+
+def main():
+    args = sys.argv[1:]
+    opt_plot = '-p' in args
+    args = [a for a in args if a != '-p']
+
+    if len(args) != 1:
+        print("usage: %s [-p] dump.txt" % sys.argv[0], file=sys.stderr)
+        return 2
+
+    header, data = load_dump(args[0])
+
+    dt = float(header['dt'])
+    r, u, y = data[:, 0], data[:, 1], data[:, 2]
+
+    nperseg = min(1024, 2 ** int(np.log2(len(r) // 4)))
+    G_rr, G_ry, G_ru, G_yy = cross_spectra(r, u, y, nperseg)
+
+    f = np.fft.rfftfreq(nperseg, dt)
+    P = G_ry / G_ru
+    coh = np.abs(G_ry) ** 2 / np.real(G_rr * G_yy)
+
+    # Only use the excited band with a good coherence
+    #
+    f_lo = float(header.get('f_start', 0)) if header.get('signal') == 'chirp' else 0
+    f_hi = float(header.get('f_end', 0.5 / dt)) if header.get('signal') == 'chirp' else 0.5 / dt / int(header.get('prbs_hold', 1))
+
+    ok = (f > max(f_lo, f[1])) & (f < min(f_hi, 0.45 / dt)) & (coh > 0.6)
+    if np.sum(ok) < 5:
+        print("Not enough coherent data. Increase the amplitude.", file=sys.stderr)
+        return 1
+
+    w = 2 * np.pi * f[ok]
+    K, T, tau = fit_model(w, P[ok], coh[ok])
+
+    print("%d samples, dt %.6f s, %d segments of %d" % (len(r), dt, 2 * len(r) // nperseg - 1, nperseg))
+    print()
+    print("    f [Hz]   |P| [dB]  phase [deg]  coherence")
+
+    for i in np.where(ok)[0][::max(1, np.sum(ok) // 20)]:
+        print("%10.2f %10.2f %12.1f %10.2f" % (f[i], 20 * np.log10(abs(P[i])), np.degrees(np.angle(P[i])), coh[i]))
+
+    print()
+    print("Model: K %.1f rad/s^2/V, T %.1f ms, tau %.1f ms" % (K, T * 1e3, tau * 1e3))
+
+    T_s = T + tau
+    kp = 1 / (2 * K * T_s)
+    ki = kp / (4 * T_s)
+
+    gains = {
+        'current':   [float(header.get(k, 0)) for k in ('kp', 'ki', 'kd')],
+        'suggested': [kp, ki, 0],
+    }
+
+    d_fc = float(header.get('d_fc', 0))
+
+    print()
+    print("             kp        ki        kd    crossover   phase margin")
+
+    # The crossover is often below the excited band, so the
+    # margins are computed with the model.
+    #
+    f_m = np.logspace(-1, np.log10(0.5 / dt), 1000)
+    P_m = model(2 * np.pi * f_m, K, T, tau)
+
+    for name in ('current', 'suggested'):
+        g = gains[name]
+        L = controller(2 * np.pi * f_m, g[0], g[1], g[2], d_fc) * P_m
+        fc, pm = margins(f_m, L)
+
+        fc = "%8.1f Hz" % fc if fc else "         -"
+        pm = "%10.1f deg" % pm if pm is not None else "             -"
+
+        print("%-9s %8.4f  %8.4f  %8.5f  %s  %s" % (name, g[0], g[1], g[2], fc, pm))
+
+    axis = ('roll', 'pitch', 'yaw')[int(header.get('axis', 0))]
+
+    print()
+    print("sp ctrl.%s.kp %.4f" % (axis, kp))
+    print("sp ctrl.%s.ki %.4f" % (axis, ki))
+
+    if opt_plot:
+        import matplotlib.pyplot as plt
+
+        fig, (a1, a2, a3) = plt.subplots(3, 1, sharex=True)
+        m = model(2 * np.pi * f[1:], K, T, tau)
+
+        a1.semilogx(f[1:], 20 * np.log10(np.abs(P[1:])), '.', f[1:], 20 * np.log10(np.abs(m)))
+        a1.set_ylabel('|P| [dB]')
+        a2.semilogx(f[1:], np.degrees(np.angle(P[1:])), '.', f[1:], np.degrees(np.angle(m)))
+        a2.set_ylabel('phase [deg]')
+        a3.semilogx(f[1:], coh[1:])
+        a3.set_ylabel('coherence')
+        a3.set_xlabel('f [Hz]')
+
+        for a in (a1, a2, a3):
+            a.grid(True, which='both')
+
+        plt.show()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())